@@ -0,0 +1,17 @@
+# 引擎性能测试
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = epinyin-bench
+DESTDIR = $$PWD/../../dist
+
+include($$PWD/../ime/ime.pri)
+
+# 默认使用随工程提供的拼音语料
+DEFINES += BENCH_CORPUS=\\\"$$PWD/corpus.txt\\\"
+
+SOURCES += \
+    main.cpp
+
+OTHER_FILES += \
+    corpus.txt
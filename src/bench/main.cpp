@@ -0,0 +1,1035 @@
+#include "dictionary.h"
+#include "dictreader.h"
+#include "dictcontainer.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "dictlist.h"
+#include "ngram.h"
+#include "candidates.h"
+#include "decoder.h"
+#include "userdict.h"
+#include "candcache.h"
+#include "sentence.h"
+#include "deadline.h"
+#include "batch.h"
+#include "reverse.h"
+#include "splrange.h"
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BENCH_CORPUS
+#define BENCH_CORPUS "corpus.txt"
+#endif
+
+using namespace IME;
+
+typedef std::chrono::steady_clock Clock;
+
+// Candidates shown at once by a typical UI.
+#define kPageSize 10
+// Per keystroke deadline of the decoder.deadline stage, in microseconds.
+#define kKeyDeadlineUs 20
+// Memory bound of the candidate cache in the decoder.cache stage.
+#define kBenchCacheBytes (8 << 20)
+
+// Every heap allocation made by the process, to report allocations per
+// operation. The benchmark is single threaded.
+static long long g_allocs = 0;
+
+void *operator new(size_t size)
+{
+    g_allocs++;
+    void *p = malloc(size? size: 1);
+    if (pNull == p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// A named group of inputs from the corpus.
+struct InputSet
+{
+    std::string name;
+    std::vector<std::string> inputs;
+};
+
+struct Result
+{
+    std::string stage;
+    std::string set;
+    long long ops;
+    double ns_per_op;
+    double items_per_op;
+    double allocs_per_op;
+};
+
+static std::vector<Result> g_results;
+// Minimum measuring time of each stage.
+static double g_min_ns = 200e6;
+static volatile quint32 g_sink;
+
+static double elapsedNs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static void addResult(const char *stage, const std::string &set, long long ops,
+                      double ns, long long items, long long allocs)
+{
+    Result r;
+    r.stage = stage;
+    r.set = set;
+    r.ops = ops;
+    r.ns_per_op = ns / ops;
+    r.items_per_op = double(items) / ops;
+    r.allocs_per_op = double(allocs) / ops;
+    g_results.push_back(r);
+}
+
+// Run fn(i) over inputs 0..n-1 round robin until g_min_ns has passed, in
+// doubling batches so that the clock is read rarely. fn returns the number
+// of items it produced.
+template <typename Fn>
+static void measure(const char *stage, const std::string &set, int n, Fn fn)
+{
+    for (int i = 0; i < n; i++) fn(i);
+
+    long long ops = 0, items = 0, allocs = 0;
+    double ns = 0;
+    long long batch = n;
+    while (ns < g_min_ns)
+    {
+        const long long a = g_allocs;
+        Clock::time_point t = Clock::now();
+        for (long long k = 0; k < batch; k++) items += fn(int(k % n));
+        ns += elapsedNs(t);
+        allocs += g_allocs - a;
+        ops += batch;
+        batch *= 2;
+    }
+    addResult(stage, set, ops, ns, items, allocs);
+}
+
+// Like measure, but fn times the measured part itself and adds it to ns, so
+// that the preparation of each operation is not counted.
+template <typename Fn>
+static void measureTimed(const char *stage, const std::string &set, int n, Fn fn)
+{
+    double ns = 0;
+    for (int i = 0; i < n; i++) fn(i, ns);
+
+    long long ops = 0, items = 0, allocs = 0;
+    ns = 0;
+    while (ns < g_min_ns)
+    {
+        const long long a = g_allocs;
+        items += fn(int(ops % n), ns);
+        allocs += g_allocs - a;
+        ops++;
+    }
+    addResult(stage, set, ops, ns, items, allocs);
+}
+
+static bool readFile(const char *path, std::string &data)
+{
+    FILE *f = fopen(path, "rb");
+    if (pNull == f) return false;
+    char buf[65536];
+    size_t n;
+    data.clear();
+    while ((n = fread(buf, 1, sizeof (buf), f)) > 0) data.append(buf, n);
+    const bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static bool loadCorpus(const char *path, std::vector<InputSet> &sets)
+{
+    std::string text;
+    if (!readFile(path, text)) return false;
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find('\n', pos);
+        if (std::string::npos == end) end = text.size();
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 1;
+        while (!line.empty() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' '))
+        {
+            line.erase(line.size() - 1);
+        }
+        if (line.empty() || '#' == line[0]) continue;
+        if ('[' == line[0] && ']' == line[line.size() - 1])
+        {
+            InputSet set;
+            set.name = line.substr(1, line.size() - 2);
+            sets.push_back(set);
+        }
+        else if (!sets.empty() && int(line.size()) < kMaxRowNum)
+        {
+            sets.back().inputs.push_back(line);
+        }
+    }
+    return !sets.empty();
+}
+
+// Loading each section of the dictionary, from a copy in memory so that disk
+// access is not measured.
+static void benchLoad(const std::string &data)
+{
+    const char * const p = data.data();
+    const qint64 size = qint64(data.size());
+    const std::string set = "dict";
+
+    // The per-section stages below walk the old format.
+    if (DictContainer::isContainer(p, size))
+    {
+        measure("load.total_v2", set, 1, [&](int) {
+            Dictionary dict(p, size);
+            return long(dict.isValid());
+        });
+        return;
+    }
+
+    // Offsets of the sections, each stage starts reading at its own.
+    qint64 offList, offDict, offNGram;
+    // The optional compiled sections at the end, -1 when missing.
+    qint64 offSplCompiled = -1, offNodesCompiled = -1;
+    quint32 splNum;
+    {
+        DictReader r;
+        SpellingTrie st;
+        DictTrie dt;
+        r.open(p, size);
+        st.loadSplTrie(r);
+        splNum = st.getSpellingNum();
+        offList = r.pos();
+        dt.loadDictList(r);
+        offDict = r.pos();
+        dt.loadDictDict(r, splNum);
+        offNGram = r.pos();
+        dt.loadDictNGram(r);
+        while (!r.atEnd())
+        {
+            const qint64 pos = r.pos();
+            if (!st.isCompiled() && st.loadCompiledTrie(r))
+            {
+                offSplCompiled = pos;
+                continue;
+            }
+            r.seek(pos);
+            if (!dt.isCompiled() && dt.loadCompiledNodes(r))
+            {
+                offNodesCompiled = pos;
+                continue;
+            }
+            break;
+        }
+    }
+
+    measureTimed("load.spl_table", set, 1, [&](int, double &ns) {
+        DictReader r;
+        SpellingTrie st;
+        Clock::time_point t = Clock::now();
+        r.open(p, size);
+        bool ok = st.loadSplTrie(r);
+        ns += elapsedNs(t);
+        return long(ok);
+    });
+    measureTimed("load.spl_build", set, 1, [&](int, double &ns) {
+        DictReader r;
+        SpellingTrie st;
+        r.open(p, size);
+        st.loadSplTrie(r);
+        Clock::time_point t = Clock::now();
+        bool ok = st.buildSplTrie();
+        ns += elapsedNs(t);
+        return long(ok);
+    });
+    if (offSplCompiled >= 0)
+    {
+        measureTimed("load.spl_compiled", set, 1, [&](int, double &ns) {
+            DictReader r;
+            SpellingTrie st;
+            r.open(p, size);
+            st.loadSplTrie(r);
+            r.open(p + offSplCompiled, size - offSplCompiled);
+            Clock::time_point t = Clock::now();
+            bool ok = st.loadCompiledTrie(r);
+            ns += elapsedNs(t);
+            return long(ok);
+        });
+    }
+    measureTimed("load.dict_list", set, 1, [&](int, double &ns) {
+        DictReader r;
+        DictTrie dt;
+        r.open(p + offList, size - offList);
+        Clock::time_point t = Clock::now();
+        bool ok = dt.loadDictList(r);
+        ns += elapsedNs(t);
+        return long(ok);
+    });
+    measureTimed("load.dict_trie", set, 1, [&](int, double &ns) {
+        DictReader r;
+        DictTrie dt;
+        r.open(p + offDict, size - offDict);
+        Clock::time_point t = Clock::now();
+        bool ok = dt.loadDictDict(r, splNum);
+        ns += elapsedNs(t);
+        return long(ok);
+    });
+    measureTimed("load.nodes_build", set, 1, [&](int, double &ns) {
+        DictReader r;
+        DictTrie dt;
+        r.open(p + offDict, size - offDict);
+        dt.loadDictDict(r, splNum);
+        Clock::time_point t = Clock::now();
+        dt.buildNodeColumns();
+        ns += elapsedNs(t);
+        return 1L;
+    });
+    if (offNodesCompiled >= 0)
+    {
+        measureTimed("load.nodes_compiled", set, 1, [&](int, double &ns) {
+            DictReader r;
+            DictTrie dt;
+            r.open(p + offDict, size - offDict);
+            dt.loadDictDict(r, splNum);
+            r.open(p + offNodesCompiled, size - offNodesCompiled);
+            Clock::time_point t = Clock::now();
+            bool ok = dt.loadCompiledNodes(r);
+            ns += elapsedNs(t);
+            return long(ok);
+        });
+    }
+    measureTimed("load.ngram", set, 1, [&](int, double &ns) {
+        DictReader r;
+        NGram ngram;
+        r.open(p + offNGram, size - offNGram);
+        Clock::time_point t = Clock::now();
+        bool ok = ngram.load(r);
+        ns += elapsedNs(t);
+        return long(ok);
+    });
+    measure("load.total", set, 1, [&](int) {
+        Dictionary dict(p, size);
+        return long(dict.isValid());
+    });
+    // The same dictionary converted to v2: nothing is copied or built.
+    std::string v2;
+    if (DictContainer::convert(p, size, v2))
+    {
+        measure("load.total_v2", set, 1, [&](int) {
+            Dictionary dict(v2.data(), qint64(v2.size()));
+            return long(dict.isValid());
+        });
+    }
+}
+
+// Splitting a pinyin string into spelling ids, with the DFA and with the
+// reference trie walk.
+static void benchSplitting(const SpellingTrie *st, const InputSet &set)
+{
+    const int n = int(set.inputs.size());
+    quint16 splIdx[kMaxRowNum];
+    quint16 startPos[kMaxRowNum + 1];
+
+    measure("split.dfa", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        return long(st->splstrToIdxs(py.data(), quint16(py.size()), splIdx,
+                                     startPos, kMaxRowNum - 1));
+    });
+    measure("split.trie", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        return long(st->splstrToIdxsTrie(py.data(), quint16(py.size()), splIdx,
+                                         startPos, kMaxRowNum - 1));
+    });
+}
+
+// Looking up the candidates, searching from the root for the whole input,
+// and typing it one key at a time reusing the frontier of the previous key.
+// succinct is the same dictionary loaded with kDictSuccinctTrie.
+static void benchSearch(const SpellingTrie *st, const DictTrie *dt,
+                        const DictTrie *succinct, const InputSet &set)
+{
+    const int n = int(set.inputs.size());
+    std::vector<std::vector<quint16> > ids(n);
+    for (int i = 0; i < n; i++)
+    {
+        quint16 splIdx[kMaxRowNum];
+        const std::string &py = set.inputs[i];
+        const int num = st->splstrToIdxs(py.data(), quint16(py.size()), splIdx,
+                                         pNull, kMaxRowNum - 1);
+        ids[i].assign(splIdx, splIdx + num);
+    }
+    Candidates *cs = new Candidates;
+    LmaFrontier *frontier = new LmaFrontier;
+
+    measure("search.cold", set.name, n, [&](int i) {
+        if (ids[i].empty()) return 0L;
+        return long(dt->setCandidates(ids[i].data(), int(ids[i].size()), cs, st));
+    });
+    // One operation types a whole input, items are the keystrokes.
+    measure("search.typing", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        quint16 splIdx[kMaxRowNum];
+        frontier->reset();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            int num = st->splstrToIdxs(py.data(), quint16(k), splIdx, pNull, kMaxRowNum - 1);
+            if (num > 0) dt->setCandidates(splIdx, num, cs, st, frontier);
+        }
+        return long(py.size());
+    });
+
+    // Both workloads again on the succinct trie.
+    measure("search.succinct_cold", set.name, n, [&](int i) {
+        if (ids[i].empty()) return 0L;
+        return long(succinct->setCandidates(ids[i].data(), int(ids[i].size()), cs, st));
+    });
+    measure("search.succinct", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        quint16 splIdx[kMaxRowNum];
+        frontier->reset();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            int num = st->splstrToIdxs(py.data(), quint16(k), splIdx, pNull, kMaxRowNum - 1);
+            if (num > 0) succinct->setCandidates(splIdx, num, cs, st, frontier);
+        }
+        return long(py.size());
+    });
+    frontier->reset();
+
+    // The typing workload again with every fuzzy rule on. Each spelling id
+    // then matches up to three id ranges instead of one.
+    FuzzyTable fuzzy;
+    st->buildFuzzyTable(kFuzzyAll, &fuzzy);
+    frontier->fuzzy = &fuzzy;
+    measure("search.fuzzy", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        quint16 splIdx[kMaxRowNum];
+        frontier->reset();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            int num = st->splstrToIdxs(py.data(), quint16(k), splIdx, pNull, kMaxRowNum - 1);
+            if (num > 0) dt->setCandidates(splIdx, num, cs, st, frontier);
+        }
+        return long(py.size());
+    });
+    frontier->fuzzy = pNull;
+    frontier->reset();
+
+    // The typing workload again with the default son range lookup and each
+    // one the CPU supports, then back to the one in use.
+    const SplRangeKind kind = splRangeKind();
+    for (int r = kSplRangeAuto; r <= kSplRangeAvx2; r++)
+    {
+        if (!setSplRangeKind(SplRangeKind(r))) continue;
+        const std::string stage = std::string("search.range.") + splRangeKindName(SplRangeKind(r));
+        measure(stage.c_str(), set.name, n, [&](int i) {
+            const std::string &py = set.inputs[i];
+            quint16 splIdx[kMaxRowNum];
+            frontier->reset();
+            for (size_t k = 1; k <= py.size(); k++)
+            {
+                int num = st->splstrToIdxs(py.data(), quint16(k), splIdx, pNull, kMaxRowNum - 1);
+                if (num > 0) dt->setCandidates(splIdx, num, cs, st, frontier);
+            }
+            return long(py.size());
+        });
+    }
+    setSplRangeKind(kind);
+
+    delete frontier;
+    delete cs;
+}
+
+// Ordering the candidates: only the first page, as the lazy sort does on a
+// keystroke, and the whole list. The list is copied unsorted before each
+// operation, the copy is not measured. packed is the same dictionary loaded
+// with kDictPackLemmas.
+static void benchSort(const SpellingTrie *st, const DictTrie *dt,
+                      const DictTrie *packed, const InputSet &set)
+{
+    const int n = int(set.inputs.size());
+    std::vector<Candidates *> filled(n);
+    for (int i = 0; i < n; i++)
+    {
+        quint16 splIdx[kMaxRowNum];
+        const std::string &py = set.inputs[i];
+        const int num = st->splstrToIdxs(py.data(), quint16(py.size()), splIdx,
+                                         pNull, kMaxRowNum - 1);
+        filled[i] = new Candidates;
+        if (num > 0) dt->setCandidates(splIdx, num, filled[i], st);
+    }
+    Candidates *cs = new Candidates;
+
+    for (int all = 0; all < 2; all++)
+    {
+        const int len = all? -1: kPageSize;
+        measureTimed(all? "sort.all": "sort.page", set.name, n, [&](int i, double &ns) {
+            *cs = *filled[i];
+            Clock::time_point t = Clock::now();
+            Candidates::Itr itr = cs->pull(0, len);
+            long items = 0;
+            while (itr.next())
+            {
+                g_sink += itr.id();
+                items++;
+            }
+            ns += elapsedNs(t);
+            return items;
+        });
+    }
+
+    // Lemma text of the first page, copied out, decoded from the packed
+    // text and as views.
+    char16_t buf[kPageSize * kMaxLemmaSize];
+    int lens[kPageSize];
+    measure("lemma.copy", set.name, n, [&](int i) {
+        return long(dt->getCandidates(filled[i], 0, kPageSize, buf,
+                                      kPageSize * kMaxLemmaSize, lens, kPageSize));
+    });
+    measure("lemma.packed", set.name, n, [&](int i) {
+        return long(packed->getCandidates(filled[i], 0, kPageSize, buf,
+                                          kPageSize * kMaxLemmaSize, lens, kPageSize));
+    });
+    measure("lemma.view", set.name, n, [&](int i) {
+        Candidates::Itr itr = filled[i]->pull(0, kPageSize);
+        long items = 0;
+        while (itr.next())
+        {
+            g_sink += *dt->getLemmaView(itr.id(), itr.lmaLen());
+            items++;
+        }
+        return items;
+    });
+
+    delete cs;
+    for (int i = 0; i < n; i++) delete filled[i];
+}
+
+// A whole session: typing an input one key at a time, showing the first page
+// after each key.
+static void benchDecoder(const Dictionary *dict, const InputSet &set)
+{
+    const int n = int(set.inputs.size());
+    Decoder dec(dict);
+    char16_t buf[kPageSize * kMaxLemmaSize];
+    int lens[kPageSize];
+
+    measure("decoder.typing", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            dec.search(py.data(), int(k));
+            dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+        }
+        return long(py.size());
+    });
+    // The same with a deadline on every keystroke. The results may be
+    // partial; the share of partial keystrokes is printed to stderr.
+    long keys = 0, partial = 0;
+    measure("decoder.deadline", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            dec.search(py.data(), int(k), Deadline::after(kKeyDeadlineUs));
+            dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+            partial += dec.isPartial();
+        }
+        keys += long(py.size());
+        return long(py.size());
+    });
+    if (keys > 0)
+    {
+        fprintf(stderr, "decoder.deadline %s: %.1f%% of keystrokes partial at %dus\n",
+                set.name.c_str(), 100.0 * partial / keys, kKeyDeadlineUs);
+    }
+    // The same with every fuzzy rule on.
+    dec.setFuzzyRules(kFuzzyAll);
+    measure("decoder.fuzzy", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            dec.search(py.data(), int(k));
+            dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+        }
+        return long(py.size());
+    });
+    dec.setFuzzyRules(0);
+    // The same with the whole sentence candidate, in the default budget.
+    dec.setSentenceEnabled(true);
+    measure("decoder.sentence", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            dec.search(py.data(), int(k));
+            dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+        }
+        return long(py.size());
+    });
+}
+
+// Typing with a shared candidate cache, warmed by the first round over the
+// set. The hit rate is printed to stderr.
+static void benchCache(const Dictionary *dict, const InputSet &set)
+{
+    const int n = int(set.inputs.size());
+    CandidateCache cache(kBenchCacheBytes);
+    Decoder dec(dict);
+    dec.setCandidateCache(&cache);
+    char16_t buf[kPageSize * kMaxLemmaSize];
+    int lens[kPageSize];
+
+    measure("decoder.cache", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            dec.search(py.data(), int(k));
+            dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+        }
+        return long(py.size());
+    });
+    CandidateCacheStats st;
+    cache.stats(&st);
+    const quint64 lookups = st.hits + st.misses;
+    fprintf(stderr, "decoder.cache %s: %.1f%% of %llu lookups hit, %zu entries, %zu bytes\n",
+            set.name.c_str(), lookups > 0? 100.0 * st.hits / lookups: 0.0,
+            (unsigned long long)lookups, st.entries, st.bytes);
+}
+
+// Choosing the first candidate until the whole input is fixed, without and
+// with a user dictionary (in memory only), then typing again with what it
+// has learnt. Items are the choices, or the keys.
+static void benchUser(const Dictionary *dict, const InputSet &set)
+{
+    const int n = int(set.inputs.size());
+    Decoder dec(dict);
+    char16_t buf[kPageSize * kMaxLemmaSize];
+    int lens[kPageSize];
+    auto chooseAll = [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        dec.search(py.data(), int(py.size()));
+        long choices = 0;
+        while (dec.getCandidateCount() > 0 && dec.getFixedSplLen() < int(py.size()))
+        {
+            dec.choose(0);
+            choices++;
+        }
+        return choices;
+    };
+
+    measure("decoder.choose", set.name, n, chooseAll);
+    UserDict user(dict);
+    dec.setUserDict(&user);
+    measure("decoder.choose.user", set.name, n, chooseAll);
+    user.flush();
+    measure("decoder.user", set.name, n, [&](int i) {
+        const std::string &py = set.inputs[i];
+        dec.resetSearch();
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            dec.search(py.data(), int(k));
+            dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+        }
+        return long(py.size());
+    });
+    fprintf(stderr, "decoder.user %s: %zu lemmas, %zu phrases, %zu bytes\n", set.name.c_str(),
+            user.lemmaNum(), user.phraseNum(), user.memoryUsage());
+    dec.setUserDict(pNull);
+}
+
+// UserDict::record alone, on choices of whole system lemmas. Each operation
+// records half a ring, then waits for the worker untimed, so that the ring
+// never fills and only the writer side is measured. Items are the choices.
+static void benchRecord(const Dictionary *dict)
+{
+    const DictTrie *dt = dict->dictTrie();
+    std::vector<UserChoice> choices;
+    dt->enumLemmas([&](quint32 id, const quint16 *splids, int len) {
+        // A few ids in the trie are past the lemma table
+        if (dt->dictList()->getLemmaLen(id) != len) return;
+        UserChoice c;
+        c.len = quint8(len);
+        c.part_num = 1;
+        c.part_len[0] = quint8(len);
+        c.part_id[0] = id;
+        memcpy(c.splids, splids, len * sizeof (quint16));
+        dt->copyLemma(id, len, c.text);
+        choices.push_back(c);
+    });
+    const int batch = kUserRingSize / 2;
+    const int n = int(choices.size()) / batch;
+    if (0 == n) return;
+
+    UserDict user(dict);
+    UserRing *ring = user.attach();
+    measureTimed("decoder.record", "all", n, [&](int i, double &ns) {
+        const UserChoice *c = &choices[size_t(i) * batch];
+        Clock::time_point t = Clock::now();
+        for (int k = 0; k < batch; k++) user.record(ring, c[k]);
+        ns += elapsedNs(t);
+        user.flush();
+        return long(batch);
+    });
+    user.detach(ring);
+}
+
+// Decoding a whole sentence from scratch without a budget, against the
+// number of spelling ids. The inputs are windows over the spelling ids of
+// the sentence set (or of all inputs) joined together. Items are the ids.
+static void benchSentence(const Dictionary *dict, const std::vector<InputSet> &sets)
+{
+    const SpellingTrie *st = dict->spellingTrie();
+    std::vector<quint16> ids;
+    for (int pass = 0; pass < 2 && ids.empty(); pass++)
+    {
+        for (size_t i = 0; i < sets.size(); i++)
+        {
+            if (0 == pass && sets[i].name != "sentence") continue;
+            for (size_t k = 0; k < sets[i].inputs.size(); k++)
+            {
+                quint16 splIdx[kMaxRowNum];
+                const std::string &py = sets[i].inputs[k];
+                const int num = st->splstrToIdxs(py.data(), quint16(py.size()), splIdx,
+                                                 pNull, kMaxRowNum - 1);
+                ids.insert(ids.end(), splIdx, splIdx + num);
+            }
+        }
+    }
+    if (ids.empty()) return;
+    while (ids.size() < 4 * kMaxRowNum) ids.insert(ids.end(), ids.begin(), ids.end());
+
+    SentenceDecoder sd(dict->dictTrie(), st);
+    sd.setBudget(0, 0);
+    const int lengths[] = { 2, 4, 8, 16, 24, 32, kMaxRowNum - 1 };
+    for (size_t l = 0; l < sizeof (lengths) / sizeof (lengths[0]); l++)
+    {
+        const int len = lengths[l];
+        // Windows starting every 7 ids, so that they differ from each other.
+        const int n = int(std::min<size_t>(64, (ids.size() - len) / 7 + 1));
+        char set[16];
+        snprintf(set, sizeof (set), "n=%d", len);
+        measure("sentence.cold", set, n, [&](int i) {
+            sd.reset();
+            sd.decode(ids.data() + i * 7, len);
+            return long(len);
+        });
+    }
+}
+
+// Converting the whole corpus in batches, with 1, 2, 4... threads up to the
+// hardware concurrency, to check that throughput scales with the cores.
+static void benchBatch(const Dictionary *dict, const std::vector<InputSet> &sets)
+{
+    std::vector<std::string> inputs;
+    while (inputs.size() < 20000)
+    {
+        for (size_t i = 0; i < sets.size(); i++)
+        {
+            inputs.insert(inputs.end(), sets[i].inputs.begin(), sets[i].inputs.end());
+        }
+    }
+    std::vector<BatchResult> results;
+    const int hw = std::max(1, int(std::thread::hardware_concurrency()));
+    for (int threads = 1; ; threads = std::min(threads * 2, hw))
+    {
+        BatchConverter conv(dict, threads);
+        char set[16];
+        snprintf(set, sizeof (set), "t%d", threads);
+        // One operation is the whole batch, items are the inputs.
+        measure("batch.convert", set, 1, [&](int) {
+            conv.convert(inputs, kPageSize, results);
+            return long(inputs.size());
+        });
+        if (threads == hw) break;
+    }
+}
+
+static void appendUtf8(std::string &out, const char16_t *s, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        const unsigned c = s[i];
+        if (c < 0x80)
+        {
+            out += char(c);
+        }
+        else if (c < 0x800)
+        {
+            out += char(0xc0 | (c >> 6));
+            out += char(0x80 | (c & 0x3f));
+        }
+        else
+        {
+            out += char(0xe0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3f));
+            out += char(0x80 | (c & 0x3f));
+        }
+    }
+}
+
+// Hanzi to pinyin. The text is the first candidate of every corpus input,
+// a few per line, which is close to ordinary Chinese text. Items are UTF-16
+// chars for annotate and bytes for the UTF-8 stages.
+static void benchReverse(const Dictionary *dict, const std::vector<InputSet> &sets)
+{
+    measureTimed("reverse.build", "all", 1, [&](int, double &ns) {
+        Clock::time_point t = Clock::now();
+        ReverseIndex index(dict);
+        ns += elapsedNs(t);
+        return 0;
+    });
+
+    std::vector<std::string> inputs;
+    for (size_t i = 0; i < sets.size(); i++)
+    {
+        inputs.insert(inputs.end(), sets[i].inputs.begin(), sets[i].inputs.end());
+    }
+    std::vector<BatchResult> results;
+    BatchConverter(dict, 1).convert(inputs, 1, results);
+    std::u16string text;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        text += results[i].text;
+        text += i % 4 == 3? u'\n': u'\uff0c';
+    }
+    while (text.size() < 256 * 1024) text += text;
+    std::string utf8;
+    appendUtf8(utf8, text.data(), int(text.size()));
+
+    const ReverseIndex *index = dict->reverseIndex();
+    std::vector<quint16> splids(text.size());
+    measure("reverse.annotate", "all", 1, [&](int) {
+        index->annotate(text.data(), int(text.size()), splids.data());
+        return long(text.size());
+    });
+    std::string out;
+    measure("reverse.utf8", "all", 1, [&](int) {
+        out.clear();
+        index->toPinyin(utf8.data(), utf8.size(), out);
+        return long(utf8.size());
+    });
+
+    // Streaming a larger text with 1, 2, 4... threads.
+    std::string big;
+    while (big.size() < 32 * 1024 * 1024) big += utf8;
+    const int hw = std::max(1, int(std::thread::hardware_concurrency()));
+    for (int threads = 1; ; threads = std::min(threads * 2, hw))
+    {
+        ReverseConverter conv(index, threads);
+        char set[16];
+        snprintf(set, sizeof (set), "t%d", threads);
+        measure("reverse.stream", set, 1, [&](int) {
+            size_t pos = 0;
+            size_t written = 0;
+            conv.convert([&](char *buf, size_t size) {
+                size = std::min(size, big.size() - pos);
+                memcpy(buf, big.data() + pos, size);
+                pos += size;
+                return size;
+            }, [&](const char *, size_t len) {
+                written += len;
+            });
+            g_sink += quint32(written);
+            return long(big.size());
+        });
+        if (threads == hw) break;
+    }
+}
+
+static void printText()
+{
+    printf("%-20s %-10s %10s %12s %12s %14s %10s\n",
+           "stage", "set", "ops", "ns/op", "items/op", "items/s", "allocs/op");
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const Result &r = g_results[i];
+        printf("%-20s %-10s %10lld %12.1f %12.2f %14.0f %10.2f\n",
+               r.stage.c_str(), r.set.c_str(), r.ops, r.ns_per_op, r.items_per_op,
+               r.items_per_op * 1e9 / r.ns_per_op, r.allocs_per_op);
+    }
+}
+
+static void printCsv()
+{
+    printf("stage,set,ops,ns_per_op,items_per_op,items_per_s,allocs_per_op\n");
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const Result &r = g_results[i];
+        printf("%s,%s,%lld,%.1f,%.3f,%.0f,%.3f\n",
+               r.stage.c_str(), r.set.c_str(), r.ops, r.ns_per_op, r.items_per_op,
+               r.items_per_op * 1e9 / r.ns_per_op, r.allocs_per_op);
+    }
+}
+
+static void printJson(const char *dictfile)
+{
+    // Names come from the code and the corpus, nothing needs escaping.
+    printf("{\n  \"dictionary\": \"%s\",\n  \"spl_range\": \"%s\",\n  \"results\": [\n",
+           dictfile, splRangeKindName(splRangeKind()));
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const Result &r = g_results[i];
+        printf("    {\"stage\": \"%s\", \"set\": \"%s\", \"ops\": %lld, \"ns_per_op\": %.1f, "
+               "\"items_per_op\": %.3f, \"items_per_s\": %.0f, \"allocs_per_op\": %.3f}%s\n",
+               r.stage.c_str(), r.set.c_str(), r.ops, r.ns_per_op, r.items_per_op,
+               r.items_per_op * 1e9 / r.ns_per_op, r.allocs_per_op,
+               i + 1 < g_results.size()? ",": "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: epinyin-bench [options] [dict_pinyin.dat]\n"
+            "    --format=text|csv|json  output format, text by default\n"
+            "    --corpus=FILE           pinyin inputs, " BENCH_CORPUS " by default\n"
+            "    --min-time=MS           minimum measuring time of each stage\n"
+            "    --filter=PREFIX         only run stages starting with PREFIX\n"
+            "    --spl-range=KIND        son range lookup: auto (the default), scalar,\n"
+            "                            binary, sse2 or avx2\n");
+}
+
+static bool selected(const char *filter, const char *stage)
+{
+    return 0 == strncmp(stage, filter, strlen(filter)) ||
+            0 == strncmp(filter, stage, strlen(stage));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dictfile = "dict_pinyin.dat";
+    const char *corpus = BENCH_CORPUS;
+    const char *format = "text";
+    const char *filter = "";
+    const char *splRange = pNull;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strncmp(argv[i], "--format=", 9)) format = argv[i] + 9;
+        else if (0 == strncmp(argv[i], "--corpus=", 9)) corpus = argv[i] + 9;
+        else if (0 == strncmp(argv[i], "--min-time=", 11)) g_min_ns = atof(argv[i] + 11) * 1e6;
+        else if (0 == strncmp(argv[i], "--filter=", 9)) filter = argv[i] + 9;
+        else if (0 == strncmp(argv[i], "--spl-range=", 12)) splRange = argv[i] + 12;
+        else if ('-' == argv[i][0])
+        {
+            usage();
+            return 2;
+        }
+        else dictfile = argv[i];
+    }
+    if (strcmp(format, "text") && strcmp(format, "csv") && strcmp(format, "json"))
+    {
+        usage();
+        return 2;
+    }
+    if (pNull != splRange)
+    {
+        int k = kSplRangeAuto;
+        while (k <= kSplRangeAvx2 && strcmp(splRange, splRangeKindName(SplRangeKind(k)))) k++;
+        if (k > kSplRangeAvx2)
+        {
+            usage();
+            return 2;
+        }
+        if (!setSplRangeKind(SplRangeKind(k)))
+        {
+            fprintf(stderr, "%s is not supported by this CPU\n", splRange);
+            return 1;
+        }
+    }
+
+    std::string data;
+    std::vector<InputSet> sets;
+    if (!readFile(dictfile, data))
+    {
+        fprintf(stderr, "cannot read %s\n", dictfile);
+        return 1;
+    }
+    if (!loadCorpus(corpus, sets))
+    {
+        fprintf(stderr, "cannot read corpus %s\n", corpus);
+        return 1;
+    }
+    Dictionary dict(data.data(), qint64(data.size()));
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "cannot load %s\n", dictfile);
+        return 1;
+    }
+
+    const SpellingTrie *st = dict.spellingTrie();
+    const DictTrie *dt = dict.dictTrie();
+    Dictionary packed(data.data(), qint64(data.size()), kDictPackLemmas);
+    const DictTrie *pdt = packed.dictTrie();
+    Dictionary succinct(data.data(), qint64(data.size()), kDictSuccinctTrie);
+    const DictTrie *sdt = succinct.dictTrie();
+    if (selected(filter, "lemma"))
+    {
+        fprintf(stderr, "lemma text: %zu bytes, packed %zu bytes\n",
+                size_t(pdt->dictList()->start_pos_[kMaxLemmaSize]) * sizeof (quint16),
+                pdt->dictList()->textMemory());
+    }
+    if (selected(filter, "search"))
+    {
+        fprintf(stderr, "trie nodes and lemma ids: %zu bytes, succinct %zu bytes\n",
+                dt->nodeMemory(), sdt->nodeMemory());
+    }
+    if (selected(filter, "load")) benchLoad(data);
+    for (size_t i = 0; i < sets.size(); i++)
+    {
+        if (sets[i].inputs.empty()) continue;
+        if (selected(filter, "split")) benchSplitting(st, sets[i]);
+        if (selected(filter, "search")) benchSearch(st, dt, sdt, sets[i]);
+        if (selected(filter, "sort") || selected(filter, "lemma")) benchSort(st, dt, pdt, sets[i]);
+        if (selected(filter, "decoder")) benchDecoder(&dict, sets[i]);
+        if (selected(filter, "decoder")) benchUser(&dict, sets[i]);
+        if (selected(filter, "decoder")) benchCache(&dict, sets[i]);
+    }
+    if (selected(filter, "decoder")) benchRecord(&dict);
+    if (selected(filter, "sentence")) benchSentence(&dict, sets);
+    if (selected(filter, "batch")) benchBatch(&dict, sets);
+    if (selected(filter, "reverse")) benchReverse(&dict, sets);
+
+    if (0 == strcmp(format, "csv")) printCsv();
+    else if (0 == strcmp(format, "json")) printJson(dictfile);
+    else printText();
+    return 0;
+}
@@ -0,0 +1,16 @@
+# 输入法服务，多个进程通过 Unix 套接字共享同一份词库
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = epinyind
+DESTDIR = $$PWD/../../dist
+
+include($$PWD/../ime/ime.pri)
+
+SOURCES += \
+    main.cpp \
+    server.cpp
+
+HEADERS += \
+    protocol.h \
+    server.h
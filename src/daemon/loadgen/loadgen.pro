@@ -0,0 +1,12 @@
+# epinyind 的压力测试客户端
+TEMPLATE = app
+CONFIG   += console c++11 thread
+CONFIG   -= app_bundle qt
+TARGET   = epinyind-load
+DESTDIR = $$PWD/../../../dist
+
+INCLUDEPATH += $$PWD/.. $$PWD/../../ime
+DEFINES += BENCH_CORPUS=\\\"$$PWD/../../bench/corpus.txt\\\"
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,338 @@
+#include "protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef BENCH_CORPUS
+#define BENCH_CORPUS "corpus.txt"
+#endif
+
+using namespace IME;
+
+typedef std::chrono::steady_clock Clock;
+
+// Each simulated user types an input one key at a time. Every keystroke
+// sends a search and a page fetch and waits for both answers, so the
+// latency of a keystroke is what a user would see. After the last key the
+// first candidate is chosen half of the time, then the session is reset.
+struct Session
+{
+    int fd;
+    unsigned rng;
+    const std::string *input;
+    size_t key;
+    // Answers still expected for the current step.
+    int waiting;
+    Clock::time_point sent;
+    std::string in;
+    std::string out;
+};
+
+struct Options
+{
+    const char *socket_path;
+    const char *corpus;
+    int sessions;
+    int threads;
+    double seconds;
+    int page;
+    bool json;
+};
+
+// Results of one worker thread.
+struct Tally
+{
+    std::vector<quint32> latency_us;
+    quint64 keystrokes;
+    quint64 requests;
+    quint64 errors;
+};
+
+static std::vector<std::string> g_inputs;
+
+static unsigned nextRandom(unsigned &state)
+{
+    state = state * 1103515245u + 12345u;
+    return state >> 8;
+}
+
+static void appendFrame(std::string &out, quint8 op, const char *data, quint16 len)
+{
+    FrameHead head;
+    head.len = len;
+    head.op = op;
+    head.st = 0;
+    out.append((const char *) &head, kFrameHeadSize);
+    out.append(data, len);
+}
+
+static bool sendAll(Session *s)
+{
+    size_t pos = 0;
+    while (pos < s->out.size())
+    {
+        const ssize_t n = send(s->fd, s->out.data() + pos, s->out.size() - pos, MSG_NOSIGNAL);
+        if (n > 0) pos += n;
+        else if (n < 0 && (EINTR == errno || EAGAIN == errno)) continue;
+        else return false;
+    }
+    s->out.clear();
+    return true;
+}
+
+// Send the requests of the next step and start timing it.
+static bool nextStep(Session *s, const Options &opt, Tally &tally)
+{
+    char buf[4];
+    if (pNull == s->input || s->key > s->input->size())
+    {
+        // Finish the current input and start another one.
+        if (pNull != s->input && (nextRandom(s->rng) & 1))
+        {
+            putU16(buf, 0);
+            appendFrame(s->out, kOpChoose, buf, 2);
+            appendFrame(s->out, kOpFixed, pNull, 0);
+            s->waiting += 2;
+        }
+        appendFrame(s->out, kOpReset, pNull, 0);
+        s->waiting++;
+        s->input = &g_inputs[nextRandom(s->rng) % g_inputs.size()];
+        s->key = 1;
+    }
+    appendFrame(s->out, kOpSearch, s->input->data(), quint16(s->key));
+    putU16(buf, 0);
+    putU16(buf + 2, quint16(opt.page));
+    appendFrame(s->out, kOpPage, buf, 4);
+    s->waiting += 2;
+    s->key++;
+    tally.requests += s->waiting;
+    s->sent = Clock::now();
+    return sendAll(s);
+}
+
+static int connectTo(const char *path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof (addr.sun_path) - 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (const sockaddr *) &addr, sizeof (addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void runWorker(const Options &opt, int sessionNum, unsigned seed, Tally *tally)
+{
+    const int ep = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Session> sessions(sessionNum);
+    for (int i = 0; i < sessionNum; i++)
+    {
+        Session &s = sessions[i];
+        s.fd = connectTo(opt.socket_path);
+        s.rng = seed + unsigned(i) * 7919u;
+        s.input = pNull;
+        s.key = 0;
+        s.waiting = 0;
+        if (s.fd < 0)
+        {
+            tally->errors++;
+            continue;
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &s;
+        epoll_ctl(ep, EPOLL_CTL_ADD, s.fd, &ev);
+    }
+    for (int i = 0; i < sessionNum; i++)
+    {
+        if (sessions[i].fd >= 0 && !nextStep(&sessions[i], opt, *tally)) tally->errors++;
+    }
+
+    const Clock::time_point end = Clock::now() +
+            std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.seconds));
+    epoll_event events[256];
+    char buf[16384];
+    while (Clock::now() < end)
+    {
+        const int n = epoll_wait(ep, events, 256, 100);
+        for (int i = 0; i < n; i++)
+        {
+            Session *s = (Session *) events[i].data.ptr;
+            const ssize_t got = recv(s->fd, buf, sizeof (buf), MSG_DONTWAIT);
+            if (got <= 0)
+            {
+                if (got < 0 && (EAGAIN == errno || EINTR == errno)) continue;
+                tally->errors++;
+                epoll_ctl(ep, EPOLL_CTL_DEL, s->fd, pNull);
+                continue;
+            }
+            s->in.append(buf, got);
+            size_t pos = 0;
+            while (s->in.size() - pos >= kFrameHeadSize)
+            {
+                FrameHead head;
+                memcpy(&head, s->in.data() + pos, kFrameHeadSize);
+                if (s->in.size() - pos - kFrameHeadSize < head.len) break;
+                if (kStatusOk != head.st) tally->errors++;
+                pos += kFrameHeadSize + head.len;
+                s->waiting--;
+            }
+            s->in.erase(0, pos);
+            if (0 == s->waiting)
+            {
+                const double us = std::chrono::duration<double, std::micro>(Clock::now() - s->sent).count();
+                tally->latency_us.push_back(quint32(us));
+                tally->keystrokes++;
+                if (!nextStep(s, opt, *tally)) tally->errors++;
+            }
+        }
+    }
+    for (int i = 0; i < sessionNum; i++)
+    {
+        if (sessions[i].fd >= 0) close(sessions[i].fd);
+    }
+    close(ep);
+}
+
+static bool loadCorpus(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (pNull == f) return false;
+    char line[256];
+    while (fgets(line, sizeof (line), f))
+    {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (0 == len || '#' == line[0] || '[' == line[0] || len >= kMaxRowNum) continue;
+        g_inputs.push_back(line);
+    }
+    fclose(f);
+    return !g_inputs.empty();
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: epinyind-load [options]\n"
+            "    --socket=PATH    daemon socket, /tmp/epinyind.sock by default\n"
+            "    --sessions=N     concurrent sessions, 1000 by default\n"
+            "    --threads=N      client threads, 1 by default\n"
+            "    --duration=SEC   test time, 10 by default\n"
+            "    --page=N         candidates fetched per keystroke, 10 by default\n"
+            "    --corpus=FILE    pinyin inputs, " BENCH_CORPUS " by default\n"
+            "    --format=json    machine-readable output\n");
+}
+
+static double percentile(const std::vector<quint32> &sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    opt.socket_path = "/tmp/epinyind.sock";
+    opt.corpus = BENCH_CORPUS;
+    opt.sessions = 1000;
+    opt.threads = 1;
+    opt.seconds = 10;
+    opt.page = 10;
+    opt.json = false;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        if (0 == strncmp(a, "--socket=", 9)) opt.socket_path = a + 9;
+        else if (0 == strncmp(a, "--sessions=", 11)) opt.sessions = atoi(a + 11);
+        else if (0 == strncmp(a, "--threads=", 10)) opt.threads = atoi(a + 10);
+        else if (0 == strncmp(a, "--duration=", 11)) opt.seconds = atof(a + 11);
+        else if (0 == strncmp(a, "--page=", 7)) opt.page = atoi(a + 7);
+        else if (0 == strncmp(a, "--corpus=", 9)) opt.corpus = a + 9;
+        else if (0 == strcmp(a, "--format=json")) opt.json = true;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    opt.threads = std::max(1, std::min(opt.threads, opt.sessions));
+    opt.page = std::max(1, std::min(opt.page, kMaxPageItems));
+    if (!loadCorpus(opt.corpus))
+    {
+        fprintf(stderr, "cannot read corpus %s\n", opt.corpus);
+        return 1;
+    }
+
+    rlimit rl;
+    if (0 == getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    std::vector<Tally> tallies(opt.threads);
+    std::vector<std::thread> threads;
+    const Clock::time_point start = Clock::now();
+    for (int t = 0; t < opt.threads; t++)
+    {
+        tallies[t].keystrokes = tallies[t].requests = tallies[t].errors = 0;
+        const int num = opt.sessions / opt.threads + (t < opt.sessions % opt.threads? 1: 0);
+        threads.push_back(std::thread(runWorker, std::cref(opt), num, 12345u + t * 104729u, &tallies[t]));
+    }
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Tally all;
+    all.keystrokes = all.requests = all.errors = 0;
+    for (size_t t = 0; t < tallies.size(); t++)
+    {
+        all.latency_us.insert(all.latency_us.end(), tallies[t].latency_us.begin(),
+                              tallies[t].latency_us.end());
+        all.keystrokes += tallies[t].keystrokes;
+        all.requests += tallies[t].requests;
+        all.errors += tallies[t].errors;
+    }
+    std::sort(all.latency_us.begin(), all.latency_us.end());
+    const double p50 = percentile(all.latency_us, 0.50);
+    const double p90 = percentile(all.latency_us, 0.90);
+    const double p99 = percentile(all.latency_us, 0.99);
+    const double p999 = percentile(all.latency_us, 0.999);
+    const double max = all.latency_us.empty()? 0: all.latency_us.back();
+
+    if (opt.json)
+    {
+        printf("{\"sessions\": %d, \"seconds\": %.2f, \"keystrokes\": %llu, \"requests\": %llu, "
+               "\"errors\": %llu, \"keystrokes_per_s\": %.0f, \"requests_per_s\": %.0f, "
+               "\"latency_us\": {\"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, \"p999\": %.0f, "
+               "\"max\": %.0f}}\n",
+               opt.sessions, seconds, all.keystrokes, all.requests, all.errors,
+               all.keystrokes / seconds, all.requests / seconds, p50, p90, p99, p999, max);
+    }
+    else
+    {
+        printf("sessions       %d\n", opt.sessions);
+        printf("keystrokes     %llu (%.0f/s)\n", all.keystrokes, all.keystrokes / seconds);
+        printf("requests       %llu (%.0f/s)\n", all.requests, all.requests / seconds);
+        printf("errors         %llu\n", all.errors);
+        printf("latency us     p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+               p50, p90, p99, p999, max);
+    }
+    return all.errors? 1: 0;
+}
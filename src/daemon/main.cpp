@@ -0,0 +1,80 @@
+#include "dictionary.h"
+#include "server.h"
+#include "candcache.h"
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define kDefaultSocket "/tmp/epinyind.sock"
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: epinyind [--socket=PATH] [--cache=MB] <dict_pinyin.dat>\n"
+            "    serve input sessions over a Unix socket, " kDefaultSocket " by default\n"
+            "    --cache=MB  share a cache of candidate lists of up to MB megabytes\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socketPath = kDefaultSocket;
+    const char *dictfile = pNull;
+    int cacheMb = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strncmp(argv[i], "--socket=", 9)) socketPath = argv[i] + 9;
+        else if (0 == strncmp(argv[i], "--cache=", 8)) cacheMb = atoi(argv[i] + 8);
+        else if ('-' != argv[i][0] && pNull == dictfile) dictfile = argv[i];
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (pNull == dictfile)
+    {
+        usage();
+        return 2;
+    }
+
+    // 每个会话一个连接，数千个会话需要放宽文件描述符的限制
+    rlimit rl;
+    if (0 == getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    IME::Dictionary dict(dictfile);
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "epinyind: cannot load %s\n", dictfile);
+        return 1;
+    }
+    // 在服务之前创建，之后销毁
+    std::unique_ptr<IME::CandidateCache> cache;
+    if (cacheMb > 0) cache.reset(new IME::CandidateCache(size_t(cacheMb) << 20));
+    IME::Server server(&dict, cache.get());
+    if (!server.listen(socketPath))
+    {
+        perror("epinyind: listen");
+        return 1;
+    }
+    fprintf(stderr, "epinyind: listening on %s\n", socketPath);
+    const bool ok = server.run();
+
+    const IME::Server::Stats &st = server.stats();
+    fprintf(stderr, "epinyind: %llu sessions, %llu requests, %llu coalesced, %llu overflows\n",
+            st.sessions, st.requests, st.coalesced, st.overflows);
+    if (cache)
+    {
+        IME::CandidateCacheStats cs;
+        cache->stats(&cs);
+        fprintf(stderr, "epinyind: cache %llu hits, %llu misses, %llu evictions, %zu entries, %zu bytes\n",
+                (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+                (unsigned long long)cs.evictions, cs.entries, cs.bytes);
+    }
+    return ok? 0: 1;
+}
@@ -0,0 +1,68 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "dictdef.h"
+#include <string.h>
+
+NAMESPACEBEGIN
+
+/**
+ * epinyind 的二进制协议。只在本机的 Unix 套接字上使用，整数均为本机字节序。
+ *
+ * 每个连接对应一个输入会话。请求和应答都是带 4 字节头的帧：
+ *   quint16 len  头之后的数据长度
+ *   quint8  op   请求类型，应答中原样返回
+ *   quint8  st   请求中为 0，应答中为状态
+ * 同一连接上可以连续发送多个请求，应答按请求的顺序返回。
+ *
+ * 请求数据：
+ *   kOpSearch  拼音串，不超过 kMaxRowNum - 1 字节
+ *   kOpChoose  quint16 候选词序号
+ *   kOpCancel  无，撤销上次选择
+ *   kOpReset   无
+ *   kOpPage    quint16 偏移, quint16 个数（不超过 kMaxPageItems）
+ *   kOpFixed   无，取固定的内容
+ * 应答数据（状态为 kStatusOk 时）：
+ *   kOpSearch/kOpChoose/kOpCancel/kOpReset
+ *              quint16 候选词个数, quint16 已固定的拼音长度
+ *   kOpPage    quint8 个数, 之后每个候选词为 quint8 长度 + UTF-16 文字
+ *   kOpFixed   quint8 长度 + UTF-16 文字
+ */
+
+#define kOpSearch 1
+#define kOpChoose 2
+#define kOpCancel 3
+#define kOpReset  4
+#define kOpPage   5
+#define kOpFixed  6
+
+#define kStatusOk         0
+#define kStatusBadRequest 1
+
+#define kFrameHeadSize 4
+// 一次取页的最大候选词个数，保证应答不超过帧的长度上限
+#define kMaxPageItems 64
+
+struct FrameHead
+{
+    quint16 len;
+    quint8 op;
+    quint8 st;
+};
+Q_STATIC_ASSERT(sizeof (FrameHead) == kFrameHeadSize);
+
+inline void putU16(char *p, quint16 v)
+{
+    memcpy(p, &v, 2);
+}
+
+inline quint16 getU16(const char *p)
+{
+    quint16 v;
+    memcpy(&v, p, 2);
+    return v;
+}
+
+NAMESPACEEND
+
+#endif // PROTOCOL_H
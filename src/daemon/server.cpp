@@ -0,0 +1,443 @@
+#include "server.h"
+#include "protocol.h"
+#include "decoder.h"
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+NAMESPACEBEGIN
+
+// 一次 epoll_wait 最多取回的事件数
+#define kMaxEvents 256
+// 每次从套接字读取的字节数
+#define kReadChunk 4096
+// 读缓冲中未处理数据的上限，须大于最长的一帧。超出的部分留在套接字中，
+// 等已收到的请求处理完再读
+#define kMaxInBuffer (128 * 1024)
+// 写缓冲中未发出数据的上限，对端不读应答使积压超过它时断开
+#define kMaxOutBuffer (1024 * 1024)
+
+struct Server::Session
+{
+    int fd;
+    // 在 sessions_ 中的位置
+    size_t index;
+    Decoder *dec;
+    // 读缓冲，[in_pos, in.size()) 是还未解析的数据
+    std::string in;
+    size_t in_pos;
+    // 写缓冲，[out_pos, out.size()) 是还未发出的数据
+    std::string out;
+    size_t out_pos;
+    // 是否在等待可写事件，此时不再读取新的请求
+    bool writing;
+    // 本次唤醒中是否有新的应答
+    bool dirty;
+    bool closed;
+    // 是否在 coalesce_ 中保存着 led 的结果
+    bool leading;
+    std::string led;
+};
+
+Server::Server(const Dictionary *dict, CandidateCache *cache)
+{
+    dict_ = dict;
+    cache_ = cache;
+    listen_fd_ = -1;
+    epoll_fd_ = -1;
+    signal_fd_ = -1;
+    memset(&stats_, 0, sizeof (stats_));
+}
+
+Server::~Server()
+{
+    for (size_t i = 0; i < sessions_.size(); i++)
+    {
+        ::close(sessions_[i]->fd);
+        delete sessions_[i]->dec;
+        delete sessions_[i];
+    }
+    if (signal_fd_ >= 0) ::close(signal_fd_);
+    if (epoll_fd_ >= 0) ::close(epoll_fd_);
+    if (listen_fd_ >= 0)
+    {
+        ::close(listen_fd_);
+        unlink(path_.c_str());
+    }
+}
+
+bool Server::listen(const char *path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof (addr.sun_path)) return false;
+    strcpy(addr.sun_path, path);
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) return false;
+    unlink(path);
+    if (bind(listen_fd_, (const sockaddr *) &addr, sizeof (addr)) != 0 ||
+            ::listen(listen_fd_, SOMAXCONN) != 0)
+    {
+        return false;
+    }
+    path_ = path;
+
+    // SIGINT/SIGTERM 经由 signalfd 进入事件循环，正常退出
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, pNull) != 0) return false;
+    signal_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd_ < 0) return false;
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) return false;
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) != 0) return false;
+    ev.data.ptr = &signal_fd_;
+    return 0 == epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, &ev);
+}
+
+bool Server::run()
+{
+    epoll_event events[kMaxEvents];
+    for (;;)
+    {
+        const int n = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+            return false;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &listen_fd_)
+            {
+                accept();
+            }
+            else if (ptr == &signal_fd_)
+            {
+                return true;
+            }
+            else
+            {
+                Session *s = (Session *) ptr;
+                if (s->closed) continue;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readFrom(s);
+                if (!s->closed && (events[i].events & EPOLLOUT)) flush(s);
+            }
+        }
+
+        process();
+
+        for (size_t i = 0; i < closed_.size(); i++)
+        {
+            Session *s = closed_[i];
+            // 从 sessions_ 中移除，最后一个填到它的位置
+            sessions_[s->index] = sessions_.back();
+            sessions_[s->index]->index = s->index;
+            sessions_.pop_back();
+            delete s->dec;
+            delete s;
+        }
+        closed_.clear();
+    }
+}
+
+void Server::accept()
+{
+    for (;;)
+    {
+        const int fd = accept4(listen_fd_, pNull, pNull, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (EMFILE == errno || ENFILE == errno)
+            {
+                perror("epinyind: accept");
+            }
+            return;
+        }
+        Session *s = new Session;
+        s->fd = fd;
+        s->index = sessions_.size();
+        s->dec = new Decoder(dict_);
+        s->dec->setCandidateCache(cache_);
+        s->in_pos = 0;
+        s->out_pos = 0;
+        s->writing = false;
+        s->dirty = false;
+        s->closed = false;
+        s->leading = false;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            ::close(fd);
+            delete s->dec;
+            delete s;
+            continue;
+        }
+        sessions_.push_back(s);
+        stats_.sessions++;
+    }
+}
+
+void Server::readFrom(Session *s)
+{
+    // 上次解析过的请求都已处理，丢掉
+    s->in.erase(0, s->in_pos);
+    s->in_pos = 0;
+
+    for (;;)
+    {
+        const size_t size = s->in.size();
+        if (size >= kMaxInBuffer) break;
+        s->in.resize(size + kReadChunk);
+        const ssize_t n = recv(s->fd, &s->in[size], kReadChunk, 0);
+        s->in.resize(size + (n > 0? size_t(n): 0));
+        if (n > 0) continue;
+        if (0 == n || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno))
+        {
+            // 对端关闭或出错，已收到的请求也不再需要应答
+            close(s);
+            return;
+        }
+        if (EINTR != errno) break;
+    }
+
+    while (s->in.size() - s->in_pos >= kFrameHeadSize)
+    {
+        FrameHead head;
+        memcpy(&head, s->in.data() + s->in_pos, kFrameHeadSize);
+        if (s->in.size() - s->in_pos - kFrameHeadSize < head.len) break;
+        Pending req;
+        req.session = s;
+        req.op = head.op;
+        req.pos = s->in_pos + kFrameHeadSize;
+        req.len = head.len;
+        pending_.push_back(req);
+        s->in_pos += kFrameHeadSize + head.len;
+    }
+}
+
+void Server::process()
+{
+    coalesce_.clear();
+    std::vector<Session *> dirty;
+    for (size_t i = 0; i < pending_.size(); i++)
+    {
+        Session *s = pending_[i].session;
+        if (s->closed) continue;
+        handle(pending_[i]);
+        if (s->out.size() - s->out_pos > kMaxOutBuffer)
+        {
+            // 积压太多时先发出一部分，对端仍不读就断开
+            flush(s);
+            if (!s->closed && s->out.size() - s->out_pos > kMaxOutBuffer)
+            {
+                stats_.overflows++;
+                close(s);
+                continue;
+            }
+        }
+        if (!s->dirty)
+        {
+            s->dirty = true;
+            dirty.push_back(s);
+        }
+    }
+    pending_.clear();
+
+    for (size_t i = 0; i < dirty.size(); i++)
+    {
+        dirty[i]->dirty = false;
+        dirty[i]->leading = false;
+        if (!dirty[i]->closed) flush(dirty[i]);
+    }
+}
+
+static void appendU16(std::string &out, quint16 v)
+{
+    char buf[2];
+    putU16(buf, v);
+    out.append(buf, 2);
+}
+
+void Server::handle(const Pending &req)
+{
+    Session *s = req.session;
+    Decoder *dec = s->dec;
+    const char *data = s->in.data() + req.pos;
+    stats_.requests++;
+
+    // 会话的状态即将改变，它保存的结果不能再给别的会话使用。
+    // 取页和取固定内容不改变状态。
+    if (s->leading && kOpPage != req.op && kOpFixed != req.op)
+    {
+        coalesce_.erase(s->led);
+        s->leading = false;
+    }
+
+    const size_t at = s->out.size();
+    s->out.resize(at + kFrameHeadSize);
+    quint8 st = kStatusOk;
+    bool status = true;
+    switch (req.op)
+    {
+    case kOpSearch:
+        if (req.len >= kMaxRowNum)
+        {
+            st = kStatusBadRequest;
+        }
+        else if (0 == dec->getFixedLen())
+        {
+            // 没有固定内容时，结果只取决于拼音串
+            s->led.assign(data, req.len);
+            std::unordered_map<std::string, Session *>::iterator it = coalesce_.find(s->led);
+            if (it != coalesce_.end())
+            {
+                dec->copyFrom(*it->second->dec);
+                stats_.coalesced++;
+            }
+            else
+            {
+                dec->search(data, req.len);
+                coalesce_[s->led] = s;
+                s->leading = true;
+            }
+        }
+        else
+        {
+            dec->search(data, req.len);
+        }
+        break;
+    case kOpChoose:
+        if (req.len != 2) st = kStatusBadRequest;
+        else dec->choose(getU16(data));
+        break;
+    case kOpCancel:
+        dec->cancelLastChoice();
+        break;
+    case kOpReset:
+        dec->resetSearch();
+        break;
+    case kOpPage:
+        status = false;
+        if (req.len != 4)
+        {
+            st = kStatusBadRequest;
+        }
+        else
+        {
+            const int count = dec->getCandidateCount();
+            const int num = std::min<int>(getU16(data + 2), kMaxPageItems);
+            const size_t numPos = s->out.size();
+            s->out += char(0);
+            int n = 0;
+            for (int i = getU16(data); i < count && n < num; i++, n++)
+            {
+                int len;
+                const char16_t *p = dec->getCandidateView(i, &len);
+                s->out += char(len);
+                s->out.append((const char *) p, len * sizeof (char16_t));
+            }
+            s->out[numPos] = char(n);
+        }
+        break;
+    case kOpFixed:
+    {
+        status = false;
+        char16_t buf[kMaxRowNum];
+        const int len = dec->getFixedStr(buf, kMaxRowNum);
+        s->out += char(len);
+        s->out.append((const char *) buf, len * sizeof (char16_t));
+        break;
+    }
+    default:
+        st = kStatusBadRequest;
+        break;
+    }
+    if (kStatusOk == st && status)
+    {
+        appendU16(s->out, quint16(dec->getCandidateCount()));
+        appendU16(s->out, quint16(dec->getFixedSplLen()));
+    }
+
+    FrameHead head;
+    head.len = quint16(s->out.size() - at - kFrameHeadSize);
+    head.op = req.op;
+    head.st = st;
+    memcpy(&s->out[at], &head, kFrameHeadSize);
+}
+
+void Server::flush(Session *s)
+{
+    while (s->out_pos < s->out.size())
+    {
+        const ssize_t n = send(s->fd, s->out.data() + s->out_pos,
+                               s->out.size() - s->out_pos, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            s->out_pos += n;
+            continue;
+        }
+        if (n < 0 && EINTR == errno) continue;
+        if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+        {
+            // 对端暂时收不下，等可写时再发。在此之前不读新的请求，
+            // 否则应答会随着请求无限积压
+            if (!s->writing)
+            {
+                epoll_event ev;
+                ev.events = EPOLLOUT;
+                ev.data.ptr = s;
+                epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, s->fd, &ev);
+                s->writing = true;
+            }
+            return;
+        }
+        close(s);
+        return;
+    }
+    s->out.clear();
+    s->out_pos = 0;
+    if (s->writing)
+    {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, s->fd, &ev);
+        s->writing = false;
+    }
+}
+
+void Server::close(Session *s)
+{
+    if (s->closed) return;
+    s->closed = true;
+    if (s->leading)
+    {
+        coalesce_.erase(s->led);
+        s->leading = false;
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, s->fd, pNull);
+    ::close(s->fd);
+    closed_.push_back(s);
+}
+
+NAMESPACEEND
@@ -0,0 +1,89 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "dictdef.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+NAMESPACEBEGIN
+
+class Dictionary;
+class Decoder;
+class CandidateCache;
+
+/**
+ * 输入法服务：单线程 epoll 事件循环，每个连接是一个会话，拥有自己的
+ * Decoder，所有会话共享同一份词库。协议见 protocol.h。
+ *
+ * 一次唤醒中收到的请求先全部解析，再依次处理。其中没有固定内容的会话
+ * 查找同一拼音串时只查找一次，其余会话直接复制结果（合并相同的查询）。
+ * 给出 CandidateCache 时所有会话共用它，跨越多次唤醒复用短拼音串的结果。
+ */
+class Server
+{
+    Q_DISABLE_COPY(Server)
+public:
+    struct Stats
+    {
+        quint64 sessions;
+        quint64 requests;
+        // 由合并得到结果、没有实际查找的请求数
+        quint64 coalesced;
+        // 应答积压超出上限而被断开的会话数
+        quint64 overflows;
+    };
+
+    // cache 可以为空，不为空时需比服务存活更久
+    Server(const Dictionary *dict, CandidateCache *cache = pNull);
+    ~Server();
+
+    // 在 path 上监听，已存在的套接字文件会被删除
+    bool listen(const char *path);
+    // 运行事件循环，直到收到 SIGINT 或 SIGTERM
+    bool run();
+
+    inline const Stats &stats() const;
+
+private:
+    struct Session;
+    // 一次唤醒中待处理的请求
+    struct Pending
+    {
+        Session *session;
+        quint8 op;
+        // 数据在会话读缓冲中的位置
+        size_t pos;
+        quint16 len;
+    };
+
+    void accept();
+    void readFrom(Session *s);
+    void process();
+    void handle(const Pending &req);
+    void flush(Session *s);
+    void close(Session *s);
+
+    const Dictionary *dict_;
+    CandidateCache *cache_;
+    int listen_fd_;
+    int epoll_fd_;
+    int signal_fd_;
+    std::string path_;
+    std::vector<Session *> sessions_;
+    std::vector<Pending> pending_;
+    // 本次唤醒中已查找过的拼音串，及保存其结果的会话
+    std::unordered_map<std::string, Session *> coalesce_;
+    std::vector<Session *> closed_;
+    Stats stats_;
+};
+
+
+const Server::Stats &Server::stats() const
+{
+    return stats_;
+}
+
+NAMESPACEEND
+
+#endif // SERVER_H
@@ -3,24 +3,21 @@ TEMPLATE = app
 
 
 QT       += core
+CONFIG   += c++11
 TARGET   = epinyin
 DESTDIR = $$PWD/../dist
 
+# 资源不压缩，词库可以直接从资源中映射而无需解压拷贝
+QMAKE_RESOURCE_FLAGS += -no-compress
+
+# 引擎核心，另有 ime/ime.pro 单独编译为不依赖 qt 的静态库
+include(ime/ime.pri)
+
+# 核心的 qt 接口
 SOURCES += \
-    ime/spellingtrie.cpp \
-    ime/dicttrie.cpp \
-    ime/ngram.cpp \
-    ime/dictlist.cpp \
-    ime/candidates.cpp \
     ime/epinyin.cpp
 
 HEADERS  += \
-    ime/spellingtrie.h \
-    ime/dictdef.h \
-    ime/dicttrie.h \
-    ime/ngram.h \
-    ime/dictlist.h \
-    ime/candidates.h \
     ime/epinyin.h
 
 RESOURCES += \
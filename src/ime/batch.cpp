@@ -0,0 +1,113 @@
+#include "batch.h"
+#include "decoder.h"
+#include "dicttrie.h"
+#include "candidates.h"
+#include <algorithm>
+
+NAMESPACEBEGIN
+
+// 每次分给一个线程的输入条数，太小时争用计数器，太大时末尾负载不均
+#define kBatchBlock 64
+
+BatchConverter::BatchConverter(const Dictionary *dict, int threadNum)
+    : pool_(threadNum), next_(0)
+{
+    inputs_ = pNull;
+    results_ = pNull;
+    input_num_ = 0;
+    top_n_ = 0;
+    for (int i = 0; i < pool_.threadNum(); i++)
+    {
+        decoders_.push_back(new Decoder(dict));
+    }
+}
+
+BatchConverter::~BatchConverter()
+{
+    for (size_t i = 0; i < decoders_.size(); i++)
+    {
+        delete decoders_[i];
+    }
+}
+
+void BatchConverter::convert(const std::vector<std::string> &inputs, int topN,
+                             std::vector<BatchResult> &results)
+{
+    results.resize(inputs.size());
+    run(inputs.data(), inputs.size(), results.data(), topN);
+}
+
+size_t BatchConverter::convert(const Source &next, const Sink &sink, int topN, int chunk)
+{
+    chunk = std::max(chunk, 1);
+    // 两组缓冲都只分配一次，字符串和结果的空间在各块之间重复使用
+    std::vector<std::string> inputs(chunk);
+    std::vector<BatchResult> results(chunk);
+    size_t index = 0;
+    bool more = true;
+    while (more)
+    {
+        size_t num = 0;
+        while (num < size_t(chunk) && (more = next(inputs[num])))
+        {
+            num++;
+        }
+        run(inputs.data(), num, results.data(), topN);
+        for (size_t i = 0; i < num; i++)
+        {
+            sink(index++, inputs[i], results[i]);
+        }
+    }
+    return index;
+}
+
+void BatchConverter::run(const std::string *inputs, size_t num,
+                         BatchResult *results, int topN)
+{
+    if (0 == num) return;
+    inputs_ = inputs;
+    results_ = results;
+    input_num_ = num;
+    top_n_ = topN;
+    next_ = 0;
+    pool_.run([this](int worker) { work(worker); });
+    inputs_ = pNull;
+    results_ = pNull;
+}
+
+void BatchConverter::work(int worker)
+{
+    // 任务参数在发布后不再改变，这里不需要加锁
+    Decoder *dec = decoders_[worker];
+    for (;;)
+    {
+        const size_t begin = next_.fetch_add(kBatchBlock);
+        if (begin >= input_num_) break;
+        convertRange(dec, begin, std::min(begin + kBatchBlock, input_num_));
+    }
+}
+
+void BatchConverter::convertRange(Decoder *dec, size_t begin, size_t end)
+{
+    const DictTrie *dt = dec->dictTrie();
+    for (size_t i = begin; i < end; i++)
+    {
+        const std::string &py = inputs_[i];
+        BatchResult &r = results_[i];
+        r.clear();
+        // 相邻的输入常有相同的前缀（如排过序的日志），解码器会复用上次的查找
+        dec->search(py.data(), int(py.size()));
+        Candidates::Itr itr = dec->candidates()->pull(0, top_n_);
+        char16_t text[kMaxLemmaSize];
+        while (itr.next())
+        {
+            const int len = itr.lmaLen();
+            r.ids.push_back(itr.id());
+            r.lens.push_back(quint8(len));
+            dt->copyLemma(itr.id(), len, text);
+            r.text.append(text, len);
+        }
+    }
+}
+
+NAMESPACEEND
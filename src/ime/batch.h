@@ -0,0 +1,93 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "threadpool.h"
+#include <atomic>
+#include <string>
+
+NAMESPACEBEGIN
+
+class Dictionary;
+class Decoder;
+
+/**
+ * 一条输入的转换结果：排在最前的若干候选词。
+ * 各候选词的文字依次存放在 text 中，第 i 个的长度为 lens[i]。
+ * 结果对象可以重复使用，已分配的空间会被保留。
+ */
+struct BatchResult
+{
+    std::vector<quint32> ids;
+    std::vector<quint8> lens;
+    std::u16string text;
+
+    inline int size() const;
+    inline void clear();
+};
+
+/**
+ * 批量转换，用于离线处理大量拼音串（如搜索日志、索引词）。
+ * 内部维护一个线程池，每个线程有自己的 Decoder，共享同一份只读词库。
+ * 输入按块分给各线程，结果总是按输入的顺序给出。
+ * 同一个对象不要在多个线程中同时调用。
+ */
+class BatchConverter
+{
+    Q_DISABLE_COPY(BatchConverter)
+public:
+    // threadNum 为 0 时使用硬件线程数。调用者需保证 dict 在对象销毁前有效。
+    BatchConverter(const Dictionary *dict, int threadNum = 0);
+    ~BatchConverter();
+
+    inline int threadNum() const;
+
+    // 转换 inputs，每条取前 topN 个候选词，results[i] 对应 inputs[i]
+    void convert(const std::vector<std::string> &inputs, int topN,
+                 std::vector<BatchResult> &results);
+
+    // 流式转换：反复调用 next 取得输入直到其返回 false，按输入顺序对每条
+    // 调用 sink(序号, 输入, 结果)。输入按 chunk 条分块读取和转换，内存占用
+    // 与总输入量无关。
+    typedef std::function<bool (std::string &input)> Source;
+    typedef std::function<void (size_t index, const std::string &input,
+                                const BatchResult &result)> Sink;
+    size_t convert(const Source &next, const Sink &sink, int topN, int chunk = 4096);
+
+private:
+    void run(const std::string *inputs, size_t num, BatchResult *results, int topN);
+    void work(int worker);
+    void convertRange(Decoder *dec, size_t begin, size_t end);
+
+    ThreadPool pool_;
+    std::vector<Decoder *> decoders_;
+
+    // 当前任务，由调用者在发布前设置，执行期间只读
+    const std::string *inputs_;
+    BatchResult *results_;
+    size_t input_num_;
+    int top_n_;
+    // 下一块未分配的输入
+    std::atomic<size_t> next_;
+};
+
+
+int BatchResult::size() const
+{
+    return int(ids.size());
+}
+
+void BatchResult::clear()
+{
+    ids.clear();
+    lens.clear();
+    text.clear();
+}
+
+int BatchConverter::threadNum() const
+{
+    return pool_.threadNum();
+}
+
+NAMESPACEEND
+
+#endif // BATCH_H
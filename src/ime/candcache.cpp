@@ -0,0 +1,155 @@
+#include "candcache.h"
+#include "spellingtrie.h"
+#include <string.h>
+
+NAMESPACEBEGIN
+
+// 链表节点、索引节点和桶的大致开销，计入每个条目的内存
+#define kCacheNodeOverhead 64
+
+CandidateCache::CandidateCache(size_t maxBytes)
+{
+    max_bytes_ = maxBytes;
+    for (int i = 0; i < kCacheShards; i++)
+    {
+        Shard &s = shards_[i];
+        s.bytes = 0;
+        s.hits = 0;
+        s.misses = 0;
+        s.inserts = 0;
+        s.evictions = 0;
+    }
+}
+
+bool CandidateCache::lookup(const quint16 *splidStr, int num, quint32 fuzzyRules,
+                            Candidates *candidates)
+{
+    quint64 key;
+    if (!makeKey(splidStr, num, fuzzyRules, &key)) return false;
+    Shard &s = shardOf(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    std::unordered_map<quint64, EntryList::iterator>::const_iterator it = s.index.find(key);
+    if (it == s.index.end())
+    {
+        s.misses++;
+        return false;
+    }
+    s.hits++;
+    // 移到链表头，不分配内存
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    const Entry &e = *it->second;
+    candidates->assign(e.items.data(), int(e.items.size()), e.full_num);
+    return true;
+}
+
+void CandidateCache::insert(const quint16 *splidStr, int num, quint32 fuzzyRules,
+                            const Candidates &candidates)
+{
+    quint64 key;
+    if (!makeKey(splidStr, num, fuzzyRules, &key)) return;
+
+    // 在锁外排序和拷贝
+    Entry e;
+    e.key = key;
+    e.full_num = 0;
+    const int n = candidates.size();
+    e.items.reserve(size_t(n));
+    for (int i = 0; i < n; i++)
+    {
+        const LmaPsbItem &item = candidates.at(i);
+        if (item.lma_len == num && e.full_num == i) e.full_num++;
+        e.items.push_back(item);
+    }
+    const size_t bytes = entryBytes(e);
+
+    Shard &s = shardOf(key);
+    const size_t limit = max_bytes_ / kCacheShards;
+    if (bytes > limit) return;
+    std::lock_guard<std::mutex> lock(s.mutex);
+    // 其他线程可能同时查找了同一个键
+    if (s.index.find(key) != s.index.end()) return;
+    s.lru.push_front(Entry());
+    s.lru.front().key = key;
+    s.lru.front().full_num = e.full_num;
+    s.lru.front().items.swap(e.items);
+    s.index[key] = s.lru.begin();
+    s.bytes += bytes;
+    s.inserts++;
+    while (s.bytes > limit)
+    {
+        const Entry &last = s.lru.back();
+        s.bytes -= entryBytes(last);
+        s.index.erase(last.key);
+        s.lru.pop_back();
+        s.evictions++;
+    }
+}
+
+void CandidateCache::clear()
+{
+    for (int i = 0; i < kCacheShards; i++)
+    {
+        Shard &s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.lru.clear();
+        s.index.clear();
+        s.bytes = 0;
+    }
+}
+
+void CandidateCache::stats(CandidateCacheStats *out) const
+{
+    memset(out, 0, sizeof (*out));
+    for (int i = 0; i < kCacheShards; i++)
+    {
+        const Shard &s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        out->hits += s.hits;
+        out->misses += s.misses;
+        out->inserts += s.inserts;
+        out->evictions += s.evictions;
+        out->entries += s.index.size();
+        out->bytes += s.bytes;
+    }
+}
+
+void CandidateCache::resetStats()
+{
+    for (int i = 0; i < kCacheShards; i++)
+    {
+        Shard &s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.hits = 0;
+        s.misses = 0;
+        s.inserts = 0;
+        s.evictions = 0;
+    }
+}
+
+bool CandidateCache::makeKey(const quint16 *splidStr, int num, quint32 fuzzyRules, quint64 *key)
+{
+    // 低 3 位是 id 数，之后 11 位是模糊音规则（kFuzzyAll），再往上每
+    // kCacheSplidBits 位一个 id，共 54 位
+    if (num <= 0 || num > kCacheMaxSplids) return false;
+    quint64 k = quint64(num) | quint64(fuzzyRules & kFuzzyAll) << 3;
+    for (int i = 0; i < num; i++)
+    {
+        if (splidStr[i] >= (1 << kCacheSplidBits)) return false;
+        k |= quint64(splidStr[i]) << (14 + i * kCacheSplidBits);
+    }
+    *key = k;
+    return true;
+}
+
+size_t CandidateCache::entryBytes(const Entry &e)
+{
+    return sizeof (Entry) + e.items.capacity() * sizeof (LmaPsbItem) + kCacheNodeOverhead;
+}
+
+CandidateCache::Shard &CandidateCache::shardOf(quint64 key)
+{
+    // 键的低位多是 id 数和规则，乘法散列后取高位
+    return shards_[((key * 0x9e3779b97f4a7c15ull) >> 32) & (kCacheShards - 1)];
+}
+
+NAMESPACEEND
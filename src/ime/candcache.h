@@ -0,0 +1,113 @@
+#ifndef CANDCACHE_H
+#define CANDCACHE_H
+
+#include "candidates.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+NAMESPACEBEGIN
+
+// 分片数，须是 2 的幂
+#define kCacheShards 16
+// 只缓存不超过这么多个拼音 id 的查找，更长的很少重复，缓存只是负担
+#define kCacheMaxSplids 4
+// 键中每个拼音 id 占的位数，id 不小于 1 << kCacheSplidBits 时不缓存
+#define kCacheSplidBits 10
+
+/**
+ * 缓存的计数，各分片之和。
+ */
+struct CandidateCacheStats
+{
+    quint64 hits;
+    quint64 misses;
+    quint64 inserts;
+    // 因超出内存上限被淘汰的条目数
+    quint64 evictions;
+    size_t entries;
+    // 条目占用的内存，字节，含估计的容器开销
+    size_t bytes;
+};
+
+/**
+ * 候选列表的缓存，由多个解码器共享（见 Decoder::setCandidateCache），
+ * 所有接口都是线程安全的。
+ *
+ * 大量会话反复查找同样的短拼音串（ni、wo、shi、zh……），每次都要展开
+ * 节点、收集词条再排序，而结果只取决于拼音 id 串和模糊音规则。这里以
+ * splstrToIdxs 得到的 id 串（不超过 kCacheMaxSplids 个）和规则为键，保存
+ * 排好序的完整候选列表，命中时直接拷贝，不再查找和排序。
+ *
+ * 键按哈希分到 kCacheShards 个分片，每片一把锁、一个 LRU 链表和一个
+ * 索引，锁内只做查找、移动链表节点和拷贝，不同的键基本不会争用。
+ * 内存上限平分给各分片，插入后从各自的链表尾淘汰。命中不分配内存，
+ * 未命中时插入要分配一次并把整个列表排好序。
+ *
+ * 只缓存词库的查找结果：不完整的结果（到期）和并入了用户词组的结果
+ * 都不插入，用户词典的调整在取出之后照常进行。
+ */
+class CandidateCache
+{
+    Q_DISABLE_COPY(CandidateCache)
+public:
+    // maxBytes 为条目占用内存的上限
+    CandidateCache(size_t maxBytes);
+
+    // 查找 splidStr[0, num) 在模糊音规则 fuzzyRules 下的候选，命中时写入
+    // candidates（已排好序）并返回 true
+    bool lookup(const quint16 *splidStr, int num, quint32 fuzzyRules, Candidates *candidates);
+    // 保存 candidates，须是 DictTrie::setCandidates 对同一键的完整结果。
+    // 会把 candidates 全部排好序
+    void insert(const quint16 *splidStr, int num, quint32 fuzzyRules, const Candidates &candidates);
+    // 清空所有条目，不清除计数
+    void clear();
+
+    void stats(CandidateCacheStats *out) const;
+    void resetStats();
+    inline size_t maxBytes() const;
+
+private:
+    struct Entry
+    {
+        quint64 key;
+        // 完整匹配（长度等于 id 数）的词条数，它们在最前面
+        int full_num;
+        std::vector<LmaPsbItem> items;
+    };
+    typedef std::list<Entry> EntryList;
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        // 最近用过的在前
+        EntryList lru;
+        std::unordered_map<quint64, EntryList::iterator> index;
+        size_t bytes;
+        quint64 hits;
+        quint64 misses;
+        quint64 inserts;
+        quint64 evictions;
+        // 各分片的锁和计数不共用缓存行
+        char pad[64];
+    };
+
+    // 不可缓存（太长或 id 太大）时返回 false
+    static bool makeKey(const quint16 *splidStr, int num, quint32 fuzzyRules, quint64 *key);
+    static size_t entryBytes(const Entry &e);
+    Shard &shardOf(quint64 key);
+
+    Shard shards_[kCacheShards];
+    size_t max_bytes_;
+};
+
+
+size_t CandidateCache::maxBytes() const
+{
+    return max_bytes_;
+}
+
+NAMESPACEEND
+
+#endif // CANDCACHE_H
@@ -1,7 +1,13 @@
 #include "candidates.h"
+#include "stats.h"
+#include <algorithm>
+#include <string.h>
 
 NAMESPACEBEGIN
 
+// 每批至少排序的候选数，大约一页
+#define kMinSortChunk 16
+
 bool LmaPsbItem::operator <(const LmaPsbItem &other) const
 {
     // The real unified psb is psb1 / lma_len1 and psb2 * lma_len2
@@ -9,7 +15,9 @@ bool LmaPsbItem::operator <(const LmaPsbItem &other) const
     // precision.
     const size_t up1 = psb * other.lma_len;
     const size_t up2 = other.psb * lma_len;
-    return up1 <= up2;
+    if (up1 != up2) return up1 < up2;
+    // 分数相同时按 id 排，使顺序成为全序：结果确定，分批排序与整体排序一致
+    return id < other.id;
 }
 
 Candidates::Itr Candidates::pull(int offs, int len) const
@@ -17,14 +25,74 @@ Candidates::Itr Candidates::pull(int offs, int len) const
     if (Q_UNLIKELY(offs < 0)) offs += size();
     else if (Q_UNLIKELY(offs > size())) offs = size();
     if (Q_UNLIKELY(len < -1)) len = -1;
-    ConstItr s = list.constBegin() + offs;
-    ConstItr e = len == -1 || offs + len >= size()? list.constEnd(): s + len;
+    ensureSorted(len == -1 || offs + len >= size()? size(): offs + len);
+    ConstItr s = list + offs;
+    ConstItr e = len == -1 || offs + len >= size()? list + num_: s + len;
     return Itr(s - 1, e);
 }
 
+void Candidates::copyFrom(const Candidates &other)
+{
+    num_ = other.num_;
+    memcpy(list, other.list, sizeof (LmaPsbItem) * num_);
+    seg_num_ = other.seg_num_;
+    memcpy(seg_start_, other.seg_start_, sizeof (seg_start_));
+    memcpy(seg_end_, other.seg_end_, sizeof (seg_end_));
+    sorted_ = other.sorted_;
+}
+
+void Candidates::assign(const LmaPsbItem *items, int num, int fullNum)
+{
+    Q_ASSERT(num <= kMaxLmaPsbItems && fullNum <= num);
+    reset();
+    memcpy(list, items, sizeof (LmaPsbItem) * num);
+    num_ = fullNum;
+    sortByPSB(0);
+    num_ = num;
+    sortByPSB(fullNum);
+    sorted_ = num;
+}
+
 void Candidates::sortByPSB(int skip)
 {
-    qSort(list.begin() + skip, list.end());
+    Q_ASSERT(skip >= 0 && skip <= size());
+    Q_ASSERT(0 == seg_num_ || skip >= seg_end_[seg_num_ - 1]);
+    Q_ASSERT(seg_num_ < kMaxSortSegments);
+    if (size() - skip < 2) return;
+    seg_start_[seg_num_] = skip;
+    seg_end_[seg_num_] = size();
+    seg_num_++;
+}
+
+void Candidates::ensureSorted(int end) const
+{
+    if (end <= sorted_) return;
+    IME_STAT_TIMER(stats_, kStatSort);
+    LmaPsbItem * const begin = list;
+    for (int i = 0; i < seg_num_ && sorted_ < end; i++)
+    {
+        const int segStart = seg_start_[i];
+        const int segEnd = seg_end_[i];
+        if (sorted_ >= segEnd) continue;
+        // Items before the segment keep their order.
+        if (sorted_ < segStart) sorted_ = std::min(segStart, end);
+        if (sorted_ < segStart) break;
+
+        // Select the next chunk of smallest items and sort only them.
+        int chunkEnd = std::max(end, sorted_ + std::max(kMinSortChunk, sorted_ - segStart));
+        if (chunkEnd >= segEnd)
+        {
+            chunkEnd = segEnd;
+        }
+        else
+        {
+            std::nth_element(begin + sorted_, begin + chunkEnd, begin + segEnd);
+        }
+        std::sort(begin + sorted_, begin + chunkEnd);
+        sorted_ = chunkEnd;
+    }
+    // Items after the last segment keep their order.
+    if (sorted_ < end) sorted_ = end;
 }
 
 
@@ -2,9 +2,10 @@
 #define CANDIDATES_H
 
 #include "dictdef.h"
-#include <QList>
 NAMESPACEBEGIN
 
+struct Stats;
+
 struct LmaPsbItem
 {
     // 32位对齐
@@ -18,11 +19,40 @@ struct LmaPsbItem
     bool operator <(const LmaPsbItem &other) const;
 };
 
+// 最多可以登记的待排序区间数
+#define kMaxSortSegments 4
+
+/**
+ * 候选词列表。
+ * sortByPSB 只登记需要排序的区间，真正的排序推迟到取候选词时进行，并且
+ * 只排出被取到的部分：每次先用 nth_element 选出下一批最小的若干项再对它们
+ * 排序，每批至少是已排部分的长度，因此翻完全部候选的总代价仍是 O(n log n)。
+ * 排序规则是全序，所以结果与整体排序完全一致。
+ * 存储是定长的，查找过程中不会分配内存。
+ */
 class Candidates
 {
-    QList<LmaPsbItem> list;
-    typedef QList<LmaPsbItem>::ConstIterator ConstItr;
+    // 排序是惰性的，在 const 的取值接口中进行
+    mutable LmaPsbItem list[kMaxLmaPsbItems];
+    int num_;
+    typedef const LmaPsbItem *ConstItr;
+
+    // 登记的待排序区间 [seg_start_[i], seg_end_[i])，互不重叠且按顺序排列
+    int seg_start_[kMaxSortSegments];
+    int seg_end_[kMaxSortSegments];
+    int seg_num_;
+    // [0, sorted_) 已是最终顺序
+    mutable int sorted_;
+#ifdef EPINYIN_STATS
+    // 记录排序耗时，可以为空
+    Stats *stats_;
+#endif
+
+    // 保证 [0, end) 已排好
+    void ensureSorted(int end) const;
 public:
+    inline Candidates();
+
     //! 候选词迭代器
     class Itr
     {
@@ -31,6 +61,7 @@ public:
         inline Itr(ConstItr s, ConstItr e) : c(s), e(e) { }
     public:
         quint32 id() const { Q_ASSERT(c != e); return c->id; }
+        int lmaLen() const { Q_ASSERT(c != e); return c->lma_len; }
         bool next() { if (c != e) c++; return c != e; }
         friend class Candidates;
     };
@@ -39,44 +70,88 @@ public:
     //! 创建迭代器
     Itr pull(int offs, int len) const;
 
-    //! 排序候选词
+    //! 排序候选词，[skip, size()) 区间在取用时按需排序
     void sortByPSB(int skip);
 
     //! 取某个候选词
     inline const LmaPsbItem &at(int idx) const;
+    //! 修改某项，如按用户词典调整 psb。已经排过序时之后须调用 resort
+    inline LmaPsbItem &itemAt(int idx);
+    //! 登记的区间在取用时重新排序
+    inline void resort();
 
     inline void reset();
+    // 排序耗时记入 stats，只在打开 EPINYIN_STATS 时有效
+    inline void setStats(Stats *stats);
+    // 复制另一个列表，只复制有效的部分
+    void copyFrom(const Candidates &other);
+    // 设为已排好序的 items，前 fullNum 个是完整匹配的词条，登记的区间
+    // 同 DictTrie::setCandidates，见 CandidateCache
+    void assign(const LmaPsbItem *items, int num, int fullNum);
     inline void append(const LmaPsbItem &item);
     inline int size() const;
     inline bool isFull() const;
 };
 
 
+Candidates::Candidates()
+{
+    num_ = 0;
+    seg_num_ = 0;
+    sorted_ = 0;
+#ifdef EPINYIN_STATS
+    stats_ = pNull;
+#endif
+}
+
 const LmaPsbItem &Candidates::at(int idx) const
 {
     Q_ASSERT(idx < size());
-    return list.at(idx);
+    if (idx >= sorted_) ensureSorted(idx + 1);
+    return list[idx];
+}
+
+LmaPsbItem &Candidates::itemAt(int idx)
+{
+    Q_ASSERT(idx < size());
+    return list[idx];
+}
+
+void Candidates::resort()
+{
+    sorted_ = 0;
 }
 
 void Candidates::reset()
 {
-    list.clear();
+    num_ = 0;
+    seg_num_ = 0;
+    sorted_ = 0;
+}
+
+void Candidates::setStats(Stats *stats)
+{
+#ifdef EPINYIN_STATS
+    stats_ = stats;
+#else
+    (void)stats;
+#endif
 }
 
 void Candidates::append(const LmaPsbItem &item)
 {
     Q_ASSERT(!isFull());
-    list.append(item);
+    list[num_++] = item;
 }
 
 int Candidates::size() const
 {
-    return list.size();
+    return num_;
 }
 
 bool Candidates::isFull() const
 {
-    return kMaxLmaPsbItems <= list.size();
+    return kMaxLmaPsbItems <= num_;
 }
 
 
@@ -0,0 +1,85 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include "dictdef.h"
+#include <atomic>
+#include <chrono>
+
+NAMESPACEBEGIN
+
+// 循环中每隔多少次才检查一次截止时间，读时钟本身也有开销
+#define kDeadlineStride 64
+
+/**
+ * 一次查找的截止时间和取消标志，两者都可以不设。
+ * 查找在各阶段之间以及展开节点、收集词条的循环中检查它，到期或被取消后
+ * 尽快结束，返回已得到的部分结果，并标明结果不完整。
+ *
+ * 取消标志由调用者持有，可以在其他线程中置位，查找只读取它。
+ * 一旦检查到期，之后的检查都直接返回 true，同一次查找的各阶段看到的结论
+ * 一致。对象很小，每次查找在栈上新建一个即可。
+ */
+class Deadline
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // 不限时，也不能取消
+    inline Deadline();
+    // 到 at 时到期，cancel 非空且为 true 时视为已到期
+    inline explicit Deadline(Clock::time_point at, const std::atomic<bool> *cancel = pNull);
+    // 从现在起 micros 微秒后到期
+    static inline Deadline after(int micros, const std::atomic<bool> *cancel = pNull);
+    // 不限时，只能取消
+    static inline Deadline cancelable(const std::atomic<bool> *cancel);
+
+    // 是否已到期或被取消
+    inline bool expired() const;
+    inline bool isUnlimited() const;
+
+private:
+    const std::atomic<bool> *cancel_;
+    Clock::time_point at_;
+    bool timed_;
+    mutable bool expired_;
+};
+
+
+Deadline::Deadline()
+    : cancel_(pNull), timed_(false), expired_(false)
+{
+}
+
+Deadline::Deadline(Clock::time_point at, const std::atomic<bool> *cancel)
+    : cancel_(cancel), at_(at), timed_(true), expired_(false)
+{
+}
+
+Deadline Deadline::after(int micros, const std::atomic<bool> *cancel)
+{
+    return Deadline(Clock::now() + std::chrono::microseconds(micros), cancel);
+}
+
+Deadline Deadline::cancelable(const std::atomic<bool> *cancel)
+{
+    Deadline d;
+    d.cancel_ = cancel;
+    return d;
+}
+
+bool Deadline::expired() const
+{
+    if (expired_) return true;
+    if (pNull != cancel_ && cancel_->load(std::memory_order_relaxed)) expired_ = true;
+    else if (timed_ && Clock::now() >= at_) expired_ = true;
+    return expired_;
+}
+
+bool Deadline::isUnlimited() const
+{
+    return pNull == cancel_ && !timed_;
+}
+
+NAMESPACEEND
+
+#endif // DEADLINE_H
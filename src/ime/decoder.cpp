@@ -0,0 +1,494 @@
+#include "decoder.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "candidates.h"
+#include "dictionary.h"
+#include "sentence.h"
+#include "deadline.h"
+#include "stats.h"
+#include "userdict.h"
+#include "candcache.h"
+#include <algorithm>
+
+NAMESPACEBEGIN
+
+Decoder::Decoder(const Dictionary *dict)
+{
+    Q_ASSERT(dict && dict->isValid());
+    st = dict->spellingTrie();
+    dt = dict->dictTrie();
+    cs = new Candidates;
+    frontier_ = new LmaFrontier;
+    sentence_ = pNull;
+    fuzzy_ = pNull;
+    user_ = pNull;
+    user_ring_ = pNull;
+    user_phrases_ = pNull;
+    cache_ = pNull;
+    sentence_steps_ = 0;
+    sentence_us_ = kSentenceDefaultBudgetUs;
+#ifdef EPINYIN_STATS
+    stats_ = new Stats;
+    cs->setStats(stats_);
+#endif
+    resetSearch();
+}
+
+Decoder::~Decoder()
+{
+#ifdef EPINYIN_STATS
+    delete stats_;
+#endif
+    if (pNull != user_) user_->detach(user_ring_);
+    delete sentence_;
+    delete fuzzy_;
+    delete[] user_phrases_;
+    delete frontier_;
+    delete cs;
+}
+
+size_t Decoder::search(const char *py, int pyLen)
+{
+    return search(py, pyLen, Deadline());
+}
+
+size_t Decoder::search(const char *py, int pyLen, const Deadline &deadline)
+{
+    pyLen = std::min(pyLen, kMaxRowNum - 1);
+
+    // Compare the new string with the previous one. Find their prefix to
+    // increase search efficiency.
+    int chPos = 0;
+    for (chPos = 0; chPos < pys_decoded_len_ && chPos < pyLen; chPos++)
+    {
+        if (py[chPos] != pys_[chPos]) break;
+    }
+
+    while (fixed_num_ > 0 && chPos < fixed_spl_[fixed_num_ - 1])
+    {
+        cancelLastChoice0();
+    }
+
+    memcpy(pys_ + chPos, py + chPos, pyLen - chPos);
+    pys_[pyLen] = '\0';
+    pys_decoded_len_ = pyLen;
+
+    return updateCandidate(deadline);
+}
+
+size_t Decoder::choose(int idx)
+{
+    return choose(idx, Deadline());
+}
+
+size_t Decoder::choose(int idx, const Deadline &deadline)
+{
+    if (pys_decoded_len_ == 0 || idx < 0 || idx >= getCandidateCount())
+    {
+        return getCandidateCount();
+    }
+    if (has_sentence_)
+    {
+        if (0 == idx)
+        {
+            // 依次固定句子中的各个词条，spl_start_ 都相对于未固定部分的开头
+            const int base = getFixedSplLen();
+            const int first = fixed_num_;
+            int splNum = 0;
+            for (int i = 0; i < sentence_->lemmaNum(); i++)
+            {
+                const LmaPsbItem &item = sentence_->lemma(i);
+                fixLemma(item, spl_id_ + splNum, base + spl_start_[splNum + item.lma_len]);
+                splNum += item.lma_len;
+            }
+            learn(first, true);
+            return updateCandidate(deadline);
+        }
+        idx--;
+    }
+    const LmaPsbItem &item = cs->at(idx);
+    fixLemma(item, spl_id_, getFixedSplLen() + spl_start_[item.lma_len]);
+    learn(fixed_num_ - 1, item.lma_len == spl_id_num_);
+    return updateCandidate(deadline);
+}
+
+void Decoder::fixLemma(const LmaPsbItem &item, const quint16 *splids, int splLst)
+{
+    Q_ASSERT(fixed_num_ < kMaxRowNum);
+    Q_ASSERT(fixed_total_ + item.lma_len <= kMaxRowNum);
+    // 文字和拼音在固定时保存，用户词组在下次查找后就不在 user_phrases_ 中了
+    if (0 != (item.id & kUserLemmaFlag))
+    {
+        const UserPhrase &p = user_phrases_[item.id & ~kUserLemmaFlag];
+        memcpy(fixed_text_ + fixed_total_, p.text, p.len * sizeof (char16_t));
+        memcpy(fixed_splid_ + fixed_total_, p.splids, p.len * sizeof (quint16));
+    }
+    else
+    {
+        dt->copyLemma(item.id, item.lma_len, fixed_text_ + fixed_total_);
+        memcpy(fixed_splid_ + fixed_total_, splids, item.lma_len * sizeof (quint16));
+    }
+    fixed_total_ += item.lma_len;
+    fixed_spl_[fixed_num_] = quint16(splLst);
+    fixed_id_[fixed_num_] = item.id;
+    fixed_len_[fixed_num_] = item.lma_len;
+    fixed_num_++;
+}
+
+size_t Decoder::cancelLastChoice()
+{
+    return cancelLastChoice(Deadline());
+}
+
+size_t Decoder::cancelLastChoice(const Deadline &deadline)
+{
+    if (fixed_num_ > 0)
+    {
+        cancelLastChoice0();
+        return updateCandidate(deadline);
+    }
+    return getCandidateCount();
+}
+
+int Decoder::getCandidate(int offs, int len, char16_t *buf, int bufLen,
+                          int *lens, int lensLen) const
+{
+    IME_STAT_TIMER(stats(), kStatLemmaText);
+    int num = 0;
+    if (has_sentence_)
+    {
+        if (0 == offs)
+        {
+            // len 为 -1 时表示全部，同 Candidates::pull
+            if (0 == len || lensLen <= 0) return 0;
+            int l;
+            const char16_t *s = sentence_->text(&l);
+            if (l > bufLen) return 0;
+            memcpy(buf, s, l * sizeof (char16_t));
+            buf += l;
+            bufLen -= l;
+            lens[num++] = l;
+            if (len > 0) len--;
+            if (0 == len) return num;
+        }
+        else if (offs > 0)
+        {
+            offs--;
+        }
+    }
+    // 候选中可能有用户词组，不能直接用 DictTrie::getCandidates
+    Candidates::Itr itr = cs->pull(offs, len);
+    while (num < lensLen && itr.next())
+    {
+        const int l = itr.lmaLen();
+        if (l > bufLen) break;
+        copyLemma(itr.id(), l, buf);
+        buf += l;
+        bufLen -= l;
+        lens[num++] = l;
+    }
+    return num;
+}
+
+const char16_t *Decoder::getCandidateView(int idx, int *len) const
+{
+    if (has_sentence_)
+    {
+        if (0 == idx) return sentence_->text(len);
+        idx--;
+    }
+    if (idx < 0 || idx >= cs->size())
+    {
+        *len = 0;
+        return pNull;
+    }
+    const LmaPsbItem &item = cs->at(idx);
+    *len = item.lma_len;
+    if (0 != (item.id & kUserLemmaFlag)) return user_phrases_[item.id & ~kUserLemmaFlag].text;
+    const char16_t *view = dt->getLemmaView(item.id, item.lma_len);
+    if (Q_LIKELY(pNull != view)) return view;
+    // 文字压缩存放时没有视图，解到实例自己的缓冲区中
+    dt->copyLemma(item.id, item.lma_len, view_buf_);
+    return view_buf_;
+}
+
+int Decoder::getCandidateCount() const
+{
+    return cs->size() + (has_sentence_? 1: 0);
+}
+
+int Decoder::getFixedStr(char16_t *buf, int bufLen) const
+{
+    // 只写出完整的词条
+    int total = 0;
+    for (int i = 0; i < fixed_num_ && fixed_len_[i] <= bufLen - total; i++)
+    {
+        total += fixed_len_[i];
+    }
+    memcpy(buf, fixed_text_, total * sizeof (char16_t));
+    return total;
+}
+
+void Decoder::setUserDict(UserDict *user)
+{
+    if (pNull != user && pNull == user_phrases_) user_phrases_ = new UserPhrase[kMaxUserCandidates];
+    if (user != user_)
+    {
+        // 已记录的选择仍由旧词典处理
+        if (pNull != user_) user_->detach(user_ring_);
+        user_ = user;
+        user_ring_ = pNull != user? user->attach(): pNull;
+    }
+    user_num_ = 0;
+    // 候选中可能有旧词典的词组
+    if (pys_decoded_len_ > 0) updateCandidate(Deadline());
+}
+
+void Decoder::copyLemma(quint32 id, int lmaLen, char16_t *buf) const
+{
+    if (0 != (id & kUserLemmaFlag))
+    {
+        memcpy(buf, user_phrases_[id & ~kUserLemmaFlag].text, lmaLen * sizeof (char16_t));
+    }
+    else
+    {
+        dt->copyLemma(id, lmaLen, buf);
+    }
+}
+
+void Decoder::learn(int first, bool whole)
+{
+    if (pNull == user_) return;
+    UserChoice c;
+    int pos = 0;
+    for (int i = 0; i < first; i++) pos += fixed_len_[i];
+    // 每个固定的词条各记一次
+    for (int i = first; i < fixed_num_; i++)
+    {
+        const int len = fixed_len_[i];
+        c.len = quint8(len);
+        c.part_num = 1;
+        c.part_len[0] = quint8(len);
+        c.part_id[0] = 0 != (fixed_id_[i] & kUserLemmaFlag)? 0: fixed_id_[i];
+        memcpy(c.splids, fixed_splid_ + pos, len * sizeof (quint16));
+        memcpy(c.text, fixed_text_ + pos, len * sizeof (char16_t));
+        user_->record(user_ring_, c);
+        pos += len;
+    }
+    // 拼音全部选完时，分几次选出的整体记为词组，下次作为一个候选给出
+    if (!whole || fixed_num_ < 2 || fixed_total_ > kMaxLemmaSize) return;
+    c.len = quint8(fixed_total_);
+    c.part_num = quint8(fixed_num_);
+    for (int i = 0; i < fixed_num_; i++)
+    {
+        c.part_len[i] = quint8(fixed_len_[i]);
+        c.part_id[i] = 0 != (fixed_id_[i] & kUserLemmaFlag)? 0: fixed_id_[i];
+    }
+    memcpy(c.splids, fixed_splid_, fixed_total_ * sizeof (quint16));
+    memcpy(c.text, fixed_text_, fixed_total_ * sizeof (char16_t));
+    user_->record(user_ring_, c);
+}
+
+void Decoder::resetSearch()
+{
+    pys_decoded_len_ = 0;
+    spl_id_num_ = 0;
+    fixed_total_ = 0;
+    fixed_num_ = 0;
+    user_num_ = 0;
+    cs->reset();
+    has_sentence_ = false;
+    partial_ = false;
+    if (pNull != sentence_) sentence_->reset();
+}
+
+void Decoder::setSentenceEnabled(bool enabled)
+{
+    if (enabled == (pNull != sentence_)) return;
+    if (enabled)
+    {
+        sentence_ = new SentenceDecoder(dt, st);
+        sentence_->setBudget(sentence_steps_, sentence_us_);
+        sentence_->setFuzzy(fuzzy_);
+    }
+    else
+    {
+        delete sentence_;
+        sentence_ = pNull;
+        has_sentence_ = false;
+    }
+}
+
+void Decoder::setFuzzyRules(quint32 rules)
+{
+    rules &= kFuzzyAll;
+    if (rules == fuzzyRules()) return;
+    if (0 == rules)
+    {
+        delete fuzzy_;
+        fuzzy_ = pNull;
+    }
+    else
+    {
+        if (pNull == fuzzy_) fuzzy_ = new FuzzyTable;
+        st->buildFuzzyTable(rules, fuzzy_);
+    }
+    frontier_->reset();
+    frontier_->fuzzy = fuzzy_;
+    if (pNull != sentence_) sentence_->setFuzzy(fuzzy_);
+}
+
+quint32 Decoder::fuzzyRules() const
+{
+    return pNull == fuzzy_? 0: fuzzy_->rules();
+}
+
+void Decoder::setSentenceBudget(int maxSteps, int maxMicros)
+{
+    sentence_steps_ = maxSteps;
+    sentence_us_ = maxMicros;
+    if (pNull != sentence_) sentence_->setBudget(maxSteps, maxMicros);
+}
+
+void Decoder::copyFrom(const Decoder &other)
+{
+    Q_ASSERT(dt == other.dt && st == other.st);
+    // 候选中的用户词组只是序号，须是同一个用户词典
+    Q_ASSERT(user_ == other.user_);
+    // 展开的节点依赖于模糊音规则，先使规则一致
+    setFuzzyRules(other.fuzzyRules());
+    cs->copyFrom(*other.cs);
+    frontier_->copyFrom(*other.frontier_);
+    fixed_num_ = other.fixed_num_;
+    memcpy(fixed_spl_, other.fixed_spl_, sizeof (fixed_spl_));
+    memcpy(fixed_id_, other.fixed_id_, sizeof (fixed_id_));
+    memcpy(fixed_len_, other.fixed_len_, sizeof (fixed_len_));
+    fixed_total_ = other.fixed_total_;
+    memcpy(fixed_text_, other.fixed_text_, sizeof (fixed_text_));
+    memcpy(fixed_splid_, other.fixed_splid_, sizeof (fixed_splid_));
+    user_num_ = other.user_num_;
+    if (user_num_ > 0) memcpy(user_phrases_, other.user_phrases_, user_num_ * sizeof (UserPhrase));
+    pys_decoded_len_ = other.pys_decoded_len_;
+    spl_id_num_ = other.spl_id_num_;
+    memcpy(spl_start_, other.spl_start_, sizeof (spl_start_));
+    memcpy(spl_id_, other.spl_id_, sizeof (spl_id_));
+    memcpy(pys_, other.pys_, sizeof (pys_));
+    sentence_steps_ = other.sentence_steps_;
+    sentence_us_ = other.sentence_us_;
+    setSentenceEnabled(pNull != other.sentence_);
+    if (pNull != sentence_)
+    {
+        sentence_->setBudget(sentence_steps_, sentence_us_);
+        sentence_->copyFrom(*other.sentence_);
+    }
+    has_sentence_ = other.has_sentence_;
+    partial_ = other.partial_;
+}
+
+quint64 Decoder::frontierOverflows() const
+{
+    return frontier_->overflow_count;
+}
+
+int Decoder::frontierPeak() const
+{
+    return int(frontier_->peak_nodes);
+}
+
+void Decoder::statsSnapshot(StatsSnapshot *out) const
+{
+    memset(out, 0, sizeof (*out));
+    if (pNull != stats()) stats()->summarize(out);
+    out->frontier_overflows = frontier_->overflow_count;
+    out->frontier_peak = frontier_->peak_nodes;
+}
+
+void Decoder::resetStats()
+{
+    if (pNull != stats()) stats()->reset();
+    frontier_->overflow_count = 0;
+    frontier_->peak_nodes = 0;
+}
+
+void Decoder::cancelLastChoice0()
+{
+    Q_ASSERT(fixed_total_ > 0);
+    fixed_num_--;
+    fixed_total_ -= fixed_len_[fixed_num_];
+    Q_ASSERT(fixed_total_ >= 0);
+}
+
+size_t Decoder::updateCandidate(const Deadline &deadline)
+{
+    // 未打开 EPINYIN_STATS 时 stats() 为空，lap 的代码都会被优化掉
+    StatLap lap(stats());
+    int pyOffs = getFixedSplLen();
+    int pyLen = pys_decoded_len_ - pyOffs;
+    if (pyLen > 0)
+    {
+        spl_id_num_ = st->splstrToIdxs(
+                    pys_ + pyOffs, pyLen,
+                    spl_id_, spl_start_, kMaxRowNum - 1);
+        lap.mark(kStatSplit);
+
+        const Deadline *dl = deadline.isUnlimited()? pNull: &deadline;
+        LmaPsbItem extras[kMaxUserCandidates];
+        user_num_ = 0;
+        if (pNull != user_)
+        {
+            user_num_ = user_->matchPhrases(spl_id_, spl_id_num_, st, fuzzy_,
+                                            user_phrases_, kMaxUserCandidates);
+            for (int i = 0; i < user_num_; i++)
+            {
+                extras[i].id = kUserLemmaFlag | quint32(i);
+                extras[i].lma_len = user_phrases_[i].len;
+                extras[i].psb = UserDict::psbOf(user_phrases_[i].count);
+            }
+        }
+        // 缓存中只有词库的结果，并入了用户词组的不使用也不插入。命中时
+        // 不展开节点，frontier_ 停在上次，之后的查找从相同的部分继续
+        bool cached = false;
+        if (pNull != cache_ && 0 == user_num_)
+        {
+            cached = cache_->lookup(spl_id_, spl_id_num_, fuzzyRules(), cs);
+            partial_ = false;
+        }
+        if (!cached)
+        {
+            dt->setCandidates(spl_id_, spl_id_num_, cs, st, frontier_, dl, &partial_,
+                              pNull != lap.stats()? &lap: pNull, extras, user_num_);
+            if (pNull != cache_ && 0 == user_num_ && !partial_)
+            {
+                cache_->insert(spl_id_, spl_id_num_, fuzzyRules(), *cs);
+            }
+        }
+        // 缓存的列表已排好序，调整后须重新排序
+        if (pNull != user_ && user_->adjust(cs)) cs->resort();
+        // 只有一个词条的句子就是候选列表中的第一个，不必重复。
+        // 候选不完整时已经到期，不再解码整句。
+        has_sentence_ = false;
+        if (pNull != sentence_ && !partial_)
+        {
+            has_sentence_ = sentence_->decode(spl_id_, spl_id_num_, dl) &&
+                    sentence_->lemmaNum() > 1;
+            lap.mark(kStatSentence);
+            if (sentence_->isPending() && pNull != dl && dl->expired()) partial_ = true;
+        }
+    }
+    else
+    {
+        spl_id_num_ = 0;
+        user_num_ = 0;
+        cs->reset();
+        has_sentence_ = false;
+        partial_ = false;
+    }
+    lap.total(kStatSearch);
+    IME_STATS(Stats *s = stats();
+              s->candidates.add(quint64(getCandidateCount()));
+              if (cs->isFull()) s->truncated++;
+              if (partial_) s->partial++);
+    return getCandidateCount();
+}
+
+NAMESPACEEND
@@ -0,0 +1,275 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include "dictdef.h"
+
+NAMESPACEBEGIN
+
+class Dictionary;
+class SpellingTrie;
+class DictTrie;
+class Candidates;
+struct LmaPsbItem;
+struct LmaFrontier;
+class SentenceDecoder;
+class FuzzyTable;
+class Deadline;
+struct Stats;
+struct StatsSnapshot;
+class UserDict;
+struct UserRing;
+struct UserPhrase;
+class CandidateCache;
+
+/**
+ * 一个输入会话的解码器，不依赖 qt。
+ * 词库由 Dictionary 共享，解码器只保存自己的输入状态，且全部为定长存储，
+ * 预热后 search/choose/cancelLastChoice 不分配内存。
+ * 结果以 UTF-16 写入调用者的缓冲区，或以指向词库数据的只读视图返回。
+ *
+ * 打开整句解码（setSentenceEnabled）后，能把全部输入组成一个由多个词条
+ * 构成的句子时，该句子排在候选列表的第 0 位，其余候选词依次后移，
+ * 选择它即固定其中的全部词条。见 SentenceDecoder。
+ *
+ * 查找类的调用都有带 Deadline 的重载，到期或被取消时返回已得到的部分
+ * 候选（照常排序），isPartial() 为 true。部分结果也是有效的状态，可以
+ * 照常取候选、选择，之后的查找会重新计算。
+ *
+ * 设置了用户词典（setUserDict）时，每次选择的词条记入其中；把全部输入
+ * 固定为多个部分时，拼成的词组也记入其中。查找时按记录调整候选的排序，
+ * 拼音匹配的用户词组作为整词一起排序。整句候选不使用用户词典。
+ */
+class Decoder
+{
+    Q_DISABLE_COPY(Decoder)
+    void cancelLastChoice0();
+    // 固定一个词条，splids 为它对应的输入的拼音 id，splLst 为固定后已固定的
+    // 拼音串长度
+    void fixLemma(const LmaPsbItem &item, const quint16 *splids, int splLst);
+    size_t updateCandidate(const Deadline &deadline);
+    // 把第 first 个之后固定的各部分记入用户词典，whole 为 true 时输入已全部
+    // 固定，再记录拼成的词组
+    void learn(int first, bool whole);
+    // 候选项的文字，用户词组取自 user_phrases_
+    void copyLemma(quint32 id, int lmaLen, char16_t *buf) const;
+public:
+    // 调用者需保证 dict 在解码器销毁前有效
+    Decoder(const Dictionary *dict);
+    ~Decoder();
+
+    // Search a Pinyin string.
+    // Return value is the position successfully parsed.
+    size_t search(const char *py, int pyLen);
+    // Choose a candidate. The decoder will do a search after the fixed position.
+    size_t choose(int idx);
+    size_t cancelLastChoice();
+    // 同上，deadline 到期或被取消时提前结束，见 isPartial
+    size_t search(const char *py, int pyLen, const Deadline &deadline);
+    size_t choose(int idx, const Deadline &deadline);
+    size_t cancelLastChoice(const Deadline &deadline);
+    // 最近一次查找是否因 deadline 提前结束，此时候选列表只含已找到的部分，
+    // 整句候选也可能缺失
+    inline bool isPartial() const;
+    void resetSearch();
+    // 复制另一个使用同一词库的解码器的全部状态，比重新查找便宜得多。
+    // 用于合并相同的查询。两者须使用同一个用户词典（或都没有）
+    void copyFrom(const Decoder &other);
+
+    // 候选词依次写入 buf（不含结束符），lens[i] 为第 i 个候选词的长度，
+    // 返回写入的候选词个数，buf 或 lens 不够时提前结束。
+    int getCandidate(int offs, int len, char16_t *buf, int bufLen,
+                     int *lens, int lensLen) const;
+    // 第 idx 个候选词的只读视图（不含结束符），直接指向词库数据，
+    // 词库存活期间有效。idx 无效时返回空指针。
+    // 词库文字压缩存放（kDictPackLemmas）时指向实例内的缓冲区，
+    // 只在下一次调用之前有效。
+    const char16_t *getCandidateView(int idx, int *len) const;
+    int getCandidateCount() const;
+    // 写入固定的内容，返回写入的长度，buf 不够时只写入能完整放下的部分。
+    int getFixedStr(char16_t *buf, int bufLen) const;
+    // 固定内容的长度，以汉字计
+    inline int getFixedLen() const;
+
+    inline int getFixedSplLen() const;
+    inline const char* getSpsStr(int *len) const;
+    inline const quint16 *getSplStartPos(int *len) const;
+
+    // 词条候选列表，不含整句候选
+    inline const Candidates *candidates() const;
+    inline const DictTrie *dictTrie() const;
+
+    // 整句解码，默认关闭。打开后下次查找时生效。
+    void setSentenceEnabled(bool enabled);
+    inline bool isSentenceEnabled() const;
+    // 模糊音规则，FuzzyRule 的组合，0 为精确匹配（默认）。
+    // 改变后下次查找时生效，之前展开的节点作废。
+    void setFuzzyRules(quint32 rules);
+    quint32 fuzzyRules() const;
+    // 每次查找整句解码的预算，见 SentenceDecoder::setBudget
+    void setSentenceBudget(int maxSteps, int maxMicros);
+    // 用户词典，为空时不记录也不调整（默认）。可以被多个解码器共享，每个
+    // 解码器向它登记自己的选择队列（UserDict::attach）。调用者需保证它在
+    // 解码器销毁或 setUserDict(pNull) 之前有效。已有输入时立即按新的词典
+    // 重新查找
+    void setUserDict(UserDict *user);
+    inline UserDict *userDict() const;
+    // 候选列表的缓存，为空时不使用（默认）。可以被使用同一份词库的多个
+    // 解码器共享，调用者需保证它在解码器销毁前有效
+    inline void setCandidateCache(CandidateCache *cache);
+    inline CandidateCache *candidateCache() const;
+    // 候选列表的第 0 位是否为整句
+    inline bool hasSentence() const;
+    inline const SentenceDecoder *sentenceDecoder() const;
+
+    // 本解码器查找时某层展开的节点超过 MAX_EXTENDBUF_LEN（旧实现会截断）
+    // 的次数，及单层节点数的最大值，见 LmaFrontier
+    quint64 frontierOverflows() const;
+    int frontierPeak() const;
+
+    // 从创建或上次 resetStats 起各阶段的耗时和计数，见 stats.h。
+    // 未打开 EPINYIN_STATS 时 enabled 为 false，只有 frontier_* 两项。
+    void statsSnapshot(StatsSnapshot *out) const;
+    void resetStats();
+    // 原始的统计数据，可用 Stats::merge 合并多个会话。未打开时为空
+    inline Stats *stats() const;
+
+private:
+    const SpellingTrie *st;
+    const DictTrie *dt;
+    Candidates *cs;
+    // 上次查找展开的词库节点，输入增加时复用
+    LmaFrontier *frontier_;
+    // 整句解码，未打开时为空
+    SentenceDecoder *sentence_;
+    int sentence_steps_;
+    int sentence_us_;
+    bool has_sentence_;
+    bool partial_;
+    // 模糊音表，精确匹配时为空
+    FuzzyTable *fuzzy_;
+    // 用户词典，没有时为空
+    UserDict *user_;
+    // 本解码器在用户词典中的选择队列，只有本解码器写入
+    UserRing *user_ring_;
+    // 本次查找匹配的用户词组，候选项的 id 为 kUserLemmaFlag | 下标。
+    // 设置用户词典时分配 kMaxUserCandidates 个
+    UserPhrase *user_phrases_;
+    int user_num_;
+    // 共享的候选列表缓存，没有时为空
+    CandidateCache *cache_;
+#ifdef EPINYIN_STATS
+    // 本会话的统计，const 的取结果接口也要记录
+    Stats *stats_;
+#endif
+
+    // 已固定的候选词，每次固定至少消耗一个字母，不会超过 kMaxRowNum 个。
+    int fixed_num_;
+    // Used to remember the fixed positions in pys_.
+    quint16 fixed_spl_[kMaxRowNum];
+    quint32 fixed_id_[kMaxRowNum];
+    quint16 fixed_len_[kMaxRowNum];
+    // Total fixed length, counted in Hanzi.
+    int fixed_total_;
+    // 已固定的每个字的文字，及其拼音 id：系统词条为输入的 id，用户词组为全拼 id
+    char16_t fixed_text_[kMaxRowNum];
+    quint16 fixed_splid_[kMaxRowNum];
+
+    // The length of the string that has been decoded successfully.
+    int pys_decoded_len_;
+
+    // Number of splling ids
+    int spl_id_num_;
+
+    // Starting positions
+    quint16 spl_start_[kMaxRowNum];
+
+    // Spelling ids
+    quint16 spl_id_[kMaxRowNum];
+
+    // 词库文字压缩存放时 getCandidateView 解出的文字
+    mutable char16_t view_buf_[kMaxLemmaSize];
+
+    // Pinyin string. Max length: kMaxRowNum - 1
+    char pys_[kMaxRowNum];
+};
+
+
+int Decoder::getFixedLen() const
+{
+    return fixed_total_;
+}
+
+int Decoder::getFixedSplLen() const
+{
+    return 0 == fixed_num_? 0: fixed_spl_[fixed_num_ - 1];
+}
+
+const char *Decoder::getSpsStr(int *len) const
+{
+    *len = pys_decoded_len_;
+    return pys_;
+}
+
+const quint16 *Decoder::getSplStartPos(int *len) const
+{
+    *len = spl_id_num_;
+    return spl_start_;
+}
+
+const Candidates *Decoder::candidates() const
+{
+    return cs;
+}
+
+const DictTrie *Decoder::dictTrie() const
+{
+    return dt;
+}
+
+bool Decoder::isPartial() const
+{
+    return partial_;
+}
+
+bool Decoder::isSentenceEnabled() const
+{
+    return pNull != sentence_;
+}
+
+bool Decoder::hasSentence() const
+{
+    return has_sentence_;
+}
+
+const SentenceDecoder *Decoder::sentenceDecoder() const
+{
+    return sentence_;
+}
+
+UserDict *Decoder::userDict() const
+{
+    return user_;
+}
+
+void Decoder::setCandidateCache(CandidateCache *cache)
+{
+    cache_ = cache;
+}
+
+CandidateCache *Decoder::candidateCache() const
+{
+    return cache_;
+}
+
+Stats *Decoder::stats() const
+{
+#ifdef EPINYIN_STATS
+    return stats_;
+#else
+    return pNull;
+#endif
+}
+
+NAMESPACEEND
+
+#endif // DECODER_H
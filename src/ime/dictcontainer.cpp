@@ -0,0 +1,233 @@
+#include "dictcontainer.h"
+#include "dictreader.h"
+#include "dictionary.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "threadpool.h"
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+
+NAMESPACEBEGIN
+
+static const char kDictContainerMagic[8] = { 'E', 'P', 'Y', 'D', 'I', 'C', 'T', '\0' };
+
+// 文件头，64 字节
+struct DictContainerHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 header_size;
+    quint32 section_num;
+    // 段表的校验和
+    quint32 table_crc;
+    quint64 file_size;
+    // 此前各字段的校验和
+    quint32 header_crc;
+    char reserved[28];
+};
+
+static_assert(sizeof (DictContainerHeader) == kDictContainerHeaderSize,
+              "container header must be 64 bytes");
+static_assert(sizeof (DictSection) == 32, "section entry must be 32 bytes");
+
+DictContainer::DictContainer()
+{
+    data_ = pNull;
+}
+
+bool DictContainer::isContainer(const char *data, qint64 size)
+{
+    return pNull != data && size >= qint64(sizeof (kDictContainerMagic))
+            && 0 == memcmp(data, kDictContainerMagic, sizeof (kDictContainerMagic));
+}
+
+bool DictContainer::open(const char *data, qint64 size)
+{
+    data_ = pNull;
+    sections_.clear();
+    if (!isContainer(data, size) || size < kDictContainerHeaderSize) return false;
+
+    DictContainerHeader h;
+    memcpy(&h, data, sizeof (h));
+    if (h.version != kDictContainerVersion) return false;
+    if (h.header_size != kDictContainerHeaderSize) return false;
+    if (h.header_crc != checksum(data, offsetof(DictContainerHeader, header_crc))) return false;
+    // 文件被截断或末尾有多余的数据
+    if (h.file_size != quint64(size)) return false;
+    if (h.section_num > kDictContainerMaxSections) return false;
+
+    const qint64 tableLen = qint64(h.section_num) * qint64(sizeof (DictSection));
+    if (tableLen > size - kDictContainerHeaderSize) return false;
+    const char *table = data + kDictContainerHeaderSize;
+    if (h.table_crc != checksum(table, size_t(tableLen))) return false;
+    sections_.resize(h.section_num);
+    memcpy(sections_.data(), table, size_t(tableLen));
+
+    // 各段对齐、在文件内、按偏移升序且不重叠
+    quint64 end = quint64(kDictContainerHeaderSize + tableLen);
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+        const DictSection &s = sections_[i];
+        if (s.offset % kDictContainerAlign != 0 || s.offset < end
+                || s.offset > quint64(size) || s.size > quint64(size) - s.offset)
+        {
+            sections_.clear();
+            return false;
+        }
+        end = s.offset + s.size;
+    }
+    // 最后一段之后不能再有不属于任何段的数据
+    if (end != quint64(size))
+    {
+        sections_.clear();
+        return false;
+    }
+    data_ = data;
+    return true;
+}
+
+int DictContainer::find(const char *tag) const
+{
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+        if (0 == memcmp(sections_[i].tag, tag, 4)) return int(i);
+    }
+    return -1;
+}
+
+bool DictContainer::enter(DictReader &dr, const char *tag) const
+{
+    Q_ASSERT(dr.data() == data_);
+    const int i = find(tag);
+    if (i < 0) return false;
+    const DictSection &s = sections_[size_t(i)];
+    return dr.setWindow(qint64(s.offset), qint64(s.offset + s.size));
+}
+
+bool DictContainer::verify(int i) const
+{
+    const DictSection &s = section(i);
+    return s.crc == checksum(data_ + s.offset, size_t(s.size));
+}
+
+bool DictContainer::convert(const char *data, qint64 size, std::string &out,
+                            ThreadPool *pool)
+{
+    if (isContainer(data, size)) return false;
+    // 完整加载一遍以得到（或校验）预编译的拼音树和节点列
+    Dictionary dict(data, size);
+    if (!dict.isValid()) return false;
+
+    std::vector<DictSectionData> sections(6);
+    sections[0].tag = kSectionSpelling;
+    sections[1].tag = kSectionList;
+    sections[2].tag = kSectionTrie;
+    sections[3].tag = kSectionNGram;
+    sections[4].tag = kSectionCompiledTrie;
+    sections[5].tag = kSectionCompiledNodes;
+
+    // 旧格式的前四部分由同样的加载函数再读一遍，读到的内容原样转写，
+    // 只在数组前补上对齐用的 0，两种格式由同一套代码解析
+    DictReader r;
+    SpellingTrie st;
+    DictTrie dt;
+    r.open(data, size);
+    r.setTranscript(&sections[0].data);
+    bool ok = st.loadSplTrie(r);
+    r.setTranscript(&sections[1].data);
+    ok = ok && dt.loadDictList(r);
+    r.setTranscript(&sections[2].data);
+    ok = ok && dt.loadDictDict(r, st.getSpellingNum());
+    r.setTranscript(&sections[3].data);
+    ok = ok && dt.loadDictNGram(r);
+    r.setTranscript(pNull);
+    if (!ok) return false;
+    dict.spellingTrie()->saveCompiledTrie(sections[4].data);
+    dict.dictTrie()->saveCompiledNodes(sections[5].data);
+
+    write(sections, out, pool);
+    return true;
+}
+
+void DictContainer::write(const std::vector<DictSectionData> &sections, std::string &out,
+                          ThreadPool *pool)
+{
+    const size_t num = sections.size();
+    Q_ASSERT(num <= kDictContainerMaxSections);
+
+    std::vector<DictSection> table(num);
+    quint64 offset = kDictContainerHeaderSize + num * sizeof (DictSection);
+    for (size_t i = 0; i < num; i++)
+    {
+        DictSection &s = table[i];
+        memset(&s, 0, sizeof (s));
+        memcpy(s.tag, sections[i].tag, 4);
+        offset = (offset + kDictContainerAlign - 1) & ~quint64(kDictContainerAlign - 1);
+        s.offset = offset;
+        s.size = sections[i].data.size();
+        offset += s.size;
+    }
+
+    auto sum = [&](size_t i) {
+        table[i].crc = checksum(sections[i].data.data(), sections[i].data.size());
+    };
+    if (pNull != pool)
+    {
+        // 以段为单位分给各线程
+        std::atomic<size_t> next(0);
+        pool->run([&](int) {
+            for (size_t i; (i = next.fetch_add(1)) < num; ) sum(i);
+        });
+    }
+    else
+    {
+        for (size_t i = 0; i < num; i++) sum(i);
+    }
+
+    DictContainerHeader h;
+    memset(&h, 0, sizeof (h));
+    memcpy(h.magic, kDictContainerMagic, sizeof (h.magic));
+    h.version = kDictContainerVersion;
+    h.header_size = kDictContainerHeaderSize;
+    h.section_num = quint32(num);
+    h.table_crc = checksum((const char *) table.data(), num * sizeof (DictSection));
+    h.file_size = offset;
+    h.header_crc = checksum((const char *) &h, offsetof(DictContainerHeader, header_crc));
+
+    out.clear();
+    out.reserve(size_t(offset));
+    out.append((const char *) &h, sizeof (h));
+    out.append((const char *) table.data(), num * sizeof (DictSection));
+    for (size_t i = 0; i < num; i++)
+    {
+        out.append(size_t(table[i].offset) - out.size(), '\0');
+        out.append(sections[i].data);
+    }
+    Q_ASSERT(out.size() == size_t(offset));
+}
+
+quint32 DictContainer::checksum(const char *data, size_t len)
+{
+    struct Table
+    {
+        quint32 v[256];
+        Table()
+        {
+            for (quint32 i = 0; i < 256; i++)
+            {
+                quint32 c = i;
+                for (int k = 0; k < 8; k++) c = (c & 1)? 0xedb88320u ^ (c >> 1): c >> 1;
+                v[i] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    quint32 c = 0xffffffffu;
+    const unsigned char *p = (const unsigned char *) data;
+    for (size_t i = 0; i < len; i++) c = table.v[(c ^ p[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffffu;
+}
+
+NAMESPACEEND
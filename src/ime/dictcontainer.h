@@ -0,0 +1,117 @@
+#ifndef DICTCONTAINER_H
+#define DICTCONTAINER_H
+
+#include "dictdef.h"
+#include <string>
+#include <vector>
+
+NAMESPACEBEGIN
+
+class DictReader;
+class ThreadPool;
+
+/**
+ * v2 词库文件的容器格式。
+ *
+ * 旧格式是各段首尾相接、没有偏移表的字节流，只能按固定顺序从头解析。
+ * v2 在开头放一个定长的文件头和段表，每段单独记录位置、大小和校验和，
+ * 并从 64 字节对齐的位置开始，段内的数组再按元素类型对齐，加载时所有
+ * 数组都能直接映射，不必拷贝。各段的内容与旧格式中对应的部分相同，
+ * 只是在数组前多了对齐用的 0，由同一套加载函数读取（见 DictReader）。
+ *
+ * 布局（按本机字节序）：
+ * 文件头 64 字节：char[8] magic "EPYDICT\0", quint32 version,
+ * quint32 header_size, quint32 section_num, quint32 table_crc,
+ * quint64 file_size, quint32 header_crc（此前各字段的校验和）, 填充的 0；
+ * 紧接着是 section_num 项段表，每项 32 字节（见 DictSection）；
+ * 之后是各段的内容，按偏移升序排列，彼此不重叠，最后一段结束于文件末尾。
+ *
+ * 打开时只校验文件头和段表，不读取各段的内容，各段的校验和由 verify
+ * 单独校验（见 dicttool verify），以免加载时触碰整个文件。
+ */
+
+#define kDictContainerVersion 2
+// 文件头的字节数
+#define kDictContainerHeaderSize 64
+// 每段开始位置的对齐字节数
+#define kDictContainerAlign 64
+#define kDictContainerMaxSections 64
+
+// 各段的标识。前四段对应旧格式中的各部分，后两段为预编译的拼音树和
+// 节点列，与 dicttool compile-spl、compile-nodes 追加的内容相同
+#define kSectionSpelling "SPLS"
+#define kSectionList "LIST"
+#define kSectionTrie "DICT"
+#define kSectionNGram "NGRM"
+#define kSectionCompiledTrie "SPLT"
+#define kSectionCompiledNodes "LMAC"
+
+// 段表中的一项，32 字节
+struct DictSection
+{
+    char tag[4];
+    // 保留，目前为 0
+    quint32 flags;
+    quint64 offset;
+    quint64 size;
+    // 段内容的 CRC-32
+    quint32 crc;
+    quint32 reserved;
+};
+
+// 写入时一段的内容
+struct DictSectionData
+{
+    const char *tag;
+    std::string data;
+};
+
+class DictContainer
+{
+public:
+    DictContainer();
+
+    // data 是否以 v2 的 magic 开始，旧格式的词库返回 false
+    static bool isContainer(const char *data, qint64 size);
+    // 解析并校验文件头和段表，data 需在使用期间有效
+    bool open(const char *data, qint64 size);
+
+    inline int sectionNum() const;
+    inline const DictSection &section(int i) const;
+    // 标识为 tag 的段的序号，没有时为 -1
+    int find(const char *tag) const;
+    // 把 dr 的读取范围设为标识为 tag 的段。dr 须打开同一份数据
+    bool enter(DictReader &dr, const char *tag) const;
+    // 第 i 段的内容是否与其校验和相符，需要读取整段
+    bool verify(int i) const;
+
+    // 把旧格式的词库 data 转为 v2 格式写到 out，含预编译的两段。
+    // data 不是有效的旧格式词库时返回 false。pool 的含义同 write
+    static bool convert(const char *data, qint64 size, std::string &out,
+                        ThreadPool *pool = pNull);
+    // 按给定顺序写出 v2 文件到 out。pool 非空时各段的校验和并行计算
+    static void write(const std::vector<DictSectionData> &sections, std::string &out,
+                      ThreadPool *pool = pNull);
+    // CRC-32（IEEE 802.3 多项式），与 zlib 的 crc32 相同
+    static quint32 checksum(const char *data, size_t len);
+
+private:
+    const char *data_;
+    std::vector<DictSection> sections_;
+};
+
+
+int DictContainer::sectionNum() const
+{
+    return int(sections_.size());
+}
+
+const DictSection &DictContainer::section(int i) const
+{
+    Q_ASSERT(i >= 0 && i < sectionNum());
+    return sections_[size_t(i)];
+}
+
+NAMESPACEEND
+
+#endif // DICTCONTAINER_H
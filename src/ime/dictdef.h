@@ -1,10 +1,43 @@
 #ifndef DICTDEF
 #define DICTDEF
 
+#include <stddef.h>
+
 #define NAMESPACEBEGIN namespace IME {
 #define NAMESPACEEND }
 #define pNull NULL
 
+// 引擎核心不依赖 qt，只用到下面几个基本定义。在 qt 工程中直接使用 qt 的，
+// 单独编译核心库（CONFIG -= qt）时使用与之等价的定义。
+#ifdef QT_CORE_LIB
+#include <QtGlobal>
+#else
+#include <assert.h>
+
+typedef unsigned char quint8;
+typedef unsigned short quint16;
+typedef unsigned int quint32;
+typedef long long qint64;
+typedef unsigned long long quint64;
+
+#ifdef NDEBUG
+#define Q_ASSERT(cond) static_cast<void>(false && (cond))
+#else
+#define Q_ASSERT(cond) assert(cond)
+#endif
+#define Q_STATIC_ASSERT(cond) static_assert(cond, #cond)
+#if defined(__GNUC__) || defined(__clang__)
+#define Q_LIKELY(expr) __builtin_expect(!!(expr), true)
+#define Q_UNLIKELY(expr) __builtin_expect(!!(expr), false)
+#else
+#define Q_LIKELY(expr) (expr)
+#define Q_UNLIKELY(expr) (expr)
+#endif
+#define Q_DISABLE_COPY(Class) \
+    Class(const Class &) = delete; \
+    Class &operator=(const Class &) = delete;
+#endif
+
 
 #define kHalfSpellingIdNum 29
 #define kFullSplIdStart (kHalfSpellingIdNum + 1)
@@ -21,5 +54,48 @@
 #define kMaxSearchSteps 40
 #define kMaxRowNum kMaxSearchSteps
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+NAMESPACEBEGIN
+
+// x 中最低位的 1 的位置，x 不能为 0。GCC/clang 用内建函数，MSVC 用对应的
+// intrinsic，其他编译器逐位查找
+inline int lowestBit64(quint64 x)
+{
+    Q_ASSERT(0 != x);
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return int(i);
+#else
+    int i = 0;
+    for (; 0 == (x & 1); x >>= 1) i++;
+    return i;
+#endif
+}
+
+// x 中最高位的 1 的位置，即 floor(log2(x))，x 不能为 0
+inline int highestBit64(quint64 x)
+{
+    Q_ASSERT(0 != x);
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanReverse64(&i, x);
+    return int(i);
+#else
+    int i = 0;
+    for (; x > 1; x >>= 1) i++;
+    return i;
+#endif
+}
+
+NAMESPACEEND
+
 #endif // DICTDEF
 
@@ -0,0 +1,126 @@
+#include "dictionary.h"
+#include "dictreader.h"
+#include "dictcontainer.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "reverse.h"
+#include <string.h>
+
+NAMESPACEBEGIN
+
+// 当前位置是否为预编译段（拼音树或节点列）的开头，只比较 magic，位置不变
+static bool atCompiledSection(DictReader &fp)
+{
+    const qint64 pos = fp.pos();
+    char magic[4];
+    const bool b = fp.read(magic, 4) &&
+            (0 == memcmp(magic, kSectionCompiledTrie, 4) ||
+             0 == memcmp(magic, kSectionCompiledNodes, 4));
+    fp.seek(pos);
+    return b;
+}
+
+Dictionary::Dictionary(const char *dictfile, int options)
+{
+    dr = new DictReader;
+    st = new SpellingTrie;
+    dt = new DictTrie;
+    reverse_ = pNull;
+    valid_ = dr->open(dictfile) && load(options);
+}
+
+Dictionary::Dictionary(const char *data, qint64 size, int options)
+{
+    dr = new DictReader;
+    st = new SpellingTrie;
+    dt = new DictTrie;
+    reverse_ = pNull;
+    valid_ = dr->open(data, size) && load(options);
+}
+
+Dictionary::~Dictionary()
+{
+    delete reverse_;
+    delete dt;
+    delete st;
+    // 各词库对象中的视图引用 dr 的数据，最后释放
+    delete dr;
+}
+
+bool Dictionary::load(int options)
+{
+    const bool b = DictContainer::isContainer(dr->data(), dr->size())?
+                loadContainer(options): loadStream(options);
+    if (!b) return false;
+    if (0 != (options & kDictPackLemmas)) dt->packLemmas();
+    if (0 != (options & kDictSuccinctTrie)) dt->buildSuccinct();
+    return true;
+}
+
+bool Dictionary::loadStream(int options)
+{
+    bool b =
+            st->loadSplTrie(*dr) &&
+            dt->loadDictList(*dr) &&
+            dt->loadDictDict(*dr, st->getSpellingNum()) &&
+            dt->loadDictNGram(*dr);
+    if (!b) return false;
+
+    // 词库末尾可以附带预编译的拼音树和节点列（见 dicttool），顺序不限，
+    // 直接映射即可；没有或校验失败时仍现场构建。除此之外多出的字节视为
+    // 损坏，与 n-gram 段之后即为文件末尾的旧格式一样拒绝
+    while (!dr->atEnd())
+    {
+        const qint64 pos = dr->pos();
+        if (!st->isCompiled() && st->loadCompiledTrie(*dr)) continue;
+        dr->seek(pos);
+        if (!dt->isCompiled() && dt->loadCompiledNodes(*dr)) continue;
+        dr->seek(pos);
+        if (!atCompiledSection(*dr)) return false;
+        break;
+    }
+    // 简洁表示直接由节点建立，不需要列
+    if (!dt->isCompiled() && 0 == (options & kDictSuccinctTrie)) dt->buildNodeColumns();
+    return st->isCompiled() || st->buildSplTrie();
+}
+
+bool Dictionary::loadContainer(int options)
+{
+    DictContainer c;
+    if (!c.open(dr->data(), dr->size())) return false;
+
+    // 段内数组都已对齐，全部直接映射。段之间有依赖（词条树要用拼音数，
+    // 节点列要用词条树），按此顺序加载，与文件中的顺序无关；每段都须
+    // 恰好读完，多出或缺少的字节都视为损坏
+    dr->setAligned(true);
+    bool b =
+            c.enter(*dr, kSectionSpelling) && st->loadSplTrie(*dr) && dr->atEnd() &&
+            c.enter(*dr, kSectionList) && dt->loadDictList(*dr) && dr->atEnd() &&
+            c.enter(*dr, kSectionTrie) && dt->loadDictDict(*dr, st->getSpellingNum()) &&
+            dr->atEnd() &&
+            c.enter(*dr, kSectionNGram) && dt->loadDictNGram(*dr) && dr->atEnd();
+    if (b)
+    {
+        // 预编译的两段可选，没有或校验失败时现场构建
+        if (!(c.enter(*dr, kSectionCompiledNodes) && dt->loadCompiledNodes(*dr)) &&
+                0 == (options & kDictSuccinctTrie))
+        {
+            dt->buildNodeColumns();
+        }
+        if (!(c.enter(*dr, kSectionCompiledTrie) && st->loadCompiledTrie(*dr)))
+        {
+            b = st->buildSplTrie();
+        }
+    }
+    dr->resetWindow();
+    return b;
+}
+
+const ReverseIndex *Dictionary::reverseIndex() const
+{
+    Q_ASSERT(valid_);
+    std::call_once(reverse_once_, [this] { reverse_ = new ReverseIndex(this); });
+    return reverse_;
+}
+
+NAMESPACEEND
@@ -0,0 +1,87 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include "dictdef.h"
+#include <mutex>
+
+NAMESPACEBEGIN
+
+class DictReader;
+class SpellingTrie;
+class DictTrie;
+class ReverseIndex;
+
+// 加载词库的选项，可以组合
+enum DictOption
+{
+    // 词条文字压缩存放（见 lemmapack.h），随工程的词库约省 70KB 内存，
+    // 取文字稍慢，也不再有指向词库的视图。旧格式的词条文字未对齐，总是
+    // 拷贝一份，压缩后直接减少堆内存；v2 格式中文字直接映射，压缩反而
+    // 多占堆内存，只在映射的页也算作占用时（如数据编译进程序）才有意义
+    kDictPackLemmas = 0x1,
+    // 词条树使用简洁表示（见 loudstrie.h），随工程的词库查找时读取的数据
+    // 由 739KB 降到 210KB，逐键查找约慢 1.3 ~ 2 倍，候选词不变。
+    // 不再建立节点列：没有预编译节点列的旧格式词库默认要在加载时建立，
+    // 约占 550KB 堆内存
+    kDictSuccinctTrie = 0x2
+};
+
+/**
+ * 加载完成后只读的词库。
+ * 词库本身不保存任何查询状态，所有查询接口都是 const 的，因此一份词库
+ * 可以同时被多个线程中的多个 EPinyin 实例共享，每个实例只保留自己的输入状态。
+ * 词库需比使用它的所有实例存活更久。
+ */
+class Dictionary
+{
+    Q_DISABLE_COPY(Dictionary)
+public:
+    // 词库文件被映射到内存，多个进程共享同一份页缓存。
+    // 旧格式和 v2 格式（见 dictcontainer.h）都可以，按文件开头区分
+    // options 为 DictOption 的组合
+    Dictionary(const char *dictfile, int options = 0);
+    // 直接使用调用者提供的词库数据（如 QResource::data()），不做拷贝。
+    // 调用者需保证 data 在词库销毁前有效。
+    Dictionary(const char *data, qint64 size, int options = 0);
+    ~Dictionary();
+
+    inline bool isValid() const;
+    inline const SpellingTrie *spellingTrie() const;
+    inline const DictTrie *dictTrie() const;
+    // 汉字转拼音的索引，第一次调用时建立，之后只读，多个线程可同时调用
+    const ReverseIndex *reverseIndex() const;
+
+private:
+    bool load(int options);
+    // 旧格式的词库，各段依次存放
+    bool loadStream(int options);
+    // v2 格式的词库，见 dictcontainer.h
+    bool loadContainer(int options);
+
+    DictReader *dr;
+    SpellingTrie *st;
+    DictTrie *dt;
+    mutable ReverseIndex *reverse_;
+    mutable std::once_flag reverse_once_;
+    bool valid_;
+};
+
+
+bool Dictionary::isValid() const
+{
+    return valid_;
+}
+
+const SpellingTrie *Dictionary::spellingTrie() const
+{
+    return st;
+}
+
+const DictTrie *Dictionary::dictTrie() const
+{
+    return dt;
+}
+
+NAMESPACEEND
+
+#endif // DICTIONARY_H
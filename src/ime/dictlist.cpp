@@ -1,40 +1,48 @@
 #include "dictlist.h"
-#include <QFile>
 
 NAMESPACEBEGIN
 
-bool DictList::load(QFile &fp)
+DictList::DictList()
 {
-    if (fp.read((char *)&scis_num_, 4) != 4) return false;
-    if (fp.read((char *)&start_pos_, sizeof (start_pos_)) != sizeof (start_pos_)) return false;
-    if (fp.read((char *)&start_id_, sizeof (start_id_)) != sizeof (start_pos_)) return false;
-    buf_.resize(start_pos_[kMaxLemmaSize]);
-    scis_hz_.resize(scis_num_);
-    scis_splid_.resize(scis_num_);
-    int size = scis_num_ * 2;
-    if (fp.read((char *)scis_hz_.data(), size) != size) return false;
-    if (fp.read((char *)scis_splid_.data(), size) != size) return false;
-    size = start_pos_[kMaxLemmaSize] * 2;
-    if (fp.read((char *)buf_.data(), size) != size) return false;
+    pack_ = pNull;
+}
+
+DictList::~DictList()
+{
+    delete pack_;
+}
+
+bool DictList::load(DictReader &fp)
+{
+    if (!fp.read(&scis_num_, 4)) return false;
+    if (!fp.read(&start_pos_, sizeof (start_pos_))) return false;
+    if (!fp.read(&start_id_, sizeof (start_id_))) return false;
+    if (!fp.map(scis_hz_, scis_num_)) return false;
+    if (!fp.map(scis_splid_, scis_num_)) return false;
+    if (!fp.map(buf_, start_pos_[kMaxLemmaSize])) return false;
     return true;
 }
 
-QString DictList::getLemmaStr(quint32 id) const
+void DictList::pack()
+{
+    if (isPacked()) return;
+    pack_ = new LemmaPack;
+    pack_->build(this);
+    buf_.adopt(std::vector<quint16>());
+}
+
+size_t DictList::textMemory() const
+{
+    if (isPacked()) return pack_->memoryUsage();
+    return buf_.isCopied()? buf_.size() * sizeof (quint16): 0;
+}
+
+int DictList::getLemmaStr(quint32 id, char16_t *buf, int bufLen) const
 {
-    if (id < start_id_[kMaxLemmaSize])
-    {
-        // Find the range
-        for (int i = 0; i < kMaxLemmaSize; i++)
-        {
-            if (start_id_[i] <= id && start_id_[i + 1] > id)
-            {
-                size_t idSpan = id - start_id_[i];
-                const quint16 *buf = buf_.data() + start_pos_[i] + idSpan * (i + 1);
-                return QString::fromUtf16(buf, i + 1);
-            }
-        }
-    }
-    return QString();
+    const int len = getLemmaLen(id);
+    if (0 == len || len > bufLen) return 0;
+    copyLemma(id, len, buf);
+    return len;
 }
 
 NAMESPACEEND
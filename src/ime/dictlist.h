@@ -1,9 +1,8 @@
 #ifndef DICTLIST_H
 #define DICTLIST_H
 
-#include "dictdef.h"
-#include <QVector>
-class QFile;
+#include "dictreader.h"
+#include "lemmapack.h"
 
 NAMESPACEBEGIN
 
@@ -14,23 +13,93 @@ struct SpellingId {
 
 struct DictList
 {
+    Q_DISABLE_COPY(DictList)
+    DictList();
+    ~DictList();
+
     // Number of SingCharItem. The first is blank, because id 0 is invalid.
     quint32 scis_num_;
-    QVector<quint16> scis_hz_;
-    QVector<SpellingId> scis_splid_;
+    ConstArray<quint16> scis_hz_;
+    ConstArray<SpellingId> scis_splid_;
     // The large memory block to store the word list.
-    QVector<quint16> buf_;
+    ConstArray<quint16> buf_;
     // Starting position of those words whose lengths are i+1, counted in
     // char16
     quint32 start_pos_[kMaxLemmaSize + 1];
     quint32 start_id_[kMaxLemmaSize + 1];
+    // 压缩存放的文字，调用 pack 之前为空
+    LemmaPack *pack_;
 
-    bool load(QFile &fp);
-    // Get the hanzi string for the given id
-    QString getLemmaStr(quint32 id) const;
+    bool load(DictReader &fp);
+    // 把文字改为压缩存放（见 lemmapack.h）并释放 buf_，之后没有视图可取，
+    // getLemmaView 返回空指针，文字只能用 copyLemma 或 getLemmaStr 拷贝。
+    // 只在加载之后、开始查询之前调用。
+    void pack();
+    inline bool isPacked() const;
+    // 文字占用的内存，字节。buf_ 直接映射时不计
+    size_t textMemory() const;
+    // Copy the hanzi string for the given id into buf without allocating.
+    // Return the length, or 0 if the id is invalid or buf is too short.
+    int getLemmaStr(quint32 id, char16_t *buf, int bufLen) const;
 
+    // 词条长度，无效 id 返回 0
+    inline int getLemmaLen(quint32 id) const;
+    // 词条文字在 buf_ 中的只读视图，不做拷贝，词库存活期间有效。
+    // 无效 id 返回空指针，*len 为 0。
+    inline const char16_t *getLemmaView(quint32 id, int *len) const;
+    // 已知长度（如候选项的 lma_len）时直接定位
+    inline const char16_t *getLemmaView(quint32 id, int lmaLen) const;
+    // 把文字拷贝到 buf（至少 lmaLen 个），lmaLen 须是它的长度。压缩时同样可用
+    inline void copyLemma(quint32 id, int lmaLen, char16_t *buf) const;
+    // 词条在 buf_ 中的位置，即它之前所有词条的总字数。压缩时同样可用
+    inline size_t getLemmaPos(quint32 id, int lmaLen) const;
 };
 
+
+int DictList::getLemmaLen(quint32 id) const
+{
+    // start_id_ 递增，长度为 i + 1 的词条 id 落在 [start_id_[i], start_id_[i + 1])，
+    // 数一下不大于 id 的分界即可，固定次数的比较，没有分支
+    if (Q_UNLIKELY(id < start_id_[0] || id >= start_id_[kMaxLemmaSize])) return 0;
+    int len = 1;
+    for (int i = 1; i < kMaxLemmaSize; i++)
+    {
+        len += id >= start_id_[i];
+    }
+    return len;
+}
+
+bool DictList::isPacked() const
+{
+    return pNull != pack_;
+}
+
+const char16_t *DictList::getLemmaView(quint32 id, int *len) const
+{
+    *len = getLemmaLen(id);
+    return 0 == *len? pNull: getLemmaView(id, *len);
+}
+
+const char16_t *DictList::getLemmaView(quint32 id, int lmaLen) const
+{
+    if (Q_UNLIKELY(isPacked())) return pNull;
+    const quint16 *buf = buf_.data() + getLemmaPos(id, lmaLen);
+    return reinterpret_cast<const char16_t *>(buf);
+}
+
+void DictList::copyLemma(quint32 id, int lmaLen, char16_t *buf) const
+{
+    if (Q_UNLIKELY(isPacked())) pack_->decode(id, lmaLen, buf);
+    else memcpy(buf, getLemmaView(id, lmaLen), lmaLen * sizeof (char16_t));
+}
+
+size_t DictList::getLemmaPos(quint32 id, int lmaLen) const
+{
+    Q_ASSERT(lmaLen > 0 && lmaLen <= kMaxLemmaSize);
+    Q_ASSERT(id >= start_id_[lmaLen - 1] && id < start_id_[lmaLen]);
+    return start_pos_[lmaLen - 1] + size_t(id - start_id_[lmaLen - 1]) * lmaLen;
+}
+
 NAMESPACEEND
 
 #endif // DICTLIST_H
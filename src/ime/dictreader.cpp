@@ -0,0 +1,133 @@
+#include "dictreader.h"
+#include <stdio.h>
+
+// 能映射文件的平台，其他平台（如 Windows）整体读入
+#if defined(__unix__) || defined(__APPLE__)
+#define DICTREADER_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+NAMESPACEBEGIN
+
+DictReader::DictReader()
+{
+    map_ = pNull;
+    data_ = pNull;
+    size_ = 0;
+    pos_ = 0;
+    end_ = 0;
+    begin_ = 0;
+    aligned_ = false;
+    transcript_ = pNull;
+}
+
+DictReader::~DictReader()
+{
+    close();
+}
+
+bool DictReader::open(const char *dictfile)
+{
+    close();
+#ifdef DICTREADER_MMAP
+    const int fd = ::open(dictfile, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        // 映射在 close 时解除，文件描述符可以立即关闭
+        void *p = mmap(pNull, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (MAP_FAILED != p)
+        {
+            map_ = p;
+            data_ = (const char *) p;
+            size_ = st.st_size;
+        }
+    }
+    ::close(fd);
+    if (pNull != map_)
+    {
+        end_ = size_;
+        return true;
+    }
+#endif
+
+    // 不支持映射的平台或设备，退回到整体读入
+    FILE *f = fopen(dictfile, "rb");
+    if (pNull == f) return false;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof (chunk), f)) > 0) buf_.insert(buf_.end(), chunk, chunk + n);
+    const bool ok = !ferror(f);
+    fclose(f);
+    if (!ok)
+    {
+        close();
+        return false;
+    }
+    data_ = buf_.data();
+    size_ = qint64(buf_.size());
+    end_ = size_;
+    return true;
+}
+
+bool DictReader::open(const char *data, qint64 size)
+{
+    close();
+    if (pNull == data || size < 0) return false;
+    data_ = data;
+    size_ = size;
+    end_ = size;
+    return true;
+}
+
+void DictReader::close()
+{
+#ifdef DICTREADER_MMAP
+    if (pNull != map_) munmap(map_, size_t(size_));
+#endif
+    map_ = pNull;
+    std::vector<char>().swap(buf_);
+    data_ = pNull;
+    size_ = 0;
+    pos_ = 0;
+    end_ = 0;
+    begin_ = 0;
+    aligned_ = false;
+}
+
+bool DictReader::read(void *buf, qint64 len)
+{
+    if (len < 0 || len > end_ - pos_) return false;
+    memcpy(buf, data_ + pos_, size_t(len));
+    if (pNull != transcript_) transcript_->append(data_ + pos_, size_t(len));
+    pos_ += len;
+    return true;
+}
+
+bool DictReader::seek(qint64 pos)
+{
+    if (pos < begin_ || pos > end_) return false;
+    pos_ = pos;
+    return true;
+}
+
+bool DictReader::setWindow(qint64 begin, qint64 end)
+{
+    if (begin < 0 || begin > end || end > size_) return false;
+    begin_ = begin;
+    end_ = end;
+    pos_ = begin;
+    return true;
+}
+
+void DictReader::resetWindow()
+{
+    begin_ = 0;
+    end_ = size_;
+}
+
+NAMESPACEEND
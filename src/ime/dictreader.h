@@ -0,0 +1,187 @@
+#ifndef DICTREADER_H
+#define DICTREADER_H
+
+#include "dictdef.h"
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+NAMESPACEBEGIN
+
+class DictReader;
+
+/**
+ * 词库数组的只读视图。
+ * 数据通常直接指向映射的词库文件或调用者提供的内存，多进程间通过页缓存共享；
+ * 只有当源数据未按元素类型对齐时，才拷贝一份由自己持有。
+ */
+template <typename T>
+class ConstArray
+{
+    const T *data_;
+    int size_;
+    std::vector<T> copy_;
+    friend class DictReader;
+public:
+    inline ConstArray() : data_(pNull), size_(0) { }
+
+    inline const T *data() const { return data_; }
+    inline const T *constData() const { return data_; }
+    inline int size() const { return size_; }
+    inline bool isEmpty() const { return 0 == size_; }
+    // 是否为拷贝，false 表示直接引用源数据
+    inline bool isCopied() const { return !copy_.empty(); }
+
+    inline const T &operator [](int i) const
+    {
+        Q_ASSERT(i >= 0 && i < size_);
+        return data_[i];
+    }
+    inline const T &at(int i) const { return (*this)[i]; }
+
+    // 改为使用自己构建的数据，传入右值时不拷贝
+    inline void adopt(std::vector<T> v)
+    {
+        copy_.swap(v);
+        data_ = copy_.data();
+        size_ = int(copy_.size());
+    }
+};
+
+/**
+ * 词库数据源。
+ * 按文件中的顺序依次读取各段，定长的头部拷贝出来，大块数组则以 ConstArray
+ * 视图的形式映射，避免每个进程都在堆上复制一份完整的词库。
+ *
+ * v2 词库（见 dictcontainer.h）中每段单独读取：setWindow 把读取限制在段内，
+ * 对齐模式下 map 先跳到数组元素类型的对齐位置，各数组都能直接映射。
+ */
+class DictReader
+{
+    Q_DISABLE_COPY(DictReader)
+public:
+    DictReader();
+    ~DictReader();
+
+    // 打开词库文件。能映射时直接映射，否则整体读入内存。
+    // qt 资源等非普通文件由调用者读出后使用下面的重载。
+    bool open(const char *dictfile);
+    // 使用调用者提供的内存，如 QResource::data()。
+    // 调用者需保证该内存在词库使用期间有效。
+    bool open(const char *data, qint64 size);
+    void close();
+
+    // 从当前位置拷贝 len 字节到 buf
+    bool read(void *buf, qint64 len);
+    // 将当前位置开始的 num 个元素以只读视图的形式交给 arr
+    template <typename T>
+    bool map(ConstArray<T> &arr, qint64 num);
+    // 回到之前的位置，用于尝试读取可选的段失败后
+    bool seek(qint64 pos);
+
+    // 之后的读取限制在 [begin, end) 内，并从 begin 开始
+    bool setWindow(qint64 begin, qint64 end);
+    // 取消读取范围的限制，位置不变
+    void resetWindow();
+    // 打开后 map 在映射前先对齐到元素类型的边界，跳过的字节由写入方填充
+    inline void setAligned(bool aligned);
+    // 把读到的内容按对齐模式的布局依次追加到 out，out 为空时不记录。
+    // 用于把旧格式的各段原样转写为 v2 的段（见 dicttool）
+    inline void setTranscript(std::string *out);
+
+    // 已到达读取范围的末尾
+    inline bool atEnd() const;
+    // 当前位置，即已读取的字节数
+    inline qint64 pos() const;
+    // 数据是否来自映射或外部内存（而非读入的堆拷贝）
+    inline bool isMapped() const;
+    // 整份数据，不受读取范围的限制
+    inline const char *data() const;
+    inline qint64 size() const;
+
+private:
+    // 映射的区域，未映射时为空
+    void *map_;
+    // 无法映射时读入的整份数据
+    std::vector<char> buf_;
+    const char *data_;
+    qint64 size_;
+    qint64 pos_;
+    // 读取范围的末尾，默认为 size_
+    qint64 end_;
+    qint64 begin_;
+    bool aligned_;
+    std::string *transcript_;
+};
+
+
+template <typename T>
+bool DictReader::map(ConstArray<T> &arr, qint64 num)
+{
+    const qint64 len = num * qint64(sizeof(T));
+    const qint64 pad = aligned_? -pos_ & qint64(alignof(T) - 1): 0;
+    if (num < 0 || len > end_ - pos_ - pad) return false;
+
+    if (pNull != transcript_)
+    {
+        transcript_->append(-transcript_->size() & (alignof(T) - 1), '\0');
+        transcript_->append(data_ + pos_ + pad, size_t(len));
+    }
+    pos_ += pad;
+    const char *p = data_ + pos_;
+    if (uintptr_t(p) % alignof(T) == 0)
+    {
+        arr.copy_.clear();
+        arr.data_ = reinterpret_cast<const T *>(p);
+    }
+    else
+    {
+        // 旧格式的各段没有对齐，只能拷贝出来
+        arr.copy_.resize(size_t(num));
+        memcpy(arr.copy_.data(), p, size_t(len));
+        arr.data_ = arr.copy_.data();
+    }
+    arr.size_ = int(num);
+    pos_ += len;
+    return true;
+}
+
+void DictReader::setAligned(bool aligned)
+{
+    aligned_ = aligned;
+}
+
+void DictReader::setTranscript(std::string *out)
+{
+    transcript_ = out;
+}
+
+bool DictReader::atEnd() const
+{
+    return pos_ >= end_;
+}
+
+qint64 DictReader::pos() const
+{
+    return pos_;
+}
+
+bool DictReader::isMapped() const
+{
+    return pNull != data_ && buf_.empty();
+}
+
+const char *DictReader::data() const
+{
+    return data_;
+}
+
+qint64 DictReader::size() const
+{
+    return size_;
+}
+
+NAMESPACEEND
+
+#endif // DICTREADER_H
@@ -2,240 +2,408 @@
 #include "dictlist.h"
 #include "candidates.h"
 #include "spellingtrie.h"
-#include <QFile>
+#include "splrange.h"
+#include "deadline.h"
+#include "stats.h"
+#include "loudstrie.h"
+#include <algorithm>
 
 NAMESPACEBEGIN
 
+// Magic and version of the compiled node columns section
+static const char kCompiledNodesMagic[4] = { 'L', 'M', 'A', 'C' };
+#define kCompiledNodesVersion 1
+
+/**
+ * 默认的表示：第 0 层的节点是 root_ 中的下标，其余是 nodes_ge1_ 各列的下标。
+ * level 为节点所在的层。
+ */
+struct DictTrie::ColumnNodes
+{
+    const DictTrie *dt;
+
+    inline quint16 splIdx(int level, quint32 node) const
+    {
+        return 0 == level? dt->root_.data()[node].spl_idx: dt->ge1_spl_idx_.data()[node];
+    }
+    // 子节点在下一层中的起点和个数
+    inline void sons(int level, quint32 node, size_t *first, size_t *num) const
+    {
+        if (0 == level)
+        {
+            *first = dt->root_.data()[node].son_1st_off;
+            *num = dt->root_.data()[node].num_of_son;
+        }
+        else
+        {
+            *first = dt->ge1_son_off_.data()[node];
+            *num = dt->ge1_son_num_.data()[node];
+        }
+    }
+    inline void homos(int level, quint32 node, size_t *off, size_t *num) const
+    {
+        if (0 == level)
+        {
+            *off = dt->root_.data()[node].homo_idx_buf_off;
+            *num = dt->root_.data()[node].num_of_homo;
+        }
+        else
+        {
+            *off = dt->ge1_homo_off_.data()[node];
+            *num = dt->ge1_homo_num_.data()[node];
+        }
+    }
+    inline size_t splRange(size_t first, size_t num, quint16 idStart, quint16 idEnd,
+                           size_t *last) const
+    {
+        return IME::splRange(dt->ge1_spl_idx_.data() + first, num, idStart, idEnd, last);
+    }
+    inline quint32 lemmaId(size_t off) const
+    {
+        return dt->getLemmaId(off);
+    }
+};
+
+/**
+ * 简洁表示，节点编号不分层，level 不使用。
+ */
+struct DictTrie::SuccinctNodes
+{
+    const LoudsTrie *louds;
+
+    inline quint16 splIdx(int, quint32 node) const
+    {
+        return louds->splIdx(node);
+    }
+    inline void sons(int, quint32 node, size_t *first, size_t *num) const
+    {
+        louds->sons(node, first, num);
+    }
+    inline void homos(int, quint32 node, size_t *off, size_t *num) const
+    {
+        louds->homos(node, off, num);
+    }
+    inline size_t splRange(size_t first, size_t num, quint16 idStart, quint16 idEnd,
+                           size_t *last) const
+    {
+        return louds->splRange(first, num, idStart, idEnd, last);
+    }
+    inline quint32 lemmaId(size_t off) const
+    {
+        return louds->lemmaId(off);
+    }
+};
+
 DictTrie::DictTrie()
 {
+    compiled_ = false;
+    louds_ = pNull;
     dictlist = new DictList;
     ngram = new NGram;
 }
 
 DictTrie::~DictTrie()
 {
+    delete louds_;
     delete ngram;
     delete dictlist;
 }
 
-int DictTrie::getLpis(
+int DictTrie::extendFrontier(
         const quint16 *splidStr,
-        int splidStrLen,
-        Candidates *candidates,
-        const SpellingTrie *st) const
+        int depth,
+        LmaFrontier *frontier,
+        const SpellingTrie *st,
+        const Deadline *deadline) const
+{
+    if (isSuccinct())
+    {
+        const SuccinctNodes trie = { louds_ };
+        return extendFrontier(trie, splidStr, depth, frontier, st, deadline);
+    }
+    const ColumnNodes trie = { this };
+    return extendFrontier(trie, splidStr, depth, frontier, st, deadline);
+}
+
+template <class Nodes>
+int DictTrie::extendFrontier(
+        const Nodes &trie,
+        const quint16 *splidStr,
+        int depth,
+        LmaFrontier *frontier,
+        const SpellingTrie *st,
+        const Deadline *deadline) const
 {
-    if (splidStrLen > kMaxLemmaSize)
-        return 0;
-
-#define MAX_EXTENDBUF_LEN 200
-    const void* nodeBuf1[MAX_EXTENDBUF_LEN];  // use size_t for data alignment
-    const void* nodeBuf2[MAX_EXTENDBUF_LEN];
-    // Nodes from.
-    const LmaNodeLE0** nodeFrLe0 =
-            reinterpret_cast<const LmaNodeLE0**>(nodeBuf1);
-    // Nodes to.
-    const LmaNodeLE0** nodeToLe0 =
-            reinterpret_cast<const LmaNodeLE0**>(nodeBuf2);
-    const LmaNodeGE1** nodeFrGe1 = pNull;
-    const LmaNodeGE1** nodeToGe1 = pNull;
-    size_t nodeFrNum = 1;
-    size_t nodeToNum = 0;
-    const LmaNodeLE0 * const root = root_.data();
-    const LmaNodeGE1 * const nodes_ge1 = nodes_ge1_.data();
-    nodeFrLe0[0] = root;
-    if (pNull == nodeFrLe0[0]) return 0;
+    Q_ASSERT(depth <= kMaxLemmaSize);
 
+    // Keep the levels whose spelling ids are not changed.
     int splPos = 0;
+    while (splPos < frontier->depth && splPos < depth &&
+           frontier->spl_ids[splPos] == splidStr[splPos])
+    {
+        splPos++;
+    }
+    // Once a level is empty, the deeper levels are empty too.
+    if (splPos > 0 && 0 == frontier->node_num[splPos - 1])
+    {
+        frontier->depth = std::max(splPos, depth);
+        for (int i = splPos; i < frontier->depth; i++)
+        {
+            frontier->spl_ids[i] = splidStr[i];
+            frontier->node_num[i] = 0;
+            frontier->node_start[i] = frontier->node_start[splPos - 1];
+        }
+        return depth;
+    }
+
+    // 每次至少展开一层，之后才检查截止时间
+    const int firstPos = splPos;
 
-    while (splPos < splidStrLen)
+    for (; splPos < depth; splPos++)
     {
-        quint16 idNum = 1;
-        quint16 idStart = splidStr[splPos];
-        // If it is a half id
-        if (SpellingTrie::isHalfId(splidStr[splPos]))
+        if (pNull != deadline && splPos > firstPos && deadline->expired())
         {
-            idNum = st->halfToFull(splidStr[splPos], &idStart);
-            Q_ASSERT(idNum > 0);
+            frontier->depth = splPos;
+            return splPos;
         }
 
+        // 这一层可以匹配的全拼 id，精确匹配时只有一段
+        SplIdRange exact;
+        const SplIdRange *ranges;
+        const int rangeNum = st->matchRanges(splidStr[splPos], frontier->fuzzy, &exact, &ranges);
+
+        // The new level is appended right after the previous one.
+        const size_t frStart = splPos > 0? frontier->node_start[splPos - 1]: 0;
+        const size_t nodeFrNum = splPos > 0? frontier->node_num[splPos - 1]: 1;
+        const size_t toStart = splPos > 0? frStart + nodeFrNum: 0;
+        size_t nodeToNum = 0;
+
         // Extend the nodes
         if (0 == splPos) // From LmaNodeLE0 (root) to LmaNodeLE0 nodes
         {
-            for (size_t nodeFrPos = 0; nodeFrPos < nodeFrNum; nodeFrPos++)
+            for (int r = 0; r < rangeNum; r++)
             {
-                size_t sonStart = splid_le0_index_[idStart - kFullSplIdStart];
-                size_t sonEnd = splid_le0_index_[idStart + idNum - kFullSplIdStart];
+                const quint16 idEnd = ranges[r].end;
+                size_t sonStart = splid_le0_index_[ranges[r].start - kFullSplIdStart];
+                size_t sonEnd = splid_le0_index_[idEnd - kFullSplIdStart];
+                quint32 *nodeTo = frontier->reserve(nodeToNum + sonEnd - sonStart);
                 for (size_t sonPos = sonStart; sonPos < sonEnd; sonPos++)
                 {
-                    const LmaNodeLE0 *nodeSon = root + sonPos;
-                    if (nodeToNum < MAX_EXTENDBUF_LEN)
-                    {
-                        nodeToLe0[nodeToNum++] = nodeSon;
-                    }
-                    // id_start + id_num - 1 is the last one, which has just been
-                    // recorded.
-                    if (nodeSon->spl_idx >= idStart + idNum - 1)
+                    nodeTo[nodeToNum++] = quint32(sonPos);
+                    // idEnd - 1 is the last one, which has just been recorded.
+                    if (trie.splIdx(0, quint32(sonPos)) >= idEnd - 1)
                     {
                         break;
                     }
                 }
             }
-            splPos++;
-            if (splPos >= splidStrLen || nodeToNum == 0)
-            {
-                break;
-            }
-            // Prepare the nodes for next extending
-            // next time, from LmaNodeLE0 to LmaNodeGE1
-            const LmaNodeLE0** nodeTmp = nodeFrLe0;
-            nodeFrLe0 = nodeToLe0;
-            nodeToLe0 = pNull;
-            nodeToGe1 = reinterpret_cast<const LmaNodeGE1**>(nodeTmp);
         }
-        else if (1 == splPos) // From LmaNodeLE0 to LmaNodeGE1 nodes
+        else // From LmaNodeLE0 to LmaNodeGE1 nodes, or between LmaNodeGE1 nodes
         {
             for (size_t nodeFrPos = 0; nodeFrPos < nodeFrNum; nodeFrPos++)
             {
-                const LmaNodeLE0 *node = nodeFrLe0[nodeFrPos];
-                for (size_t sonPos = 0; sonPos < size_t(node->num_of_son); sonPos++)
+                if (pNull != deadline && splPos > firstPos && 0 == (nodeFrPos + 1) % kDeadlineStride &&
+                        deadline->expired())
                 {
-                    const LmaNodeGE1 *nodeSon = nodes_ge1_.data() + node->son_1st_off + sonPos;
-                    if (nodeSon->spl_idx >= idStart && nodeSon->spl_idx < idStart + idNum)
-                    {
-                        if (nodeToNum < MAX_EXTENDBUF_LEN)
-                        {
-                            nodeToGe1[nodeToNum++] = nodeSon;
-                        }
-                    }
-                    // id_start + id_num - 1 is the last one, which has just been
-                    // recorded.
-                    if (nodeSon->spl_idx >= idStart + idNum - 1)
-                    {
-                        break;
-                    }
+                    // 这一层只展开了一部分，不保留
+                    frontier->depth = splPos;
+                    return splPos;
                 }
-            }
-            splPos++;
-            if (splPos >= splidStrLen || nodeToNum == 0)
-            {
-                break;
-            }
-            // Prepare the nodes for next extending
-            // next time, from LmaNodeGE1 to LmaNodeGE1
-            nodeFrGe1 = nodeToGe1;
-            nodeToGe1 = reinterpret_cast<const LmaNodeGE1**>(nodeFrLe0);
-            nodeFrLe0 = pNull;
-            nodeToLe0 = pNull;
-        }
-        else // From LmaNodeGE1 to LmaNodeGE1 nodes
-        {
-            for (size_t nodeFrPos = 0; nodeFrPos < nodeFrNum; nodeFrPos++)
-            {
-                const LmaNodeGE1 *node = nodeFrGe1[nodeFrPos];
-                for (size_t sonPos = 0; sonPos < size_t (node->num_of_son); sonPos++)
+                const quint32 nodeFrom = frontier->nodes(splPos - 1)[nodeFrPos];
+                size_t sonOff, sonNum;
+                trie.sons(splPos - 1, nodeFrom, &sonOff, &sonNum);
+                // The sons are sorted by spl_idx, so the matched ones are a
+                // contiguous range for each id range.
+                for (int r = 0; r < rangeNum; r++)
                 {
-                    const LmaNodeGE1 *nodeSon = nodes_ge1 + getSonOffset(node) + sonPos;
-                    if (nodeSon->spl_idx >= idStart && nodeSon->spl_idx < idStart + idNum)
+                    size_t last;
+                    size_t first = trie.splRange(sonOff, sonNum, ranges[r].start,
+                                                 ranges[r].end, &last);
+                    if (first == last) continue;
+                    quint32 *nodeTo = frontier->reserve(toStart + nodeToNum + last - first) + toStart;
+                    for (; first < last; first++)
                     {
-                        if (nodeToNum < MAX_EXTENDBUF_LEN)
-                        {
-                            nodeToGe1[nodeToNum++] = nodeSon;
-                        }
-                    }
-                    // id_start + id_num - 1 is the last one, which has just been
-                    // recorded.
-                    if (nodeSon->spl_idx >= idStart + idNum - 1)
-                    {
-                        break;
+                        nodeTo[nodeToNum++] = quint32(sonOff + first);
                     }
                 }
             }
-            splPos++;
-            if (splPos >= splidStrLen || nodeToNum == 0)
+        }
+
+        frontier->spl_ids[splPos] = splidStr[splPos];
+        frontier->node_num[splPos] = quint32(nodeToNum);
+        frontier->node_start[splPos] = quint32(toStart);
+        frontier->depth = splPos + 1;
+        if (nodeToNum > MAX_EXTENDBUF_LEN) frontier->overflow_count++;
+        frontier->peak_nodes = std::max(frontier->peak_nodes, quint32(nodeToNum));
+        if (0 == nodeToNum)
+        {
+            // Nothing to extend, mark the remaining levels as empty.
+            for (int i = splPos + 1; i < depth; i++)
             {
-                break;
+                frontier->spl_ids[i] = splidStr[i];
+                frontier->node_num[i] = 0;
+                frontier->node_start[i] = quint32(toStart);
             }
-            // Prepare the nodes for next extending
-            // next time, from LmaNodeGE1 to LmaNodeGE1
-            const LmaNodeGE1 **nodeTmp = nodeFrGe1;
-            nodeFrGe1 = nodeToGe1;
-            nodeToGe1 = nodeTmp;
+            frontier->depth = depth;
+            break;
         }
+    }
+    return depth;
+}
+
+void LmaFrontier::grow(size_t end)
+{
+    // 正在展开的层可能已写入一部分，整块保留。离开内置数组只有一次。
+    const size_t capacity = std::max(end, capacity_ * 2);
+    heap_.resize(capacity);
+    if (buf_ == inline_) memcpy(heap_.data(), inline_, sizeof (inline_));
+    buf_ = heap_.data();
+    capacity_ = capacity;
+}
+
+void LmaFrontier::copyFrom(const LmaFrontier &other)
+{
+    depth = other.depth;
+    const size_t used = depth > 0? other.node_start[depth - 1] + other.node_num[depth - 1]: 0;
+    quint32 *buf = reserve(used);
+    memcpy(spl_ids, other.spl_ids, sizeof (quint16) * depth);
+    memcpy(node_num, other.node_num, sizeof (quint32) * depth);
+    memcpy(node_start, other.node_start, sizeof (quint32) * depth);
+    memcpy(buf, other.buf_, sizeof (quint32) * used);
+}
 
-        // The number of node for next extending
-        nodeFrNum = nodeToNum;
-        nodeToNum = 0;
+bool DictTrie::getLpis(
+        const LmaFrontier *frontier,
+        int lmaLen,
+        const quint16 *splidStr,
+        Candidates *candidates,
+        const SpellingTrie *st,
+        const Deadline *deadline) const
+{
+    if (isSuccinct())
+    {
+        const SuccinctNodes trie = { louds_ };
+        return getLpis(trie, frontier, lmaLen, splidStr, candidates, st, deadline);
     }
+    const ColumnNodes trie = { this };
+    return getLpis(trie, frontier, lmaLen, splidStr, candidates, st, deadline);
+}
 
-    if (0 == nodeToNum) return 0;
+template <class Nodes>
+bool DictTrie::getLpis(
+        const Nodes &trie,
+        const LmaFrontier *frontier,
+        int lmaLen,
+        const quint16 *splidStr,
+        Candidates *candidates,
+        const SpellingTrie *st,
+        const Deadline *deadline) const
+{
+    Q_ASSERT(lmaLen > 0 && lmaLen <= frontier->depth);
+    size_t nodeNum = frontier->node_num[lmaLen - 1];
+    const quint32 *nodes = frontier->nodes(lmaLen - 1);
+    if (0 == nodeNum) return true;
 
     // If the length is 1, and the splid is a one-char Yunmu like 'a', 'o', 'e',
     // only those candidates for the full matched one-char id will be returned.
-    if (1 == splidStrLen && st->isHalfIdYunmu(splidStr[0]))
+    if (1 == lmaLen && st->isHalfIdYunmu(splidStr[0]))
     {
-        nodeToNum = nodeToNum > 0 ? 1 : 0;
+        nodeNum = 1;
     }
     LmaPsbItem item;
-    for (size_t nodePos = 0; nodePos < nodeToNum; nodePos++)
+    for (size_t nodePos = 0; nodePos < nodeNum; nodePos++)
     {
-        size_t numOfHomo = 0;
-        if (splPos <= 1) // Get from LmaNodeLE0 nodes
+        if (pNull != deadline && 0 == (nodePos + 1) % kDeadlineStride && deadline->expired())
         {
-            const LmaNodeLE0* nodeLe0 = nodeToLe0[nodePos];
-            numOfHomo = nodeLe0->num_of_homo;
-            for (size_t homoPos = 0; homoPos < numOfHomo; homoPos++)
-            {
-                item.id = getLemmaId(nodeLe0->homo_idx_buf_off + homoPos);
-                item.lma_len = 1;
-                item.psb = ngram->getUniPSB(item.id);
-                candidates->append(item);
-                if (candidates->isFull()) break;
-            }
+            return false;
+        }
+        // 第 0 层从 LmaNodeLE0 取，之后从 LmaNodeGE1 取
+        size_t homoOff, numOfHomo;
+        trie.homos(lmaLen - 1, nodes[nodePos], &homoOff, &numOfHomo);
+        for (size_t homoPos = 0; homoPos < numOfHomo; homoPos++)
+        {
+            item.id = trie.lemmaId(homoOff + homoPos);
+            item.lma_len = quint16 (lmaLen);
+            item.psb = ngram->getUniPSB(item.id);
+            candidates->append(item);
+            if (candidates->isFull()) break;
         }
-        else // Get from LmaNodeGE1 nodes
+        if (candidates->isFull()) break;
+    }
+    return true;
+}
+
+bool DictTrie::getBestLemmas(const quint16 *splidStr, int depth, LmaFrontier *frontier,
+                             const SpellingTrie *st, LmaPsbItem *best,
+                             const Deadline *deadline) const
+{
+    Q_ASSERT(depth > 0 && depth <= kMaxLemmaSize);
+    if (extendFrontier(splidStr, depth, frontier, st, deadline) < depth) return false;
+    if (isSuccinct())
+    {
+        const SuccinctNodes trie = { louds_ };
+        getBestLemmas(trie, frontier, depth, splidStr, st, best);
+    }
+    else
+    {
+        const ColumnNodes trie = { this };
+        getBestLemmas(trie, frontier, depth, splidStr, st, best);
+    }
+    return true;
+}
+
+template <class Nodes>
+void DictTrie::getBestLemmas(const Nodes &trie, const LmaFrontier *frontier, int depth,
+                             const quint16 *splidStr, const SpellingTrie *st,
+                             LmaPsbItem *best) const
+{
+    for (int lmaLen = 1; lmaLen <= depth; lmaLen++)
+    {
+        LmaPsbItem &b = best[lmaLen - 1];
+        b.lma_len = 0;
+        size_t nodeNum = frontier->node_num[lmaLen - 1];
+        const quint32 *nodes = frontier->nodes(lmaLen - 1);
+        // Same as getLpis for a one-char Yunmu.
+        if (1 == lmaLen && nodeNum > 1 && st->isHalfIdYunmu(splidStr[0])) nodeNum = 1;
+        for (size_t nodePos = 0; nodePos < nodeNum; nodePos++)
         {
-            const LmaNodeGE1* nodeGe1 = nodeToGe1[nodePos];
-            numOfHomo = nodeGe1->num_of_homo;
-            for (size_t homoPos = 0; homoPos < numOfHomo; homoPos++)
+            size_t homoOff, homoNum;
+            trie.homos(lmaLen - 1, nodes[nodePos], &homoOff, &homoNum);
+            for (size_t homoPos = 0; homoPos < homoNum; homoPos++)
             {
-                size_t nodeHomoOff = getHomoIdxBufOffset(nodeGe1);
-                item.id = getLemmaId(nodeHomoOff + homoPos);
-                item.lma_len = quint16 (splidStrLen);
-                item.psb = ngram->getUniPSB(item.id);
-                candidates->append(item);
-                if (candidates->isFull()) break;
+                const quint32 id = trie.lemmaId(homoOff + homoPos);
+                const LmaScoreType psb = ngram->getUniPSB(id);
+                if (0 == b.lma_len || psb < b.psb || (psb == b.psb && id < b.id))
+                {
+                    b.id = id;
+                    b.psb = psb;
+                    b.lma_len = quint16(lmaLen);
+                }
             }
         }
-        if (candidates->isFull()) break;
     }
-    return candidates->size();
 }
 
-bool DictTrie::loadDictDict(QFile &fp, int spellingNum)
+bool DictTrie::loadDictDict(DictReader &fp, int spellingNum)
 {
     int lma_node_num_le0_;
     int lma_node_num_ge1_;
     int lma_idx_buf_len_;  // The total size of lma_idx_buf_ in byte.
     int top_lmas_num_;     // Number of lemma with highest scores.
-    if (fp.read((char *)&lma_node_num_le0_, 4) != 4) return false;
-    if (fp.read((char *)&lma_node_num_ge1_, 4) != 4) return false;
-    if (fp.read((char *)&lma_idx_buf_len_, 4) != 4) return false;
-    if (fp.read((char *)&top_lmas_num_, 4) != 4) return false;
-
-    root_.resize(lma_node_num_le0_);
-    nodes_ge1_.resize(lma_node_num_ge1_);
-    lma_idx_buf_.resize(lma_idx_buf_len_);
+    if (!fp.read(&lma_node_num_le0_, 4)) return false;
+    if (!fp.read(&lma_node_num_ge1_, 4)) return false;
+    if (!fp.read(&lma_idx_buf_len_, 4)) return false;
+    if (!fp.read(&top_lmas_num_, 4)) return false;
+
     int buf_size = spellingNum + 1;
     splid_le0_index_.resize(buf_size);
 
     //    parsing_marks_ = new ParsingMark[kMaxParsingMark];
     //    mile_stones_ = new MileStone[kMaxMileStone];
 
-    int size = sizeof(LmaNodeLE0) * root_.size();
-    if (fp.read((char *)root_.data(), size) != size) return false;
-    size = sizeof(LmaNodeGE1) * nodes_ge1_.size();
-    if (fp.read((char *)nodes_ge1_.data(), size) != size) return false;
-    if (fp.read(lma_idx_buf_.data(), lma_idx_buf_.size()) != lma_idx_buf_.size()) return false;
+    if (!fp.map(root_, lma_node_num_le0_)) return false;
+    if (!fp.map(nodes_ge1_, lma_node_num_ge1_)) return false;
+    if (!fp.map(lma_idx_buf_, lma_idx_buf_len_)) return false;
 
     // The quick index for the first level sons
     quint16 last_splid = kFullSplIdStart;
@@ -261,7 +429,84 @@ bool DictTrie::loadDictDict(QFile &fp, int spellingNum)
     return true;
 }
 
-bool DictTrie::loadDictList(QFile &fp)
+void DictTrie::buildNodeColumns()
+{
+    const int nodeNum = nodes_ge1_.size();
+    std::vector<quint32> sonOff(nodeNum), homoOff(nodeNum);
+    std::vector<quint16> splIdx(nodeNum);
+    std::vector<quint8> sonNum(nodeNum), homoNum(nodeNum);
+    for (int i = 0; i < nodeNum; i++)
+    {
+        const LmaNodeGE1 *node = nodes_ge1_.data() + i;
+        sonOff[i] = quint32(getSonOffset(node));
+        homoOff[i] = quint32(getHomoIdxBufOffset(node));
+        splIdx[i] = node->spl_idx;
+        sonNum[i] = node->num_of_son;
+        homoNum[i] = node->num_of_homo;
+    }
+    ge1_son_off_.adopt(std::move(sonOff));
+    ge1_homo_off_.adopt(std::move(homoOff));
+    ge1_spl_idx_.adopt(std::move(splIdx));
+    ge1_son_num_.adopt(std::move(sonNum));
+    ge1_homo_num_.adopt(std::move(homoNum));
+    compiled_ = false;
+}
+
+/**
+ * 预编译节点列段的布局（与词库其他部分一样按本机字节序）：
+ * char[4] magic "LMAC", quint32 version, quint32 node_num, quint32 pad,
+ * pad 个 0 使之后的数组在文件中按 4 字节对齐,
+ * quint32 son_off[node_num], quint32 homo_off[node_num],
+ * quint16 spl_idx[node_num], quint8 son_num[node_num], quint8 homo_num[node_num]
+ */
+void DictTrie::saveCompiledNodes(std::string &buf) const
+{
+    const quint32 version = kCompiledNodesVersion;
+    const quint32 nodeNum = quint32(nodes_ge1_.size());
+    const quint32 pad = quint32(-(buf.size() + 16) & 3);
+    buf.append(kCompiledNodesMagic, 4);
+    buf.append((const char *)&version, 4);
+    buf.append((const char *)&nodeNum, 4);
+    buf.append((const char *)&pad, 4);
+    buf.append(pad, '\0');
+    buf.append((const char *)ge1_son_off_.data(), sizeof (quint32) * nodeNum);
+    buf.append((const char *)ge1_homo_off_.data(), sizeof (quint32) * nodeNum);
+    buf.append((const char *)ge1_spl_idx_.data(), sizeof (quint16) * nodeNum);
+    buf.append((const char *)ge1_son_num_.data(), nodeNum);
+    buf.append((const char *)ge1_homo_num_.data(), nodeNum);
+}
+
+bool DictTrie::loadCompiledNodes(DictReader &fp)
+{
+    char magic[4];
+    quint32 version;
+    quint32 nodeNum;
+    quint32 pad;
+    char zeros[4];
+    if (!fp.read(magic, 4) || memcmp(magic, kCompiledNodesMagic, 4) != 0) return false;
+    if (!fp.read(&version, 4) || version != kCompiledNodesVersion) return false;
+    if (!fp.read(&nodeNum, 4) || nodeNum != quint32(nodes_ge1_.size())) return false;
+    if (!fp.read(&pad, 4) || pad > 3 || !fp.read(zeros, pad)) return false;
+    if (!fp.map(ge1_son_off_, nodeNum)) return false;
+    if (!fp.map(ge1_homo_off_, nodeNum)) return false;
+    if (!fp.map(ge1_spl_idx_, nodeNum)) return false;
+    if (!fp.map(ge1_son_num_, nodeNum)) return false;
+    if (!fp.map(ge1_homo_num_, nodeNum)) return false;
+
+    // 只做廉价的边界检查，保证之后的查找不会越界
+    const quint32 homoEnd = quint32(lma_idx_buf_.size() / kLemmaIdSize);
+    const quint32 idEnd = kFullSplIdStart + quint32(splid_le0_index_.size()) - 1;
+    for (quint32 i = 0; i < nodeNum; i++)
+    {
+        if (quint64(ge1_son_off_.data()[i]) + ge1_son_num_.data()[i] > nodeNum) return false;
+        if (quint64(ge1_homo_off_.data()[i]) + ge1_homo_num_.data()[i] > homoEnd) return false;
+        if (ge1_spl_idx_.data()[i] < kFullSplIdStart || ge1_spl_idx_.data()[i] >= idEnd) return false;
+    }
+    compiled_ = true;
+    return true;
+}
+
+bool DictTrie::loadDictList(DictReader &fp)
 {
     return dictlist->load(fp);
 }
@@ -269,36 +514,289 @@ bool DictTrie::loadDictList(QFile &fp)
 int DictTrie::setCandidates(const quint16 *splidStr,
         int splidStrLen,
         Candidates *candidates,
-        const SpellingTrie *st) const
+        const SpellingTrie *st,
+        LmaFrontier *frontier,
+        const Deadline *deadline,
+        bool *partial,
+        StatLap *lap,
+        const LmaPsbItem *extras,
+        int extraNum) const
 {
     // Get candiates from the first un-fixed step.
-    int lmaSize = qMin(kMaxLemmaSize, splidStrLen);
+    int lmaSize = std::min(kMaxLemmaSize, splidStrLen);
     // Number of items which are fully-matched.
     int lpi_num_full_match = 0;
     candidates->reset();
+    bool complete = true;
+    (void)lap;      // 未打开 EPINYIN_STATS 时不使用
+
+    // 所有长度的词条共用同一次展开：长度为 n 的词条就在第 n - 1 层
+    LmaFrontier local;
+    if (pNull == frontier) frontier = &local;
+    if (lmaSize > 0)
+    {
+        // 到期时只有前面几层可用，从能取到的最长的词条开始
+        const int levels = extendFrontier(splidStr, lmaSize, frontier, st, deadline);
+        if (levels < lmaSize) complete = false;
+        lmaSize = levels;
+    }
+    IME_STATS(if (pNull != lap)
+    {
+        lap->mark(kStatExtend);
+        quint64 nodes = 0;
+        for (int i = 0; i < lmaSize; i++) nodes += frontier->node_num[i];
+        lap->stats()->frontier_nodes.add(nodes);
+    });
+
     while (lmaSize > 0)
     {
-        getLpis(splidStr, lmaSize, candidates, st);
+        // 到期后只在还没有任何候选时继续，保证结果不为空
+        const Deadline *dl = candidates->size() > 0? deadline: pNull;
+        if (pNull != dl && dl->expired())
+        {
+            complete = false;
+            break;
+        }
+        const bool done = getLpis(frontier, lmaSize, splidStr, candidates, st, dl);
+        for (int i = 0; i < extraNum && !candidates->isFull(); i++)
+        {
+            if (extras[i].lma_len == lmaSize) candidates->append(extras[i]);
+        }
         if (lmaSize == splidStrLen)
         {
             candidates->sortByPSB(0);
             lpi_num_full_match = candidates->size();
         }
+        if (!done)
+        {
+            complete = false;
+            break;
+        }
         lmaSize--;
     }
     candidates->sortByPSB(lpi_num_full_match);
+    if (pNull != partial) *partial = !complete;
+    IME_STATS(if (pNull != lap)
+    {
+        lap->mark(kStatLpis);
+        lap->stats()->lemmas.add(quint64(candidates->size()));
+    });
     return candidates->size();
 }
 
-QStringList DictTrie::getCandidates(const Candidates *candidates, int offs, int len) const
+int DictTrie::getCandidates(const Candidates *candidates, int offs, int len,
+                            char16_t *buf, int bufLen, int *lens, int lensLen) const
 {
     IME::Candidates::Itr itr = candidates->pull(offs, len);
-    QStringList ls;
-    while (itr.next())
+    int num = 0;
+    while (num < lensLen && itr.next())
     {
-        ls << dictlist->getLemmaStr(itr.id());
+        const int l = itr.lmaLen();
+        if (l > bufLen) break;
+        dictlist->copyLemma(itr.id(), l, buf);
+        buf += l;
+        bufLen -= l;
+        lens[num++] = l;
     }
-    return ls;
+    return num;
+}
+
+const char16_t *DictTrie::getLemmaView(quint32 id, int lmaLen) const
+{
+    return dictlist->getLemmaView(id, lmaLen);
+}
+
+void DictTrie::copyLemma(quint32 id, int lmaLen, char16_t *buf) const
+{
+    dictlist->copyLemma(id, lmaLen, buf);
+}
+
+void DictTrie::packLemmas()
+{
+    dictlist->pack();
+}
+
+bool DictTrie::isLemmaPacked() const
+{
+    return dictlist->isPacked();
+}
+
+bool DictTrie::getLemmaSplids(quint32 id, int lmaLen, const quint16 *splidStr,
+                              const SpellingTrie *st, const FuzzyTable *fuzzy,
+                              quint16 *splids) const
+{
+    Q_ASSERT(lmaLen > 0 && lmaLen <= kMaxLemmaSize);
+    return findPath(splidStr, lmaLen, st, fuzzy, [id](quint32 lemma) {
+        return lemma == id;
+    }, splids);
+}
+
+quint32 DictTrie::findLemma(const quint16 *splids, int lmaLen, const char16_t *text,
+                            const SpellingTrie *st) const
+{
+    Q_ASSERT(lmaLen > 0 && lmaLen <= kMaxLemmaSize);
+    // 全拼 id 精确匹配，只有一条路径，同音词条逐个比较文字
+    quint32 found = 0;
+    quint16 path[kMaxLemmaSize];
+    char16_t buf[kMaxLemmaSize];
+    findPath(splids, lmaLen, st, pNull, [&](quint32 lemma) {
+        copyLemma(lemma, lmaLen, buf);
+        if (0 != memcmp(buf, text, lmaLen * sizeof (char16_t))) return false;
+        found = lemma;
+        return true;
+    }, path);
+    return found;
+}
+
+template <class Match>
+bool DictTrie::findPath(const quint16 *splidStr, int lmaLen, const SpellingTrie *st,
+                        const FuzzyTable *fuzzy, const Match &match, quint16 *splids) const
+{
+    if (isSuccinct())
+    {
+        const SuccinctNodes trie = { louds_ };
+        return findPath(trie, 0, 0, 0, splidStr, lmaLen, st, fuzzy, match, splids);
+    }
+    const ColumnNodes trie = { this };
+    return findPath(trie, 0, 0, 0, splidStr, lmaLen, st, fuzzy, match, splids);
+}
+
+template <class Nodes, class Match>
+bool DictTrie::findPath(const Nodes &trie, int level, size_t first, size_t num,
+                        const quint16 *splidStr, int lmaLen, const SpellingTrie *st,
+                        const FuzzyTable *fuzzy, const Match &match, quint16 *splids) const
+{
+    SplIdRange exact;
+    const SplIdRange *ranges;
+    const int rangeNum = st->matchRanges(splidStr[level], fuzzy, &exact, &ranges);
+    for (int r = 0; r < rangeNum; r++)
+    {
+        size_t pos, last;
+        if (0 == level)
+        {
+            // 同 extendFrontier，第 0 层由 splid_le0_index_ 直接定位
+            pos = splid_le0_index_[ranges[r].start - kFullSplIdStart];
+            last = splid_le0_index_[ranges[r].end - kFullSplIdStart];
+        }
+        else
+        {
+            pos = trie.splRange(first, num, ranges[r].start, ranges[r].end, &last);
+            pos += first;
+            last += first;
+        }
+        for (; pos < last; pos++)
+        {
+            const quint32 node = quint32(pos);
+            splids[level] = trie.splIdx(level, node);
+            if (splids[level] < ranges[r].start || splids[level] >= ranges[r].end) continue;
+            if (level + 1 < lmaLen)
+            {
+                size_t sonOff, sonNum;
+                trie.sons(level, node, &sonOff, &sonNum);
+                if (findPath(trie, level + 1, sonOff, sonNum, splidStr, lmaLen, st,
+                             fuzzy, match, splids))
+                {
+                    return true;
+                }
+                continue;
+            }
+            size_t homoOff, homoNum;
+            trie.homos(level, node, &homoOff, &homoNum);
+            for (size_t i = 0; i < homoNum; i++)
+            {
+                if (match(trie.lemmaId(homoOff + i))) return true;
+            }
+        }
+    }
+    return false;
+}
+
+void DictTrie::enumLemmas(const LemmaVisitor &fn) const
+{
+    quint16 splids[kMaxLemmaSize];
+    // root_[0] 是根节点，第 0 层从 1 开始，两种表示中编号相同
+    for (quint32 i = 1; i < quint32(root_.size()); i++)
+    {
+        if (isSuccinct())
+        {
+            const SuccinctNodes trie = { louds_ };
+            enumLemmas(trie, 0, i, splids, fn);
+        }
+        else
+        {
+            const ColumnNodes trie = { this };
+            enumLemmas(trie, 0, i, splids, fn);
+        }
+    }
+}
+
+template <class Nodes>
+void DictTrie::enumLemmas(const Nodes &trie, int level, quint32 node, quint16 *splids,
+                          const LemmaVisitor &fn) const
+{
+    Q_ASSERT(level < kMaxLemmaSize);
+    splids[level] = trie.splIdx(level, node);
+    size_t homoOff, homoNum;
+    trie.homos(level, node, &homoOff, &homoNum);
+    for (size_t homoPos = 0; homoPos < homoNum; homoPos++)
+    {
+        fn(trie.lemmaId(homoOff + homoPos), splids, level + 1);
+    }
+    size_t sonOff, sonNum;
+    trie.sons(level, node, &sonOff, &sonNum);
+    for (size_t sonPos = 0; sonPos < sonNum; sonPos++)
+    {
+        enumLemmas(trie, level + 1, quint32(sonOff + sonPos), splids, fn);
+    }
+}
+
+void DictTrie::buildSuccinct()
+{
+    if (isSuccinct()) return;
+    louds_ = new LoudsTrie;
+
+    // 按层序加入节点。第 0 层就是 root_[1, size)，之后每层是上一层各节点
+    // 的子节点依次排列，order 记录它们在 nodes_ge1_ 中的下标
+    const LmaNodeLE0 *root = root_.data();
+    std::vector<quint32> order;
+    std::vector<quint32> ids;
+    for (int i = 0; i < root_.size(); i++)
+    {
+        ids.resize(root[i].num_of_homo);
+        for (size_t k = 0; k < ids.size(); k++) ids[k] = getLemmaId(root[i].homo_idx_buf_off + k);
+        louds_->addNode(root[i].spl_idx, root[i].num_of_son, ids.data(), quint32(ids.size()));
+        if (0 == i) continue;
+        for (quint32 k = 0; k < root[i].num_of_son; k++) order.push_back(root[i].son_1st_off + k);
+    }
+    for (size_t pos = 0; pos < order.size(); pos++)
+    {
+        const LmaNodeGE1 *node = nodes_ge1_.data() + order[pos];
+        const size_t homoOff = getHomoIdxBufOffset(node);
+        ids.resize(node->num_of_homo);
+        for (size_t k = 0; k < ids.size(); k++) ids[k] = getLemmaId(homoOff + k);
+        louds_->addNode(node->spl_idx, node->num_of_son, ids.data(), quint32(ids.size()));
+        const size_t sonOff = getSonOffset(node);
+        for (quint32 k = 0; k < node->num_of_son; k++) order.push_back(quint32(sonOff + k));
+    }
+    louds_->finish();
+
+    // 查找不再读各列，映射的直接丢弃视图，建立的释放
+    ge1_son_off_.adopt(std::vector<quint32>());
+    ge1_homo_off_.adopt(std::vector<quint32>());
+    ge1_spl_idx_.adopt(std::vector<quint16>());
+    ge1_son_num_.adopt(std::vector<quint8>());
+    ge1_homo_num_.adopt(std::vector<quint8>());
+    compiled_ = false;
+}
+
+size_t DictTrie::nodeMemory() const
+{
+    const size_t index = splid_le0_index_.size() * sizeof (quint16);
+    if (isSuccinct()) return louds_->memoryUsage() + index;
+    return size_t(root_.size()) * sizeof (LmaNodeLE0) +
+            size_t(lma_idx_buf_.size()) +
+            size_t(ge1_son_off_.size()) * (2 * sizeof (quint32) + sizeof (quint16) + 2) +
+            index;
 }
 
 
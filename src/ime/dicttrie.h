@@ -2,14 +2,19 @@
 #define DICTTRIE_H
 
 #include "ngram.h"
-#include <QByteArray>
-#include <QStringList>
+#include <functional>
+#include <string>
 
 NAMESPACEBEGIN
 
 class Candidates;
+struct LmaPsbItem;
 class SpellingTrie;
+class FuzzyTable;
 class DictList;
+class Deadline;
+class StatLap;
+class LoudsTrie;
 
 /**
  * We use different node types for different layers
@@ -26,18 +31,23 @@ class DictList;
  *
  * LE = less and equal,
  * A node occupies 16 bytes. so, totallly less than 16 * 500 = 8K
+ *
+ * 节点直接映射自词库文件，而旧格式中各段并不对齐，所以按 1 字节对齐声明，
+ * 编译器会为可能未对齐的字段生成安全的访问代码。
  */
+#pragma pack(push, 1)
 struct LmaNodeLE0 {
     quint32 son_1st_off;
     quint32 homo_idx_buf_off;
     quint16 spl_idx;
     quint16 num_of_son;
     quint16 num_of_homo;
+    quint16 reserved;             // 原结构体末尾的填充
 };
 
 /**
  * GE = great and equal
- * A node occupies 8 bytes.
+ * A node occupies 10 bytes.
  */
 struct LmaNodeGE1 {
     quint16 son_1st_off_l;        // Low bits of the son_1st_off
@@ -48,16 +58,84 @@ struct LmaNodeGE1 {
     quint8 son_1st_off_h;         // high bits of the son_1st_off
     quint8 homo_idx_buf_off_h;    // high bits of the homo_idx_buf_off
 };
+#pragma pack(pop)
+
+Q_STATIC_ASSERT(sizeof (LmaNodeLE0) == 16);
+Q_STATIC_ASSERT(sizeof (LmaNodeGE1) == 10);
+
+// 旧实现中每层最多保留的节点数，超出的被丢弃。现在只作为各层内置空间的
+// 大小和统计的阈值。
+#define MAX_EXTENDBUF_LEN 200
+
+/**
+ * 查找时每一层到达的节点。
+ * 第 i 层是匹配拼音 id 串前 i + 1 个 id 后到达的节点，第 0 层为 root_ 中的
+ * 下标，其余为 nodes_ge1_ 中的下标（使用 LoudsTrie 时为它的节点编号）。它只依赖于这些拼音 id，由会话保存，
+ * 下次查找时与新输入公共前缀对应的层直接复用，只需继续展开后面的层。
+ *
+ * 各层的节点依次存放在同一块空间中，第 i + 1 层紧接在第 i 层之后，重新展开
+ * 某层时它后面的层都作废，所以总是在末尾追加。空间先用内置的数组，放不下
+ * 时改用堆上的数组并按需加倍，之后一直复用，每层的节点数没有上限。
+ *
+ * fuzzy 非空时按其中的模糊音区间展开。各层只依赖于拼音 id 和规则，改变
+ * fuzzy 后须 reset。
+ */
+struct LmaFrontier
+{
+    Q_DISABLE_COPY(LmaFrontier)
+public:
+    // Number of levels that are valid.
+    int depth;
+    // The spelling id of each level.
+    quint16 spl_ids[kMaxLemmaSize];
+    quint32 node_num[kMaxLemmaSize];
+    // 各层第一个节点的位置
+    quint32 node_start[kMaxLemmaSize];
+
+    // 某层超过 MAX_EXTENDBUF_LEN 个节点（旧实现会截断）的次数，
+    // 及单层节点数的最大值。reset 和 copyFrom 不清除。
+    quint64 overflow_count;
+    quint32 peak_nodes;
+
+    // 模糊音表，为空时精确匹配。reset 和 copyFrom 不改变它
+    const FuzzyTable *fuzzy;
+
+    inline LmaFrontier()
+        : depth(0), overflow_count(0), peak_nodes(0), fuzzy(pNull),
+          buf_(inline_), capacity_(kMaxLemmaSize * MAX_EXTENDBUF_LEN) { }
+    inline void reset() { depth = 0; }
+
+    inline const quint32 *nodes(int level) const { return buf_ + node_start[level]; }
+    // 保证可以写入 [0, end)，返回空间的起点。空间可能移动，之前取得的
+    // 指针都会失效。
+    inline quint32 *reserve(size_t end)
+    {
+        if (Q_UNLIKELY(end > capacity_)) grow(end);
+        return buf_;
+    }
+    // 当前空间的大小，以节点计
+    inline size_t capacity() const { return capacity_; }
 
+    // 只复制有效的层和节点，两者须使用相同的模糊音规则
+    void copyFrom(const LmaFrontier &other);
+
+private:
+    void grow(size_t end);
+
+    quint32 *buf_;
+    size_t capacity_;
+    std::vector<quint32> heap_;
+    quint32 inline_[kMaxLemmaSize * MAX_EXTENDBUF_LEN];
+};
 
 
 class DictTrie
 {
-    QVector<LmaNodeLE0> root_;        // Nodes for root and the first layer.
-    QVector<LmaNodeGE1> nodes_ge1_;   // Nodes for other layers.
+    ConstArray<LmaNodeLE0> root_;        // Nodes for root and the first layer.
+    ConstArray<LmaNodeGE1> nodes_ge1_;   // Nodes for other layers.
     // The first part is for homophnies, and the last  top_lma_num_ items are
     // lemmas with highest scores.
-    QByteArray lma_idx_buf_;
+    ConstArray<char> lma_idx_buf_;
     // An quick index from spelling id to the LmaNodeLE0 node buffer, or
     // to the root_ buffer.
     // Index length:
@@ -67,7 +145,19 @@ class DictTrie
     // corresponding full ids.
     // So, given an id splid, the son is:
     // root_[splid_le0_index_[splid - kFullSplIdStart]]
-    QVector<quint16> splid_le0_index_;
+    std::vector<quint16> splid_le0_index_;
+    // nodes_ge1_ 按字段拆开的各列，下标与 nodes_ge1_ 相同。查找时只读这些
+    // 列：一个节点的子节点在 ge1_spl_idx_ 中是一段连续升序的数组，供 splRange
+    // 查找，偏移量也不必再由高低两部分拼接。词库附带预编译的列（见 dicttool）
+    // 时直接映射，否则加载时由 nodes_ge1_ 建立，约 550KB。
+    ConstArray<quint32> ge1_son_off_;
+    ConstArray<quint32> ge1_homo_off_;
+    ConstArray<quint16> ge1_spl_idx_;
+    ConstArray<quint8> ge1_son_num_;
+    ConstArray<quint8> ge1_homo_num_;
+    bool compiled_;
+    // 简洁表示，见 buildSuccinct，建立后查找只读它，不再有上面的各列
+    LoudsTrie *louds_;
 
 
     NGram *ngram;
@@ -77,24 +167,141 @@ public:
     DictTrie();
     ~DictTrie();
 
-    bool loadDictDict(QFile &fp, int spellingNum);
-    bool loadDictList(QFile &fp);
-    inline bool loadDictNGram(QFile &fp);
+    bool loadDictDict(DictReader &fp, int spellingNum);
+    bool loadDictList(DictReader &fp);
+    inline bool loadDictNGram(DictReader &fp);
 
+    // 从当前位置映射预先编译好的节点列，须在 loadDictDict 之后调用。
+    // 段不存在或校验失败时返回 false，此时应调用 buildNodeColumns。
+    bool loadCompiledNodes(DictReader &fp);
+    // 由 nodes_ge1_ 建立节点列
+    void buildNodeColumns();
+    // 由 root_ 和 nodes_ge1_ 建立简洁表示（见 loudstrie.h），之后查找只读它，
+    // 候选词与原表示相同；节点列如已建立则释放。词库中的节点和词条 id 数组
+    // 不再被读取，映射的页不会调入内存。只在加载之后、开始查询之前调用。
+    void buildSuccinct();
+    inline bool isSuccinct() const;
+    // 查找时读取的节点和词条 id 数据的大小，字节，不论是否映射。
+    // 默认的表示为 root_、各列和词条 id 数组，nodes_ge1_ 查找时不读
+    size_t nodeMemory() const;
+    // 将节点列追加到 buf，供 loadCompiledNodes 使用。buf 为词库文件到目前
+    // 为止的全部内容，用于对齐。
+    void saveCompiledNodes(std::string &buf) const;
+    inline bool isCompiled() const;
+
+    // frontier 保存上次查找展开的节点，可以为空。
+    // deadline 非空时到期即停止，candidates 中保留已收集的词条，照常排序，
+    // 并在 partial 非空时置 *partial 为 true。每次至少展开一层，并且在有
+    // 词条可取时至少收集到一种长度的全部词条。已展开完整的层留在 frontier
+    // 中，对同一输入再次查找时不必重新展开。
+    // lap 非空且打开了 EPINYIN_STATS 时依次记录展开和收集的耗时，以及
+    // 展开的节点数和收集的词条数。
+    // extras 为词库之外并入的 extraNum 个词条（如用户词组，见 UserDict），
+    // 拼音须与 splidStr 的前 lma_len 个匹配，与同样长度的词条一起排序。
     int setCandidates(const quint16 *splidStr, int splidStrLen,
-                             Candidates *candidates, const SpellingTrie *st) const;
+                      Candidates *candidates, const SpellingTrie *st,
+                      LmaFrontier *frontier = pNull,
+                      const Deadline *deadline = pNull, bool *partial = pNull,
+                      StatLap *lap = pNull,
+                      const LmaPsbItem *extras = pNull, int extraNum = 0) const;
+
+    // 候选词依次写入 buf（不含结束符），lens[i] 为第 i 个的长度，不分配内存。
+    // 返回写入的个数，buf 或 lens 不够时提前结束。
+    int getCandidates(const Candidates *candidates, int offs, int len,
+                      char16_t *buf, int bufLen, int *lens, int lensLen) const;
+    // 词条文字的只读视图，指向词库数据，词库存活期间有效。
+    // 文字压缩存放时返回空指针，见 packLemmas
+    const char16_t *getLemmaView(quint32 id, int lmaLen) const;
+    // 把词条文字拷贝到 buf（至少 lmaLen 个），压缩时同样可用
+    void copyLemma(quint32 id, int lmaLen, char16_t *buf) const;
+    // 把词条文字改为压缩存放，见 DictList::pack
+    void packLemmas();
+    bool isLemmaPacked() const;
+
+    // 从 splidStr 开始展开 frontier 到 depth 层，对每个长度 l 取出拼音完全
+    // 匹配的词条中 psb 最小的一个写入 best[l - 1]，没有时其 lma_len 为 0。
+    // 用于整句解码，不经过 Candidates。deadline 在展开完 depth 层之前到期时
+    // 返回 false，best 不变，已展开完整的层留在 frontier 中。
+    bool getBestLemmas(const quint16 *splidStr, int depth, LmaFrontier *frontier,
+                       const SpellingTrie *st, LmaPsbItem *best,
+                       const Deadline *deadline = pNull) const;
 
-    QStringList getCandidates(const Candidates *candidates, int offs, int len) const;
+    // 在拼音与 splidStr[0, lmaLen) 匹配（fuzzy 为空时精确匹配）的词条中找到
+    // id，把它每个字的全拼 id 写入 splids，找不到时返回 false。用于把输入的
+    // 简拼、模糊音还原为词条本来的读音，只沿匹配的节点深入，不使用 frontier。
+    bool getLemmaSplids(quint32 id, int lmaLen, const quint16 *splidStr,
+                        const SpellingTrie *st, const FuzzyTable *fuzzy,
+                        quint16 *splids) const;
+    // 全拼 id 为 splids、文字为 text 的词条 id，没有时返回 0
+    quint32 findLemma(const quint16 *splids, int lmaLen, const char16_t *text,
+                      const SpellingTrie *st) const;
+
+    // 遍历所有词条，对每个调用 fn(id, 拼音 id 串, 长度)，拼音 id 都是全拼 id。
+    // 每个词条只在树中出现一次，同一文字的不同读音是不同的词条。
+    typedef std::function<void (quint32 id, const quint16 *splids, int len)> LemmaVisitor;
+    void enumLemmas(const LemmaVisitor &fn) const;
+    inline LmaScoreType getUniPSB(quint32 id) const;
+    inline const DictList *dictList() const;
 
 private:
-    int getLpis(const quint16 *splidStr, int splidStrLen,
-                    Candidates *candidates, const SpellingTrie *st) const;
+    // 查找时读节点的方式，两种表示各一个，见 dicttrie.cpp。下面几个模板
+    // 只在 dicttrie.cpp 中用这两种实例化
+    struct ColumnNodes;
+    struct SuccinctNodes;
+
+    // Extend the frontier to depth levels for splidStr. Levels computed for
+    // the same leading spelling ids are reused.
+    // 返回展开完整的层数，deadline 到期时可能小于 depth，未完成的层不保留。
+    int extendFrontier(const quint16 *splidStr, int depth,
+                       LmaFrontier *frontier, const SpellingTrie *st,
+                       const Deadline *deadline = pNull) const;
+    template <class Nodes>
+    int extendFrontier(const Nodes &nodes, const quint16 *splidStr, int depth,
+                       LmaFrontier *frontier, const SpellingTrie *st,
+                       const Deadline *deadline) const;
+    // Get the lemmas of length lmaLen from the frontier.
+    // deadline 到期而没有取完时返回 false。
+    bool getLpis(const LmaFrontier *frontier, int lmaLen, const quint16 *splidStr,
+                 Candidates *candidates, const SpellingTrie *st,
+                 const Deadline *deadline = pNull) const;
+    template <class Nodes>
+    bool getLpis(const Nodes &nodes, const LmaFrontier *frontier, int lmaLen,
+                 const quint16 *splidStr, Candidates *candidates,
+                 const SpellingTrie *st, const Deadline *deadline) const;
+    template <class Nodes>
+    void getBestLemmas(const Nodes &nodes, const LmaFrontier *frontier, int depth,
+                       const quint16 *splidStr, const SpellingTrie *st,
+                       LmaPsbItem *best) const;
+
+    template <class Nodes>
+    void enumLemmas(const Nodes &nodes, int level, quint32 node, quint16 *splids,
+                    const LemmaVisitor &fn) const;
+    // 从第 level 层的节点 [first, first + num)（第 0 层不使用）中取拼音与
+    // splidStr[level] 匹配的，逐层深入到第 lmaLen - 1 层，对那里的词条调用
+    // match(id)，它返回 true 时停止并返回 true，splids 为经过的各节点的全拼 id
+    template <class Match>
+    bool findPath(const quint16 *splidStr, int lmaLen, const SpellingTrie *st,
+                  const FuzzyTable *fuzzy, const Match &match, quint16 *splids) const;
+    template <class Nodes, class Match>
+    bool findPath(const Nodes &nodes, int level, size_t first, size_t num,
+                  const quint16 *splidStr, int lmaLen, const SpellingTrie *st,
+                  const FuzzyTable *fuzzy, const Match &match, quint16 *splids) const;
 
     inline quint32 getLemmaId(size_t idOffset) const;
     inline size_t getSonOffset(const LmaNodeGE1 *node) const;
     inline size_t getHomoIdxBufOffset(const LmaNodeGE1 *node) const;
 };
 
+bool DictTrie::isCompiled() const
+{
+    return compiled_;
+}
+
+bool DictTrie::isSuccinct() const
+{
+    return pNull != louds_;
+}
+
 quint32 DictTrie::getLemmaId(size_t idOffset) const
 {
     Q_ASSERT(kLemmaIdSize == 3);
@@ -118,8 +325,17 @@ size_t DictTrie::getHomoIdxBufOffset(const LmaNodeGE1 *node) const
 }
 
 
+LmaScoreType DictTrie::getUniPSB(quint32 id) const
+{
+    return ngram->getUniPSB(id);
+}
+
+const DictList *DictTrie::dictList() const
+{
+    return dictlist;
+}
 
-bool DictTrie::loadDictNGram(QFile &fp)
+bool DictTrie::loadDictNGram(DictReader &fp)
 {
     return ngram->load(fp);
 }
@@ -1,141 +1,172 @@
 #include "epinyin.h"
-#include "spellingtrie.h"
 #include "dicttrie.h"
 #include "candidates.h"
+#include "dictionary.h"
+#include <algorithm>
 #include <QFile>
 
 NAMESPACEBEGIN
 
 EPinyin::EPinyin(const QString &dictfile)
 {
-    st = new SpellingTrie;
-    dt = new DictTrie;
-    cs = new Candidates;
-    QFile f(dictfile);
-    f.open(QIODevice::ReadOnly);
-    bool b =
-            st->loadSplTrie(f) &&
-            dt->loadDictList(f) &&
-            dt->loadDictDict(f, st->getSpellingNum()) &&
-            dt->loadDictNGram(f);
-    Q_ASSERT(b);
-    Q_UNUSED(b);
-    resetSearch();
+    // qt 资源不是普通文件，由 QFile 打开后把数据交给词库
+    file_ = new QFile(dictfile);
+    const char *data = pNull;
+    qint64 size = 0;
+    if (file_->open(QIODevice::ReadOnly))
+    {
+        size = file_->size();
+        // 映射在 file_ 销毁时自动解除
+        data = (const char *) file_->map(0, size);
+        if (pNull == data)
+        {
+            // 压缩的资源或不支持映射的设备，退回到整体读入
+            data_ = file_->readAll();
+            data = data_.constData();
+            size = data_.size();
+            file_->close();
+        }
+    }
+    own_dict_ = new Dictionary(data, size);
+    init(own_dict_);
 }
 
-EPinyin::~EPinyin()
+EPinyin::EPinyin(const char *data, qint64 size)
 {
-    delete cs;
-    delete dt;
-    delete st;
+    file_ = pNull;
+    own_dict_ = new Dictionary(data, size);
+    init(own_dict_);
 }
 
-size_t EPinyin::search(const QString &str)
+EPinyin::EPinyin(const Dictionary *dict)
 {
-    const QByteArray &py = str.toLatin1();
-    return search(py.constData(), py.size());
+    file_ = pNull;
+    own_dict_ = pNull;
+    init(dict);
 }
 
-size_t EPinyin::search(const char *py, int pyLen)
+EPinyin::~EPinyin()
 {
-    pyLen = qMin(pyLen, kMaxRowNum - 1);
+    delete dec_;
+    delete own_dict_;
+    // 词库引用文件数据，最后释放
+    delete file_;
+}
 
-    // Compare the new string with the previous one. Find their prefix to
-    // increase search efficiency.
-    int chPos = 0;
-    for (chPos = 0; chPos < pys_decoded_len_ && chPos < pyLen; chPos++)
-    {
-        if (py[chPos] != pys_[chPos]) break;
-    }
+void EPinyin::init(const Dictionary *dict)
+{
+    Q_ASSERT(dict->isValid());
+    dec_ = new Decoder(dict);
+}
 
-    while (!fixed_spl_.isEmpty() && chPos < fixed_spl_.last())
+// 直接转换到栈上，避免 toLatin1() 分配内存。py 至少 kMaxRowNum 字节。
+static int toPinyin(const QString &str, char *py)
+{
+    const int len = qMin(str.size(), kMaxRowNum - 1);
+    const QChar *s = str.constData();
+    for (int i = 0; i < len; i++)
     {
-        cancelLastChoice0();
+        const ushort u = s[i].unicode();
+        py[i] = u < 0x100? char(u): '?';
     }
+    return len;
+}
 
-    memcpy(pys_ + chPos, py + chPos, pyLen - chPos);
-    pys_[pyLen] = '\0';
-    pys_decoded_len_ = pyLen;
+size_t EPinyin::search(const QString &str)
+{
+    char py[kMaxRowNum];
+    const int len = toPinyin(str, py);
+    return dec_->search(py, len);
+}
 
-    return updateCandidate();
+size_t EPinyin::search(const char *py, int pyLen)
+{
+    return dec_->search(py, pyLen);
 }
 
 size_t EPinyin::choose(int idx)
 {
-    if (pys_decoded_len_ == 0 || idx >= cs->size())
-    {
-        return cs->size();
-    }
-    const LmaPsbItem &item = cs->at(idx);
-    fixed_total_ += item.lma_len;
-    fixed_list_.append(getCandidate(idx, 1));
-    int splLst = spl_start_[item.lma_len];
-    if (!fixed_spl_.isEmpty()) splLst += fixed_spl_.last();
-    fixed_spl_.append(splLst);
-    return updateCandidate();
+    return dec_->choose(idx);
 }
 
 size_t EPinyin::cancelLastChoice()
 {
-    if (fixed_list_.size())
-    {
-        cancelLastChoice0();
-        return updateCandidate();
-    }
-    return cs->size();
+    return dec_->cancelLastChoice();
 }
 
-QStringList EPinyin::getCandidate(int offs, int len) const
+size_t EPinyin::search(const QString &str, const Deadline &deadline)
 {
-    return dt->getCandidates(cs, offs, len);
+    char py[kMaxRowNum];
+    const int len = toPinyin(str, py);
+    return dec_->search(py, len, deadline);
 }
 
-int EPinyin::getCandidateCount() const
+size_t EPinyin::search(const char *py, int pyLen, const Deadline &deadline)
 {
-    return cs->size();
+    return dec_->search(py, pyLen, deadline);
+}
+
+size_t EPinyin::choose(int idx, const Deadline &deadline)
+{
+    return dec_->choose(idx, deadline);
+}
+
+size_t EPinyin::cancelLastChoice(const Deadline &deadline)
+{
+    return dec_->cancelLastChoice(deadline);
+}
+
+QStringList EPinyin::getCandidate(int offs, int len) const
+{
+    // 经过解码器取，以包含整句候选
+    IME_STAT_TIMER(dec_->stats(), kStatLemmaText);
+    QStringList ls;
+    const int count = dec_->getCandidateCount();
+    // 参数的含义同 Candidates::pull
+    if (offs < 0) offs = std::max(offs + count, 0);
+    const int end = len == -1? count: std::min(count, offs + std::max(len, 0));
+    for (int i = offs; i < end; i++)
+    {
+        int l;
+        const char16_t *s = dec_->getCandidateView(i, &l);
+        ls << QString(reinterpret_cast<const QChar *>(s), l);
+    }
+    return ls;
 }
 
 QString EPinyin::getFixedStr() const
 {
-    return fixed_list_.join(QString());
+    // 每次固定至少消耗一个字母，固定的汉字不会超过 kMaxRowNum 个
+    char16_t buf[kMaxRowNum];
+    const int len = dec_->getFixedStr(buf, kMaxRowNum);
+    Q_ASSERT(len == dec_->getFixedLen());
+    return QString(reinterpret_cast<const QChar *>(buf), len);
 }
 
-void EPinyin::resetSearch()
+int EPinyin::getCandidate(int offs, int len, char16_t *buf, int bufLen,
+                          int *lens, int lensLen) const
 {
-    pys_decoded_len_ = 0;
-    spl_id_num_ = 0;
-    fixed_total_ = 0;
-    fixed_list_.clear();
-    fixed_spl_.clear();
-    cs->reset();
+    return dec_->getCandidate(offs, len, buf, bufLen, lens, lensLen);
 }
 
-void EPinyin::cancelLastChoice0()
+int EPinyin::getFixedStr(char16_t *buf, int bufLen) const
 {
-    Q_ASSERT(fixed_total_ > 0);
-    fixed_spl_.removeLast();
-    fixed_total_ -= fixed_list_.takeLast().length();
-    Q_ASSERT(fixed_total_ >= 0);
+    return dec_->getFixedStr(buf, bufLen);
 }
 
-size_t EPinyin::updateCandidate()
+const char16_t *EPinyin::getCandidateView(int idx, int *len) const
 {
-    int pyOffs = fixed_spl_.isEmpty()? 0: fixed_spl_.last();
-    int pyLen = pys_decoded_len_ - pyOffs;
-    if (pyLen > 0)
-    {
-        spl_id_num_ = st->splstrToIdxs(
-                    pys_ + pyOffs, pyLen,
-                    spl_id_, spl_start_, kMaxRowNum - 1);
+    return dec_->getCandidateView(idx, len);
+}
 
-        dt->setCandidates(spl_id_, spl_id_num_, cs, st);
-    }
-    else
-    {
-        spl_id_num_ = 0;
-        cs->reset();
-    }
-    return cs->size();
+void EPinyin::resetSearch()
+{
+    dec_->resetSearch();
+}
+
+int EPinyin::getCandidateCount() const
+{
+    return dec_->getCandidateCount();
 }
 
 NAMESPACEEND
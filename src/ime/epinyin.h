@@ -1,22 +1,33 @@
 #ifndef EPINYIN_H
 #define EPINYIN_H
 
-#include "dictdef.h"
-#include <QVector>
+#include "decoder.h"
+#include "deadline.h"
+#include "stats.h"
+#include "spellingtrie.h"
 #include <QStringList>
+#include <QByteArray>
+class QFile;
 
 NAMESPACEBEGIN
 
-class SpellingTrie;
-class DictTrie;
-class Candidates;
-
+/**
+ * 解码器的 qt 包装，提供 QString 接口，并负责从 qt 资源等位置加载词库。
+ * 不需要 qt 时直接使用 Decoder 和 Dictionary 即可。
+ */
 class EPinyin
 {
-    void cancelLastChoice0();
-    size_t updateCandidate();
+    Q_DISABLE_COPY(EPinyin)
+    void init(const Dictionary *dict);
 public:
+    // 加载一份自己独占的词库，可以是未压缩的 qt 资源
     EPinyin(const QString &dictfile);
+    // 直接使用调用者提供的词库数据（如 QResource::data()），不做拷贝。
+    // 调用者需保证 data 在实例销毁前有效。
+    EPinyin(const char *data, qint64 size);
+    // 使用共享的词库，实例只保存自己的输入状态。
+    // 词库可被多个线程中的实例同时使用，调用者需保证其在实例销毁前有效。
+    EPinyin(const Dictionary *dict);
     ~EPinyin();
 
     // Search a Pinyin string.
@@ -26,8 +37,20 @@ public:
     // Choose a candidate. The decoder will do a search after the fixed position.
     size_t choose(int idx);
     size_t cancelLastChoice();
+    // 带截止时间或取消标志的版本，到期时只给出已找到的候选，见 Decoder
+    size_t search(const QString &str, const Deadline &deadline);
+    size_t search(const char *py, int pyLen, const Deadline &deadline);
+    size_t choose(int idx, const Deadline &deadline);
+    size_t cancelLastChoice(const Deadline &deadline);
+    // 最近一次查找的候选是否不完整
+    inline bool isPartial() const;
     QStringList getCandidate(int offs, int len) const;
     QString getFixedStr() const;
+    // 与上面两个相同，但结果写入调用者提供的缓冲区，不分配内存，见 Decoder。
+    int getCandidate(int offs, int len, char16_t *buf, int bufLen,
+                     int *lens, int lensLen) const;
+    int getFixedStr(char16_t *buf, int bufLen) const;
+    const char16_t *getCandidateView(int idx, int *len) const;
     void resetSearch();
 
     int getCandidateCount() const;
@@ -35,49 +58,103 @@ public:
     inline const char* getSpsStr(int *len) const;
     inline const quint16 *getSplStartPos(int *len) const;
 
-private:
-    SpellingTrie *st;
-    DictTrie *dt;
-    Candidates *cs;
-
-    // Used to remember the last fixed position, counted in Hanzi.
-    QList<int> fixed_spl_;
-    QStringList fixed_list_;
-    int fixed_total_;
+    // 模糊音规则，IME::FuzzyRule 的组合，如 kFuzzyZZh | kFuzzyNL，0 为关闭。
+    // 下次查找时生效。
+    inline void setFuzzyRules(quint32 rules);
+    inline quint32 fuzzyRules() const;
 
-    // The length of the string that has been decoded successfully.
-    int pys_decoded_len_;
+    // 用户词典，见 Decoder::setUserDict。由调用者创建和释放，可在多个实例间共享
+    inline void setUserDict(UserDict *user);
+    inline UserDict *userDict() const;
+    // 候选列表的缓存，见 CandidateCache，可在使用同一词库的实例间共享
+    inline void setCandidateCache(CandidateCache *cache);
+    inline CandidateCache *candidateCache() const;
 
-    // Number of splling ids
-    int spl_id_num_;
+    // 从创建或上次 resetStats 起各阶段的耗时（纳秒）和计数的摘要，含 p50、
+    // p99，可直接导出到监控。需编译时打开 EPINYIN_STATS，否则 enabled 为 false。
+    inline StatsSnapshot statsSnapshot() const;
+    inline void resetStats();
 
-    // Starting positions
-    quint16 spl_start_[kMaxRowNum];
+    // 内部的解码器
+    inline Decoder *decoder() const;
 
-    // Spelling ids
-    quint16 spl_id_[kMaxRowNum];
-
-    // Pinyin string. Max length: kMaxRowNum - 1
-    char pys_[kMaxRowNum];
+private:
+    // 由路径加载词库时打开的文件，词库映射其内容
+    QFile *file_;
+    // 文件无法映射时读入的数据
+    QByteArray data_;
+    // 自己加载的词库，使用共享词库时为空
+    Dictionary *own_dict_;
+    Decoder *dec_;
 };
 
 
 
+bool EPinyin::isPartial() const
+{
+    return dec_->isPartial();
+}
+
 int EPinyin::getFixedSplLen() const
 {
-    return fixed_spl_.isEmpty()? 0: fixed_spl_.last();
+    return dec_->getFixedSplLen();
 }
 
 const char *EPinyin::getSpsStr(int *len) const
 {
-    *len = pys_decoded_len_;
-    return pys_;
+    return dec_->getSpsStr(len);
 }
 
 const quint16 * EPinyin::getSplStartPos(int *len) const
 {
-    *len = spl_id_num_;
-    return spl_start_;
+    return dec_->getSplStartPos(len);
+}
+
+void EPinyin::setFuzzyRules(quint32 rules)
+{
+    dec_->setFuzzyRules(rules);
+}
+
+quint32 EPinyin::fuzzyRules() const
+{
+    return dec_->fuzzyRules();
+}
+
+void EPinyin::setUserDict(UserDict *user)
+{
+    dec_->setUserDict(user);
+}
+
+UserDict *EPinyin::userDict() const
+{
+    return dec_->userDict();
+}
+
+void EPinyin::setCandidateCache(CandidateCache *cache)
+{
+    dec_->setCandidateCache(cache);
+}
+
+CandidateCache *EPinyin::candidateCache() const
+{
+    return dec_->candidateCache();
+}
+
+StatsSnapshot EPinyin::statsSnapshot() const
+{
+    StatsSnapshot s;
+    dec_->statsSnapshot(&s);
+    return s;
+}
+
+void EPinyin::resetStats()
+{
+    dec_->resetStats();
+}
+
+Decoder *EPinyin::decoder() const
+{
+    return dec_;
 }
 
 NAMESPACEEND
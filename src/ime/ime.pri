@@ -0,0 +1,50 @@
+# 引擎核心，不依赖 qt
+INCLUDEPATH += $$PWD
+# 批量转换和汉字转拼音使用线程池
+CONFIG += thread
+# 分阶段计时和计数（见 stats.h），qmake CONFIG+=epinyin_stats 打开
+epinyin_stats: DEFINES += EPINYIN_STATS
+
+SOURCES += \
+    $$PWD/dictreader.cpp \
+    $$PWD/dictcontainer.cpp \
+    $$PWD/spellingtrie.cpp \
+    $$PWD/dicttrie.cpp \
+    $$PWD/loudstrie.cpp \
+    $$PWD/splrange.cpp \
+    $$PWD/ngram.cpp \
+    $$PWD/dictlist.cpp \
+    $$PWD/lemmapack.cpp \
+    $$PWD/candidates.cpp \
+    $$PWD/candcache.cpp \
+    $$PWD/dictionary.cpp \
+    $$PWD/decoder.cpp \
+    $$PWD/sentence.cpp \
+    $$PWD/userdict.cpp \
+    $$PWD/stats.cpp \
+    $$PWD/threadpool.cpp \
+    $$PWD/batch.cpp \
+    $$PWD/reverse.cpp
+
+HEADERS += \
+    $$PWD/dictdef.h \
+    $$PWD/dictreader.h \
+    $$PWD/dictcontainer.h \
+    $$PWD/spellingtrie.h \
+    $$PWD/dicttrie.h \
+    $$PWD/loudstrie.h \
+    $$PWD/splrange.h \
+    $$PWD/ngram.h \
+    $$PWD/dictlist.h \
+    $$PWD/lemmapack.h \
+    $$PWD/candidates.h \
+    $$PWD/candcache.h \
+    $$PWD/dictionary.h \
+    $$PWD/decoder.h \
+    $$PWD/sentence.h \
+    $$PWD/userdict.h \
+    $$PWD/deadline.h \
+    $$PWD/stats.h \
+    $$PWD/threadpool.h \
+    $$PWD/batch.h \
+    $$PWD/reverse.h
@@ -0,0 +1,8 @@
+# 不依赖 qt 的引擎核心静态库，用于嵌入其他 C++ 程序
+TEMPLATE = lib
+CONFIG   += staticlib c++11
+CONFIG   -= qt
+TARGET   = epinyincore
+DESTDIR = $$PWD/../../dist
+
+include(ime.pri)
@@ -0,0 +1,145 @@
+#include "lemmapack.h"
+#include "dictlist.h"
+#include <algorithm>
+
+NAMESPACEBEGIN
+
+// 第 t 档的名次占 8 + 2t 位，由档位直接算出，解码时不必查表
+#define RANK_BITS(t) (8 + 2 * (t))
+// 各档的起始名次
+static const quint32 kRankBase[4] = { 0, 1 << 8, (1 << 8) + (1 << 10),
+                                      (1 << 8) + (1 << 10) + (1 << 12) };
+#define kRankNum (kRankBase[3] + (1u << RANK_BITS(3)))
+
+// 长度为 i 的词条，与前一个相同的前缀长度 [0, i] 所占的位数
+static const int kPrefixBits[kMaxLemmaSize + 1] = { 0, 1, 2, 2, 3, 3, 3, 3, 4 };
+
+namespace {
+
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<quint64> &out) : out_(out), pos_(0) { }
+
+    void write(quint32 v, int n)
+    {
+        Q_ASSERT(n > 0 && n <= 32 && (quint64(v) >> n) == 0);
+        const unsigned s = unsigned(pos_ & 63);
+        if (0 == s) out_.push_back(0);
+        out_.back() |= quint64(v) << s;
+        if (s + unsigned(n) > 64) out_.push_back(quint64(v) >> (64 - s));
+        pos_ += size_t(n);
+    }
+    inline size_t pos() const { return pos_; }
+
+private:
+    std::vector<quint64> &out_;
+    size_t pos_;
+};
+
+}
+
+void LemmaPack::build(const DictList *dl)
+{
+    const quint16 *text = dl->buf_.data();
+
+    // 按前缀之后余下的字计数，这些才是要编码的
+    std::vector<quint32> count(0x10000, 0);
+    for (int l = 1; l <= kMaxLemmaSize; l++)
+    {
+        const quint32 first = dl->start_id_[l - 1];
+        for (quint32 id = first; id < dl->start_id_[l]; id++)
+        {
+            const quint16 *s = text + dl->getLemmaPos(id, l);
+            int k = 0;
+            if (0 != (id - first) % kLemmaPackBlock)
+            {
+                while (k < l && s[k - l] == s[k]) k++;
+            }
+            for (; k < l; k++) count[s[k]]++;
+        }
+    }
+    hz_.clear();
+    for (quint32 c = 0; c < 0x10000; c++)
+    {
+        if (count[c] > 0) hz_.push_back(char16_t(c));
+    }
+    Q_ASSERT(hz_.size() <= kRankNum);
+    std::stable_sort(hz_.begin(), hz_.end(), [&count](char16_t a, char16_t b) {
+        return count[a] > count[b];
+    });
+    std::vector<quint32> &code = count;
+    for (size_t i = 0; i < hz_.size(); i++) code[hz_[i]] = quint32(i);
+
+    bits_.clear();
+    block_off_.clear();
+    BitWriter w(bits_);
+    for (int l = 1; l <= kMaxLemmaSize; l++)
+    {
+        const quint32 first = dl->start_id_[l - 1];
+        start_id_[l - 1] = first;
+        start_block_[l - 1] = quint32(block_off_.size());
+        for (quint32 id = first; id < dl->start_id_[l]; id++)
+        {
+            const quint16 *s = text + dl->getLemmaPos(id, l);
+            int k = 0;
+            if (0 == (id - first) % kLemmaPackBlock)
+            {
+                block_off_.push_back(quint32(w.pos()));
+            }
+            else
+            {
+                while (k < l && s[k - l] == s[k]) k++;
+                w.write(quint32(k), kPrefixBits[l]);
+            }
+            for (; k < l; k++)
+            {
+                const quint32 rank = code[s[k]];
+                int t = 0;
+                while (rank >= kRankBase[t] + (1u << RANK_BITS(t))) t++;
+                w.write(quint32(t) | (rank - kRankBase[t]) << 2, 2 + RANK_BITS(t));
+            }
+        }
+    }
+    Q_ASSERT(w.pos() <= 0xffffffffu);
+    bits_.push_back(0);
+    bits_.shrink_to_fit();
+    block_off_.shrink_to_fit();
+    hz_.shrink_to_fit();
+}
+
+void LemmaPack::decode(quint32 id, int lmaLen, char16_t *buf) const
+{
+    Q_ASSERT(lmaLen > 0 && lmaLen <= kMaxLemmaSize);
+    Q_ASSERT(id >= start_id_[lmaLen - 1]);
+    const quint32 rel = id - start_id_[lmaLen - 1];
+    size_t pos = block_off_[start_block_[lmaLen - 1] + rel / kLemmaPackBlock];
+    const int prefixBits = kPrefixBits[lmaLen];
+    const quint32 prefixMask = (1u << prefixBits) - 1;
+
+    // 块内第一个词条没有前缀长度，之后的每个先解出前缀长度，
+    // 相同的前缀已经在 buf 中，只需覆盖余下的字
+    int k = 0;
+    for (quint32 i = rel % kLemmaPackBlock; ; i--)
+    {
+        for (; k < lmaLen; k++)
+        {
+            const quint32 v = peek(pos);
+            const int t = v & 3;
+            buf[k] = hz_[kRankBase[t] + ((v >> 2) & ((1u << RANK_BITS(t)) - 1))];
+            pos += size_t(2 + RANK_BITS(t));
+        }
+        if (0 == i) break;
+        k = int(peek(pos) & prefixMask);
+        pos += size_t(prefixBits);
+    }
+}
+
+size_t LemmaPack::memoryUsage() const
+{
+    return bits_.size() * sizeof (quint64) +
+            block_off_.size() * sizeof (quint32) +
+            hz_.size() * sizeof (char16_t) + sizeof (*this);
+}
+
+NAMESPACEEND
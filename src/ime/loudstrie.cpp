@@ -0,0 +1,160 @@
+#include "loudstrie.h"
+
+NAMESPACEBEGIN
+
+// UnaryCounts 每隔多少个 0 记录一次位置
+#define kSelectSample 64
+
+// x 中第 i 个字节是其低 i + 1 个字节中 1 的个数，最高字节即总数。
+// 不依赖 popcnt 指令（x86-64 默认不能假定有），__builtin_popcountll 在
+// 没有时是函数调用，慢得多
+static inline quint64 bytePrefixCounts(quint64 x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return x * 0x0101010101010101ull;
+}
+
+// x 中第 rest 个 1 的位置（rest 从 0 起），须小于 x 中 1 的个数
+static inline size_t selectInWord(quint64 x, size_t rest)
+{
+    const quint64 prefix = bytePrefixCounts(x);
+    size_t shift = 0;
+    while (((prefix >> shift) & 0xff) <= rest) shift += 8;
+    if (shift > 0) rest -= size_t((prefix >> (shift - 8)) & 0xff);
+    x >>= shift;
+    for (; rest > 0; rest--) x &= x - 1;
+    return shift + size_t(lowestBit64(x));
+}
+
+void PackedInts::build(const std::vector<quint32> &values)
+{
+    quint32 maxValue = 0;
+    for (size_t i = 0; i < values.size(); i++) maxValue |= values[i];
+    width_ = 1;
+    while (width_ < 32 && (maxValue >> width_) != 0) width_++;
+    mask_ = quint32((quint64(1) << width_) - 1);
+
+    bits_.assign((values.size() * size_t(width_) + 63) / 64 + 1, 0);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        const size_t pos = i * size_t(width_);
+        const unsigned s = unsigned(pos & 63);
+        bits_[pos >> 6] |= quint64(values[i]) << s;
+        if (s + unsigned(width_) > 64) bits_[(pos >> 6) + 1] |= quint64(values[i]) >> (64 - s);
+    }
+}
+
+size_t PackedInts::memoryUsage() const
+{
+    return bits_.size() * sizeof (quint64);
+}
+
+void UnaryCounts::append(quint32 n)
+{
+    // 1 逐个写入，建立时的开销无所谓
+    for (quint32 i = 0; i <= n; i++)
+    {
+        if (0 == (bit_num_ & 63)) bits_.push_back(0);
+        if (i < n) bits_.back() |= quint64(1) << (bit_num_ & 63);
+        bit_num_++;
+    }
+    count_num_++;
+}
+
+void UnaryCounts::finish()
+{
+    // 末尾补一个全 0 的字，nextZero 总能在范围内停下
+    bits_.push_back(0);
+    bits_.shrink_to_fit();
+    samples_.clear();
+    size_t zeros = 0;
+    for (size_t pos = 0; pos < bit_num_; pos++)
+    {
+        if (bits_[pos >> 6] >> (pos & 63) & 1) continue;
+        if (0 == zeros % kSelectSample) samples_.push_back(quint32(pos));
+        zeros++;
+    }
+    samples_.shrink_to_fit();
+}
+
+size_t UnaryCounts::select0(size_t k) const
+{
+    Q_ASSERT(k < count_num_);
+    size_t pos = samples_[k / kSelectSample];
+    size_t rest = k % kSelectSample;
+    // 从记录的 0 开始（含）数到第 rest 个 0
+    size_t w = pos >> 6;
+    quint64 x = ~bits_[w] & (~quint64(0) << (pos & 63));
+    for (;;)
+    {
+        const size_t c = size_t(bytePrefixCounts(x) >> 56);
+        if (rest < c) break;
+        rest -= c;
+        x = ~bits_[++w];
+    }
+    return (w << 6) + selectInWord(x, rest);
+}
+
+size_t UnaryCounts::memoryUsage() const
+{
+    return bits_.size() * sizeof (quint64) + samples_.size() * sizeof (quint32);
+}
+
+void LoudsTrie::addNode(quint16 splIdx, quint32 sonNum, const quint32 *lemmaIds, quint32 homoNum)
+{
+    shape_.append(sonNum);
+    homo_.append(homoNum);
+    spl_tmp_.push_back(splIdx);
+    ids_tmp_.insert(ids_tmp_.end(), lemmaIds, lemmaIds + homoNum);
+}
+
+void LoudsTrie::finish()
+{
+    shape_.finish();
+    homo_.finish();
+    spl_.build(spl_tmp_);
+    ids_.build(ids_tmp_);
+    std::vector<quint32>().swap(spl_tmp_);
+    std::vector<quint32>().swap(ids_tmp_);
+}
+
+size_t LoudsTrie::splRange(size_t first, size_t num, quint16 idStart, quint16 idEnd,
+                           size_t *last) const
+{
+    // 子节点按拼音 id 升序，两端各做一次二分查找（lower bound）
+    size_t lo = 0, len = num;
+    while (len > 0)
+    {
+        const size_t half = len / 2;
+        if (spl_.at(first + lo + half) < idStart)
+        {
+            lo += half + 1;
+            len -= half + 1;
+        }
+        else len = half;
+    }
+    size_t hi = lo;
+    len = num - lo;
+    while (len > 0)
+    {
+        const size_t half = len / 2;
+        if (spl_.at(first + hi + half) < idEnd)
+        {
+            hi += half + 1;
+            len -= half + 1;
+        }
+        else len = half;
+    }
+    *last = hi;
+    return lo;
+}
+
+size_t LoudsTrie::memoryUsage() const
+{
+    return shape_.memoryUsage() + homo_.memoryUsage() +
+            spl_.memoryUsage() + ids_.memoryUsage() + sizeof (*this);
+}
+
+NAMESPACEEND
@@ -0,0 +1,157 @@
+#ifndef LOUDSTRIE_H
+#define LOUDSTRIE_H
+
+#include "dictdef.h"
+#include <vector>
+#include <string.h>
+
+NAMESPACEBEGIN
+
+/**
+ * 按位紧凑存放的无符号整数，每个占同样的位数，即最大值所需的位数。
+ */
+class PackedInts
+{
+public:
+    PackedInts() : width_(0), mask_(0) { }
+
+    void build(const std::vector<quint32> &values);
+    inline quint32 at(size_t i) const;
+    inline int width() const { return width_; }
+    size_t memoryUsage() const;
+
+private:
+    // 低位在前，末尾多一个字，at 读 8 个字节不会越界
+    std::vector<quint64> bits_;
+    int width_;
+    quint32 mask_;
+};
+
+/**
+ * 一串计数的一元编码：第 i 个计数 n 写为 n 个 1 和一个 0。
+ * 第 i 组的起点是第 i - 1 个 0 之后，它之前 1 的个数（即前 i 个计数之和）
+ * 就是起点减去 i，不必另存前缀和；第 i 个 0 的位置（select0）由每
+ * kSelectSample 个 0 记录一次的位置加上逐字的 popcount 求出。
+ */
+class UnaryCounts
+{
+public:
+    UnaryCounts() : bit_num_(0), count_num_(0) { }
+
+    // 依次追加计数，之后调用 finish
+    void append(quint32 n);
+    void finish();
+
+    // 第 i 个计数及它之前各计数的和
+    inline void get(quint32 i, size_t *sum, size_t *n) const;
+    inline quint32 size() const { return count_num_; }
+    size_t memoryUsage() const;
+
+private:
+    // 第 k 个 0 的位置（k 从 0 起）
+    size_t select0(size_t k) const;
+    // pos 处或之后第一个 0 的位置
+    inline size_t nextZero(size_t pos) const;
+
+    std::vector<quint64> bits_;
+    // 第 k * kSelectSample 个 0 的位置
+    std::vector<quint32> samples_;
+    size_t bit_num_;
+    quint32 count_num_;
+};
+
+/**
+ * 词条树的简洁表示（LOUDS），供最廉价的设备使用，见 DictTrie::buildSuccinct。
+ *
+ * 节点按层序重新编号，根为 0，第 0 层的节点编号与 root_ 中的下标相同。
+ * 树的形状是各节点子节点数的一元编码，同一节点的子节点编号连续，第一个
+ * 子节点的编号就是它之前所有节点的子节点数之和加 1。同音词条数也是一元
+ * 编码，之前的和就是它在词条 id 数组中的位置。拼音 id 和词条 id 都按所需
+ * 的最少位数存放。
+ *
+ * 随工程的词库有约 46k 个节点、65k 个词条 id，默认的表示查找时读取
+ * root_、各列和 3 字节的词条 id，共 739KB，这里为 210KB。每个字段都要
+ * 现场解出，逐键查找约慢 1.3 ~ 2 倍（bench 中的 search.succinct）。
+ */
+class LoudsTrie
+{
+public:
+    // 按层序依次加入节点，之后调用 finish。lemmaIds 为同音词条的 id
+    void addNode(quint16 splIdx, quint32 sonNum, const quint32 *lemmaIds, quint32 homoNum);
+    void finish();
+
+    inline quint32 nodeNum() const { return shape_.size(); }
+    // 节点 node 的第一个子节点和子节点数
+    inline void sons(quint32 node, size_t *first, size_t *num) const;
+    // 节点 node 的同音词条在 lemmaId 中的位置和个数
+    inline void homos(quint32 node, size_t *off, size_t *num) const;
+    inline quint16 splIdx(quint32 node) const;
+    inline quint32 lemmaId(size_t off) const;
+    // 子节点 [first, first + num) 中拼音 id 落在 [idStart, idEnd) 的一段，
+    // 同 splRange，返回起点，*last 为终点，都是相对 first 的位置
+    size_t splRange(size_t first, size_t num, quint16 idStart, quint16 idEnd,
+                    size_t *last) const;
+    size_t memoryUsage() const;
+
+private:
+    UnaryCounts shape_;
+    UnaryCounts homo_;
+    PackedInts spl_;
+    PackedInts ids_;
+    // 建立时暂存，finish 后释放
+    std::vector<quint32> spl_tmp_;
+    std::vector<quint32> ids_tmp_;
+};
+
+
+quint32 PackedInts::at(size_t i) const
+{
+    // 与词库的其他部分一样按小端读取，width_ 不超过 32，去掉字节内的
+    // 偏移后 8 个字节总够用
+    const size_t pos = i * size_t(width_);
+    quint64 v;
+    memcpy(&v, reinterpret_cast<const char *>(bits_.data()) + (pos >> 3), sizeof (v));
+    return quint32(v >> (pos & 7)) & mask_;
+}
+
+size_t UnaryCounts::nextZero(size_t pos) const
+{
+    size_t w = pos >> 6;
+    quint64 x = ~bits_[w] & (~quint64(0) << (pos & 63));
+    while (0 == x) x = ~bits_[++w];
+    return (w << 6) + size_t(lowestBit64(x));
+}
+
+void UnaryCounts::get(quint32 i, size_t *sum, size_t *n) const
+{
+    Q_ASSERT(i < count_num_);
+    const size_t start = i > 0? select0(i - 1) + 1: 0;
+    *n = nextZero(start) - start;
+    *sum = start - i;
+}
+
+void LoudsTrie::sons(quint32 node, size_t *first, size_t *num) const
+{
+    // 根不是任何节点的子节点，子节点的编号从 1 开始
+    shape_.get(node, first, num);
+    (*first)++;
+}
+
+void LoudsTrie::homos(quint32 node, size_t *off, size_t *num) const
+{
+    homo_.get(node, off, num);
+}
+
+quint16 LoudsTrie::splIdx(quint32 node) const
+{
+    return quint16(spl_.at(node));
+}
+
+quint32 LoudsTrie::lemmaId(size_t off) const
+{
+    return ids_.at(off);
+}
+
+NAMESPACEEND
+
+#endif // LOUDSTRIE_H
@@ -1,17 +1,14 @@
 #include "ngram.h"
-#include <QFile>
 
 NAMESPACEBEGIN
 
 
-bool NGram::load(QFile &fp)
+bool NGram::load(DictReader &fp)
 {
     quint32 idx_num_;
-    if (fp.read((char *)&idx_num_, 4) != 4) return false;
-    lma_freq_idx_.resize(idx_num_);
-    if (fp.read((char*)freq_codes_, sizeof (freq_codes_)) != sizeof (freq_codes_)) return false;
-    if (fp.read((char*)lma_freq_idx_.data(), idx_num_) != idx_num_) return false;
-    return fp.atEnd();
+    if (!fp.read(&idx_num_, 4)) return false;
+    if (!fp.read(freq_codes_, sizeof (freq_codes_))) return false;
+    return fp.map(lma_freq_idx_, idx_num_);
 }
 
 
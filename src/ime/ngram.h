@@ -1,9 +1,7 @@
 #ifndef NGRAM_H
 #define NGRAM_H
 
-#include "dictdef.h"
-#include <QVector>
-class QFile;
+#include "dictreader.h"
 
 NAMESPACEBEGIN
 
@@ -13,10 +11,10 @@ typedef quint16 LmaScoreType;
 class NGram
 {
     LmaScoreType freq_codes_[kCodeBookSize];
-    QVector<CODEBOOK_TYPE> lma_freq_idx_;
+    ConstArray<CODEBOOK_TYPE> lma_freq_idx_;
 
 public:
-    bool load(QFile &fp);
+    bool load(DictReader &fp);
     inline LmaScoreType getUniPSB(quint32 lmaId) const;
 };
 
@@ -0,0 +1,361 @@
+#include "reverse.h"
+#include "dictionary.h"
+#include "dicttrie.h"
+#include "dictlist.h"
+#include "spellingtrie.h"
+#include <algorithm>
+#include <ctype.h>
+#include <string.h>
+
+NAMESPACEBEGIN
+
+ReverseIndex::ReverseIndex(const Dictionary *dict)
+{
+    const DictTrie *dt = dict->dictTrie();
+    const DictList *dl = dt->dictList();
+    const SpellingTrie *st = dict->spellingTrie();
+
+    // 每个长度为 n 的词条最多带来 n 个节点，先按这个上限建表，
+    // 再按实际的节点数（约为上限的一半）重建，表小一些更容易留在缓存中
+    size_t maxNodes = 0;
+    for (int i = 0; i < kMaxLemmaSize; i++)
+    {
+        maxNodes += size_t(dl->start_id_[i + 1] - dl->start_id_[i]) * (i + 1);
+    }
+    build(dt, maxNodes);
+    size_t used = 0;
+    for (size_t i = 0; i < nodes_.size(); i++) used += 0 != nodes_[i].ch;
+    build(dt, used);
+
+    splids_.assign(dl->start_pos_[kMaxLemmaSize], 0);
+    dt->enumLemmas([this, dl](quint32 id, const quint16 *splids, int len) {
+        // 树中有个别 id 超出了词条表，跳过
+        if (dl->getLemmaLen(id) != len) return;
+        memcpy(splids_.data() + dl->getLemmaPos(id, len), splids, len * sizeof (quint16));
+    });
+
+    const int splNum = int(st->getSpellingNum());
+    spellings_.assign(size_t(splNum) * kMaxSpellingSize, 0);
+    spelling_lens_.assign(splNum, 0);
+    for (int i = 0; i < splNum; i++)
+    {
+        const char *s = st->getSpellingStr(quint16(kFullSplIdStart + i));
+        char *d = spellings_.data() + size_t(i) * kMaxSpellingSize;
+        int len = 0;
+        while (s[len] && len < kMaxSpellingSize - 1)
+        {
+            d[len] = char(tolower(s[len]));
+            len++;
+        }
+        spelling_lens_[i] = quint8(len);
+    }
+}
+
+void ReverseIndex::build(const DictTrie *dt, size_t nodeNum)
+{
+    const DictList *dl = dt->dictList();
+    // 装载率不超过 1/2，查不到时的探测序列也很短
+    size_t size = 1024;
+    shift_ = 64 - 10;
+    while (size < nodeNum * 2)
+    {
+        size <<= 1;
+        shift_--;
+    }
+    Node empty;
+    memset(&empty, 0, sizeof (empty));
+    nodes_.assign(size, empty);
+    first_.assign(0x10000, kReverseRoot);
+    known_.assign(0x10000 / 32, 0);
+
+    for (quint32 id = dl->start_id_[0]; id < dl->start_id_[kMaxLemmaSize]; id++)
+    {
+        // 文字可能压缩存放，拷贝出来
+        char16_t key[kMaxLemmaSize];
+        const int len = dl->getLemmaStr(id, key, kMaxLemmaSize);
+        quint32 node = kReverseRoot;
+        for (int l = 0; l < len; l++)
+        {
+            if (kReverseRoot != node) nodes_[node].has_son = 1;
+            node = insert(node, key[l]);
+        }
+        first_[key[0]] = insert(kReverseRoot, key[0]);
+        // 同一文字的多个词条只保留最常用的读音
+        Node &n = nodes_[node];
+        const LmaScoreType psb = dt->getUniPSB(id);
+        if (kReverseNoLemma == n.pos || psb < n.psb)
+        {
+            n.pos = quint32(dl->getLemmaPos(id, len));
+            n.psb = psb;
+        }
+        if (1 == len) known_[key[0] >> 5] |= 1u << (key[0] & 31);
+    }
+}
+
+quint32 ReverseIndex::insert(quint32 parent, char16_t ch)
+{
+    Q_ASSERT(0 != ch);
+    const quint32 found = child(parent, ch);
+    if (kReverseRoot != found) return found;
+    const size_t mask = nodes_.size() - 1;
+    size_t i = slot(parent, ch);
+    while (0 != nodes_[i].ch) i = (i + 1) & mask;
+    Node &node = nodes_[i];
+    node.parent = parent;
+    node.ch = ch;
+    node.pos = kReverseNoLemma;
+    node.has_son = 0;
+    return quint32(i);
+}
+
+void ReverseIndex::annotate(const char16_t *text, int len, quint16 *splids) const
+{
+    int pos = 0;
+    while (pos < len)
+    {
+        if (!isKnown(text[pos]))
+        {
+            splids[pos++] = 0;
+            continue;
+        }
+        int end = pos + 1;
+        while (end < len && end - pos < kReverseWindow && isKnown(text[end])) end++;
+        const bool whole = end == len || !isKnown(text[end]);
+        pos += segment(text + pos, end - pos, whole, splids + pos);
+    }
+}
+
+int ReverseIndex::segment(const char16_t *text, int num, bool whole, quint16 *splids) const
+{
+    Q_ASSERT(num > 0 && num <= kReverseWindow);
+    Q_ASSERT(whole || num > 2 * kMaxLemmaSize);
+    // cost[i] 为 text[0, i) 最优切分的 psb 之和，其最后一个词在 buf_ 中的
+    // 位置为 pos[i]，长度为 len[i]。每个字都有单字词条，所以每个位置都可达。
+    quint32 cost[kReverseWindow + 1];
+    quint32 pos[kReverseWindow + 1];
+    quint8 len[kReverseWindow + 1];
+    cost[0] = 0;
+    for (int i = 1; i <= num; i++) cost[i] = 0xffffffffu;
+    for (int i = 0; i < num; i++)
+    {
+        const int maxLen = std::min(kMaxLemmaSize, num - i);
+        quint32 node = first_[text[i]];
+        for (int l = 1; ; l++)
+        {
+            const Node &n = nodes_[node];
+            if (kReverseNoLemma != n.pos)
+            {
+                const quint32 c = cost[i] + n.psb;
+                if (c < cost[i + l])
+                {
+                    cost[i + l] = c;
+                    pos[i + l] = n.pos;
+                    len[i + l] = quint8(l);
+                }
+            }
+            if (!n.has_son || l == maxLen) break;
+            node = child(node, text[i + l]);
+            if (kReverseRoot == node) break;
+        }
+    }
+
+    int end = num;
+    if (!whole)
+    {
+        // 每个词不超过 kMaxLemmaSize 个字，往前总能找到切分点
+        while (end > num - kMaxLemmaSize) end -= len[end];
+    }
+    for (int i = end; i > 0; )
+    {
+        const int l = len[i];
+        memcpy(splids + i - l, splids_.data() + pos[i], l * sizeof (quint16));
+        i -= l;
+    }
+    return end;
+}
+
+// 取出 s 开头的一个字符，返回其长度。编码不在 BMP 中或 UTF-8 不合法时
+// *ch 为 0，照原样复制即可。
+static inline int decodeChar(const char *s, size_t len, char16_t *ch)
+{
+    const quint8 c = quint8(s[0]);
+    if (c < 0x80)
+    {
+        *ch = c;
+        return 1;
+    }
+    if (c >= 0xe0 && c < 0xf0 && len >= 3 &&
+            (quint8(s[1]) & 0xc0) == 0x80 && (quint8(s[2]) & 0xc0) == 0x80)
+    {
+        *ch = char16_t(((c & 0x0f) << 12) | ((quint8(s[1]) & 0x3f) << 6) |
+                       (quint8(s[2]) & 0x3f));
+        return 3;
+    }
+    if (c >= 0xc0 && c < 0xe0 && len >= 2 && (quint8(s[1]) & 0xc0) == 0x80)
+    {
+        *ch = char16_t(((c & 0x1f) << 6) | (quint8(s[1]) & 0x3f));
+        return 2;
+    }
+    *ch = 0;
+    return 1;
+}
+
+static inline int decodeChar(const char16_t *s, size_t, char16_t *ch)
+{
+    *ch = s[0];
+    return 1;
+}
+
+template <class String>
+void ReverseIndex::convert(const typename String::value_type *text, size_t len,
+                           String &out) const
+{
+    char16_t run[kReverseWindow];
+    quint16 splids[kReverseWindow];
+    // run 中已收集的汉字个数
+    int num = 0;
+    // 下一个拼音前是否要加空格
+    bool space = false;
+    // text[copied, i) 是还未输出的其他内容
+    size_t copied = 0;
+    size_t i = 0;
+    while (i < len || num > 0)
+    {
+        char16_t ch = 0;
+        int n = 0;
+        bool known = false;
+        if (i < len)
+        {
+            n = decodeChar(text + i, len - i, &ch);
+            known = isKnown(ch);
+        }
+        if (known && num < kReverseWindow)
+        {
+            if (copied < i)
+            {
+                out.append(text + copied, i - copied);
+                space = false;
+            }
+            run[num++] = ch;
+            i += n;
+            copied = i;
+            continue;
+        }
+        if (num > 0)
+        {
+            // 连续的汉字结束或放满了窗口，当前字符在下一轮重新处理
+            const int done = segment(run, num, !known, splids);
+            // 拼音先写到 buf 中再一次追加。每个拼音补齐到 kMaxSpellingSize，
+            // 按定长复制后只前进实际的长度
+            char buf[kReverseWindow * kMaxSpellingSize + kMaxSpellingSize];
+            char *p = buf;
+            for (int k = 0; k < done; k++)
+            {
+                *p = ' ';
+                p += space;
+                space = true;
+                const size_t spl = size_t(splids[k] - kFullSplIdStart);
+                memcpy(p, spellings_.data() + spl * kMaxSpellingSize, kMaxSpellingSize);
+                p += spelling_lens_[spl];
+            }
+            out.append(buf, p);
+            num -= done;
+            memmove(run, run + done, num * sizeof (char16_t));
+            continue;
+        }
+        i += n;
+    }
+    out.append(text + copied, len - copied);
+}
+
+void ReverseIndex::toPinyin(const char16_t *text, size_t len, std::u16string &out) const
+{
+    convert(text, len, out);
+}
+
+void ReverseIndex::toPinyin(const char *text, size_t len, std::string &out) const
+{
+    convert(text, len, out);
+}
+
+// 块的最小长度，保证块中总有完整的字符
+#define kMinReverseBlock 4096
+
+ReverseConverter::ReverseConverter(const ReverseIndex *index, int threadNum)
+    : index_(index), pool_(threadNum), next_(0)
+{
+}
+
+// 在 data[begin, end) 中找到块的结尾：最后一个换行之后；一行比一块还长时
+// 为最后一个完整字符之后，截断处两侧的汉字分开切分
+static size_t cutBlock(const char *data, size_t begin, size_t end)
+{
+    for (size_t i = end; i > begin; i--)
+    {
+        if ('\n' == data[i - 1]) return i;
+    }
+    size_t lead = end;
+    while (lead > begin && end - lead < 4)
+    {
+        const quint8 c = quint8(data[--lead]);
+        if ((c & 0xc0) == 0x80) continue;
+        const size_t n = c < 0x80? 1: c < 0xe0? 2: c < 0xf0? 3: 4;
+        return lead + n > end? lead: end;
+    }
+    return end;
+}
+
+quint64 ReverseConverter::convert(const Reader &read, const Writer &write, size_t blockSize)
+{
+    blockSize = std::max<size_t>(blockSize, kMinReverseBlock);
+    // 每个线程几块，各块转换的快慢不同时负载仍然均衡
+    const size_t blockNum = size_t(threadNum()) * 4;
+    cuts_.resize(blockNum + 1);
+    outs_.resize(blockNum);
+
+    // 上一轮末尾不完整的一行留在 in 的开头
+    std::string in;
+    quint64 total = 0;
+    bool eof = false;
+    while (!eof || !in.empty())
+    {
+        size_t size = in.size();
+        in.resize(blockNum * blockSize);
+        while (!eof && size < in.size())
+        {
+            const size_t n = read(&in[size], in.size() - size);
+            if (0 == n) eof = true;
+            size += n;
+            total += n;
+        }
+        in.resize(size);
+
+        size_t num = 0;
+        cuts_[0] = 0;
+        while (num < blockNum && cuts_[num] < size)
+        {
+            const size_t begin = cuts_[num];
+            size_t end = std::min(begin + blockSize, size);
+            if (end < size || !eof) end = cutBlock(in.data(), begin, end);
+            if (end == begin) break;
+            cuts_[++num] = end;
+        }
+
+        next_ = 0;
+        pool_.run([this, &in, num](int) {
+            for (size_t b; (b = next_.fetch_add(1)) < num; )
+            {
+                outs_[b].clear();
+                index_->toPinyin(in.data() + cuts_[b], cuts_[b + 1] - cuts_[b], outs_[b]);
+            }
+        });
+        for (size_t b = 0; b < num; b++)
+        {
+            write(outs_[b].data(), outs_[b].size());
+        }
+        in.erase(0, cuts_[num]);
+    }
+    return total;
+}
+
+NAMESPACEEND
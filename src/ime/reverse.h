@@ -0,0 +1,161 @@
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include "threadpool.h"
+#include <atomic>
+#include <string>
+
+NAMESPACEBEGIN
+
+class Dictionary;
+class DictTrie;
+
+// 一次切分的最大字数，更长的连续汉字分窗口切分
+#define kReverseWindow 256
+// 一个拼音的最大长度（"zhuang"）加结束符
+#define kMaxSpellingSize 8
+#define kReverseRoot 0xffffffffu
+#define kReverseNoLemma 0x7fffffffu
+
+/**
+ * 汉字转拼音（反查）索引，由词库的全部词条建立，建立后只读，可被多个
+ * 线程共享。一般通过 Dictionary::reverseIndex() 取得。
+ *
+ * 所有词条的文字组成一棵按字展开的树，节点存放在开放寻址的哈希表中，
+ * 以（父节点, 字）为键，向后匹配时每多一个字查一次表，不需要比较字符串，
+ * 前缀不存在即可停止。同一文字有多个读音（即多个词条，如“行” xing/hang）
+ * 时只保留一元概率最高的一个。
+ * 连续的汉字按一元概率之积最大（psb 之和最小）切分，多字词中的字取词的
+ * 读音，以此区分多音字，如“银行”和“行走”。
+ */
+class ReverseIndex
+{
+    Q_DISABLE_COPY(ReverseIndex)
+public:
+    // 调用者需保证 dict 在索引销毁前有效
+    ReverseIndex(const Dictionary *dict);
+
+    // 是否为词库中的字（有单字词条）
+    inline bool isKnown(char16_t ch) const;
+    // 为 text 中每个字写入拼音 id，不在词库中的字为 0。不分配内存。
+    void annotate(const char16_t *text, int len, quint16 *splids) const;
+    // 全拼 id 的小写拼音，如 "zhong"
+    inline const char *getSpelling(quint16 splid, int *len) const;
+
+    // 把 text 中的汉字转换为拼音追加到 out，相邻汉字的拼音以空格分隔，
+    // 其余内容原样保留。
+    void toPinyin(const char16_t *text, size_t len, std::u16string &out) const;
+    // 同上，text 和 out 为 UTF-8
+    void toPinyin(const char *text, size_t len, std::string &out) const;
+
+private:
+    // 树的一个节点，即某个词条或词条的前缀
+    struct Node
+    {
+        // 父节点在 nodes_ 中的位置，第一个字为 kReverseRoot
+        quint32 parent;
+        // 0 表示空位
+        char16_t ch;
+        // 一元概率，同 LmaPsbItem::psb，越小越常用
+        quint16 psb;
+        // 词条在 DictList::buf_ 中的位置（见 getLemmaPos），只是前缀时为 kReverseNoLemma
+        quint32 pos:31;
+        // 是否有子节点，没有时不必再往后查
+        quint32 has_son:1;
+    };
+
+    inline size_t slot(quint32 parent, char16_t ch) const;
+    // 子节点的位置，不存在时返回 kReverseRoot
+    inline quint32 child(quint32 parent, char16_t ch) const;
+    quint32 insert(quint32 parent, char16_t ch);
+    // 按 nodeNum 个节点分配表，插入所有词条
+    void build(const DictTrie *dt, size_t nodeNum);
+    // 切分 text[0, num)，写入拼音 id，返回写入的字数。whole 为 false 时
+    // 后面还有汉字，结尾处的词可能被窗口截断，只写入到最后 kMaxLemmaSize
+    // 个字之前的切分点。
+    int segment(const char16_t *text, int num, bool whole, quint16 *splids) const;
+    template <class String>
+    void convert(const typename String::value_type *text, size_t len, String &out) const;
+
+    std::vector<Node> nodes_;
+    // 第一个字直接按编码索引到节点，没有时为 kReverseRoot
+    std::vector<quint32> first_;
+    // 哈希值映射到表中位置时右移的位数
+    int shift_;
+    // 与 DictList::buf_ 一一对应，每个字在其词条中的拼音 id
+    std::vector<quint16> splids_;
+    // 单字词条的位图，按字的编码索引
+    std::vector<quint32> known_;
+    // 小写拼音，每个占 kMaxSpellingSize 字节，不足的补 0
+    std::vector<char> spellings_;
+    std::vector<quint8> spelling_lens_;
+};
+
+/**
+ * 多线程转换大量 UTF-8 文本。输入按块读取，每块在换行处截断后分给各线程，
+ * 结果按输入的顺序写出，内存占用只与块大小和线程数有关。
+ * 同一个对象不要在多个线程中同时调用。
+ */
+class ReverseConverter
+{
+    Q_DISABLE_COPY(ReverseConverter)
+public:
+    // threadNum 为 0 时使用硬件线程数。调用者需保证 index 在对象销毁前有效。
+    ReverseConverter(const ReverseIndex *index, int threadNum = 0);
+
+    inline int threadNum() const;
+
+    // 反复调用 read 读取输入直到其返回 0，转换结果按顺序交给 write。
+    // 返回读取的字节数。
+    typedef std::function<size_t (char *buf, size_t size)> Reader;
+    typedef std::function<void (const char *data, size_t len)> Writer;
+    quint64 convert(const Reader &read, const Writer &write, size_t blockSize = 1 << 20);
+
+private:
+    const ReverseIndex *index_;
+    ThreadPool pool_;
+    // 本轮输入中各块的起止位置，及各块的结果
+    std::vector<size_t> cuts_;
+    std::vector<std::string> outs_;
+    std::atomic<size_t> next_;
+};
+
+
+bool ReverseIndex::isKnown(char16_t ch) const
+{
+    return known_[ch >> 5] & (1u << (ch & 31));
+}
+
+const char *ReverseIndex::getSpelling(quint16 splid, int *len) const
+{
+    const size_t i = size_t(splid - kFullSplIdStart);
+    Q_ASSERT(i < spelling_lens_.size());
+    *len = spelling_lens_[i];
+    return spellings_.data() + i * kMaxSpellingSize;
+}
+
+size_t ReverseIndex::slot(quint32 parent, char16_t ch) const
+{
+    const quint64 key = (quint64(parent) << 16) | ch;
+    return size_t((key * 0x9e3779b97f4a7c15ull) >> shift_);
+}
+
+quint32 ReverseIndex::child(quint32 parent, char16_t ch) const
+{
+    const size_t mask = nodes_.size() - 1;
+    for (size_t i = slot(parent, ch); ; i = (i + 1) & mask)
+    {
+        const Node &node = nodes_[i];
+        if (node.ch == ch && node.parent == parent) return quint32(i);
+        if (0 == node.ch) return kReverseRoot;
+    }
+}
+
+int ReverseConverter::threadNum() const
+{
+    return pool_.threadNum();
+}
+
+NAMESPACEEND
+
+#endif // REVERSE_H
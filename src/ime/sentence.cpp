@@ -0,0 +1,182 @@
+#include "sentence.h"
+#include "dicttrie.h"
+#include "deadline.h"
+#include <algorithm>
+
+NAMESPACEBEGIN
+
+typedef std::chrono::steady_clock Clock;
+
+SentenceDecoder::SentenceDecoder(const DictTrie *dt, const SpellingTrie *st)
+    : dt_(dt), st_(st)
+{
+    frontier_ = new LmaFrontier;
+    setBudget(0, kSentenceDefaultBudgetUs);
+    reset();
+}
+
+SentenceDecoder::~SentenceDecoder()
+{
+    delete frontier_;
+}
+
+void SentenceDecoder::setBudget(int maxSteps, int maxMicros)
+{
+    max_steps_ = std::max(maxSteps, 0);
+    max_time_ = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::microseconds(std::max(maxMicros, 0)));
+}
+
+void SentenceDecoder::reset()
+{
+    num_ = 0;
+    steps_ = 0;
+    ready_ = false;
+    pending_ = false;
+    lemma_num_ = 0;
+    text_len_ = 0;
+    frontier_->reset();
+}
+
+void SentenceDecoder::setFuzzy(const FuzzyTable *fuzzy)
+{
+    frontier_->fuzzy = fuzzy;
+    reset();
+}
+
+void SentenceDecoder::copyFrom(const SentenceDecoder &other)
+{
+    Q_ASSERT(dt_ == other.dt_ && st_ == other.st_);
+    num_ = other.num_;
+    memcpy(spl_, other.spl_, sizeof (quint16) * num_);
+    memcpy(edges_, other.edges_, sizeof (edges_[0]) * num_);
+    memcpy(done_, other.done_, num_);
+    memcpy(paths_, other.paths_, sizeof (paths_[0]) * (num_ + 1));
+    memcpy(path_num_, other.path_num_, num_ + 1);
+    steps_ = other.steps_;
+    ready_ = other.ready_;
+    pending_ = other.pending_;
+    lemma_num_ = other.lemma_num_;
+    memcpy(lemmas_, other.lemmas_, sizeof (LmaPsbItem) * lemma_num_);
+    text_len_ = other.text_len_;
+    memcpy(text_, other.text_, sizeof (char16_t) * text_len_);
+}
+
+bool SentenceDecoder::decode(const quint16 *splids, int num, const Deadline *deadline)
+{
+    Q_ASSERT(num >= 0 && num < kMaxRowNum);
+    const Clock::time_point start = Clock::now();
+    steps_ = 0;
+    ready_ = false;
+    pending_ = false;
+
+    // 覆盖到公共前缀之后的边作废
+    int common = 0;
+    while (common < num_ && common < num && spl_[common] == splids[common]) common++;
+    for (int j = 0; j < num; j++)
+    {
+        const int valid = j < num_? std::max(0, common - j): 0;
+        done_[j] = quint8(std::min<int>(j < num_? done_[j]: 0, valid));
+    }
+    memcpy(spl_, splids, sizeof (quint16) * num);
+    num_ = num;
+    if (0 == num) return false;
+
+    for (int j = 0; j < num; j++)
+    {
+        const int want = std::min(kMaxLemmaSize, num - j);
+        if (done_[j] >= want) continue;
+        // 每次至少前进一个起点
+        if (steps_ > 0 && ((max_steps_ > 0 && steps_ >= max_steps_) ||
+                           (max_time_.count() > 0 && Clock::now() - start >= max_time_) ||
+                           (pNull != deadline && deadline->expired())))
+        {
+            pending_ = true;
+            return false;
+        }
+        // 展开多的起点（如一串声母）本身就可能超时，deadline 也传给展开
+        if (!dt_->getBestLemmas(spl_ + j, want, frontier_, st_, edges_[j], deadline))
+        {
+            pending_ = true;
+            return false;
+        }
+        done_[j] = quint8(want);
+        steps_++;
+    }
+    if (pNull != deadline && deadline->expired())
+    {
+        pending_ = true;
+        return false;
+    }
+    search();
+    return ready_;
+}
+
+void SentenceDecoder::search()
+{
+    path_num_[0] = 1;
+    paths_[0][0].cost = 0;
+    paths_[0][0].lma_len = 0;
+    for (int i = 1; i <= num_; i++)
+    {
+        Path *best = paths_[i];
+        int n = 0;
+        for (int l = 1; l <= std::min(kMaxLemmaSize, i); l++)
+        {
+            const int j = i - l;
+            const LmaPsbItem &edge = edges_[j][l - 1];
+            if (0 == edge.lma_len) continue;
+            for (int k = 0; k < path_num_[j]; k++)
+            {
+                const quint32 cost = paths_[j][k].cost + edge.psb;
+                if (n == kSentenceBeam && cost >= best[n - 1].cost) break;
+                // 插入按 cost 升序的 best 中，满了则挤掉最后一条
+                int p = std::min(n, kSentenceBeam - 1);
+                while (p > 0 && best[p - 1].cost > cost)
+                {
+                    best[p] = best[p - 1];
+                    p--;
+                }
+                best[p].cost = cost;
+                best[p].prev = quint8(j);
+                best[p].prev_k = quint8(k);
+                best[p].lma_len = quint8(l);
+                best[p].id = edge.id;
+                if (n < kSentenceBeam) n++;
+            }
+        }
+        path_num_[i] = quint8(n);
+    }
+    if (0 == path_num_[num_]) return;
+
+    ready_ = true;
+    lemma_num_ = getPath(0, lemmas_, kMaxRowNum);
+    text_len_ = 0;
+    for (int i = 0; i < lemma_num_; i++)
+    {
+        const int len = lemmas_[i].lma_len;
+        dt_->copyLemma(lemmas_[i].id, len, text_ + text_len_);
+        text_len_ += len;
+    }
+}
+
+int SentenceDecoder::getPath(int k, LmaPsbItem *items, int maxNum) const
+{
+    if (k < 0 || k >= pathNum()) return 0;
+    int n = 0;
+    for (int i = num_; i > 0; )
+    {
+        const Path &p = paths_[i][k];
+        if (n == maxNum) return 0;
+        items[n].id = p.id;
+        items[n].lma_len = p.lma_len;
+        items[n].psb = quint16(p.cost - paths_[p.prev][p.prev_k].cost);
+        n++;
+        i = p.prev;
+        k = p.prev_k;
+    }
+    std::reverse(items, items + n);
+    return n;
+}
+
+NAMESPACEEND
@@ -0,0 +1,153 @@
+#ifndef SENTENCE_H
+#define SENTENCE_H
+
+#include "candidates.h"
+#include <chrono>
+
+NAMESPACEBEGIN
+
+class DictTrie;
+class SpellingTrie;
+class FuzzyTable;
+struct LmaFrontier;
+class Deadline;
+
+// 每个位置保留的部分句子数
+#define kSentenceBeam 4
+// 默认的时间预算，微秒
+#define kSentenceDefaultBudgetUs 1000
+
+/**
+ * 整句解码：把拼音 id 串切分为若干词条，使各词条一元概率之积最大（psb
+ * 之和最小），组成一个句子。词库中没有二元概率，只使用一元概率。
+ *
+ * 对每个起点 j 展开一次词库树，得到 spl[j, j + l) 完全匹配的词条中 psb
+ * 最小的一个，作为从 j 到 j + l 的边。再从左到右对每个位置保留最好的
+ * kSentenceBeam 条部分句子，最后得到的第 k 条即第 k 好的句子。
+ *
+ * 边只依赖于它覆盖的拼音 id，输入与上次有公共前缀时（逐键输入）只需计算
+ * 末尾几个起点。每次 decode 可以限定计算的起点数和时间，预算用完时先返回，
+ * 已算好的边保留到下次调用继续，所以很长的输入也不会让一次按键超时。
+ * 超时检查在每个起点之间进行，一个起点最多展开 kMaxLemmaSize 层；
+ * deadline 还在展开每层之前和最后的搜索之前检查。
+ *
+ * 存储都是定长的，decode 不分配内存（展开节点特别多时 LmaFrontier 除外）。
+ */
+class SentenceDecoder
+{
+    Q_DISABLE_COPY(SentenceDecoder)
+public:
+    // 调用者需保证 dt 和 st 在对象销毁前有效
+    SentenceDecoder(const DictTrie *dt, const SpellingTrie *st);
+    ~SentenceDecoder();
+
+    // 每次 decode 最多计算 maxSteps 个起点、用时最多约 maxMicros 微秒，
+    // 0 表示不限。默认只限时间，为 kSentenceDefaultBudgetUs。
+    void setBudget(int maxSteps, int maxMicros);
+    // 解码 splids[0, num)。得到完整的句子时返回 true；预算用完、deadline
+    // 到期或某处没有词条可用时返回 false，此时没有句子。
+    bool decode(const quint16 *splids, int num, const Deadline *deadline = pNull);
+    // 忘记之前的输入和已算好的边
+    void reset();
+    // 使用模糊音表（为空时精确匹配），调用者需保证其在使用期间有效。
+    // 之前算好的边作废。
+    void setFuzzy(const FuzzyTable *fuzzy);
+    // 复制结果和已算好的边，两者须使用相同的模糊音规则
+    void copyFrom(const SentenceDecoder &other);
+
+    // 最近一次 decode 是否得到了句子
+    inline bool isReady() const;
+    // 最近一次 decode 是否因预算或 deadline 没有算完
+    inline bool isPending() const;
+    // 最好的句子的词条，依次覆盖全部拼音 id
+    inline int lemmaNum() const;
+    inline const LmaPsbItem &lemma(int i) const;
+    // 最好的句子的文字
+    inline const char16_t *text(int *len) const;
+    // 得到的句子个数，不超过 kSentenceBeam
+    inline int pathNum() const;
+    // 第 k 好的句子的词条写入 items，返回词条数，maxNum 不够时返回 0
+    int getPath(int k, LmaPsbItem *items, int maxNum) const;
+    // 最近一次 decode 计算的起点数
+    inline int lastSteps() const;
+
+private:
+    // 到达某位置的一条部分句子
+    struct Path
+    {
+        quint32 cost;
+        // 上一个位置及其中的第几条
+        quint8 prev;
+        quint8 prev_k;
+        // 最后一个词条
+        quint8 lma_len;
+        quint32 id;
+    };
+
+    void search();
+
+    const DictTrie *dt_;
+    const SpellingTrie *st_;
+    LmaFrontier *frontier_;
+    int max_steps_;
+    std::chrono::steady_clock::duration max_time_;
+
+    int num_;
+    quint16 spl_[kMaxRowNum];
+    // edges_[j][l - 1] 为从 j 开始长度为 l 的最好词条，没有时 lma_len 为 0。
+    // 起点 j 的前 done_[j] 个长度已算好。
+    LmaPsbItem edges_[kMaxRowNum][kMaxLemmaSize];
+    quint8 done_[kMaxRowNum];
+    Path paths_[kMaxRowNum + 1][kSentenceBeam];
+    quint8 path_num_[kMaxRowNum + 1];
+    int steps_;
+
+    bool ready_;
+    bool pending_;
+    int lemma_num_;
+    LmaPsbItem lemmas_[kMaxRowNum];
+    int text_len_;
+    char16_t text_[kMaxRowNum];
+};
+
+
+bool SentenceDecoder::isReady() const
+{
+    return ready_;
+}
+
+bool SentenceDecoder::isPending() const
+{
+    return pending_;
+}
+
+int SentenceDecoder::lemmaNum() const
+{
+    return ready_? lemma_num_: 0;
+}
+
+const LmaPsbItem &SentenceDecoder::lemma(int i) const
+{
+    Q_ASSERT(i >= 0 && i < lemmaNum());
+    return lemmas_[i];
+}
+
+const char16_t *SentenceDecoder::text(int *len) const
+{
+    *len = ready_? text_len_: 0;
+    return text_;
+}
+
+int SentenceDecoder::pathNum() const
+{
+    return ready_? path_num_[num_]: 0;
+}
+
+int SentenceDecoder::lastSteps() const
+{
+    return steps_;
+}
+
+NAMESPACEEND
+
+#endif // SENTENCE_H
@@ -1,5 +1,5 @@
 #include "spellingtrie.h"
-#include <QFile>
+#include <algorithm>
 
 NAMESPACEBEGIN
 
@@ -50,38 +50,80 @@ static inline bool isSzmChar(char ch)
     return isShengmuChar(ch) || isYunmuChar(ch);
 }
 
-void SpellingTrie::freeSonTrie(SpellingNode *node)
+// 一条模糊音规则的两种写法，写法同 getSpellingStr
+struct FuzzyPair
 {
-    if (pNull == node) return;
-    for (size_t pos = 0; pos < node->num_of_son; pos++)
+    quint32 rule;
+    const char *a;
+    const char *b;
+};
+
+static const FuzzyPair kFuzzyInitials[] = {
+    { kFuzzyZZh, "Z", "Zh" },
+    { kFuzzyCCh, "C", "Ch" },
+    { kFuzzySSh, "S", "Sh" },
+    { kFuzzyNL, "N", "L" },
+    { kFuzzyFH, "F", "H" },
+    { kFuzzyRL, "R", "L" }
+};
+
+static const FuzzyPair kFuzzyFinals[] = {
+    { kFuzzyAnAng, "AN", "ANG" },
+    { kFuzzyEnEng, "EN", "ENG" },
+    { kFuzzyInIng, "IN", "ING" },
+    { kFuzzyIanIang, "IAN", "IANG" },
+    { kFuzzyUanUang, "UAN", "UANG" }
+};
+
+// part 在规则下的所有写法，含其自身，写入 out，返回个数
+static int fuzzyVariants(const std::string &part, quint32 rules,
+                         const FuzzyPair *pairs, size_t pairNum, std::string *out)
+{
+    int num = 0;
+    out[num++] = part;
+    for (size_t i = 0; i < pairNum; i++)
     {
-        freeSonTrie(node->first_son + pos);
+        if (0 == (rules & pairs[i].rule)) continue;
+        if (part == pairs[i].a) out[num++] = pairs[i].b;
+        else if (part == pairs[i].b) out[num++] = pairs[i].a;
     }
-    if (pNull != node->first_son) delete [] node->first_son;
+    return num;
+}
+
+// 声母的长度：零声母为 0，zh/ch/sh 为 2
+static size_t initialLength(const char *spl)
+{
+    if ('A' == spl[0] || 'E' == spl[0] || 'O' == spl[0]) return 0;
+    return 'h' == spl[1]? 2: 1;
 }
 
-SpellingNode *SpellingTrie::constructSpellingsSubset(
+// Magic and version of the compiled spelling trie section
+static const char kCompiledTrieMagic[4] = { 'S', 'P', 'L', 'T' };
+#define kCompiledTrieVersion 1
+
+quint16 SpellingTrie::constructSpellingsSubset(
+        std::vector<SpellingNode> &nodes,
         size_t itemStart,
         size_t itemEnd,
         size_t level,
-        SpellingNode *parent)
+        quint16 parent)
 {
-    if (level >= spelling_size_ || itemEnd <= itemStart || pNull == parent)
+    if (level >= spelling_size_ || itemEnd <= itemStart)
     {
-        return pNull;
+        return 0;
     }
-    SpellingNode *firstSon = pNull;
+    quint16 firstSon = 0;
     quint16 numOfSon = 0;
     quint8 minSonScore = 255;
 
-    const char *spellingLastStart = spelling_buf_ + spelling_size_ * itemStart;
+    const char *spellingLastStart = spelling_buf_.data() + spelling_size_ * itemStart;
     char charForNode = spellingLastStart[level];
     Q_ASSERT((charForNode >= 'A' && charForNode <= 'Z') || 'h' == charForNode);
 
     // Scan the array to find how many sons
     for (size_t i = itemStart + 1; i < itemEnd; i++)
     {
-        const char *spellingCurrent = spelling_buf_ + spelling_size_ * i;
+        const char *spellingCurrent = spelling_buf_.data() + spelling_size_ * i;
         char charCurrent = spellingCurrent[level];
         if (charCurrent != charForNode)
         {
@@ -92,13 +134,15 @@ SpellingNode *SpellingTrie::constructSpellingsSubset(
     numOfSon++;
 
     // Allocate memory
-    firstSon = new SpellingNode[numOfSon];
-    memset(firstSon, 0, sizeof(SpellingNode) * numOfSon);
+    // 子节点追加到数组末尾，递归过程中数组可能重新分配，所以只保存下标
+    firstSon = quint16(nodes.size());
+    nodes.resize(firstSon + numOfSon);
+    memset(nodes.data() + firstSon, 0, sizeof(SpellingNode) * numOfSon);
 
     // Now begin construct tree
     size_t sonPos = 0;
 
-    spellingLastStart = spelling_buf_ + spelling_size_ * itemStart;
+    spellingLastStart = spelling_buf_.data() + spelling_size_ * itemStart;
     charForNode = spellingLastStart[level];
 
     bool spellingEndable = true;
@@ -114,20 +158,21 @@ SpellingNode *SpellingTrie::constructSpellingsSubset(
     {
         if (i != itemEnd)
         {
-            spellingCurrent = spelling_buf_ + spelling_size_ * i;
+            spellingCurrent = spelling_buf_.data() + spelling_size_ * i;
             charCurrent = spellingCurrent[level];
             Q_ASSERT(isValidSplChar(charCurrent));
             if (charCurrent == charForNode) continue;
         }
 
         // Construct a node
-        SpellingNode *nodeCurrent = firstSon + sonPos;
+        const quint16 current = quint16(firstSon + sonPos);
+        SpellingNode *nodeCurrent = nodes.data() + current;
         nodeCurrent->char_this_node = charForNode;
 
         // For quick search in the first level
         if (0 == level)
         {
-            level1_sons_[charForNode - 'A'] = nodeCurrent;
+            level1_sons_[charForNode - 'A'] = current;
         }
         if (spellingEndable)
         {
@@ -141,8 +186,11 @@ SpellingNode *SpellingTrie::constructSpellingsSubset(
             {
                 realStart++;
             }
-            nodeCurrent->first_son =
-                    constructSpellingsSubset(realStart, i, level + 1, nodeCurrent);
+            const quint16 sonStart =
+                    constructSpellingsSubset(nodes, realStart, i, level + 1, current);
+            // The array may have been reallocated by the recursion.
+            nodeCurrent = nodes.data() + current;
+            nodeCurrent->first_son = sonStart;
 
             if (realStart == itemStartNext + 1)
             {
@@ -155,7 +203,7 @@ SpellingNode *SpellingTrie::constructSpellingsSubset(
         }
         else
         {
-            nodeCurrent->first_son = pNull;
+            nodeCurrent->first_son = 0;
             nodeCurrent->score = quint8(spellingLastStart[spelling_size_ - 1]);
         }
 
@@ -217,41 +265,37 @@ SpellingNode *SpellingTrie::constructSpellingsSubset(
         }
     }
 
-    parent->num_of_son = numOfSon;
-    parent->score = minSonScore;
+    nodes[parent].num_of_son = numOfSon;
+    nodes[parent].score = minSonScore;
     return firstSon;
 }
 
 bool SpellingTrie::buildF2H()
 {
-    f2h_ = new quint16[spelling_num_];
-    Q_ASSERT(f2h_);
+    std::vector<quint16> f2h(spelling_num_);
 
     for (quint16 hid = 0; hid < kFullSplIdStart; hid++)
     {
         int h2fEnd = h2f_start_[hid] + h2f_num_[hid];
         for (quint16 fid = h2f_start_[hid]; fid < h2fEnd; fid++)
         {
-            f2h_[fid - kFullSplIdStart] = hid;
+            f2h[fid - kFullSplIdStart] = hid;
         }
     }
+    f2h_.adopt(f2h);
     return true;
 }
 
 SpellingTrie::SpellingTrie()
 {
-    spelling_buf_ = pNull;
     spelling_size_ = 0;
     spelling_num_ = 0;
-    f2h_ = pNull;
-    memset(&root, 0, sizeof(SpellingNode));
+    compiled_ = false;
+    dfa_rows_ = 0;
 }
 
 SpellingTrie::~SpellingTrie()
 {
-    freeSonTrie(&root);
-    if (f2h_)          delete [] f2h_;
-    if (spelling_buf_) delete [] spelling_buf_;
 }
 
 bool SpellingTrie::ifValidIdUpdate(quint16 &splid) const
@@ -302,32 +346,269 @@ quint16 SpellingTrie::halfToFull(quint16 halfId, quint16 *splIdStart) const
     return h2f_num_[halfId];
 }
 
-bool SpellingTrie::loadSplTrie(QFile &fp)
+quint16 SpellingTrie::fullIdOf(const char *spl) const
+{
+    // 拼音表按字符串升序排列
+    size_t lo = 0, hi = spelling_num_;
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        const int c = strcmp(spelling_buf_.data() + mid * spelling_size_, spl);
+        if (0 == c) return quint16(kFullSplIdStart + mid);
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+void SpellingTrie::buildFuzzyTable(quint32 rules, FuzzyTable *table) const
 {
-    if (fp.read((char *)&spelling_size_, 4) != 4) return false;
-    if (fp.read((char *)&spelling_num_, 4) != 4) return false;
+    const size_t idNum = kFullSplIdStart + spelling_num_;
+    table->rules_ = rules;
+    table->offs_.assign(idNum + 1, 0);
+    table->ranges_.clear();
+
+    const size_t initialNum = sizeof (kFuzzyInitials) / sizeof (kFuzzyInitials[0]);
+    const size_t finalNum = sizeof (kFuzzyFinals) / sizeof (kFuzzyFinals[0]);
+    std::string initials[initialNum + 1];
+    std::string finals[finalNum + 1];
+    for (size_t id = 0; id < idNum; id++)
+    {
+        SplIdRange found[kMaxFuzzyRanges];
+        int num = 0;
+        if (isHalfId(quint16(id)))
+        {
+            quint16 start;
+            const quint16 n = halfToFull(quint16(id), &start);
+            if (n > 0)
+            {
+                found[num].start = start;
+                found[num].end = quint16(start + n);
+                num++;
+                // 简拼只有声母，用声母规则换成其他简拼
+                const char ch = kHalfId2Sc_[id];
+                std::string initial(1, char(ch & ~0x20));
+                if (ch >= 'a' && ch <= 'z') initial += 'h';
+                const int vn = fuzzyVariants(initial, rules, kFuzzyInitials, initialNum, initials);
+                for (int v = 1; v < vn; v++)
+                {
+                    const char c = 2 == initials[v].size()? char(initials[v][0] | 0x20): initials[v][0];
+                    const quint16 halfId = quint16(strchr(kHalfId2Sc_ + 1, c) - kHalfId2Sc_);
+                    const quint16 m = halfToFull(halfId, &start);
+                    if (0 == m) continue;
+                    Q_ASSERT(num < kMaxFuzzyRanges);
+                    found[num].start = start;
+                    found[num].end = quint16(start + m);
+                    num++;
+                }
+            }
+        }
+        else if (id >= kFullSplIdStart)
+        {
+            const char *spl = getSpellingStr(quint16(id));
+            const size_t len = initialLength(spl);
+            const int in = fuzzyVariants(std::string(spl, len), rules,
+                                         kFuzzyInitials, initialNum, initials);
+            const int fn = fuzzyVariants(std::string(spl + len), rules,
+                                         kFuzzyFinals, finalNum, finals);
+            for (int i = 0; i < in; i++)
+            {
+                for (int f = 0; f < fn; f++)
+                {
+                    const quint16 other = fullIdOf((initials[i] + finals[f]).c_str());
+                    if (0 == other) continue;
+                    Q_ASSERT(num < kMaxFuzzyRanges);
+                    found[num].start = other;
+                    found[num].end = quint16(other + 1);
+                    num++;
+                }
+            }
+        }
+
+        // 插入排序（最多 kMaxFuzzyRanges 个），再合并重叠和相邻的区间
+        for (int i = 1; i < num; i++)
+        {
+            const SplIdRange r = found[i];
+            int j = i;
+            for (; j > 0 && found[j - 1].start > r.start; j--) found[j] = found[j - 1];
+            found[j] = r;
+        }
+        table->offs_[id] = quint16(table->ranges_.size());
+        for (int i = 0; i < num; i++)
+        {
+            if (quint16(table->ranges_.size()) > table->offs_[id] &&
+                    found[i].start <= table->ranges_.back().end)
+            {
+                table->ranges_.back().end = std::max(table->ranges_.back().end, found[i].end);
+            }
+            else
+            {
+                table->ranges_.push_back(found[i]);
+            }
+        }
+    }
+    table->offs_[idNum] = quint16(table->ranges_.size());
+}
+
+bool SpellingTrie::loadSplTrie(DictReader &fp)
+{
+    if (!fp.read(&spelling_size_, 4)) return false;
+    if (!fp.read(&spelling_num_, 4)) return false;
 
     float scoreAmplifier;
     unsigned char averageScore;
-    if (fp.read((char *)&scoreAmplifier, sizeof(float)) != sizeof(float)) return false;
-    if (fp.read((char *)&averageScore, 1) != 1) return false;
+    if (!fp.read(&scoreAmplifier, sizeof(float))) return false;
+    if (!fp.read(&averageScore, 1)) return false;
 
-    spelling_buf_ = new char[spelling_size_ * spelling_num_];
-    if (pNull == spelling_buf_) return false;
+    return fp.map(spelling_buf_, qint64(spelling_size_) * spelling_num_);
+}
 
-    const int size = spelling_size_ * spelling_num_;
-    if (fp.read((char *)spelling_buf_, size) != size) return false;
+bool SpellingTrie::buildSplTrie()
+{
+    if (spelling_buf_.isEmpty()) return false;
 
-    memset(&root, 0, sizeof(SpellingNode));
-    memset(level1_sons_, 0, sizeof(SpellingNode*) * kValidSplCharNum);
+    memset(level1_sons_, 0, sizeof(quint16) * kValidSplCharNum);
 
     memset(h2f_start_, 0, sizeof(quint16) * kFullSplIdStart);
     memset(h2f_num_, 0, sizeof(quint16) * kFullSplIdStart);
 
-    root.first_son = constructSpellingsSubset(0, spelling_num_, 0, &root);
-    if (pNull == root.first_son) return false;
+    std::vector<SpellingNode> nodes(1);
+    memset(nodes.data(), 0, sizeof(SpellingNode));
+    quint16 firstSon = constructSpellingsSubset(nodes, 0, spelling_num_, 0, 0);
+    if (0 == firstSon) return false;
+    nodes[0].first_son = firstSon;
+    nodes_.adopt(nodes);
+    compiled_ = false;
+
+    return buildF2H() && buildDfa();
+}
+
+bool SpellingTrie::buildDfa()
+{
+    const int nodeNum = nodes_.size();
+    if (nodeNum < 2) return false;
+
+    // Number the states in breadth-first order, nodes with sons first, so
+    // that only they need a row in the transition table. A mapped trie may
+    // be corrupt: a node reached twice (a cycle or shared sons) shows up as
+    // more states than nodes, and stops the walk before it runs away.
+    std::vector<quint16> order;
+    std::vector<quint16> stateOf(nodeNum);
+    order.reserve(nodeNum);
+    order.push_back(0);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const SpellingNode &node = nodes_[order[i]];
+            for (int son = 0; son < node.num_of_son; son++)
+            {
+                const quint16 idx = quint16(node.first_son + son);
+                if ((0 == pass) == (nodes_[idx].num_of_son > 0))
+                {
+                    if (int(order.size()) >= nodeNum) return false;
+                    order.push_back(idx);
+                }
+            }
+        }
+        if (0 == pass) dfa_rows_ = quint16(order.size());
+    }
+    if (int(order.size()) != nodeNum) return false;
+    for (int i = 0; i < nodeNum; i++)
+    {
+        stateOf[order[i]] = quint16(i);
+    }
 
-    return buildF2H();
+    dfa_next_.assign(dfa_rows_ * kValidSplCharNum, 0);
+    dfa_info_.resize(nodeNum);
+    for (int state = 0; state < nodeNum; state++)
+    {
+        const SpellingNode &node = nodes_[order[state]];
+        quint16 id = node.spelling_idx;
+        dfa_info_[state] = ifValidIdUpdate(id)?
+                    quint16(id | kSplStateEndable | (isHalfId(id)? kSplStateHalfId: 0)): 0;
+
+        for (int son = 0; son < node.num_of_son; son++)
+        {
+            const quint16 idx = quint16(node.first_son + son);
+            const char ch = nodes_[idx].char_this_node;
+            int col;
+            if (ch >= 'a' && ch <= 'z') col = ch - 'a';
+            else if (ch >= 'A' && ch <= 'Z') col = ch - 'A';
+            else return false;
+            Q_ASSERT(state < dfa_rows_ && col < kValidSplCharNum);
+            dfa_next_[state * kValidSplCharNum + col] = stateOf[idx];
+        }
+    }
+    return true;
+}
+
+/**
+ * 预编译树段的布局（全部为 16 位或 32 位整数，与词库其他部分一样按本机字节序）：
+ * char[4] magic "SPLT", quint32 version, quint32 spelling_num, quint32 node_num,
+ * quint16 level1_sons_[kValidSplCharNum],
+ * quint16 h2f_start_[kFullSplIdStart], quint16 h2f_num_[kFullSplIdStart],
+ * SpellingNode nodes[node_num], quint16 f2h_[spelling_num]
+ */
+void SpellingTrie::saveCompiledTrie(std::string &buf) const
+{
+    const quint32 version = kCompiledTrieVersion;
+    const quint32 nodeNum = nodes_.size();
+    buf.append(kCompiledTrieMagic, 4);
+    buf.append((const char *)&version, 4);
+    buf.append((const char *)&spelling_num_, 4);
+    buf.append((const char *)&nodeNum, 4);
+    buf.append((const char *)level1_sons_, sizeof (level1_sons_));
+    buf.append((const char *)h2f_start_, sizeof (h2f_start_));
+    buf.append((const char *)h2f_num_, sizeof (h2f_num_));
+    buf.append((const char *)nodes_.data(), sizeof (SpellingNode) * nodeNum);
+    buf.append((const char *)f2h_.data(), sizeof (quint16) * f2h_.size());
+}
+
+bool SpellingTrie::loadCompiledTrie(DictReader &fp)
+{
+    char magic[4];
+    quint32 version;
+    quint32 splNum;
+    quint32 nodeNum;
+    if (!fp.read(magic, 4) || memcmp(magic, kCompiledTrieMagic, 4) != 0) return false;
+    if (!fp.read(&version, 4) || version != kCompiledTrieVersion) return false;
+    if (!fp.read(&splNum, 4) || splNum != spelling_num_) return false;
+    if (!fp.read(&nodeNum, 4) || nodeNum < 2 || nodeNum > 0xffff) return false;
+    if (!fp.read(level1_sons_, sizeof (level1_sons_))) return false;
+    if (!fp.read(h2f_start_, sizeof (h2f_start_))) return false;
+    if (!fp.read(h2f_num_, sizeof (h2f_num_))) return false;
+    if (!fp.map(nodes_, nodeNum)) return false;
+    if (!fp.map(f2h_, splNum)) return false;
+
+    // 只做廉价的边界检查，保证之后的遍历不会越界
+    const quint32 idEnd = kFullSplIdStart + spelling_num_;
+    for (int i = 0; i < kValidSplCharNum; i++)
+    {
+        if (level1_sons_[i] >= nodeNum) return false;
+    }
+    for (int i = 0; i < kFullSplIdStart; i++)
+    {
+        if (quint32(h2f_start_[i]) + h2f_num_[i] > idEnd) return false;
+    }
+    for (quint32 i = 0; i < nodeNum; i++)
+    {
+        const SpellingNode &node = nodes_[int(i)];
+        if (node.spelling_idx >= idEnd) return false;
+        if (node.num_of_son > 0 &&
+                (0 == node.first_son ||
+                 quint32(node.first_son) + node.num_of_son > nodeNum))
+        {
+            return false;
+        }
+    }
+    for (quint32 i = 0; i < splNum; i++)
+    {
+        if (f2h_[int(i)] >= kFullSplIdStart) return false;
+    }
+    // 状态机建不起来时树也不可信，由调用者退回到现场构建
+    compiled_ = buildDfa();
+    return compiled_;
 }
 
 quint16 SpellingTrie::splstrToIdxs(
@@ -340,7 +621,100 @@ quint16 SpellingTrie::splstrToIdxs(
     if (pNull == splstr || 0 == maxSize || 0 == strLen) return 0;
     if (!SpellingTrie::isValidSplChar(splstr[0])) return 0;
 
-    const SpellingNode *nodeThis = &root;
+    const quint16 * const next = dfa_next_.data();
+    const quint16 * const info = dfa_info_.data();
+    const quint16 rows = dfa_rows_;
+    quint16 state = 0;
+
+    quint16 strPos = 0;
+    quint16 idxNum = 0;
+    if (pNull != startPos) startPos[0] = 0;
+    bool lastIsSplitter = false;
+
+    while (strPos < strLen)
+    {
+        char charThis = splstr[strPos];
+        // all characters outside of [a, z] are considered as splitters
+        if (!SpellingTrie::isValidSplChar(charThis))
+        {
+            // test if the current state is endable
+            if (info[state] & kSplStateEndable)
+            {
+                splIdx[idxNum] = info[state] & kSplStateIdMask;
+                idxNum++;
+                strPos++;
+                if (pNull != startPos) startPos[idxNum] = strPos;
+                if (idxNum >= maxSize) return idxNum;
+
+                state = 0;
+                lastIsSplitter = true;
+                continue;
+            }
+            else  if (lastIsSplitter)
+            {
+                strPos++;
+                if (pNull != startPos) startPos[idxNum] = strPos;
+                continue;
+            }
+            else
+            {
+                return idxNum;
+            }
+        }
+
+        lastIsSplitter = false;
+        const quint16 to = state < rows?
+                    next[state * kValidSplCharNum + ((charThis | 0x20) - 'a')]: 0;
+
+        // found, just move to the next state
+        if (0 != to)
+        {
+            state = to;
+        }
+        else
+        {
+            // not found, test if it is endable
+            if (info[state] & kSplStateEndable)
+            {
+                // endable, remember the index
+                splIdx[idxNum] = info[state] & kSplStateIdMask;
+
+                idxNum++;
+                if (pNull != startPos) startPos[idxNum] = strPos;
+                if (idxNum >= maxSize) return idxNum;
+                state = 0;
+                continue;
+            }
+            else
+            {
+                return idxNum;
+            }
+        }
+        strPos++;
+    }
+
+    if (info[state] & kSplStateEndable)
+    {
+        // endable, remember the index
+        splIdx[idxNum] = info[state] & kSplStateIdMask;
+        idxNum++;
+        if (pNull != startPos) startPos[idxNum] = strPos;
+    }
+    return idxNum;
+}
+
+quint16 SpellingTrie::splstrToIdxsTrie(
+        const char *splstr,
+        quint16 strLen,
+        quint16 splIdx[],
+        quint16 startPos[],
+        quint16 maxSize) const
+{
+    if (pNull == splstr || 0 == maxSize || 0 == strLen) return 0;
+    if (!SpellingTrie::isValidSplChar(splstr[0])) return 0;
+
+    const SpellingNode * const root = nodes_.data();
+    const SpellingNode *nodeThis = root;
 
     quint16 strPos = 0;
     quint16 idxNum = 0;
@@ -363,7 +737,7 @@ quint16 SpellingTrie::splstrToIdxs(
                 if (pNull != startPos) startPos[idxNum] = strPos;
                 if (idxNum >= maxSize) return idxNum;
 
-                nodeThis = &root;
+                nodeThis = root;
                 lastIsSplitter = true;
                 continue;
             }
@@ -380,26 +754,23 @@ quint16 SpellingTrie::splstrToIdxs(
         }
 
         lastIsSplitter = false;
-        SpellingNode *foundSon = pNull;
+        const SpellingNode *foundSon = pNull;
         if (0 == strPos)
         {
-            if (charThis >= 'a')
-            {
-                foundSon = level1_sons_[charThis - 'a'];
-            }
-            else
+            quint16 son = level1_sons_[charThis >= 'a'? charThis - 'a': charThis - 'A'];
+            if (0 != son)
             {
-                foundSon = level1_sons_[charThis - 'A'];
+                foundSon = root + son;
             }
         }
         else
         {
-            SpellingNode *firstSon = nodeThis->first_son;
+            const SpellingNode *firstSon = root + nodeThis->first_son;
             // Because for Zh/Ch/Sh nodes, they are the last in the buffer and
             // frequently used, so we scan from the end.
             for (int i = 0; i < nodeThis->num_of_son; i++)
             {
-                SpellingNode *thisSon = firstSon + i;
+                const SpellingNode *thisSon = firstSon + i;
                 if (SpellingTrie::isSameSplChar(thisSon->char_this_node, charThis))
                 {
                     foundSon = thisSon;
@@ -425,7 +796,7 @@ quint16 SpellingTrie::splstrToIdxs(
                 idxNum++;
                 if (pNull != startPos) startPos[idxNum] = strPos;
                 if (idxNum >= maxSize) return idxNum;
-                nodeThis = &root;
+                nodeThis = root;
                 continue;
             }
             else
@@ -1,18 +1,25 @@
 #ifndef SPELLINGTRIE_H
 #define SPELLINGTRIE_H
 
-#include "dictdef.h"
-#include <QtGlobal>
-class QFile;
+#include "dictreader.h"
+#include <string>
 
 NAMESPACEBEGIN
 
 
 
+// Flags of a state in the spelling DFA, see SpellingTrie::dfa_info_.
+#define kSplStateEndable 0x8000
+#define kSplStateHalfId  0x4000
+#define kSplStateIdMask  0x07ff
+
 // Node used for the trie of spellings
+// 所有节点存放在一个连续的数组中，[0] 是根节点，子节点以下标引用，
+// 因此建好的树可以原样保存到词库并直接映射回来。
 struct SpellingNode
 {
-    SpellingNode *first_son;
+    // Index of the first son in the node array, 0 if there is no son.
+    quint16 first_son;
     // The spelling id for each node. If you need more bits to store
     // spelling id, please adjust this structure.
     quint16 spelling_idx:11;
@@ -21,10 +28,71 @@ struct SpellingNode
     quint8 score;
 };
 
+/**
+ * 模糊音规则，可以任意组合。声母规则对全拼和声母简拼都有效，韵母规则
+ * 只对全拼有效。规则是成对的，不传递：同时打开 n/l 和 r/l 时，l 可以
+ * 匹配 n 和 r，但 n 不匹配 r。
+ */
+enum FuzzyRule
+{
+    kFuzzyZZh = 0x0001,
+    kFuzzyCCh = 0x0002,
+    kFuzzySSh = 0x0004,
+    kFuzzyNL = 0x0008,
+    kFuzzyFH = 0x0010,
+    kFuzzyRL = 0x0020,
+    kFuzzyAnAng = 0x0040,
+    kFuzzyEnEng = 0x0080,
+    kFuzzyInIng = 0x0100,
+    kFuzzyIanIang = 0x0200,
+    kFuzzyUanUang = 0x0400,
+    kFuzzyAll = 0x07ff
+};
+
+// 全拼 id 的区间 [start, end)
+struct SplIdRange
+{
+    quint16 start;
+    quint16 end;
+};
+
+// 一个拼音 id 最多对应的区间数。声母最多 3 种 × 韵母最多 2 种
+#define kMaxFuzzyRanges 6
+
+/**
+ * 一组模糊音规则下，每个拼音 id 可以匹配的全拼 id。
+ * 与 halfToFull 把简拼展开为一段连续的全拼 id 一样，这里把每个 id 预先
+ * 展开为几段互不相交、升序排列的区间，查找时逐段在子节点中取区间，一遍
+ * 展开即可，不需要对每种写法各查一次。由 SpellingTrie::buildFuzzyTable
+ * 建立，之后只读，约 3KB。
+ */
+class FuzzyTable
+{
+public:
+    inline FuzzyTable() : rules_(0) { }
+
+    inline quint32 rules() const { return rules_; }
+    // splid 可以匹配的区间，含其自身（简拼为 halfToFull 的区间），
+    // 返回区间数，不超过 kMaxFuzzyRanges
+    inline int ranges(quint16 splid, const SplIdRange **ranges) const
+    {
+        Q_ASSERT(size_t(splid) + 1 < offs_.size());
+        *ranges = ranges_.data() + offs_[splid];
+        return offs_[splid + 1] - offs_[splid];
+    }
+
+private:
+    friend class SpellingTrie;
+    quint32 rules_;
+    // 拼音 id 的区间在 ranges_ 中的位置，共 id 数 + 1 项
+    std::vector<quint16> offs_;
+    std::vector<SplIdRange> ranges_;
+};
+
 class  SpellingTrie
 {
     // The spelling table
-    char *spelling_buf_;
+    ConstArray<char> spelling_buf_;
 
     // The size of longest spelling string, includes '\0' and an extra char to
     // store score. For example, "zhuang" is the longgest item in Pinyin list,
@@ -36,11 +104,11 @@ class  SpellingTrie
     // Number of full spelling ids.
     quint32 spelling_num_;
 
-    // The root node of the spelling tree
-    SpellingNode root;
+    // Nodes of the spelling tree, the first one is the root.
+    ConstArray<SpellingNode> nodes_;
 
-    // Used to get the first level sons.
-    SpellingNode* level1_sons_[kValidSplCharNum];
+    // Used to get the first level sons. 0 if there is no such son.
+    quint16 level1_sons_[kValidSplCharNum];
 
     // The full spl_id range for specific half id.
     // h2f means half to full.
@@ -51,18 +119,34 @@ class  SpellingTrie
     quint16 h2f_num_[kFullSplIdStart];
 
     // Map from full id to half id.
-    quint16 *f2h_;
+    ConstArray<quint16> f2h_;
+
+    // 树是否来自词库中预先编译好的段
+    bool compiled_;
 
+    // 由树展开的确定性自动机，切分拼音时每个字符只需查一次表。
+    // 状态 0 是根节点；有子节点的状态排在前面，共 dfa_rows_ 个，只有它们
+    // 在 dfa_next_ 中占一行 kValidSplCharNum 个转移（按小写字母索引），
+    // 0 表示没有转移。约 230 行 x 26 x 2 字节，约 12KB。
+    std::vector<quint16> dfa_next_;
+    // 每个状态在此结束时输出的拼音 id（已按 ifValidIdUpdate 修正）以及
+    // kSplStateEndable / kSplStateHalfId 标志，不可结束的状态为 0。
+    std::vector<quint16> dfa_info_;
+    quint16 dfa_rows_;
 
-    void freeSonTrie(SpellingNode* node);
 
     // Construct a subtree using a subset of the spelling array (from
     // item_star to item_end).
     // Member spelliing_buf_ and spelling_size_ should be valid.
     // parent is used to update its num_of_son and score.
-    SpellingNode* constructSpellingsSubset(size_t itemStart, size_t itemEnd,
-                                           size_t level, SpellingNode *parent);
+    // 新节点追加到 nodes 中，返回第一个子节点的下标。
+    quint16 constructSpellingsSubset(std::vector<SpellingNode> &nodes,
+                                     size_t itemStart, size_t itemEnd,
+                                     size_t level, quint16 parent);
     bool buildF2H();
+    bool buildDfa();
+    // 全拼字符串（如 "ZhONG"）的 id，不存在时返回 0
+    quint16 fullIdOf(const char *spl) const;
 
     // Test if the given id is a valid spelling id.
     // If function returns true, the given splid may be updated like this:
@@ -95,12 +179,34 @@ public:
     // to return the first full id.
     quint16 halfToFull(quint16 halfId, quint16 *splIdStart) const;
 
+    // 为规则 rules（FuzzyRule 的组合）建立模糊音表，rules 为 0 时每个 id
+    // 只匹配自身
+    void buildFuzzyTable(quint32 rules, FuzzyTable *table) const;
+    // splid 可以匹配的全拼 id 区间，fuzzy 为空时精确匹配（简拼为 halfToFull
+    // 的区间），只有一段，写入 exact。返回区间数，*ranges 指向各区间
+    inline int matchRanges(quint16 splid, const FuzzyTable *fuzzy,
+                           SplIdRange *exact, const SplIdRange **ranges) const;
+
     // Load from the file stream
-    bool loadSplTrie(QFile &fp);
+    // 只读取拼音表，树由 loadCompiledTrie 或 buildSplTrie 建立
+    bool loadSplTrie(DictReader &fp);
+
+    // 从当前位置映射预先编译好的树。段不存在或校验失败时返回 false，
+    // 此时应调用 buildSplTrie 重新构建。
+    bool loadCompiledTrie(DictReader &fp);
+    // 由拼音表构建树
+    bool buildSplTrie();
+    // 将建好的树以与位置无关的形式追加到 buf，供 loadCompiledTrie 使用
+    void saveCompiledTrie(std::string &buf) const;
+    inline bool isCompiled() const;
 
     // Get the number of spellings
     inline quint32 getSpellingNum() const;
 
+    // Get the spelling string of a full id, such as "ZhONG". zh/ch/sh are
+    // written as "Zh", "Ch" and "Sh", the others are in upper case.
+    inline const char *getSpellingStr(quint16 splid) const;
+
 
     // Given a string, parse it into a spelling id stream.
     // If the whole string are sucessfully parsed, last_is_pre will be true;
@@ -115,6 +221,11 @@ public:
     quint16 splstrToIdxs(const char *splstr, quint16 strLen, quint16 splIdx[],
                           quint16 startPos[], quint16 maxSize) const;
 
+    // 与 splstrToIdxs 结果相同，但直接遍历树，逐个比较子节点。
+    // 仅作为参照实现和性能对比使用。
+    quint16 splstrToIdxsTrie(const char *splstr, quint16 strLen, quint16 splIdx[],
+                              quint16 startPos[], quint16 maxSize) const;
+
 };
 
 bool SpellingTrie::isValidSplChar(char ch)
@@ -137,6 +248,36 @@ quint32 SpellingTrie::getSpellingNum() const
     return spelling_num_;
 }
 
+const char *SpellingTrie::getSpellingStr(quint16 splid) const
+{
+    Q_ASSERT(splid >= kFullSplIdStart && splid < kFullSplIdStart + spelling_num_);
+    return spelling_buf_.data() + size_t(splid - kFullSplIdStart) * spelling_size_;
+}
+
+bool SpellingTrie::isCompiled() const
+{
+    return compiled_;
+}
+
+int SpellingTrie::matchRanges(quint16 splid, const FuzzyTable *fuzzy,
+                              SplIdRange *exact, const SplIdRange **ranges) const
+{
+    if (pNull != fuzzy) return fuzzy->ranges(splid, ranges);
+    *ranges = exact;
+    if (isHalfId(splid))
+    {
+        const quint16 idNum = halfToFull(splid, &exact->start);
+        Q_ASSERT(idNum > 0);
+        exact->end = quint16(exact->start + idNum);
+    }
+    else
+    {
+        exact->start = splid;
+        exact->end = quint16(splid + 1);
+    }
+    return 1;
+}
+
 
 NAMESPACEEND
 
@@ -0,0 +1,187 @@
+#include "splrange.h"
+#include <atomic>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SPLRANGE_X86
+#include <immintrin.h>
+#endif
+
+NAMESPACEBEGIN
+
+static inline size_t rangeScalar(const quint16 *spl, size_t num, quint16 idStart,
+                          quint16 idEnd, size_t *last)
+{
+    size_t first = 0;
+    while (first < num && spl[first] < idStart) first++;
+    size_t end = first;
+    while (end < num && spl[end] < idEnd) end++;
+    *last = end;
+    return first;
+}
+
+// 第一个不小于 v 的位置。每次比较后只移动起点，编译为条件传送，没有分支。
+static inline size_t lowerBound(const quint16 *a, size_t n, quint16 v)
+{
+    if (0 == n) return 0;
+    const quint16 *base = a;
+    while (n > 1)
+    {
+        const size_t half = n / 2;
+        base += base[half] < v? half: 0;
+        n -= half;
+    }
+    return size_t(base - a) + (*base < v);
+}
+
+static inline size_t rangeBinary(const quint16 *spl, size_t num, quint16 idStart,
+                          quint16 idEnd, size_t *last)
+{
+    const size_t first = lowerBound(spl, num, idStart);
+    *last = first + lowerBound(spl + first, num - first, idEnd);
+    return first;
+}
+
+#ifdef SPLRANGE_X86
+// 拼音 id 都小于 0x8000，可以用有符号的 16 位比较。
+// 比较结果为 -1 的通道累加到计数器中，最后横向求和。
+
+__attribute__((target("sse2")))
+static inline size_t sumEpi16(__m128i acc)
+{
+    acc = _mm_madd_epi16(acc, _mm_set1_epi16(1));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return size_t(_mm_cvtsi128_si32(acc));
+}
+
+__attribute__((target("sse2")))
+static size_t rangeSse2(const quint16 *spl, size_t num, quint16 idStart,
+                        quint16 idEnd, size_t *last)
+{
+    if (num >= kSplRangeBinaryMin) return rangeBinary(spl, num, idStart, idEnd, last);
+    const __m128i lo = _mm_set1_epi16(short(idStart));
+    const __m128i hi = _mm_set1_epi16(short(idEnd));
+    __m128i accLo = _mm_setzero_si128();
+    __m128i accHi = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(spl + i));
+        accLo = _mm_sub_epi16(accLo, _mm_cmplt_epi16(v, lo));
+        accHi = _mm_sub_epi16(accHi, _mm_cmplt_epi16(v, hi));
+    }
+    size_t first = sumEpi16(accLo);
+    size_t end = sumEpi16(accHi);
+    for (; i < num; i++)
+    {
+        first += spl[i] < idStart;
+        end += spl[i] < idEnd;
+    }
+    *last = end;
+    return first;
+}
+
+__attribute__((target("avx2")))
+static size_t rangeAvx2(const quint16 *spl, size_t num, quint16 idStart,
+                        quint16 idEnd, size_t *last)
+{
+    if (num >= kSplRangeBinaryMin) return rangeBinary(spl, num, idStart, idEnd, last);
+    const __m256i lo = _mm256_set1_epi16(short(idStart));
+    const __m256i hi = _mm256_set1_epi16(short(idEnd));
+    __m256i accLo = _mm256_setzero_si256();
+    __m256i accHi = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(spl + i));
+        // a < b 即 b > a
+        accLo = _mm256_sub_epi16(accLo, _mm256_cmpgt_epi16(lo, v));
+        accHi = _mm256_sub_epi16(accHi, _mm256_cmpgt_epi16(hi, v));
+    }
+    size_t first = sumEpi16(_mm_add_epi16(_mm256_castsi256_si128(accLo),
+                                          _mm256_extracti128_si256(accLo, 1)));
+    size_t end = sumEpi16(_mm_add_epi16(_mm256_castsi256_si128(accHi),
+                                        _mm256_extracti128_si256(accHi, 1)));
+    for (; i < num; i++)
+    {
+        first += spl[i] < idStart;
+        end += spl[i] < idEnd;
+    }
+    *last = end;
+    return first;
+}
+#endif
+
+static bool supported(SplRangeKind kind)
+{
+    switch (kind)
+    {
+    case kSplRangeScalar:
+    case kSplRangeBinary:
+        return true;
+#ifdef SPLRANGE_X86
+    case kSplRangeSse2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case kSplRangeAvx2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+// 只在查找开始之前改变，读取不需要同步
+static std::atomic<int> g_kind(kSplRangeAuto);
+
+bool setSplRangeKind(SplRangeKind kind)
+{
+    if (kSplRangeAuto != kind && !supported(kind)) return false;
+    g_kind.store(kind, std::memory_order_relaxed);
+    return true;
+}
+
+SplRangeKind splRangeKind()
+{
+    return SplRangeKind(g_kind.load(std::memory_order_relaxed));
+}
+
+const char *splRangeKindName(SplRangeKind kind)
+{
+    switch (kind)
+    {
+    case kSplRangeScalar: return "scalar";
+    case kSplRangeBinary: return "binary";
+    case kSplRangeSse2: return "sse2";
+    case kSplRangeAvx2: return "avx2";
+    default: return "auto";
+    }
+}
+
+size_t splRange(const quint16 *spl, size_t num, quint16 idStart, quint16 idEnd,
+                size_t *last)
+{
+    Q_ASSERT(idStart <= idEnd && idEnd < 0x8000);
+    const int kind = g_kind.load(std::memory_order_relaxed);
+    if (Q_LIKELY(kSplRangeAuto == kind))
+    {
+        return num < kSplRangeBinaryMin? rangeScalar(spl, num, idStart, idEnd, last):
+                                         rangeBinary(spl, num, idStart, idEnd, last);
+    }
+    switch (kind)
+    {
+#ifdef SPLRANGE_X86
+    case kSplRangeSse2:
+        return rangeSse2(spl, num, idStart, idEnd, last);
+    case kSplRangeAvx2:
+        return rangeAvx2(spl, num, idStart, idEnd, last);
+#endif
+    case kSplRangeBinary:
+        return rangeBinary(spl, num, idStart, idEnd, last);
+    default:
+        return rangeScalar(spl, num, idStart, idEnd, last);
+    }
+}
+
+NAMESPACEEND
@@ -0,0 +1,47 @@
+#ifndef SPLRANGE_H
+#define SPLRANGE_H
+
+#include "dictdef.h"
+
+NAMESPACEBEGIN
+
+/**
+ * 在一个节点的子节点中找出拼音 id 落在 [idStart, idEnd) 的一段。
+ * 子节点按拼音 id 升序存放且互不相同，所以这一段就是
+ * [小于 idStart 的个数, 小于 idEnd 的个数)。
+ *
+ * 声母等半拼音对应一段全拼 id，第 0 层的节点最多有约 280 个子节点，逐个
+ * 比较的代价与子节点数成正比。默认子节点少时逐个比较，多时用无分支的
+ * 二分查找，直接选择，不经函数指针。用 SIMD 一次比较 8 个（SSE2）或
+ * 16 个（AVX2）并计数的实现在实测中没有更快，只在用 setSplRangeKind
+ * 指定时使用，以便对比。
+ */
+enum SplRangeKind
+{
+    // 默认，子节点少于 kSplRangeBinaryMin 时逐个比较，否则二分查找
+    kSplRangeAuto,
+    // 逐个比较，越过区间即停止，即原来的实现
+    kSplRangeScalar,
+    // 无分支二分查找
+    kSplRangeBinary,
+    kSplRangeSse2,
+    kSplRangeAvx2
+};
+
+// 子节点数不少于此值时用二分查找，SIMD 的实现也用它
+#define kSplRangeBinaryMin 64
+
+// 指定实现，CPU 不支持时返回 false 且不做改变。
+// 只在查找开始之前调用，查找期间改变的结果是未定义的。
+bool setSplRangeKind(SplRangeKind kind);
+// 当前使用的实现
+SplRangeKind splRangeKind();
+const char *splRangeKindName(SplRangeKind kind);
+
+// spl[0, num) 升序，拼音 id 都小于 0x8000。返回区间的起点，*last 为终点。
+size_t splRange(const quint16 *spl, size_t num, quint16 idStart, quint16 idEnd,
+                size_t *last);
+
+NAMESPACEEND
+
+#endif // SPLRANGE_H
@@ -0,0 +1,123 @@
+#include "stats.h"
+#include <string.h>
+
+NAMESPACEBEGIN
+
+// 小于此值的数各占一个桶
+#define kStatExactNum 16
+// 每个 2 的幂分成的段数的对数
+#define kStatSubBits 2
+
+static int bucketOf(quint64 v)
+{
+    if (v < kStatExactNum) return int(v);
+    const int bits = highestBit64(v);
+    const int sub = int(v >> (bits - kStatSubBits)) & ((1 << kStatSubBits) - 1);
+    const int b = kStatExactNum + ((bits - 4) << kStatSubBits) + sub;
+    return b < kStatBuckets? b: kStatBuckets - 1;
+}
+
+// 桶中最大的数
+static quint64 bucketHigh(int b)
+{
+    if (b < kStatExactNum) return quint64(b);
+    const int bits = ((b - kStatExactNum) >> kStatSubBits) + 4;
+    const quint64 sub = quint64((b - kStatExactNum) & ((1 << kStatSubBits) - 1));
+    const quint64 step = quint64(1) << (bits - kStatSubBits);
+    return (quint64(1) << bits) + (sub + 1) * step - 1;
+}
+
+void StatHistogram::reset()
+{
+    memset(buckets_, 0, sizeof (buckets_));
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+}
+
+void StatHistogram::add(quint64 v)
+{
+    buckets_[bucketOf(v)]++;
+    count_++;
+    sum_ += v;
+    if (v > max_) max_ = v;
+}
+
+void StatHistogram::merge(const StatHistogram &other)
+{
+    for (int i = 0; i < kStatBuckets; i++) buckets_[i] += other.buckets_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.max_ > max_) max_ = other.max_;
+}
+
+quint64 StatHistogram::percentile(double p) const
+{
+    if (0 == count_) return 0;
+    // 第 rank 个（从 1 计）数所在的桶
+    quint64 rank = quint64(p * double(count_) + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count_) rank = count_;
+    quint64 seen = 0;
+    for (int i = 0; i < kStatBuckets; i++)
+    {
+        seen += buckets_[i];
+        if (seen >= rank)
+        {
+            const quint64 high = bucketHigh(i);
+            return high < max_? high: max_;
+        }
+    }
+    return max_;
+}
+
+static void summarizeHistogram(const StatHistogram &h, StatSummary *out)
+{
+    out->count = h.count();
+    out->sum = h.sum();
+    out->p50 = h.percentile(0.5);
+    out->p99 = h.percentile(0.99);
+    out->max = h.max();
+}
+
+void Stats::reset()
+{
+    for (int i = 0; i < kStatPhaseNum; i++) phases[i].reset();
+    frontier_nodes.reset();
+    lemmas.reset();
+    candidates.reset();
+    truncated = 0;
+    partial = 0;
+}
+
+void Stats::merge(const Stats &other)
+{
+    for (int i = 0; i < kStatPhaseNum; i++) phases[i].merge(other.phases[i]);
+    frontier_nodes.merge(other.frontier_nodes);
+    lemmas.merge(other.lemmas);
+    candidates.merge(other.candidates);
+    truncated += other.truncated;
+    partial += other.partial;
+}
+
+void Stats::summarize(StatsSnapshot *out) const
+{
+    out->enabled = true;
+    for (int i = 0; i < kStatPhaseNum; i++) summarizeHistogram(phases[i], out->phases + i);
+    summarizeHistogram(frontier_nodes, &out->frontier_nodes);
+    summarizeHistogram(lemmas, &out->lemmas);
+    summarizeHistogram(candidates, &out->candidates);
+    out->searches = phases[kStatSearch].count();
+    out->truncated = truncated;
+    out->partial = partial;
+}
+
+const char *StatsSnapshot::phaseName(int phase)
+{
+    static const char * const names[kStatPhaseNum] = {
+        "split", "extend", "lpis", "sort", "sentence", "lemma_text", "search"
+    };
+    return phase >= 0 && phase < kStatPhaseNum? names[phase]: "";
+}
+
+NAMESPACEEND
@@ -0,0 +1,195 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "dictdef.h"
+#include <chrono>
+
+NAMESPACEBEGIN
+
+/**
+ * 查找各阶段的耗时和计数，用于找出慢的按键把时间花在了哪里。
+ *
+ * 只在编译时定义了 EPINYIN_STATS（qmake 时加 CONFIG+=epinyin_stats）才记录。
+ * 未定义时记录用的宏展开为空，解码器也不持有 Stats，查找路径上没有任何
+ * 额外的代码；快照接口仍然可用，只是 enabled 为 false。
+ *
+ * 每个解码器有自己的 Stats，不在线程间共享，记录时不加锁。数值都是从创建
+ * 或 resetStats 起累计的，直方图按对数分桶，每个 2 的幂再分 4 段，
+ * 给出的分位数误差在 1/4 以内。多个会话的统计可以用 merge 合并。
+ */
+enum StatPhase
+{
+    // 拼音串切分为拼音 id，splstrToIdxs
+    kStatSplit,
+    // 展开词库树的节点
+    kStatExtend,
+    // 由展开的节点收集各长度的词条，getLpis
+    kStatLpis,
+    // 候选词排序，发生在取候选词时
+    kStatSort,
+    // 整句解码
+    kStatSentence,
+    // 取候选词文字，含其中触发的排序
+    kStatLemmaText,
+    // 一次查找的全部耗时，即切分、展开、收集和整句之和
+    kStatSearch,
+    kStatPhaseNum
+};
+
+// 直方图的桶数：0 ~ 15 各一个，之后每个 2 的幂 4 个，最大约 2^40
+#define kStatBuckets 160
+
+class StatHistogram
+{
+public:
+    inline StatHistogram() { reset(); }
+    void reset();
+    void add(quint64 v);
+    void merge(const StatHistogram &other);
+
+    inline quint64 count() const { return count_; }
+    inline quint64 sum() const { return sum_; }
+    inline quint64 max() const { return max_; }
+    // 不小于 p（0 ~ 1）比例的数值所在桶的上界，不超过最大值。没有数值时为 0
+    quint64 percentile(double p) const;
+
+private:
+    quint32 buckets_[kStatBuckets];
+    quint64 count_;
+    quint64 sum_;
+    quint64 max_;
+};
+
+// 一项统计的摘要
+struct StatSummary
+{
+    quint64 count;
+    quint64 sum;
+    quint64 p50;
+    quint64 p99;
+    quint64 max;
+};
+
+/**
+ * 某一时刻的统计，只含摘要，可以直接拷贝、导出到监控系统。
+ * 耗时以纳秒计。
+ */
+struct StatsSnapshot
+{
+    // 编译时是否打开了统计，未打开时以下全为 0
+    bool enabled;
+    StatSummary phases[kStatPhaseNum];
+    // 每次查找展开后各层的节点总数
+    StatSummary frontier_nodes;
+    // 每次查找收集的词条数（同音词），被截断时为截断前收集到的
+    StatSummary lemmas;
+    // 每次查找后的候选数，含整句
+    StatSummary candidates;
+    quint64 searches;
+    // 候选达到 kMaxLmaPsbItems 而被截断的查找数
+    quint64 truncated;
+    // 因 Deadline 提前结束的查找数
+    quint64 partial;
+    // 见 LmaFrontier，这两项不受 EPINYIN_STATS 影响
+    quint64 frontier_overflows;
+    quint32 frontier_peak;
+
+    static const char *phaseName(int phase);
+};
+
+struct Stats
+{
+    StatHistogram phases[kStatPhaseNum];
+    StatHistogram frontier_nodes;
+    StatHistogram lemmas;
+    StatHistogram candidates;
+    quint64 truncated;
+    quint64 partial;
+
+    inline Stats() { reset(); }
+    void reset();
+    void merge(const Stats &other);
+    // 写入摘要，不涉及 frontier_* 两项
+    void summarize(StatsSnapshot *out) const;
+};
+
+// 在作用域内计时，结束时记入 stats 的 phase。stats 为空时什么也不做，
+// stats 在编译时即为空（未打开 EPINYIN_STATS）时整个对象都会被优化掉。
+class StatTimer
+{
+    Q_DISABLE_COPY(StatTimer)
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    inline StatTimer(Stats *stats, StatPhase phase)
+        : stats_(stats), phase_(phase)
+    {
+        if (pNull != stats_) start_ = Clock::now();
+    }
+    inline ~StatTimer()
+    {
+        if (pNull == stats_) return;
+        const Clock::duration d = Clock::now() - start_;
+        stats_->phases[phase_].add(quint64(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+    }
+
+private:
+    Stats *stats_;
+    StatPhase phase_;
+    Clock::time_point start_;
+};
+
+// 依次记录相邻几个阶段的耗时，每个阶段只读一次时钟（读时钟约 40ns，
+// 与一次查找的耗时相比并不小）。stats 为空时什么也不做。
+class StatLap
+{
+    Q_DISABLE_COPY(StatLap)
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    inline explicit StatLap(Stats *stats)
+        : stats_(stats)
+    {
+        if (pNull != stats_) start_ = last_ = Clock::now();
+    }
+    // 上次 mark（或开始）到现在的时间记入 phase
+    inline void mark(StatPhase phase)
+    {
+        if (pNull == stats_) return;
+        const Clock::time_point now = Clock::now();
+        add(phase, now - last_);
+        last_ = now;
+    }
+    // 开始到最后一次 mark 的时间记入 phase
+    inline void total(StatPhase phase)
+    {
+        if (pNull != stats_) add(phase, last_ - start_);
+    }
+    inline Stats *stats() const { return stats_; }
+
+private:
+    inline void add(StatPhase phase, Clock::duration d)
+    {
+        stats_->phases[phase].add(quint64(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+    }
+
+    Stats *stats_;
+    Clock::time_point start_;
+    Clock::time_point last_;
+};
+
+#ifdef EPINYIN_STATS
+// 执行记录统计的语句
+#define IME_STATS(...) do { __VA_ARGS__; } while (0)
+// 在当前作用域计时，每个作用域只能用一次
+#define IME_STAT_TIMER(stats, phase) IME::StatTimer stat_timer_(stats, phase)
+#else
+#define IME_STATS(...) do { } while (0)
+#define IME_STAT_TIMER(stats, phase) do { } while (0)
+#endif
+
+NAMESPACEEND
+
+#endif // STATS_H
@@ -0,0 +1,64 @@
+#include "threadpool.h"
+#include <algorithm>
+
+NAMESPACEBEGIN
+
+ThreadPool::ThreadPool(int threadNum)
+{
+    if (threadNum <= 0) threadNum = std::max(1, int(std::thread::hardware_concurrency()));
+    generation_ = 0;
+    running_ = 0;
+    quit_ = false;
+    task_ = pNull;
+    for (int i = 0; i < threadNum; i++)
+    {
+        threads_.push_back(std::thread(&ThreadPool::work, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    start_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        threads_[i].join();
+    }
+}
+
+void ThreadPool::run(const Task &fn)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &fn;
+    running_ = threadNum();
+    generation_++;
+    start_.notify_all();
+    done_.wait(lock, [this] { return 0 == running_; });
+    task_ = pNull;
+}
+
+void ThreadPool::work(int worker)
+{
+    quint32 seen = 0;
+    for (;;)
+    {
+        const Task *task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return quit_ || generation_ != seen; });
+            if (quit_) return;
+            seen = generation_;
+            task = task_;
+        }
+
+        (*task)(worker);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (0 == --running_) done_.notify_one();
+    }
+}
+
+NAMESPACEEND
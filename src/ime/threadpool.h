@@ -0,0 +1,59 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "dictdef.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+NAMESPACEBEGIN
+
+/**
+ * 固定个数的工作线程，供批量处理使用。
+ * run 把同一个任务交给所有线程执行，等它们全部完成后返回；任务自己
+ * 决定如何在线程间分配工作（通常是从一个原子计数器中按块领取）。
+ * 同一个对象不要在多个线程中同时调用 run。
+ */
+class ThreadPool
+{
+    Q_DISABLE_COPY(ThreadPool)
+public:
+    // threadNum 为 0 时使用硬件线程数
+    ThreadPool(int threadNum = 0);
+    ~ThreadPool();
+
+    inline int threadNum() const;
+
+    // 在每个线程上调用 fn(线程序号)，序号为 [0, threadNum())
+    typedef std::function<void (int worker)> Task;
+    void run(const Task &fn);
+
+private:
+    void work(int worker);
+
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    // 有新任务或需要退出时通知工作线程
+    std::condition_variable start_;
+    // 所有工作线程完成当前任务时通知调用者
+    std::condition_variable done_;
+    // 每个任务递增，工作线程借此区分新任务
+    quint32 generation_;
+    int running_;
+    bool quit_;
+    // 当前任务，由调用者在发布前设置，执行期间只读
+    const Task *task_;
+};
+
+
+int ThreadPool::threadNum() const
+{
+    return int(threads_.size());
+}
+
+NAMESPACEEND
+
+#endif // THREADPOOL_H
@@ -0,0 +1,789 @@
+#include "userdict.h"
+#include "dictionary.h"
+#include "dicttrie.h"
+#include "dictlist.h"
+#include "dictcontainer.h"
+#include "candidates.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+NAMESPACEBEGIN
+
+// 日志文件用到的几个系统调用。Windows 的 CRT 有同样的一组函数，只是名字
+// 不同，文件须以二进制方式打开；rename 在目标存在时失败，替换用 MoveFileEx
+#ifdef _WIN32
+static int openFile(const char *path, int flags)
+{
+    return _open(path, flags | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+static long long readFile(int fd, void *buf, size_t len) { return _read(fd, buf, unsigned(len)); }
+static long long writeFile(int fd, const void *buf, size_t len) { return _write(fd, buf, unsigned(len)); }
+static bool truncateFile(int fd, qint64 size) { return 0 == _chsize_s(fd, size); }
+static bool seekEnd(int fd) { return _lseeki64(fd, 0, SEEK_END) >= 0; }
+static bool syncFile(int fd) { return 0 == _commit(fd); }
+static void closeFile(int fd) { _close(fd); }
+static bool replaceFile(const char *from, const char *to)
+{
+    return 0 != MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+#else
+static int openFile(const char *path, int flags) { return ::open(path, flags, 0644); }
+static long long readFile(int fd, void *buf, size_t len) { return ::read(fd, buf, len); }
+static long long writeFile(int fd, const void *buf, size_t len) { return ::write(fd, buf, len); }
+static bool truncateFile(int fd, qint64 size) { return 0 == ftruncate(fd, off_t(size)); }
+static bool seekEnd(int fd) { return lseek(fd, 0, SEEK_END) >= 0; }
+static bool syncFile(int fd) { return 0 == fsync(fd); }
+static void closeFile(int fd) { ::close(fd); }
+static bool replaceFile(const char *from, const char *to) { return 0 == rename(from, to); }
+#endif
+
+// 写入 len 字节，中途出错时返回 false
+static bool writeAll(int fd, const char *data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        const long long n = writeFile(fd, data + done, len - done);
+        if (n <= 0) return false;
+        done += size_t(n);
+    }
+    return true;
+}
+
+// 单生产者单消费者的环形缓冲区。head 只由写入者修改，tail 只由后台线程
+// 修改，中间隔开一个缓存行，互不干扰
+struct UserRing
+{
+    UserChoice items[kUserRingSize];
+    std::atomic<quint32> head;
+    char pad[64];
+    std::atomic<quint32> tail;
+    // 写入者已不再使用，取空后释放
+    std::atomic<bool> detached;
+
+    UserRing() : head(0), tail(0), detached(false) { }
+};
+
+// 日志的文件头：char[8] magic, quint32 version, quint32 词库指纹
+static const char kUserMagic[8] = { 'E', 'P', 'Y', 'U', 'S', 'E', 'R', '\0' };
+#define kUserVersion 1
+#define kUserHeaderSize 16
+
+// 每条记录：quint8 类型, quint8 字数, quint16 次数, 内容, quint32 此前各字节的
+// CRC-32。词条的内容为 quint32 id，词组为 char16_t 文字和 quint16 全拼 id 各 len 个
+#define kUserRecordLemma 1
+#define kUserRecordPhrase 2
+#define kUserRecordHead 4
+#define kUserRecordCrc 4
+
+UserDict::UserDict(const Dictionary *dict, const char *path)
+{
+    Q_ASSERT(dict && dict->isValid());
+    st_ = dict->spellingTrie();
+    dt_ = dict->dictTrie();
+    st_->buildFuzzyTable(kFuzzyAll, &fuzzy_all_);
+    table_.lemma_num = 0;
+    table_.marked.assign(dt_->dictList()->start_id_[kMaxLemmaSize] / 64 + 1, 0);
+    table_.phrase_head.assign(st_->getSpellingNum(), kNoUserPhrase);
+    rebuildLemmas(64);
+    current_ = pNull;
+    shared_ring_ = attach();
+    parked_ = false;
+    flush_req_ = 0;
+    flush_done_ = 0;
+    kicked_ = false;
+    clear_ = false;
+    quit_ = false;
+    fd_ = -1;
+    log_records_ = 0;
+    if (pNull != path)
+    {
+        path_ = path;
+        load();
+    }
+    persistent_ = fd_ >= 0;
+    publish();
+    worker_ = std::thread(&UserDict::work, this);
+}
+
+UserDict::~UserDict()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        quit_ = true;
+    }
+    wake_.notify_one();
+    worker_.join();
+    if (fd_ >= 0) closeFile(fd_);
+    for (size_t i = 0; i < rings_.size(); i++) delete rings_[i];
+    for (size_t i = 0; i < snapshots_.size(); i++) delete snapshots_[i];
+}
+
+UserRing *UserDict::attach()
+{
+    UserRing *ring = new UserRing;
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    rings_.push_back(ring);
+    return ring;
+}
+
+void UserDict::detach(UserRing *ring)
+{
+    ring->detached.store(true, std::memory_order_release);
+}
+
+void UserDict::record(UserRing *ring, const UserChoice &choice)
+{
+    const quint32 head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= kUserRingSize)
+    {
+        // 队列满，唤醒后台线程立即取走，等待它腾出位置
+        wake();
+        while (head - ring->tail.load(std::memory_order_acquire) >= kUserRingSize)
+        {
+            std::this_thread::yield();
+        }
+    }
+    ring->items[head & (kUserRingSize - 1)] = choice;
+    ring->head.store(head + 1, std::memory_order_release);
+    // 与后台线程休眠前的检查配对（见 work）：要么它看到这次的选择，要么
+    // 这里看到它已休眠
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed)) wake();
+}
+
+void UserDict::record(const UserChoice &choice)
+{
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    record(shared_ring_, choice);
+}
+
+void UserDict::wake()
+{
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    parked_.store(false, std::memory_order_relaxed);
+    kicked_ = true;
+    wake_.notify_one();
+}
+
+void UserDict::flush()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    const quint64 req = ++flush_req_;
+    wake_.notify_one();
+    flushed_.wait(lock, [this, req] { return flush_done_ >= req; });
+}
+
+void UserDict::clear()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    clear_ = true;
+    const quint64 req = ++flush_req_;
+    wake_.notify_one();
+    flushed_.wait(lock, [this, req] { return flush_done_ >= req; });
+}
+
+void UserDict::work()
+{
+    std::vector<UserChoice> batch;
+    std::string out;
+    int idle = 0;
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    const auto woken = [this] { return kicked_ || clear_ || quit_ || flush_req_ != flush_done_; };
+    for (;;)
+    {
+        if (!woken() && idle < kUserIdlePolls)
+        {
+            // 等满一个周期再取，其间的选择一起处理、发布一次
+            wake_.wait_for(lock, std::chrono::milliseconds(kUserPollMs), woken);
+        }
+        else if (!woken())
+        {
+            // 长时间没有选择，休眠到下一次选择。先声明休眠再检查队列，
+            // 与 record 配对
+            parked_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool pending;
+            {
+                std::lock_guard<std::mutex> rings(rings_mutex_);
+                pending = hasChoices();
+            }
+            if (!pending)
+            {
+                wake_.wait(lock, [&] {
+                    return !parked_.load(std::memory_order_relaxed) || woken();
+                });
+            }
+            parked_.store(false, std::memory_order_relaxed);
+            idle = 0;
+        }
+        const bool clear = clear_;
+        const bool quit = quit_;
+        const quint64 req = flush_req_;
+        kicked_ = false;
+        clear_ = false;
+        lock.unlock();
+
+        // 在读取 flush_req_ 之后取，flush 之前记录的选择都在其中
+        batch.clear();
+        drain(batch);
+        if (clear)
+        {
+            batch.clear();
+            clearTable();
+            resetFile();
+        }
+        idle = batch.empty() && !clear? idle + 1: 0;
+        out.clear();
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            LemmaEntry lemma;
+            UserPhrase phrase;
+            if (!resolve(batch[i], &lemma, &phrase)) continue;
+            if (0 != lemma.id) addLemma(lemma.id, lemma.len, lemma.count);
+            else addPhrase(phrase);
+            if (0 != lemma.id) writeLemma(out, lemma.id, lemma.len, lemma.count);
+            else writePhrase(out, phrase);
+            log_records_++;
+        }
+        if (!batch.empty() || clear) publish();
+        if (!out.empty()) append(out);
+        if (log_records_ > kUserCompactMin &&
+                log_records_ > 2 * (table_.lemma_num + table_.phrases.size()))
+        {
+            compact();
+        }
+        if (req != flush_done_ || quit) sync();
+
+        lock.lock();
+        flush_done_ = req;
+        flushed_.notify_all();
+        if (quit)
+        {
+            std::lock_guard<std::mutex> rings(rings_mutex_);
+            if (!hasChoices()) break;
+        }
+    }
+}
+
+void UserDict::drain(std::vector<UserChoice> &batch)
+{
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (size_t i = 0; i < rings_.size(); )
+    {
+        UserRing *ring = rings_[i];
+        // 先看是否已 detach：是的话此前的选择都已可见，取完即可释放
+        const bool detached = ring->detached.load(std::memory_order_acquire);
+        quint32 tail = ring->tail.load(std::memory_order_relaxed);
+        const quint32 head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) batch.push_back(ring->items[tail & (kUserRingSize - 1)]);
+        ring->tail.store(tail, std::memory_order_release);
+        if (detached)
+        {
+            delete ring;
+            rings_[i] = rings_.back();
+            rings_.pop_back();
+            continue;
+        }
+        i++;
+    }
+}
+
+bool UserDict::hasChoices() const
+{
+    for (size_t i = 0; i < rings_.size(); i++)
+    {
+        if (rings_[i]->head.load(std::memory_order_acquire) !=
+                rings_[i]->tail.load(std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void UserDict::publish()
+{
+    // 找一份不是当前副本、也没有查找在用的复制过去，都在用时新建
+    const Snapshot *current = current_.load(std::memory_order_relaxed);
+    Snapshot *next = pNull;
+    for (size_t i = 0; i < snapshots_.size() && pNull == next; i++)
+    {
+        Snapshot *s = snapshots_[i];
+        if (s != current && 0 == s->refs.load()) next = s;
+    }
+    if (pNull == next)
+    {
+        next = new Snapshot;
+        next->refs = 0;
+        snapshots_.push_back(next);
+    }
+    next->tables = table_;
+    current_.store(next);
+}
+
+const UserDict::Snapshot *UserDict::acquire() const
+{
+    // 加上引用后当前副本仍是它，后台线程就不会再改写它，见 publish
+    for (;;)
+    {
+        const Snapshot *s = current_.load();
+        s->refs.fetch_add(1);
+        if (s == current_.load()) return s;
+        release(s);
+    }
+}
+
+bool UserDict::resolve(const UserChoice &c, LemmaEntry *lemma, UserPhrase *phrase) const
+{
+    lemma->id = 0;
+    lemma->len = c.len;
+    lemma->count = 1;
+    if (1 == c.part_num && 0 != c.part_id[0])
+    {
+        lemma->id = c.part_id[0];
+        return true;
+    }
+    if (c.len < 2 || c.len > kMaxLemmaSize) return false;
+    phrase->len = c.len;
+    phrase->count = 1;
+    memcpy(phrase->text, c.text, c.len * sizeof (char16_t));
+    int pos = 0;
+    for (int i = 0; i < c.part_num; i++)
+    {
+        const int len = c.part_len[i];
+        if (0 == c.part_id[i])
+        {
+            memcpy(phrase->splids + pos, c.splids + pos, len * sizeof (quint16));
+        }
+        else if (!dt_->getLemmaSplids(c.part_id[i], len, c.splids + pos, st_, &fuzzy_all_,
+                                      phrase->splids + pos))
+        {
+            return false;
+        }
+        pos += len;
+    }
+    Q_ASSERT(pos == c.len);
+    // 拼成的词组词库中本来就有时，记为该词条，候选中不会出现两个
+    lemma->id = dt_->findLemma(phrase->splids, phrase->len, phrase->text, st_);
+    return true;
+}
+
+int UserDict::matchPhrases(const quint16 *splidStr, int num, const SpellingTrie *st,
+                           const FuzzyTable *fuzzy, UserPhrase *out, int maxNum) const
+{
+    const SnapshotRef ref(this);
+    const Tables &t = ref.tables();
+    if (t.phrases.empty() || num < 2) return 0;
+    const int maxLen = std::min(num, kMaxLemmaSize);
+    SplIdRange exact[kMaxLemmaSize];
+    const SplIdRange *ranges[kMaxLemmaSize];
+    int rangeNum[kMaxLemmaSize];
+    for (int k = 0; k < maxLen; k++)
+    {
+        rangeNum[k] = st->matchRanges(splidStr[k], fuzzy, exact + k, ranges + k);
+    }
+
+    // 第一个字可以匹配的每个全拼 id 的桶，再逐字比较其余的字
+    int n = 0;
+    for (int r = 0; r < rangeNum[0]; r++)
+    {
+        for (quint16 id = ranges[0][r].start; id < ranges[0][r].end; id++)
+        {
+            quint32 i = t.phrase_head[id - kFullSplIdStart];
+            for (; kNoUserPhrase != i; i = t.phrase_next[i])
+            {
+                const UserPhrase &p = t.phrases[i];
+                if (p.len > maxLen) continue;
+                int k = 1;
+                for (; k < p.len; k++)
+                {
+                    int j = 0;
+                    while (j < rangeNum[k] && (p.splids[k] < ranges[k][j].start ||
+                                               p.splids[k] >= ranges[k][j].end)) j++;
+                    if (j == rangeNum[k]) break;
+                }
+                if (k < p.len) continue;
+                if (n < maxNum)
+                {
+                    out[n++] = p;
+                    continue;
+                }
+                int least = 0;
+                for (int j = 1; j < n; j++)
+                {
+                    if (out[j].count < out[least].count) least = j;
+                }
+                if (p.count > out[least].count) out[least] = p;
+            }
+        }
+    }
+    return n;
+}
+
+bool UserDict::adjust(Candidates *candidates) const
+{
+    const SnapshotRef ref(this);
+    const Tables &t = ref.tables();
+    if (0 == t.lemma_num) return false;
+    const quint32 limit = quint32(t.marked.size() * 64);
+    bool changed = false;
+    for (int i = 0; i < candidates->size(); i++)
+    {
+        // 用户词组的 id 带有 kUserLemmaFlag，超出位图
+        LmaPsbItem &item = candidates->itemAt(i);
+        const quint32 id = item.id;
+        if (id >= limit || 0 == ((t.marked[id >> 6] >> (id & 63)) & 1)) continue;
+        const LemmaEntry *e = t.findLemma(id);
+        Q_ASSERT(pNull != e);
+        const quint16 psb = psbOf(e->count);
+        if (psb >= item.psb) continue;
+        item.psb = psb;
+        changed = true;
+    }
+    return changed;
+}
+
+size_t UserDict::lemmaNum() const
+{
+    const SnapshotRef ref(this);
+    return ref.tables().lemma_num;
+}
+
+size_t UserDict::phraseNum() const
+{
+    const SnapshotRef ref(this);
+    return ref.tables().phrases.size();
+}
+
+size_t UserDict::memoryUsage() const
+{
+    const SnapshotRef ref(this);
+    return ref.tables().memoryUsage();
+}
+
+size_t UserDict::Tables::memoryUsage() const
+{
+    return lemmas.size() * sizeof (LemmaEntry) +
+            marked.size() * sizeof (quint64) +
+            phrases.capacity() * sizeof (UserPhrase) +
+            (phrase_head.size() + phrase_next.capacity()) * sizeof (quint32);
+}
+
+size_t UserDict::Tables::lemmaSlot(quint32 id) const
+{
+    return size_t((quint64(id) * 0x9e3779b97f4a7c15ull) >> lemma_shift);
+}
+
+const UserDict::LemmaEntry *UserDict::Tables::findLemma(quint32 id) const
+{
+    const size_t mask = lemmas.size() - 1;
+    for (size_t i = lemmaSlot(id); ; i = (i + 1) & mask)
+    {
+        const LemmaEntry &e = lemmas[i];
+        if (e.id == id) return &e;
+        if (0 == e.id) return pNull;
+    }
+}
+
+void UserDict::insertLemma(const LemmaEntry &entry)
+{
+    const size_t mask = table_.lemmas.size() - 1;
+    size_t i = table_.lemmaSlot(entry.id);
+    while (0 != table_.lemmas[i].id) i = (i + 1) & mask;
+    table_.lemmas[i] = entry;
+    table_.lemma_num++;
+    table_.marked[entry.id >> 6] |= quint64(1) << (entry.id & 63);
+}
+
+void UserDict::addLemma(quint32 id, quint16 len, quint16 count)
+{
+    LemmaEntry *e = const_cast<LemmaEntry *>(table_.findLemma(id));
+    if (pNull != e)
+    {
+        e->count = quint16(std::min(0xffff, e->count + count));
+        return;
+    }
+    while (table_.lemma_num >= kUserMaxLemmas) age();
+    // 装填率不超过一半
+    if ((table_.lemma_num + 1) * 2 > table_.lemmas.size())
+    {
+        rebuildLemmas(table_.lemmas.size() * 2);
+    }
+    const LemmaEntry entry = { id, count, len };
+    insertLemma(entry);
+}
+
+void UserDict::addPhrase(const UserPhrase &phrase)
+{
+    const size_t bucket = size_t(phrase.splids[0] - kFullSplIdStart);
+    for (quint32 i = table_.phrase_head[bucket]; kNoUserPhrase != i; i = table_.phrase_next[i])
+    {
+        UserPhrase &p = table_.phrases[i];
+        if (p.len == phrase.len &&
+                0 == memcmp(p.text, phrase.text, p.len * sizeof (char16_t)) &&
+                0 == memcmp(p.splids, phrase.splids, p.len * sizeof (quint16)))
+        {
+            p.count = quint16(std::min(0xffff, p.count + phrase.count));
+            return;
+        }
+    }
+    while (table_.phrases.size() >= kUserMaxPhrases) age();
+    table_.phrases.push_back(phrase);
+    table_.phrase_next.push_back(table_.phrase_head[bucket]);
+    table_.phrase_head[bucket] = quint32(table_.phrases.size() - 1);
+}
+
+void UserDict::age()
+{
+    for (size_t i = 0; i < table_.lemmas.size(); i++) table_.lemmas[i].count >>= 1;
+    for (size_t i = 0; i < table_.phrases.size(); i++) table_.phrases[i].count >>= 1;
+    rebuildLemmas(table_.lemmas.size());
+    rebuildPhrases();
+}
+
+void UserDict::rebuildLemmas(size_t capacity)
+{
+    std::vector<LemmaEntry> old(capacity);
+    old.swap(table_.lemmas);
+    table_.lemma_shift = 64;
+    for (size_t c = capacity; c > 1; c >>= 1) table_.lemma_shift--;
+    table_.lemma_num = 0;
+    std::fill(table_.marked.begin(), table_.marked.end(), 0);
+    for (size_t i = 0; i < old.size(); i++)
+    {
+        if (0 != old[i].id && 0 != old[i].count) insertLemma(old[i]);
+    }
+}
+
+void UserDict::rebuildPhrases()
+{
+    std::vector<UserPhrase> &phrases = table_.phrases;
+    phrases.erase(std::remove_if(phrases.begin(), phrases.end(), [](const UserPhrase &p) {
+        return 0 == p.count;
+    }), phrases.end());
+    std::fill(table_.phrase_head.begin(), table_.phrase_head.end(), kNoUserPhrase);
+    table_.phrase_next.resize(phrases.size());
+    for (size_t i = 0; i < phrases.size(); i++)
+    {
+        const size_t bucket = size_t(phrases[i].splids[0] - kFullSplIdStart);
+        table_.phrase_next[i] = table_.phrase_head[bucket];
+        table_.phrase_head[bucket] = quint32(i);
+    }
+}
+
+void UserDict::clearTable()
+{
+    std::fill(table_.lemmas.begin(), table_.lemmas.end(), LemmaEntry());
+    table_.lemma_num = 0;
+    std::fill(table_.marked.begin(), table_.marked.end(), 0);
+    table_.phrases.clear();
+    rebuildPhrases();
+}
+
+quint32 UserDict::fingerprint() const
+{
+    // 各长度的起始 id 和拼音数，词条 id 的含义变了它们几乎总会变
+    const DictList *dl = dt_->dictList();
+    quint32 buf[kMaxLemmaSize + 2];
+    memcpy(buf, dl->start_id_, sizeof (dl->start_id_));
+    buf[kMaxLemmaSize + 1] = st_->getSpellingNum();
+    return DictContainer::checksum(reinterpret_cast<const char *>(buf), sizeof (buf));
+}
+
+void UserDict::writeHeader(std::string &out, quint32 fingerprint)
+{
+    const quint32 version = kUserVersion;
+    out.append(kUserMagic, sizeof (kUserMagic));
+    out.append(reinterpret_cast<const char *>(&version), sizeof (version));
+    out.append(reinterpret_cast<const char *>(&fingerprint), sizeof (fingerprint));
+}
+
+void UserDict::writeLemma(std::string &out, quint32 id, quint16 len, quint16 count)
+{
+    char rec[kUserRecordHead + sizeof (quint32) + kUserRecordCrc];
+    rec[0] = kUserRecordLemma;
+    rec[1] = char(len);
+    memcpy(rec + 2, &count, sizeof (count));
+    memcpy(rec + kUserRecordHead, &id, sizeof (id));
+    const quint32 crc = DictContainer::checksum(rec, sizeof (rec) - kUserRecordCrc);
+    memcpy(rec + sizeof (rec) - kUserRecordCrc, &crc, sizeof (crc));
+    out.append(rec, sizeof (rec));
+}
+
+void UserDict::writePhrase(std::string &out, const UserPhrase &phrase)
+{
+    char rec[kUserRecordHead + kMaxLemmaSize * 4 + kUserRecordCrc];
+    const size_t textSize = phrase.len * sizeof (char16_t);
+    const size_t size = kUserRecordHead + textSize * 2;
+    rec[0] = kUserRecordPhrase;
+    rec[1] = char(phrase.len);
+    memcpy(rec + 2, &phrase.count, sizeof (phrase.count));
+    memcpy(rec + kUserRecordHead, phrase.text, textSize);
+    memcpy(rec + kUserRecordHead + textSize, phrase.splids, textSize);
+    const quint32 crc = DictContainer::checksum(rec, size);
+    memcpy(rec + size, &crc, sizeof (crc));
+    out.append(rec, size + kUserRecordCrc);
+}
+
+bool UserDict::load()
+{
+    const int fd = openFile(path_.c_str(), O_RDWR | O_CREAT);
+    if (fd < 0) return false;
+    std::string data;
+    char chunk[65536];
+    long long n;
+    while ((n = readFile(fd, chunk, sizeof (chunk))) > 0) data.append(chunk, size_t(n));
+
+    // 从头重放，遇到不完整或校验不符的记录即停止，之后的都丢弃
+    size_t valid = 0;
+    std::string header;
+    writeHeader(header, fingerprint());
+    if (data.size() >= kUserHeaderSize && 0 == memcmp(data.data(), header.data(), kUserHeaderSize))
+    {
+        const DictList *dl = dt_->dictList();
+        valid = kUserHeaderSize;
+        while (valid + kUserRecordHead <= data.size())
+        {
+            const char *rec = data.data() + valid;
+            const int type = rec[0];
+            const int len = quint8(rec[1]);
+            quint16 count;
+            memcpy(&count, rec + 2, sizeof (count));
+            size_t size = 0;
+            if (kUserRecordLemma == type && len > 0 && len <= kMaxLemmaSize)
+            {
+                size = kUserRecordHead + sizeof (quint32);
+            }
+            else if (kUserRecordPhrase == type && len > 1 && len <= kMaxLemmaSize)
+            {
+                size = kUserRecordHead + len * 4;
+            }
+            if (0 == size || 0 == count || valid + size + kUserRecordCrc > data.size()) break;
+            quint32 crc;
+            memcpy(&crc, rec + size, sizeof (crc));
+            if (crc != DictContainer::checksum(rec, size)) break;
+
+            if (kUserRecordLemma == type)
+            {
+                quint32 id;
+                memcpy(&id, rec + kUserRecordHead, sizeof (id));
+                if (dl->getLemmaLen(id) != len) break;
+                addLemma(id, quint16(len), count);
+            }
+            else
+            {
+                UserPhrase p;
+                p.len = quint16(len);
+                p.count = count;
+                memcpy(p.text, rec + kUserRecordHead, len * sizeof (char16_t));
+                memcpy(p.splids, rec + kUserRecordHead + len * 2, len * sizeof (quint16));
+                int k = 0;
+                while (k < len && p.splids[k] >= kFullSplIdStart &&
+                       p.splids[k] < kFullSplIdStart + st_->getSpellingNum()) k++;
+                if (k < len) break;
+                addPhrase(p);
+            }
+            log_records_++;
+            valid += size + kUserRecordCrc;
+        }
+    }
+    fd_ = fd;
+    if (0 == valid)
+    {
+        // 新文件，或换了词库
+        resetFile();
+    }
+    else if ((valid < data.size() && !truncateFile(fd_, qint64(valid))) || !seekEnd(fd_))
+    {
+        closeFile(fd_);
+        fd_ = -1;
+    }
+    return fd_ >= 0;
+}
+
+void UserDict::append(const std::string &data)
+{
+    if (fd_ < 0) return;
+    if (!writeAll(fd_, data.data(), data.size()))
+    {
+        // 写了一半的记录在下次加载时被截掉
+        closeFile(fd_);
+        fd_ = -1;
+        persistent_ = false;
+    }
+}
+
+void UserDict::resetFile()
+{
+    log_records_ = 0;
+    if (fd_ < 0) return;
+    // 以追加方式写入，截断后不必移动位置
+    if (!truncateFile(fd_, 0) || !seekEnd(fd_))
+    {
+        closeFile(fd_);
+        fd_ = -1;
+        persistent_ = false;
+        return;
+    }
+    std::string header;
+    writeHeader(header, fingerprint());
+    append(header);
+}
+
+void UserDict::compact()
+{
+    if (fd_ < 0) return;
+    std::string out;
+    writeHeader(out, fingerprint());
+    size_t records = 0;
+    for (size_t i = 0; i < table_.lemmas.size(); i++)
+    {
+        const LemmaEntry &e = table_.lemmas[i];
+        if (0 != e.id) writeLemma(out, e.id, e.len, e.count);
+    }
+    for (size_t i = 0; i < table_.phrases.size(); i++) writePhrase(out, table_.phrases[i]);
+    records = table_.lemma_num + table_.phrases.size();
+
+    // 先完整写入新文件再替换，中途失败时旧日志仍然完整
+    const std::string tmp = path_ + ".tmp";
+    const int fd = openFile(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) return;
+    const bool ok = writeAll(fd, out.data(), out.size()) && syncFile(fd);
+    closeFile(fd);
+    // Windows 上替换前须先关闭旧日志
+    closeFile(fd_);
+    fd_ = -1;
+    if (!ok || !replaceFile(tmp.c_str(), path_.c_str()))
+    {
+        remove(tmp.c_str());
+        fd_ = openFile(path_.c_str(), O_RDWR);
+        if (fd_ < 0 || !seekEnd(fd_)) persistent_ = false;
+        return;
+    }
+    const int newFd = openFile(path_.c_str(), O_RDWR);
+    if (newFd < 0 || !seekEnd(newFd))
+    {
+        if (newFd >= 0) closeFile(newFd);
+        persistent_ = false;
+        return;
+    }
+    fd_ = newFd;
+    log_records_ = records;
+}
+
+void UserDict::sync()
+{
+    if (fd_ >= 0) syncFile(fd_);
+}
+
+NAMESPACEEND
@@ -0,0 +1,287 @@
+#ifndef USERDICT_H
+#define USERDICT_H
+
+#include "spellingtrie.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+NAMESPACEBEGIN
+
+class Dictionary;
+class DictTrie;
+class Candidates;
+
+// 用户词组作为候选时 id 带有此标志，低位是它在解码器中的序号
+#define kUserLemmaFlag 0x80000000u
+// 一次查找最多给出的用户词组数
+#define kMaxUserCandidates 16
+// 最多记录的词条数和词组数，满时所有次数减半，去掉减为 0 的
+#define kUserMaxLemmas 4096
+#define kUserMaxPhrases 1024
+// 选择 1 次的分数，次数每多一倍减少 kUserPsbStep，与词条本来的 psb 取小的。
+// 词库中单字的 psb 约为 2400 ~ 15000，一半在 10000 以上
+#define kUserPsbBase 6000
+#define kUserPsbStep 600
+// 日志中的记录超过这么多，并且超过表中条目数的两倍时压缩
+#define kUserCompactMin 1024
+#define kNoUserPhrase 0xffffffffu
+// 每个写入者的选择队列的长度，2 的幂
+#define kUserRingSize 64
+// 有选择时后台线程每隔这么多毫秒取一次队列，连续 kUserIdlePolls 次
+// 没有新的选择后休眠，直到被下一次选择唤醒
+#define kUserPollMs 5
+#define kUserIdlePolls 200
+
+// 一个写入者的选择队列，见 UserDict::attach
+struct UserRing;
+
+/**
+ * 记录的词组：多次选择拼成的，或整体选中的整句，2 ~ kMaxLemmaSize 个字。
+ */
+struct UserPhrase
+{
+    char16_t text[kMaxLemmaSize];
+    // 每个字的全拼 id
+    quint16 splids[kMaxLemmaSize];
+    quint16 len;
+    // 选择的次数
+    quint16 count;
+};
+
+/**
+ * 一次选择，由 Decoder 填写。只有一个系统词条时记录该词条，否则记录
+ * 由各部分拼成的词组。
+ */
+struct UserChoice
+{
+    // 总字数，不超过 kMaxLemmaSize
+    quint8 len;
+    quint8 part_num;
+    quint8 part_len[kMaxLemmaSize];
+    // 各部分的系统词条 id，为 0 时是用户词组
+    quint32 part_id[kMaxLemmaSize];
+    // 每个字的拼音 id。系统词条部分为输入的 id，可能是简拼或模糊音；
+    // 用户词组部分已是全拼 id
+    quint16 splids[kMaxLemmaSize];
+    char16_t text[kMaxLemmaSize];
+};
+
+/**
+ * 用户词典：记住用户选择的词条和拼成的词组，查找时提前它们的排序，并把
+ * 词组作为整词给出。一个用户的多个解码器可以共享同一个，所有接口都是
+ * 线程安全的。词库需比它存活更久。
+ *
+ * 内存中是两张表：词条以 id 为键，开放寻址；词组按第一个字的全拼 id 分桶，
+ * 同一桶的串成链表。另有一张以词条 id 为下标的位图，调整候选时先查位图，
+ * 绝大多数没有记录的候选只多读一位。表只由后台线程修改，每处理完一批
+ * 选择复制一份发布给查找，查找只增减所用副本的引用计数，不加锁，不会
+ * 等待后台线程减半、重建或压缩。
+ *
+ * 每个写入者（通常是一个解码器）用 attach 得到自己的定长队列（单生产者
+ * 单消费者的环形缓冲区），record 只拷贝选择并移动队尾，不加锁，也没有
+ * 系统调用；只有后台线程已休眠或队列已满时才唤醒它。后台线程定时取出
+ * 各队列中的选择，把输入的简拼、模糊音还原为全拼（见
+ * DictTrie::getLemmaSplids），与词库中的词条相同的词组改记为该词条，并入
+ * 表中，再追加到日志文件。选择之后约 kUserPollMs 毫秒内生效，通常早于
+ * 下一次按键，flush 可以等待它完成。
+ *
+ * 日志是定长的文件头加一串记录，每条记录带 CRC-32，次数是要加上的值，
+ * 按顺序重放即得到表（满时的减半也会同样发生）。断电等造成的不完整或
+ * 损坏的尾部在加载时截掉。记录多到表的两倍以上时，后台线程把表写到新
+ * 文件再替换日志（压缩），任何时刻中断都不丢失已写入的记录。文件头中有
+ * 词库的指纹，换了词库（词条 id 不同）时旧的记录作废。
+ */
+class UserDict
+{
+    Q_DISABLE_COPY(UserDict)
+public:
+    // path 为日志文件，不存在时创建；为空或无法打开时只记在内存中
+    UserDict(const Dictionary *dict, const char *path = pNull);
+    // 等待队列处理完再退出
+    ~UserDict();
+
+    // 日志文件是否可用
+    inline bool isPersistent() const;
+
+    // 为一个写入者分配队列，同一队列只能由一个线程写入。
+    // 用完后须 detach，之后不能再使用；未 detach 的在词典销毁时释放
+    UserRing *attach();
+    // 不再使用 ring，其中已记录的选择仍会处理，不等待
+    void detach(UserRing *ring);
+    // 记录一次选择，放入 ring 后立即返回。队列满时等待后台线程取走
+    void record(UserRing *ring, const UserChoice &choice);
+    // 同上，使用所有调用者共用的队列，加锁
+    void record(const UserChoice &choice);
+    // 等待此前记录的选择全部并入表中并写入文件
+    void flush();
+    // 清除全部记录，日志只留文件头
+    void clear();
+
+    // 拼音与 splidStr[0, num) 的前若干个 id 匹配（fuzzy 为空时精确匹配）的词组
+    // 写入 out，最多 maxNum 个，多时保留次数多的，返回个数
+    int matchPhrases(const quint16 *splidStr, int num, const SpellingTrie *st,
+                     const FuzzyTable *fuzzy, UserPhrase *out, int maxNum) const;
+    // 按记录的次数调整 candidates 中系统词条的 psb，须在取用候选之前调用。
+    // 有改动时返回 true，已排好序的列表（见 CandidateCache）须重新排序
+    bool adjust(Candidates *candidates) const;
+    // 选择 count 次的分数，同 LmaPsbItem::psb
+    static inline quint16 psbOf(quint16 count);
+
+    size_t lemmaNum() const;
+    size_t phraseNum() const;
+    // 一份表和位图占用的内存，字节。后台线程的表和发布的副本（通常两三份）
+    // 各占这么多
+    size_t memoryUsage() const;
+
+private:
+    struct LemmaEntry
+    {
+        // 0 表示空位，词库中的 id 从 1 开始
+        quint32 id;
+        quint16 count;
+        quint16 len;
+    };
+
+    // 词条表、位图和词组表
+    struct Tables
+    {
+        std::vector<LemmaEntry> lemmas;
+        size_t lemma_num;
+        // lemmas 的下标由 id 的哈希值右移的位数
+        int lemma_shift;
+        // 有记录的词条 id 的位图
+        std::vector<quint64> marked;
+        std::vector<UserPhrase> phrases;
+        // 每个全拼 id 的第一个词组和每个词组的下一个，没有时为 kNoUserPhrase
+        std::vector<quint32> phrase_head;
+        std::vector<quint32> phrase_next;
+
+        inline const LemmaEntry *findLemma(quint32 id) const;
+        inline size_t lemmaSlot(quint32 id) const;
+        size_t memoryUsage() const;
+    };
+
+    // 发布给查找的副本。不再是当前副本并且没有引用时，后台线程用它复制
+    // 下一份，内存在词典销毁时才释放，所以查找可以先加引用再确认
+    struct Snapshot
+    {
+        Tables tables;
+        mutable std::atomic<int> refs;
+    };
+
+    // 查找时取得当前副本，用完后 release
+    const Snapshot *acquire() const;
+    inline void release(const Snapshot *snapshot) const;
+
+    // 在作用域内持有当前副本
+    struct SnapshotRef
+    {
+        const UserDict *dict;
+        const Snapshot *snapshot;
+        inline explicit SnapshotRef(const UserDict *d) : dict(d), snapshot(d->acquire()) { }
+        inline ~SnapshotRef() { dict->release(snapshot); }
+        inline const Tables &tables() const { return snapshot->tables; }
+    };
+
+    // 唤醒后台线程，由 record 在它休眠或队列已满时调用
+    void wake();
+
+    // 以下只由后台线程调用，或在它启动之前调用
+    void work();
+    // 取出各队列中的选择追加到 batch，释放已 detach 且取空的队列
+    void drain(std::vector<UserChoice> &batch);
+    // 是否有还未取出的选择，须持有 rings_mutex_
+    bool hasChoices() const;
+    // 把 table_ 复制一份，作为当前副本
+    void publish();
+    // 把一次选择还原为要记录的词条或词组，无效时返回 false
+    bool resolve(const UserChoice &c, LemmaEntry *lemma, UserPhrase *phrase) const;
+    bool load();
+    // 写出 data，出错时不再使用文件
+    void append(const std::string &data);
+    void compact();
+    void sync();
+    void resetFile();
+
+    // 以下修改 table_，只由后台线程调用，或在它启动之前调用
+    void addLemma(quint32 id, quint16 len, quint16 count);
+    void addPhrase(const UserPhrase &phrase);
+    // 插入一个不在表中的词条，须有空位
+    void insertLemma(const LemmaEntry &entry);
+    // 所有次数减半，去掉减为 0 的，重建表
+    void age();
+    void rebuildLemmas(size_t capacity);
+    void rebuildPhrases();
+    void clearTable();
+
+    static void writeHeader(std::string &out, quint32 fingerprint);
+    static void writeLemma(std::string &out, quint32 id, quint16 len, quint16 count);
+    static void writePhrase(std::string &out, const UserPhrase &phrase);
+    quint32 fingerprint() const;
+
+    const SpellingTrie *st_;
+    const DictTrie *dt_;
+    // 所有模糊音规则都打开的表，用于还原拼音，比任何会话的规则都宽
+    FuzzyTable fuzzy_all_;
+
+    // 只由后台线程使用的表
+    Tables table_;
+    std::atomic<Snapshot *> current_;
+    // 分配过的所有副本，只由后台线程使用
+    std::vector<Snapshot *> snapshots_;
+
+    // 保护 rings_ 的增减；record 不用它
+    mutable std::mutex rings_mutex_;
+    std::vector<UserRing *> rings_;
+    // record(const UserChoice &) 共用的队列
+    std::mutex shared_mutex_;
+    UserRing *shared_ring_;
+
+    std::mutex queue_mutex_;
+    // 后台线程休眠时，有新的选择、flush、clear 或退出时通知它
+    std::condition_variable wake_;
+    // 处理完一批时通知 flush
+    std::condition_variable flushed_;
+    // 后台线程是否在无限期地等待，此时 record 须唤醒它
+    std::atomic<bool> parked_;
+    // 有队列满了，后台线程不等满周期立即取
+    bool kicked_;
+    quint64 flush_req_;
+    quint64 flush_done_;
+    bool clear_;
+    bool quit_;
+
+    std::atomic<bool> persistent_;
+    // 以下只由后台线程使用
+    std::string path_;
+    int fd_;
+    // 日志中的记录数
+    size_t log_records_;
+    std::thread worker_;
+};
+
+
+bool UserDict::isPersistent() const
+{
+    return persistent_;
+}
+
+void UserDict::release(const Snapshot *snapshot) const
+{
+    snapshot->refs.fetch_sub(1, std::memory_order_release);
+}
+
+quint16 UserDict::psbOf(quint16 count)
+{
+    Q_ASSERT(count > 0);
+    const int psb = kUserPsbBase - kUserPsbStep * highestBit64(count);
+    return quint16(psb > 0? psb: 0);
+}
+
+NAMESPACEEND
+
+#endif // USERDICT_H
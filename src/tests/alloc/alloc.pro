@@ -0,0 +1,15 @@
+# 测试：预热后的逐键查找、选择、撤销和取结果都不分配内存
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = epinyin-test-alloc
+DESTDIR = $$PWD/../../../dist
+
+include($$PWD/../../ime/ime.pri)
+
+# 默认使用随工程提供的词库和拼音语料
+DEFINES += TEST_DICT=\\\"$$PWD/../../ime/dict_pinyin.dat\\\"
+DEFINES += TEST_CORPUS=\\\"$$PWD/../../bench/corpus.txt\\\"
+
+SOURCES += \
+    main.cpp
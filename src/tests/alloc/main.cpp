@@ -0,0 +1,184 @@
+// Checks that a warm Decoder does not touch the heap: every keystroke of
+// search, choose, cancelLastChoice and the buffer overloads of getCandidate
+// and getFixedStr must make zero allocations. Exits non-zero otherwise.
+//
+// usage: epinyin-test-alloc [dict_pinyin.dat] [corpus.txt]
+
+#include "dictionary.h"
+#include "decoder.h"
+#include "spellingtrie.h"
+#include <new>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace IME;
+
+// Candidates shown at once by a typical UI.
+#define kPageSize 10
+
+// Every heap allocation made by the process. The test is single threaded.
+static long long g_allocs = 0;
+
+void *operator new(size_t size)
+{
+    g_allocs++;
+    void *p = malloc(size? size: 1);
+    if (pNull == p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Non-empty lines of the corpus that are not comments or set headers.
+static bool loadInputs(const char *path, std::vector<std::string> &inputs)
+{
+    FILE *f = fopen(path, "rb");
+    if (pNull == f) return false;
+    char line[1024];
+    while (fgets(line, sizeof (line), f))
+    {
+        std::string s(line);
+        while (!s.empty() && (s[s.size() - 1] == '\n' || s[s.size() - 1] == '\r' ||
+                              s[s.size() - 1] == ' '))
+        {
+            s.erase(s.size() - 1);
+        }
+        if (s.empty() || '#' == s[0] || '[' == s[0] || int(s.size()) >= kMaxRowNum) continue;
+        inputs.push_back(s);
+    }
+    fclose(f);
+    return !inputs.empty();
+}
+
+// One operation of a session, checked separately so that a failure names it.
+struct Checker
+{
+    long long failures;
+    const char *mode;
+    const std::string *input;
+
+    template <typename Fn>
+    void check(const char *op, int key, Fn fn)
+    {
+        const long long a = g_allocs;
+        fn();
+        const long long n = g_allocs - a;
+        if (0 == n) return;
+        if (failures++ < 20)
+        {
+            fprintf(stderr, "FAIL %s: \"%s\" key %d %s: %lld allocations\n",
+                    mode, input->c_str(), key, op, n);
+        }
+    }
+};
+
+// Types every input one key at a time, reading the first page after each
+// key, then chooses the first candidate and takes the choice back. With
+// checker set, every step must not allocate.
+static void typeAll(Decoder &dec, const std::vector<std::string> &inputs, Checker *checker)
+{
+    char16_t buf[kPageSize * kMaxLemmaSize];
+    char16_t fixed[kMaxRowNum];
+    int lens[kPageSize];
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        const std::string &py = inputs[i];
+        Checker dummy = { 0, "", &py };
+        Checker &c = pNull != checker? *checker: dummy;
+        c.input = &py;
+        c.check("resetSearch", 0, [&]() { dec.resetSearch(); });
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            c.check("search", int(k), [&]() { dec.search(py.data(), int(k)); });
+            c.check("getCandidate", int(k), [&]() {
+                dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+            });
+        }
+        const int key = int(py.size());
+        while (dec.getCandidateCount() > 0 && dec.getFixedSplLen() < key)
+        {
+            c.check("choose", key, [&]() { dec.choose(0); });
+            c.check("getFixedStr", key, [&]() { dec.getFixedStr(fixed, kMaxRowNum); });
+            c.check("getCandidate", key, [&]() {
+                dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+            });
+        }
+        while (dec.getFixedLen() > 0)
+        {
+            c.check("cancelLastChoice", key, [&]() { dec.cancelLastChoice(); });
+            c.check("getCandidate", key, [&]() {
+                dec.getCandidate(0, kPageSize, buf, kPageSize * kMaxLemmaSize, lens, kPageSize);
+            });
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dictfile = argc > 1? argv[1]: TEST_DICT;
+    const char *corpus = argc > 2? argv[2]: TEST_CORPUS;
+    Dictionary dict(dictfile);
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "cannot load %s\n", dictfile);
+        return 2;
+    }
+    std::vector<std::string> inputs;
+    if (!loadInputs(corpus, inputs))
+    {
+        fprintf(stderr, "cannot read corpus %s\n", corpus);
+        return 2;
+    }
+
+    struct Mode
+    {
+        const char *name;
+        quint32 fuzzy;
+        bool sentence;
+    };
+    const Mode modes[] = {
+        { "exact", 0, false },
+        { "fuzzy", kFuzzyAll, false },
+        { "sentence", 0, true },
+    };
+    long long failures = 0;
+    for (size_t m = 0; m < sizeof (modes) / sizeof (modes[0]); m++)
+    {
+        Decoder dec(&dict);
+        dec.setFuzzyRules(modes[m].fuzzy);
+        dec.setSentenceEnabled(modes[m].sentence);
+        // The first round grows the buffers that size themselves to the
+        // input, the second must not allocate at all
+        typeAll(dec, inputs, pNull);
+        Checker c = { 0, modes[m].name, pNull };
+        typeAll(dec, inputs, &c);
+        printf("%-8s %zu inputs: %lld failures\n", modes[m].name, inputs.size(), c.failures);
+        failures += c.failures;
+    }
+    return 0 == failures? 0: 1;
+}
@@ -0,0 +1,14 @@
+# 测试：损坏的词库要么被拒绝，要么给出与完好的词库相同的候选
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = epinyin-test-dictload
+DESTDIR = $$PWD/../../../dist
+
+include($$PWD/../../ime/ime.pri)
+
+# 默认使用随工程提供的词库
+DEFINES += TEST_DICT=\\\"$$PWD/../../ime/dict_pinyin.dat\\\"
+
+SOURCES += \
+    main.cpp
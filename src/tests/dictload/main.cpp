@@ -0,0 +1,278 @@
+// Loads the dictionary from damaged copies in memory and checks that each
+// one is either rejected or still gives the same candidates as the intact
+// file. Exits non-zero on any unexpected result.
+//
+// usage: epinyin-test-dictload [dict_pinyin.dat]
+
+#include "dictionary.h"
+#include "dictcontainer.h"
+#include "dictreader.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "decoder.h"
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+using namespace IME;
+
+// Inputs whose candidates are compared with the intact dictionary.
+static const char *kInputs[] = {
+    "nihao", "zhongguo", "xi'an", "bjdx", "woshizhongguoren", "sss",
+};
+
+static int g_checks = 0;
+static int g_failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+    g_checks++;
+    if (ok) return;
+    g_failures++;
+    fprintf(stderr, "FAIL %s\n", what);
+}
+
+static bool readFile(const char *path, std::string &data)
+{
+    FILE *f = fopen(path, "rb");
+    if (pNull == f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof (buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+    return !data.empty();
+}
+
+// The first candidates of every input, one line each.
+static std::u16string candidates(const Dictionary &dict)
+{
+    Decoder dec(&dict);
+    std::u16string s;
+    for (size_t i = 0; i < sizeof (kInputs) / sizeof (kInputs[0]); i++)
+    {
+        dec.resetSearch();
+        dec.search(kInputs[i], int(strlen(kInputs[i])));
+        for (int k = 0; k < dec.getCandidateCount() && k < 10; k++)
+        {
+            int len;
+            const char16_t *text = dec.getCandidateView(k, &len);
+            s.append(text, size_t(len));
+            s += u'|';
+        }
+        s += u'\n';
+    }
+    return s;
+}
+
+// Loads data, which must stay valid while the dictionary is used.
+static bool loads(const std::string &data)
+{
+    Dictionary dict(data.data(), qint64(data.size()));
+    return dict.isValid();
+}
+
+// Loads data and compares its candidates with expected.
+static bool loadsSame(const std::string &data, const std::u16string &expected)
+{
+    Dictionary dict(data.data(), qint64(data.size()));
+    return dict.isValid() && candidates(dict) == expected;
+}
+
+// Size of the old format without the optional compiled sections, which end
+// the file when present.
+static qint64 plainSize(const std::string &data)
+{
+    DictReader r;
+    SpellingTrie st;
+    DictTrie dt;
+    const bool b =
+            r.open(data.data(), qint64(data.size())) &&
+            st.loadSplTrie(r) &&
+            dt.loadDictList(r) &&
+            dt.loadDictDict(r, int(st.getSpellingNum())) &&
+            dt.loadDictNGram(r);
+    return b? r.pos(): -1;
+}
+
+// Loads data whose compiled spelling trie is damaged: the trie must be
+// built again instead of mapped, and give the same candidates.
+static bool rebuildsTrie(const std::string &data, const std::u16string &expected)
+{
+    Dictionary dict(data.data(), qint64(data.size()));
+    return dict.isValid() && !dict.spellingTrie()->isCompiled() && candidates(dict) == expected;
+}
+
+// Damages the nodes of the compiled spelling trie at offset in ways the
+// cheap bounds checks on load let through.
+static void checkCompiledTrie(const std::string &compiled, size_t offset,
+                              const std::u16string &expected)
+{
+    // magic, version, spelling_num, node_num, level1_sons_, h2f_start_, h2f_num_
+    const size_t nodesAt = offset + 16 + sizeof (quint16) * (kValidSplCharNum + 2 * kFullSplIdStart);
+    quint32 nodeNum;
+    memcpy(&nodeNum, compiled.data() + offset + 12, 4);
+    expect(0 == compiled.compare(offset, 4, "SPLT") &&
+           nodesAt + sizeof (SpellingNode) * nodeNum <= compiled.size(), "trie: find the nodes");
+    if (nodeNum < 2 || nodesAt + sizeof (SpellingNode) * nodeNum > compiled.size()) return;
+
+    SpellingNode root, first;
+    memcpy(&root, compiled.data() + nodesAt, sizeof (root));
+    const size_t firstAt = nodesAt + sizeof (SpellingNode) * root.first_son;
+    memcpy(&first, compiled.data() + firstAt, sizeof (first));
+    expect(first.num_of_son > 0, "trie: the first letter has sons");
+    if (0 == first.num_of_son) return;
+
+    // The first letter becomes its own son: a walk without a bound never ends
+    std::string cycle = compiled;
+    SpellingNode node = first;
+    node.first_son = root.first_son;
+    memcpy(&cycle[firstAt], &node, sizeof (node));
+    expect(rebuildsTrie(cycle, expected), "trie: rebuild a trie with a cycle");
+
+    // A letter outside A-Z would index past the transition row
+    const char bad[] = { '@', '[', '`', '{', '\0', '\x80' };
+    for (size_t i = 0; i < sizeof (bad); i++)
+    {
+        std::string letter = compiled;
+        node = first;
+        node.char_this_node = bad[i];
+        memcpy(&letter[firstAt], &node, sizeof (node));
+        expect(rebuildsTrie(letter, expected), "trie: rebuild a trie with a bad letter");
+    }
+}
+
+// The old format, then the same with the compiled trie and nodes appended
+// as dicttool compile-spl and compile-nodes do.
+static void checkStream(const std::string &file)
+{
+    const qint64 size = plainSize(file);
+    expect(size > 0, "stream: parse the sections");
+    if (size <= 0) return;
+    const std::string plain(file, 0, size_t(size));
+    std::u16string expected;
+    {
+        Dictionary dict(plain.data(), qint64(plain.size()));
+        expect(dict.isValid(), "stream: load");
+        if (!dict.isValid()) return;
+        expected = candidates(dict);
+    }
+
+    expect(!loads(plain + "junk"), "stream: reject bytes after the n-gram");
+    expect(!loads(plain + std::string(1, '\0')), "stream: reject one byte after the n-gram");
+    expect(!loads(plain.substr(0, plain.size() - 1)), "stream: reject a truncated n-gram");
+
+    std::string compiled = plain;
+    {
+        Dictionary dict(plain.data(), qint64(plain.size()));
+        dict.spellingTrie()->saveCompiledTrie(compiled);
+        dict.dictTrie()->saveCompiledNodes(compiled);
+    }
+    {
+        Dictionary dict(compiled.data(), qint64(compiled.size()));
+        expect(dict.isValid() && dict.spellingTrie()->isCompiled() &&
+               dict.dictTrie()->isCompiled(), "stream: map the compiled sections");
+    }
+    expect(loadsSame(compiled, expected), "stream: same candidates with the compiled sections");
+    expect(!loads(compiled + "junk"), "stream: reject bytes after the compiled sections");
+
+    checkCompiledTrie(compiled, plain.size(), expected);
+}
+
+// Offsets in the v2 file header, see DictContainerHeader.
+#define kTableCrcAt 20
+#define kHeaderCrcAt 32
+
+// Recomputes the checksums of the header and the section table after the
+// table was edited, so that only the edit itself can make the file invalid.
+static void resign(std::string &v2, quint32 sectionNum)
+{
+    const size_t tableLen = sectionNum * sizeof (DictSection);
+    const quint32 tableCrc = DictContainer::checksum(v2.data() + kDictContainerHeaderSize, tableLen);
+    memcpy(&v2[kTableCrcAt], &tableCrc, 4);
+    const quint32 headerCrc = DictContainer::checksum(v2.data(), kHeaderCrcAt);
+    memcpy(&v2[kHeaderCrcAt], &headerCrc, 4);
+}
+
+static DictSection *sectionAt(std::string &v2, int i)
+{
+    return (DictSection *) &v2[kDictContainerHeaderSize + i * sizeof (DictSection)];
+}
+
+// The v2 format converted from the old one, then copies damaged in the
+// header, the section table and the file size.
+static void checkContainer(const std::string &file)
+{
+    std::u16string expected;
+    {
+        Dictionary dict(file.data(), qint64(file.size()));
+        if (!dict.isValid()) return;
+        expected = candidates(dict);
+    }
+    std::string v2;
+    expect(DictContainer::convert(file.data(), qint64(file.size()), v2), "v2: convert");
+    DictContainer c;
+    expect(c.open(v2.data(), qint64(v2.size())), "v2: open");
+    const int num = c.sectionNum();
+    expect(num >= 2, "v2: sections");
+    if (num < 2) return;
+    for (int i = 0; i < num; i++) expect(c.verify(i), "v2: section checksums");
+    expect(loadsSame(v2, expected), "v2: same candidates");
+
+    std::string bad = v2;
+    bad[kHeaderCrcAt] ^= 1;
+    expect(!loads(bad), "v2: reject a bad header checksum");
+
+    bad = v2;
+    sectionAt(bad, 0)->flags ^= 1;
+    expect(!loads(bad), "v2: reject a bad table checksum");
+
+    expect(!loads(v2.substr(0, v2.size() - 1)), "v2: reject a truncated file");
+    expect(!loads(v2.substr(0, kDictContainerHeaderSize)), "v2: reject the header alone");
+    expect(!loads(v2 + "junk"), "v2: reject trailing bytes");
+
+    // The file size is also in the header: trailing bytes that it covers
+    // are still rejected, the last section must end the file
+    bad = v2 + std::string(kDictContainerAlign, '\0');
+    const quint64 size = bad.size();
+    memcpy(&bad[24], &size, 8);
+    resign(bad, quint32(num));
+    expect(!loads(bad), "v2: reject bytes after the last section");
+
+    bad = v2;
+    sectionAt(bad, 1)->offset += 8;
+    resign(bad, quint32(num));
+    expect(!loads(bad), "v2: reject a misaligned section");
+
+    bad = v2;
+    sectionAt(bad, 1)->offset = sectionAt(bad, 0)->offset;
+    resign(bad, quint32(num));
+    expect(!loads(bad), "v2: reject overlapping sections");
+
+    bad = v2;
+    sectionAt(bad, num - 1)->size += kDictContainerAlign;
+    resign(bad, quint32(num));
+    expect(!loads(bad), "v2: reject a section past the end");
+
+    // Section contents are only checked by verify, not on load
+    bad = v2;
+    bad[size_t(sectionAt(bad, num - 1)->offset)] ^= 1;
+    expect(c.open(bad.data(), qint64(bad.size())) && !c.verify(num - 1),
+           "v2: verify finds a damaged section");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dictfile = argc > 1? argv[1]: TEST_DICT;
+    std::string file;
+    if (!readFile(dictfile, file))
+    {
+        fprintf(stderr, "cannot read %s\n", dictfile);
+        return 2;
+    }
+
+    checkStream(file);
+    checkContainer(file);
+
+    printf("%d checks: %d failures\n", g_checks, g_failures);
+    return 0 == g_failures? 0: 1;
+}
@@ -0,0 +1,248 @@
+// Runs many Decoder sessions on many threads against one shared Dictionary
+// and compares every step with a single session typing the same input
+// alone. Exits non-zero on any difference. Build with -fsanitize=thread
+// (qmake CONFIG+=tsan) to also check the sharing for data races.
+//
+// usage: epinyin-test-sessions [--sessions=N] [--threads=M] [--rounds=R]
+//                              [dict_pinyin.dat] [corpus.txt]
+
+#include "dictionary.h"
+#include "decoder.h"
+#include "spellingtrie.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace IME;
+
+// Candidates compared after each step.
+#define kPageSize 20
+
+// Session configurations, chosen by session number. The sentence budget
+// is unlimited so that the result does not depend on the load.
+#define kConfigNum 3
+
+static void configure(Decoder &dec, int config)
+{
+    dec.setFuzzyRules(1 == config? quint32(kFuzzyAll): 0);
+    dec.setSentenceEnabled(2 == config);
+    dec.setSentenceBudget(0, 0);
+}
+
+static bool loadInputs(const char *path, std::vector<std::string> &inputs)
+{
+    FILE *f = fopen(path, "rb");
+    if (pNull == f) return false;
+    char line[1024];
+    while (fgets(line, sizeof (line), f))
+    {
+        std::string s(line);
+        while (!s.empty() && (s[s.size() - 1] == '\n' || s[s.size() - 1] == '\r' ||
+                              s[s.size() - 1] == ' '))
+        {
+            s.erase(s.size() - 1);
+        }
+        if (s.empty() || '#' == s[0] || '[' == s[0] || int(s.size()) >= kMaxRowNum) continue;
+        inputs.push_back(s);
+    }
+    fclose(f);
+    return !inputs.empty();
+}
+
+// The visible state after a step: the number of candidates, the first page
+// and the fixed string.
+static std::u16string snapshot(const Decoder &dec)
+{
+    char16_t buf[kMaxRowNum];
+    std::u16string s;
+    const int count = dec.getCandidateCount();
+    s += char16_t(count);
+    for (int i = 0; i < count && i < kPageSize; i++)
+    {
+        int len;
+        const char16_t *text = dec.getCandidateView(i, &len);
+        s.append(text, size_t(len));
+        s += u'|';
+    }
+    s.append(buf, size_t(dec.getFixedStr(buf, kMaxRowNum)));
+    return s;
+}
+
+// Steps of typing one input: each key, then choosing the first candidate
+// until the input is fixed, then taking the choices back one by one.
+struct Typing
+{
+    const std::string *input;
+    size_t key;
+    bool choosing;
+
+    void start(Decoder &dec, const std::string *py)
+    {
+        input = py;
+        key = 0;
+        choosing = true;
+        dec.resetSearch();
+    }
+
+    // Makes the next step, returns false when the input is done
+    bool next(Decoder &dec)
+    {
+        const int len = int(input->size());
+        if (key < input->size())
+        {
+            key++;
+            dec.search(input->data(), int(key));
+            return true;
+        }
+        if (choosing && dec.getCandidateCount() > 0 && dec.getFixedSplLen() < len)
+        {
+            dec.choose(0);
+            return true;
+        }
+        choosing = false;
+        if (dec.getFixedLen() > 0)
+        {
+            dec.cancelLastChoice();
+            return true;
+        }
+        return false;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    int sessionNum = 400;
+    int threadNum = int(std::thread::hardware_concurrency());
+    int rounds = 2;
+    const char *dictfile = TEST_DICT;
+    const char *corpus = TEST_CORPUS;
+    int files = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strncmp(argv[i], "--sessions=", 11)) sessionNum = atoi(argv[i] + 11);
+        else if (0 == strncmp(argv[i], "--threads=", 10)) threadNum = atoi(argv[i] + 10);
+        else if (0 == strncmp(argv[i], "--rounds=", 9)) rounds = atoi(argv[i] + 9);
+        else if ('-' != argv[i][0] && files < 2)
+        {
+            if (0 == files++) dictfile = argv[i];
+            else corpus = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: epinyin-test-sessions [--sessions=N] [--threads=M] "
+                            "[--rounds=R] [dict_pinyin.dat] [corpus.txt]\n");
+            return 2;
+        }
+    }
+    if (threadNum < 4) threadNum = 4;
+    if (sessionNum < threadNum) sessionNum = threadNum;
+
+    const Dictionary dict(dictfile);
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "cannot load %s\n", dictfile);
+        return 2;
+    }
+    std::vector<std::string> inputs;
+    if (!loadInputs(corpus, inputs))
+    {
+        fprintf(stderr, "cannot read corpus %s\n", corpus);
+        return 2;
+    }
+
+    // Expected states, from one session per configuration typing alone
+    std::vector<std::vector<std::u16string> > expected[kConfigNum];
+    for (int config = 0; config < kConfigNum; config++)
+    {
+        Decoder dec(&dict);
+        configure(dec, config);
+        expected[config].resize(inputs.size());
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            Typing t;
+            t.start(dec, &inputs[i]);
+            while (t.next(dec)) expected[config][i].push_back(snapshot(dec));
+        }
+    }
+
+    // Every thread owns sessionNum / threadNum sessions and advances them
+    // one step at a time in turn, so that all sessions are in the middle of
+    // an input together. Session s starts at input s and goes round.
+    std::atomic<long long> steps(0), failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadNum; t++)
+    {
+        threads.push_back(std::thread([&, t]() {
+            struct Session
+            {
+                Decoder *dec;
+                int config;
+                size_t input;
+                size_t done;
+                size_t step;
+                Typing typing;
+            };
+            std::vector<Session> sessions;
+            for (int s = t; s < sessionNum; s += threadNum)
+            {
+                Session ss;
+                ss.dec = new Decoder(&dict);
+                ss.config = s % kConfigNum;
+                configure(*ss.dec, ss.config);
+                ss.input = size_t(s) % inputs.size();
+                ss.done = 0;
+                ss.step = 0;
+                ss.typing.start(*ss.dec, &inputs[ss.input]);
+                sessions.push_back(ss);
+            }
+            const size_t total = inputs.size() * size_t(rounds);
+            long long localSteps = 0;
+            size_t active = sessions.size();
+            while (active > 0)
+            {
+                active = 0;
+                for (size_t k = 0; k < sessions.size(); k++)
+                {
+                    Session &s = sessions[k];
+                    if (s.done >= total) continue;
+                    active++;
+                    if (s.typing.next(*s.dec))
+                    {
+                        const std::vector<std::u16string> &e = expected[s.config][s.input];
+                        if (s.step >= e.size() || snapshot(*s.dec) != e[s.step])
+                        {
+                            if (failures++ < 20)
+                            {
+                                fprintf(stderr, "FAIL thread %d config %d: \"%s\" step %zu\n",
+                                        t, s.config, inputs[s.input].c_str(), s.step);
+                            }
+                        }
+                        s.step++;
+                        localSteps++;
+                        continue;
+                    }
+                    if (s.step != expected[s.config][s.input].size() && failures++ < 20)
+                    {
+                        fprintf(stderr, "FAIL thread %d config %d: \"%s\" ended after %zu steps\n",
+                                t, s.config, inputs[s.input].c_str(), s.step);
+                    }
+                    s.done++;
+                    s.input = (s.input + 1) % inputs.size();
+                    s.step = 0;
+                    s.typing.start(*s.dec, &inputs[s.input]);
+                }
+            }
+            for (size_t k = 0; k < sessions.size(); k++) delete sessions[k].dec;
+            steps += localSteps;
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+    printf("%d sessions on %d threads, %lld steps: %lld failures\n",
+           sessionNum, threadNum, (long long)steps, (long long)failures);
+    return 0 == failures? 0: 1;
+}
@@ -0,0 +1,21 @@
+# 测试：多个线程上的大量会话共享同一份词库，结果与单独运行一致
+TEMPLATE = app
+CONFIG   += console c++11 thread
+CONFIG   -= app_bundle qt
+TARGET   = epinyin-test-sessions
+DESTDIR = $$PWD/../../../dist
+
+include($$PWD/../../ime/ime.pri)
+
+# 默认使用随工程提供的词库和拼音语料
+DEFINES += TEST_DICT=\\\"$$PWD/../../ime/dict_pinyin.dat\\\"
+DEFINES += TEST_CORPUS=\\\"$$PWD/../../bench/corpus.txt\\\"
+
+# qmake CONFIG+=tsan 时用 ThreadSanitizer 检查数据竞争
+tsan {
+    QMAKE_CXXFLAGS += -fsanitize=thread -g
+    QMAKE_LFLAGS += -fsanitize=thread
+}
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,154 @@
+// Loads the dictionary with the default trie and with the succinct one
+// (kDictSuccinctTrie) and checks that both give the same lemmas from
+// enumLemmas and the same candidates from setCandidates for every prefix
+// of every corpus input, exact and with every fuzzy rule. Exits non-zero
+// on any difference.
+//
+// usage: epinyin-test-succinct [dict_pinyin.dat] [corpus.txt]
+
+#include "dictionary.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "candidates.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+using namespace IME;
+
+static long long g_checks = 0;
+static long long g_failures = 0;
+
+static void expect(bool ok, const char *what, const std::string &input = std::string(),
+                   int key = 0)
+{
+    g_checks++;
+    if (ok) return;
+    if (g_failures++ < 20)
+    {
+        if (input.empty()) fprintf(stderr, "FAIL %s\n", what);
+        else fprintf(stderr, "FAIL %s: \"%s\" key %d\n", what, input.c_str(), key);
+    }
+}
+
+// Non-empty lines of the corpus that are not comments or set headers.
+static bool loadInputs(const char *path, std::vector<std::string> &inputs)
+{
+    FILE *f = fopen(path, "rb");
+    if (pNull == f) return false;
+    char line[1024];
+    while (fgets(line, sizeof (line), f))
+    {
+        std::string s(line);
+        while (!s.empty() && (s[s.size() - 1] == '\n' || s[s.size() - 1] == '\r' ||
+                              s[s.size() - 1] == ' '))
+        {
+            s.erase(s.size() - 1);
+        }
+        if (s.empty() || '#' == s[0] || '[' == s[0] || int(s.size()) >= kMaxRowNum) continue;
+        inputs.push_back(s);
+    }
+    fclose(f);
+    return !inputs.empty();
+}
+
+// Every lemma as its id followed by its spelling ids, sorted.
+static std::vector<std::vector<quint32> > lemmas(const DictTrie *dt)
+{
+    std::vector<std::vector<quint32> > all;
+    dt->enumLemmas([&](quint32 id, const quint16 *splids, int len) {
+        std::vector<quint32> v(1, id);
+        v.insert(v.end(), splids, splids + len);
+        all.push_back(v);
+    });
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+static bool sameCandidates(const Candidates &a, const Candidates &b)
+{
+    if (a.size() != b.size()) return false;
+    for (int i = 0; i < a.size(); i++)
+    {
+        const LmaPsbItem &x = a.at(i);
+        const LmaPsbItem &y = b.at(i);
+        if (x.id != y.id || x.lma_len != y.lma_len || x.psb != y.psb) return false;
+    }
+    return true;
+}
+
+// Types every input one key at a time on both tries, each with its own
+// frontier as a session would, and compares the whole candidate list after
+// each key. The full input is also looked up without a frontier.
+static void typeAll(const Dictionary &column, const Dictionary &succinct,
+                    const std::vector<std::string> &inputs, const FuzzyTable *fuzzy,
+                    const char *mode)
+{
+    const SpellingTrie *st = column.spellingTrie();
+    Candidates *a = new Candidates;
+    Candidates *b = new Candidates;
+    LmaFrontier *fa = new LmaFrontier;
+    LmaFrontier *fb = new LmaFrontier;
+    fa->fuzzy = fuzzy;
+    fb->fuzzy = fuzzy;
+    const std::string what = std::string(mode) + ": same candidates";
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        const std::string &py = inputs[i];
+        quint16 splIdx[kMaxRowNum];
+        fa->reset();
+        fb->reset();
+        int num = 0;
+        for (size_t k = 1; k <= py.size(); k++)
+        {
+            num = st->splstrToIdxs(py.data(), quint16(k), splIdx, pNull, kMaxRowNum - 1);
+            if (num <= 0) continue;
+            const int na = column.dictTrie()->setCandidates(splIdx, num, a, st, fa);
+            const int nb = succinct.dictTrie()->setCandidates(splIdx, num, b, st, fb);
+            expect(na == nb && sameCandidates(*a, *b), what.c_str(), py, int(k));
+        }
+        if (num <= 0 || pNull != fuzzy) continue;
+        column.dictTrie()->setCandidates(splIdx, num, a, st);
+        succinct.dictTrie()->setCandidates(splIdx, num, b, st);
+        expect(sameCandidates(*a, *b), "cold: same candidates", py, int(py.size()));
+    }
+    delete fb;
+    delete fa;
+    delete b;
+    delete a;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dictfile = argc > 1? argv[1]: TEST_DICT;
+    const char *corpus = argc > 2? argv[2]: TEST_CORPUS;
+    const Dictionary column(dictfile);
+    const Dictionary succinct(dictfile, kDictSuccinctTrie);
+    if (!column.isValid() || !succinct.isValid())
+    {
+        fprintf(stderr, "cannot load %s\n", dictfile);
+        return 2;
+    }
+    std::vector<std::string> inputs;
+    if (!loadInputs(corpus, inputs))
+    {
+        fprintf(stderr, "cannot read corpus %s\n", corpus);
+        return 2;
+    }
+    expect(!column.dictTrie()->isSuccinct() && succinct.dictTrie()->isSuccinct(),
+           "load the two representations");
+
+    const std::vector<std::vector<quint32> > all = lemmas(column.dictTrie());
+    expect(!all.empty() && all == lemmas(succinct.dictTrie()), "same lemmas");
+
+    typeAll(column, succinct, inputs, pNull, "exact");
+    FuzzyTable fuzzy;
+    column.spellingTrie()->buildFuzzyTable(kFuzzyAll, &fuzzy);
+    typeAll(column, succinct, inputs, &fuzzy, "fuzzy");
+
+    printf("%zu lemmas, %zu inputs, %lld checks: %lld failures\n",
+           all.size(), inputs.size(), g_checks, g_failures);
+    return 0 == g_failures? 0: 1;
+}
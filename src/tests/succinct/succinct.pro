@@ -0,0 +1,15 @@
+# 测试：简洁表示的词条树与默认的表示给出相同的词条和候选
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = epinyin-test-succinct
+DESTDIR = $$PWD/../../../dist
+
+include($$PWD/../../ime/ime.pri)
+
+# 默认使用随工程提供的词库和拼音语料
+DEFINES += TEST_DICT=\\\"$$PWD/../../ime/dict_pinyin.dat\\\"
+DEFINES += TEST_CORPUS=\\\"$$PWD/../../bench/corpus.txt\\\"
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,276 @@
+// Writes a user dictionary log through UserDict, damages copies of the file
+// and loads them again: the log must replay to the same tables, a torn or
+// corrupt tail must be cut at the last good record, a log of another
+// dictionary must be reset, and compaction must keep the tables. Exits
+// non-zero on any unexpected result.
+//
+// usage: epinyin-test-userlog [dict_pinyin.dat] [log file]
+
+#include "dictionary.h"
+#include "dicttrie.h"
+#include "dictlist.h"
+#include "candidates.h"
+#include "userdict.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+using namespace IME;
+
+// Offsets and sizes of the log format, see UserDict::writeHeader and
+// writeLemma.
+#define kHeaderSize 16
+#define kFingerprintAt 12
+#define kLemmaRecordSize 12
+
+// System lemmas recorded, the last one after the phrases.
+#define kLemmaNum 6
+// Choices of the first lemmas recorded to make the log compact.
+#define kCompactChoices 3000
+#define kCompactLemmas 10
+
+static int g_checks = 0;
+static int g_failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+    g_checks++;
+    if (ok) return;
+    g_failures++;
+    fprintf(stderr, "FAIL %s\n", what);
+}
+
+static bool readFile(const char *path, std::string &data)
+{
+    data.clear();
+    FILE *f = fopen(path, "rb");
+    if (pNull == f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof (buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+    return true;
+}
+
+static bool writeFile(const char *path, const std::string &data)
+{
+    FILE *f = fopen(path, "wb");
+    if (pNull == f) return false;
+    const bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return 0 == fclose(f) && ok;
+}
+
+static UserChoice lemmaChoice(const DictTrie *dt, quint32 id, const quint16 *splids, int len)
+{
+    UserChoice c;
+    c.len = quint8(len);
+    c.part_num = 1;
+    c.part_len[0] = quint8(len);
+    c.part_id[0] = id;
+    memcpy(c.splids, splids, len * sizeof (quint16));
+    dt->copyLemma(id, len, c.text);
+    return c;
+}
+
+// A choice of a user phrase, with text that no system lemma has.
+static UserChoice phraseChoice(const quint16 *splids, int len, char16_t first)
+{
+    UserChoice c;
+    c.len = quint8(len);
+    c.part_num = 1;
+    c.part_len[0] = quint8(len);
+    c.part_id[0] = 0;
+    memcpy(c.splids, splids, len * sizeof (quint16));
+    for (int i = 0; i < len; i++) c.text[i] = char16_t(first + i);
+    return c;
+}
+
+// What the tables give to lookups: the adjusted psb of every lemma and the
+// phrases matching every phrase, with their counts.
+struct Probe
+{
+    std::vector<LmaPsbItem> lemmas;
+    std::vector<UserChoice> phrases;
+
+    std::u16string state(const UserDict &user, const SpellingTrie *st) const
+    {
+        std::u16string s;
+        s += char16_t(user.lemmaNum());
+        s += char16_t(user.phraseNum());
+        Candidates cands;
+        for (size_t i = 0; i < lemmas.size(); i++) cands.append(lemmas[i]);
+        user.adjust(&cands);
+        for (int i = 0; i < cands.size(); i++) s += char16_t(cands.itemAt(i).psb);
+        UserPhrase out[kMaxUserCandidates];
+        for (size_t i = 0; i < phrases.size(); i++)
+        {
+            const int n = user.matchPhrases(phrases[i].splids, phrases[i].len, st, pNull,
+                                            out, kMaxUserCandidates);
+            s += u'|';
+            for (int k = 0; k < n; k++)
+            {
+                s.append(out[k].text, out[k].len);
+                s += char16_t(out[k].count);
+            }
+        }
+        return s;
+    }
+};
+
+// Loads the log at path and returns its state, and the file size after
+// loading in size.
+static std::u16string reload(const Dictionary &dict, const char *path, const Probe &probe,
+                             size_t *size)
+{
+    std::u16string s;
+    {
+        UserDict user(&dict, path);
+        expect(user.isPersistent(), "reload: open the log");
+        s = probe.state(user, dict.spellingTrie());
+    }
+    std::string data;
+    readFile(path, data);
+    *size = data.size();
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dictfile = argc > 1? argv[1]: TEST_DICT;
+    const char *path = argc > 2? argv[2]: "epinyin-test-userlog.log";
+    const Dictionary dict(dictfile);
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "cannot load %s\n", dictfile);
+        return 2;
+    }
+    const SpellingTrie *st = dict.spellingTrie();
+    const DictTrie *dt = dict.dictTrie();
+    remove(path);
+
+    // Single characters to record as system lemmas, and the readings of a
+    // two and a three character lemma to give the phrases
+    std::vector<UserChoice> lemmas;
+    quint16 spl2[2] = { 0, 0 }, spl3[3] = { 0, 0, 0 };
+    Probe probe;
+    dt->enumLemmas([&](quint32 id, const quint16 *splids, int len) {
+        // A few ids in the trie are past the lemma table
+        if (dt->dictList()->getLemmaLen(id) != len) return;
+        if (1 == len && lemmas.size() < kCompactLemmas)
+        {
+            lemmas.push_back(lemmaChoice(dt, id, splids, len));
+            const LmaPsbItem item = { id, 1, 0xffff };
+            probe.lemmas.push_back(item);
+        }
+        if (2 == len && 0 == spl2[0]) memcpy(spl2, splids, sizeof (spl2));
+        if (3 == len && 0 == spl3[0]) memcpy(spl3, splids, sizeof (spl3));
+    });
+    expect(lemmas.size() == kCompactLemmas && 0 != spl2[0] && 0 != spl3[0], "find lemmas");
+    if (lemmas.size() < kCompactLemmas || 0 == spl2[0] || 0 == spl3[0]) return 1;
+    probe.phrases.push_back(phraseChoice(spl2, 2, u'\u4e02'));
+    probe.phrases.push_back(phraseChoice(spl3, 3, u'\u4e04'));
+
+    // The choices written, one record each: the lemmas, the phrases, then
+    // the last lemma
+    std::vector<UserChoice> choices(lemmas.begin(), lemmas.begin() + kLemmaNum - 1);
+    choices.insert(choices.end(), probe.phrases.begin(), probe.phrases.end());
+    choices.push_back(lemmas[kLemmaNum - 1]);
+    const size_t recordNum = choices.size();
+    // Where each record starts, and the tables after the first r records
+    std::vector<size_t> recordAt(1, kHeaderSize);
+    std::vector<std::u16string> before;
+    {
+        UserDict user(&dict, path);
+        expect(user.isPersistent(), "write: create the log");
+        UserRing *ring = user.attach();
+        before.push_back(probe.state(user, st));
+        for (size_t i = 0; i < recordNum; i++)
+        {
+            const UserChoice &c = choices[i];
+            user.record(ring, c);
+            user.flush();
+            const bool phrase = 0 == c.part_id[0];
+            recordAt.push_back(recordAt.back() + (phrase? 4 + c.len * 4 + 4: kLemmaRecordSize));
+            before.push_back(probe.state(user, st));
+        }
+        user.detach(ring);
+        expect(user.lemmaNum() == kLemmaNum && user.phraseNum() == 2, "write: tables");
+    }
+    std::string log;
+    expect(readFile(path, log) && log.size() == recordAt.back(), "write: log size");
+
+    // Replay: every record is applied again
+    size_t size;
+    expect(reload(dict, path, probe, &size) == before[recordNum], "replay: same tables");
+    expect(size == log.size(), "replay: the log is kept");
+
+    // A tail torn anywhere inside the last record is cut, the rest replays
+    const size_t last = recordAt[recordNum - 1];
+    for (size_t cut = last + 1; cut < log.size(); cut += 3)
+    {
+        writeFile(path, log.substr(0, cut));
+        expect(reload(dict, path, probe, &size) == before[recordNum - 1], "torn: earlier records");
+        expect(size == last, "torn: truncated to the last whole record");
+    }
+    // New records go after the cut
+    {
+        writeFile(path, log.substr(0, last + 1));
+        UserDict user(&dict, path);
+        user.record(lemmas[kLemmaNum - 1]);
+        user.flush();
+    }
+    expect(reload(dict, path, probe, &size) == before[recordNum], "torn: append after the cut");
+    expect(size == log.size(), "torn: append one record");
+
+    // A record with a bad checksum ends the replay, whichever byte is wrong
+    for (size_t r = 0; r < recordNum; r++)
+    {
+        for (size_t at = recordAt[r]; at < recordAt[r + 1]; at += 5)
+        {
+            std::string bad = log;
+            bad[at] ^= 0x10;
+            writeFile(path, bad);
+            expect(reload(dict, path, probe, &size) == before[r], "crc: records before the bad one");
+            expect(size == recordAt[r], "crc: truncated at the bad record");
+        }
+    }
+
+    // The log of another dictionary is reset to the header
+    std::string other = log;
+    other[kFingerprintAt] ^= 1;
+    writeFile(path, other);
+    expect(reload(dict, path, probe, &size) == before[0], "fingerprint: empty tables");
+    std::string reset;
+    readFile(path, reset);
+    expect(reset == log.substr(0, kHeaderSize), "fingerprint: only the right header is left");
+    // As is a file that is not a log
+    writeFile(path, "junk");
+    expect(reload(dict, path, probe, &size) == before[0] && kHeaderSize == size, "junk: reset");
+
+    // Many choices of a few lemmas: the log is compacted in the background
+    // and still replays to the same tables
+    std::u16string compacted;
+    {
+        remove(path);
+        UserDict user(&dict, path);
+        UserRing *ring = user.attach();
+        for (int i = 0; i < kCompactChoices; i++) user.record(ring, lemmas[size_t(i % kCompactLemmas)]);
+        user.detach(ring);
+        user.flush();
+        expect(user.lemmaNum() == kCompactLemmas, "compact: tables");
+        compacted = probe.state(user, st);
+    }
+    readFile(path, log);
+    expect(log.size() < kHeaderSize + size_t(kCompactChoices) * kLemmaRecordSize / 2,
+           "compact: the log shrank");
+    expect(0 == (log.size() - kHeaderSize) % kLemmaRecordSize, "compact: whole records");
+    expect(reload(dict, path, probe, &size) == compacted, "compact: same tables");
+    FILE *tmp = fopen((std::string(path) + ".tmp").c_str(), "rb");
+    expect(pNull == tmp, "compact: no temporary file left");
+    if (pNull != tmp) fclose(tmp);
+
+    remove(path);
+    printf("%d checks: %d failures\n", g_checks, g_failures);
+    return 0 == g_failures? 0: 1;
+}
@@ -0,0 +1,14 @@
+# 测试：用户词典的日志重放、截掉残缺或损坏的尾部、换词库时重置、压缩
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = epinyin-test-userlog
+DESTDIR = $$PWD/../../../dist
+
+include($$PWD/../../ime/ime.pri)
+
+# 默认使用随工程提供的词库
+DEFINES += TEST_DICT=\\\"$$PWD/../../ime/dict_pinyin.dat\\\"
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,11 @@
+# 词库离线处理工具
+TEMPLATE = app
+CONFIG   += console c++11
+CONFIG   -= app_bundle qt
+TARGET   = dicttool
+DESTDIR = $$PWD/../../../dist
+
+include($$PWD/../../ime/ime.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,293 @@
+#include "dictionary.h"
+#include "dictreader.h"
+#include "dictcontainer.h"
+#include "spellingtrie.h"
+#include "dicttrie.h"
+#include "threadpool.h"
+#include "batch.h"
+#include "reverse.h"
+#include <atomic>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: dicttool compile-spl <in.dat> <out.dat>\n"
+            "    append the compiled spelling trie to a dictionary, so that\n"
+            "    loading maps it instead of rebuilding the trie\n"
+            "       dicttool compile-nodes <in.dat> <out.dat>\n"
+            "    append the lemma trie nodes split into columns, so that\n"
+            "    loading maps them instead of building them\n"
+            "       dicttool to-v2 <in.dat> <out.dat> [threads]\n"
+            "    rewrite a dictionary in the v2 format: an offset table of\n"
+            "    64-byte aligned, checksummed sections, including the compiled\n"
+            "    spelling trie and nodes, so that every array is mapped as is\n"
+            "       dicttool verify <dict.dat> [threads]\n"
+            "    check the checksum of every section of a v2 dictionary\n"
+            "       dicttool convert <dict.dat> [top-n] [threads]\n"
+            "    read one pinyin string per line from stdin and write it with\n"
+            "    its top candidates (10 by default) to stdout, tab separated,\n"
+            "    in input order, using all cores unless threads is given\n"
+            "       dicttool pinyin <dict.dat> [threads]\n"
+            "    read UTF-8 text from stdin and write it to stdout with every\n"
+            "    known Hanzi replaced by its pinyin\n");
+}
+
+static bool readFile(const char *path, std::string &data)
+{
+    FILE *f = fopen(path, "rb");
+    if (pNull == f)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    data.clear();
+    while ((n = fread(buf, 1, sizeof (buf), f)) > 0) data.append(buf, n);
+    const bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) fprintf(stderr, "cannot read %s\n", path);
+    return ok;
+}
+
+static bool writeFile(const char *path, const std::string &data)
+{
+    FILE *f = fopen(path, "wb");
+    bool ok = pNull != f && fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (pNull != f && fclose(f) != 0) ok = false;
+    if (!ok) fprintf(stderr, "cannot write %s\n", path);
+    return ok;
+}
+
+// A v2 dictionary always has the compiled sections, nothing can be appended.
+static bool isV2(const char *path, const std::string &data)
+{
+    if (!IME::DictContainer::isContainer(data.data(), qint64(data.size()))) return false;
+    fprintf(stderr, "%s is a v2 dictionary, which already contains the compiled sections\n", path);
+    return true;
+}
+
+static int compileSpl(const char *in, const char *out)
+{
+    std::string data;
+    if (!readFile(in, data) || isV2(in, data)) return 1;
+
+    IME::Dictionary dict(data.data(), qint64(data.size()));
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "%s is not a valid dictionary\n", in);
+        return 1;
+    }
+    const IME::SpellingTrie *st = dict.spellingTrie();
+    if (st->isCompiled())
+    {
+        fprintf(stderr, "%s already contains a compiled spelling trie\n", in);
+    }
+    else
+    {
+        const size_t size = data.size();
+        st->saveCompiledTrie(data);
+        printf("compiled spelling trie: %d bytes\n", int(data.size() - size));
+    }
+    return writeFile(out, data)? 0: 1;
+}
+
+static int compileNodes(const char *in, const char *out)
+{
+    std::string data;
+    if (!readFile(in, data) || isV2(in, data)) return 1;
+
+    IME::Dictionary dict(data.data(), qint64(data.size()));
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "%s is not a valid dictionary\n", in);
+        return 1;
+    }
+    const IME::DictTrie *dt = dict.dictTrie();
+    if (dt->isCompiled())
+    {
+        fprintf(stderr, "%s already contains the compiled nodes\n", in);
+    }
+    else
+    {
+        const size_t size = data.size();
+        dt->saveCompiledNodes(data);
+        printf("compiled nodes: %d bytes\n", int(data.size() - size));
+    }
+    return writeFile(out, data)? 0: 1;
+}
+
+static int toV2(const char *in, const char *out, int threads)
+{
+    std::string data;
+    if (!readFile(in, data) || isV2(in, data)) return 1;
+
+    std::string v2;
+    IME::ThreadPool pool(threads);
+    if (!IME::DictContainer::convert(data.data(), qint64(data.size()), v2, &pool))
+    {
+        fprintf(stderr, "%s is not a valid dictionary\n", in);
+        return 1;
+    }
+    // Make sure the new file loads before writing it.
+    IME::Dictionary check(v2.data(), qint64(v2.size()));
+    if (!check.isValid())
+    {
+        fprintf(stderr, "cannot convert %s\n", in);
+        return 1;
+    }
+    printf("v2 dictionary: %d bytes\n", int(v2.size()));
+    return writeFile(out, v2)? 0: 1;
+}
+
+static int verify(const char *dictfile, int threads)
+{
+    IME::DictReader r;
+    IME::DictContainer c;
+    if (!r.open(dictfile) || !c.open(r.data(), r.size()))
+    {
+        fprintf(stderr, "%s is not a valid v2 dictionary\n", dictfile);
+        return 1;
+    }
+    const int num = c.sectionNum();
+    std::vector<char> good(num, 0);
+    std::atomic<int> next(0);
+    IME::ThreadPool pool(threads);
+    pool.run([&](int) {
+        for (int i; (i = next.fetch_add(1)) < num; ) good[size_t(i)] = c.verify(i);
+    });
+
+    bool ok = true;
+    for (int i = 0; i < num; i++)
+    {
+        const IME::DictSection &s = c.section(i);
+        printf("%.4s\t%llu\t%llu\t%s\n", s.tag, (unsigned long long) s.offset,
+               (unsigned long long) s.size, good[size_t(i)]? "ok": "BAD CHECKSUM");
+        ok = ok && good[size_t(i)];
+    }
+    return ok? 0: 1;
+}
+
+static void appendUtf8(std::string &out, const char16_t *s, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        unsigned c = s[i];
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < len)
+        {
+            c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+        }
+        if (c < 0x80)
+        {
+            out += char(c);
+        }
+        else if (c < 0x800)
+        {
+            out += char(0xc0 | (c >> 6));
+            out += char(0x80 | (c & 0x3f));
+        }
+        else if (c < 0x10000)
+        {
+            out += char(0xe0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3f));
+            out += char(0x80 | (c & 0x3f));
+        }
+        else
+        {
+            out += char(0xf0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3f));
+            out += char(0x80 | ((c >> 6) & 0x3f));
+            out += char(0x80 | (c & 0x3f));
+        }
+    }
+}
+
+static bool readLine(FILE *f, std::string &line)
+{
+    line.clear();
+    int ch;
+    while ((ch = fgetc(f)) != EOF && ch != '\n')
+    {
+        line += char(ch);
+    }
+    if (!line.empty() && '\r' == line[line.size() - 1]) line.erase(line.size() - 1);
+    return EOF != ch || !line.empty();
+}
+
+static int convert(const char *dictfile, int topN, int threads)
+{
+    IME::Dictionary dict(dictfile);
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "%s is not a valid dictionary\n", dictfile);
+        return 1;
+    }
+    IME::BatchConverter conv(&dict, threads);
+    std::string out;
+    conv.convert([](std::string &line) {
+        return readLine(stdin, line);
+    }, [&out](size_t, const std::string &input, const IME::BatchResult &r) {
+        out = input;
+        const char16_t *s = r.text.data();
+        for (int i = 0; i < r.size(); i++)
+        {
+            out += '\t';
+            appendUtf8(out, s, r.lens[i]);
+            s += r.lens[i];
+        }
+        out += '\n';
+        fwrite(out.data(), 1, out.size(), stdout);
+    }, topN);
+    return ferror(stdout)? 1: 0;
+}
+
+static int pinyin(const char *dictfile, int threads)
+{
+    IME::Dictionary dict(dictfile);
+    if (!dict.isValid())
+    {
+        fprintf(stderr, "%s is not a valid dictionary\n", dictfile);
+        return 1;
+    }
+    IME::ReverseConverter conv(dict.reverseIndex(), threads);
+    conv.convert([](char *buf, size_t size) {
+        return fread(buf, 1, size, stdin);
+    }, [](const char *data, size_t len) {
+        fwrite(data, 1, len, stdout);
+    });
+    return ferror(stdin) || ferror(stdout)? 1: 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 4 && 0 == strcmp(argv[1], "compile-spl"))
+    {
+        return compileSpl(argv[2], argv[3]);
+    }
+    if (argc == 4 && 0 == strcmp(argv[1], "compile-nodes"))
+    {
+        return compileNodes(argv[2], argv[3]);
+    }
+    if (argc >= 4 && argc <= 5 && 0 == strcmp(argv[1], "to-v2"))
+    {
+        return toV2(argv[2], argv[3], argc > 4? atoi(argv[4]): 0);
+    }
+    if (argc >= 3 && argc <= 4 && 0 == strcmp(argv[1], "verify"))
+    {
+        return verify(argv[2], argc > 3? atoi(argv[3]): 0);
+    }
+    if (argc >= 3 && argc <= 5 && 0 == strcmp(argv[1], "convert"))
+    {
+        return convert(argv[2], argc > 3? atoi(argv[3]): 10, argc > 4? atoi(argv[4]): 0);
+    }
+    if (argc >= 3 && argc <= 4 && 0 == strcmp(argv[1], "pinyin"))
+    {
+        return pinyin(argv[2], argc > 3? atoi(argv[3]): 0);
+    }
+    usage();
+    return 2;
+}